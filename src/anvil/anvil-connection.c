@@ -2,6 +2,7 @@
 
 #include "common.h"
 #include "llist.h"
+#include "fdpass.h"
 #include "istream.h"
 #include "ostream.h"
 #include "master-service.h"
@@ -51,6 +52,7 @@ anvil_connection_request(struct anvil_connection *conn,
 	unsigned int value, checksum;
 	time_t stamp;
 	pid_t pid;
+	int fd;
 
 	args++;
 	if (strcmp(cmd, "CONNECT") == 0) {
@@ -92,6 +94,19 @@ anvil_connection_request(struct anvil_connection *conn,
 		value = connect_limit_lookup(connect_limit, args[0]);
 		o_stream_nsend_str(conn->output,
 				   t_strdup_printf("%u\n", value));
+	} else if (strcmp(cmd, "CONNECT-LIMIT-SHM") == 0) {
+		if (conn->output == NULL) {
+			*error_r = "CONNECT-LIMIT-SHM on a FIFO, can't send reply";
+			return -1;
+		}
+		/* reply with "+" and the fd, or "-" if it's not available */
+		fd = connect_limit_get_shm_fd(connect_limit);
+		if (o_stream_flush(conn->output) < 0 ||
+		    fd_send(conn->fd, fd, fd == -1 ? "-" : "+", 1) < 0) {
+			*error_r = t_strdup_printf(
+				"CONNECT-LIMIT-SHM: fd_send() failed: %m");
+			return -1;
+		}
 	} else if (strcmp(cmd, "PENALTY-GET") == 0) {
 		if (args[0] == NULL) {
 			*error_r = "PENALTY-GET: Not enough parameters";
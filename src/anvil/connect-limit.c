@@ -1,17 +1,27 @@
 /* Copyright (c) 2009-2014 Dovecot authors, see the included COPYING file */
 
 #include "common.h"
+#include "llist.h"
 #include "hash.h"
 #include "str.h"
 #include "strescape.h"
 #include "ostream.h"
+#include "connect-limit-shm.h"
 #include "connect-limit.h"
 
+/* Number of entries in the shared memory table. Up to 75% of them can be
+   used, so this allows ~100k concurrent user+IP pairs before login processes
+   need to fall back to asking anvil. */
+#define CONNECT_LIMIT_SHM_ENTRIES (1024*128)
+
 struct ident_pid {
 	/* ident string points to ident_hash keys */
 	const char *ident;
 	pid_t pid;
 	unsigned int refcount;
+
+	/* list of all the idents of this pid */
+	struct ident_pid *prev, *next;
 };
 
 struct connect_limit {
@@ -19,6 +29,11 @@ struct connect_limit {
 	HASH_TABLE(char *, void *) ident_hash;
 	/* struct ident_pid => struct ident_pid */
 	HASH_TABLE(struct ident_pid *, struct ident_pid *) ident_pid_hash;
+	/* pid => struct ident_pid list */
+	HASH_TABLE(void *, struct ident_pid *) pid_hash;
+
+	/* ident => refcount published for login processes, or NULL */
+	struct connect_limit_shm *shm;
 };
 
 static unsigned int ident_pid_hash(const struct ident_pid *i)
@@ -44,6 +59,8 @@ struct connect_limit *connect_limit_init(void)
 	hash_table_create(&limit->ident_hash, default_pool, 0, str_hash, strcmp);
 	hash_table_create(&limit->ident_pid_hash, default_pool, 0,
 			  ident_pid_hash, ident_pid_cmp);
+	hash_table_create_direct(&limit->pid_hash, default_pool, 0);
+	limit->shm = connect_limit_shm_create(CONNECT_LIMIT_SHM_ENTRIES);
 	return limit;
 }
 
@@ -52,11 +69,23 @@ void connect_limit_deinit(struct connect_limit **_limit)
 	struct connect_limit *limit = *_limit;
 
 	*_limit = NULL;
+	if (limit->shm != NULL) {
+		/* login processes may still have it mapped */
+		connect_limit_shm_disable(limit->shm);
+		connect_limit_shm_free(&limit->shm);
+	}
 	hash_table_destroy(&limit->ident_hash);
 	hash_table_destroy(&limit->ident_pid_hash);
+	hash_table_destroy(&limit->pid_hash);
 	i_free(limit);
 }
 
+int connect_limit_get_shm_fd(struct connect_limit *limit)
+{
+	return limit->shm == NULL ? -1 :
+		connect_limit_shm_get_fd(limit->shm);
+}
+
 unsigned int connect_limit_lookup(struct connect_limit *limit,
 				  const char *ident)
 {
@@ -66,6 +95,41 @@ unsigned int connect_limit_lookup(struct connect_limit *limit,
 	return POINTER_CAST_TO(value, unsigned int);
 }
 
+static void
+connect_limit_shm_update_count(struct connect_limit *limit, const char *ident,
+			       unsigned int count)
+{
+	if (limit->shm == NULL)
+		return;
+	if (connect_limit_shm_update(limit->shm, ident, count) < 0) {
+		i_warning("connect limit: Shared memory table is full, "
+			  "login processes fall back to lookups via anvil");
+	}
+}
+
+static void
+connect_limit_pid_link(struct connect_limit *limit, struct ident_pid *i)
+{
+	struct ident_pid *list;
+
+	list = hash_table_lookup(limit->pid_hash, POINTER_CAST(i->pid));
+	DLLIST_PREPEND(&list, i);
+	hash_table_update(limit->pid_hash, POINTER_CAST(i->pid), list);
+}
+
+static void
+connect_limit_pid_unlink(struct connect_limit *limit, struct ident_pid *i)
+{
+	struct ident_pid *list;
+
+	list = hash_table_lookup(limit->pid_hash, POINTER_CAST(i->pid));
+	DLLIST_REMOVE(&list, i);
+	if (list != NULL)
+		hash_table_update(limit->pid_hash, POINTER_CAST(i->pid), list);
+	else
+		hash_table_remove(limit->pid_hash, POINTER_CAST(i->pid));
+}
+
 void connect_limit_connect(struct connect_limit *limit, pid_t pid,
 			   const char *ident)
 {
@@ -73,6 +137,12 @@ void connect_limit_connect(struct connect_limit *limit, pid_t pid,
 	char *key;
 	void *value;
 
+	if (pid <= 0) {
+		i_error("connect limit: connection with invalid pid %s + "
+			"ident %s", dec2str(pid), ident);
+		return;
+	}
+
 	if (!hash_table_lookup_full(limit->ident_hash, ident,
 				    &key, &value)) {
 		key = i_strdup(ident);
@@ -82,6 +152,8 @@ void connect_limit_connect(struct connect_limit *limit, pid_t pid,
 		value = POINTER_CAST(POINTER_CAST_TO(value, unsigned int) + 1);
 		hash_table_update(limit->ident_hash, key, value);
 	}
+	connect_limit_shm_update_count(limit, key,
+				       POINTER_CAST_TO(value, unsigned int));
 
 	lookup_i.ident = ident;
 	lookup_i.pid = pid;
@@ -92,6 +164,7 @@ void connect_limit_connect(struct connect_limit *limit, pid_t pid,
 		i->pid = pid;
 		i->refcount = 1;
 		hash_table_insert(limit->ident_pid_hash, i, i);
+		connect_limit_pid_link(limit, i);
 	} else {
 		i->refcount++;
 	}
@@ -108,6 +181,7 @@ connect_limit_ident_hash_unref(struct connect_limit *limit, const char *ident)
 		i_panic("connect limit hash tables are inconsistent");
 
 	new_refcount = POINTER_CAST_TO(value, unsigned int) - 1;
+	connect_limit_shm_update_count(limit, key, new_refcount);
 	if (new_refcount > 0) {
 		value = POINTER_CAST(new_refcount);
 		hash_table_update(limit->ident_hash, key, value);
@@ -134,6 +208,7 @@ void connect_limit_disconnect(struct connect_limit *limit, pid_t pid,
 
 	if (--i->refcount == 0) {
 		hash_table_remove(limit->ident_pid_hash, i);
+		connect_limit_pid_unlink(limit, i);
 		i_free(i);
 	}
 
@@ -142,21 +217,23 @@ void connect_limit_disconnect(struct connect_limit *limit, pid_t pid,
 
 void connect_limit_disconnect_pid(struct connect_limit *limit, pid_t pid)
 {
-	struct hash_iterate_context *iter;
-	struct ident_pid *i, *value;
+	struct ident_pid *i, *next;
 
-	/* this should happen rarely (or never), so this slow implementation
-	   should be fine. */
-	iter = hash_table_iterate_init(limit->ident_pid_hash);
-	while (hash_table_iterate(iter, limit->ident_pid_hash, &i, &value)) {
-		if (i->pid == pid) {
-			hash_table_remove(limit->ident_pid_hash, i);
-			for (; i->refcount > 0; i->refcount--)
-				connect_limit_ident_hash_unref(limit, i->ident);
-			i_free(i);
-		}
+	if (pid <= 0)
+		return;
+
+	i = hash_table_lookup(limit->pid_hash, POINTER_CAST(pid));
+	if (i == NULL)
+		return;
+	hash_table_remove(limit->pid_hash, POINTER_CAST(pid));
+
+	for (; i != NULL; i = next) {
+		next = i->next;
+		hash_table_remove(limit->ident_pid_hash, i);
+		for (; i->refcount > 0; i->refcount--)
+			connect_limit_ident_hash_unref(limit, i->ident);
+		i_free(i);
 	}
-	hash_table_iterate_deinit(&iter);
 }
 
 void connect_limit_dump(struct connect_limit *limit, struct ostream *output)
@@ -4,6 +4,10 @@
 struct connect_limit *connect_limit_init(void);
 void connect_limit_deinit(struct connect_limit **limit);
 
+/* Returns fd of the shared memory table of the ident counts,
+   or -1 if it's not available. */
+int connect_limit_get_shm_fd(struct connect_limit *limit);
+
 unsigned int connect_limit_lookup(struct connect_limit *limit,
 				  const char *ident);
 void connect_limit_connect(struct connect_limit *limit, pid_t pid,
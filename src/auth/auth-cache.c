@@ -5,17 +5,39 @@
 #include "hash.h"
 #include "str.h"
 #include "strescape.h"
+#include "strnum.h"
+#include "istream.h"
+#include "ostream.h"
 #include "var-expand.h"
 #include "auth-request.h"
 #include "auth-cache.h"
 
 #include <time.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 
-struct auth_cache {
+/* The cache is split into shards by the username in the cache key, so that
+   clearing a user's entries needs to look only at a single shard. Each shard
+   has its own LRU and gets an equal part of the max_size. */
+#define AUTH_CACHE_MAX_SHARDS 16
+/* Use fewer shards if they'd become smaller than this. */
+#define AUTH_CACHE_MIN_SHARD_SIZE (1024*64)
+
+#define AUTH_CACHE_SNAPSHOT_HEADER "AUTH-CACHE-SNAPSHOT 1"
+
+struct auth_cache_shard {
 	HASH_TABLE(char *, struct auth_cache_node *) hash;
 	struct auth_cache_node *head, *tail;
 
 	size_t max_size, size_left;
+};
+
+struct auth_cache {
+	struct auth_cache_shard *shards;
+	unsigned int shard_count;
+
+	size_t max_size;
 	unsigned int ttl_secs, neg_ttl_secs;
 
 	unsigned int hit_count, miss_count;
@@ -143,47 +165,91 @@ char *auth_cache_parse_key(pool_t pool, const char *query)
 	return p_strdup(pool, str_c(str));
 }
 
+static const char *
+auth_cache_key_get_user(const char *data, unsigned int *len_r)
+{
+	const char *p;
+
+	/* The cache keys begin with "P"/"U", passdb/userdb ID, optional
+	   "+" master user, "\t" and then usually followed by the username.
+	   It's too much trouble to keep track of all the cache keys, so we'll
+	   just handle it as if it was the username. If e.g. '%n' is used in the
+	   cache key instead of '%u', it means that cache entries can be
+	   removed only when @domain isn't in the username parameter. */
+	if (*data != 'P' && *data != 'U')
+		return NULL;
+	data++;
+
+	while (*data >= '0' && *data <= '9')
+		data++;
+	if (*data == '+') {
+		/* skip over +master_user */
+		while (*data != '\t' && *data != '\0')
+			data++;
+	}
+	if (*data != '\t')
+		return NULL;
+	data++;
+
+	for (p = data; *p != '\t' && *p != '\0'; p++) ;
+	*len_r = p - data;
+	return data;
+}
+
+static struct auth_cache_shard *
+auth_cache_get_shard(struct auth_cache *cache, const char *key)
+{
+	const char *user;
+	unsigned int len, hash;
+
+	user = auth_cache_key_get_user(key, &len);
+	hash = user == NULL ? str_hash(key) : mem_hash(user, len);
+	return &cache->shards[hash % cache->shard_count];
+}
+
 static void
-auth_cache_node_unlink(struct auth_cache *cache, struct auth_cache_node *node)
+auth_cache_node_unlink(struct auth_cache_shard *shard,
+		       struct auth_cache_node *node)
 {
 	if (node->prev != NULL)
 		node->prev->next = node->next;
 	else {
 		/* unlinking tail */
-		cache->tail = node->next;
+		shard->tail = node->next;
 	}
 
 	if (node->next != NULL)
 		node->next->prev = node->prev;
 	else {
 		/* unlinking head */
-		cache->head = node->prev;
+		shard->head = node->prev;
 	}
 }
 
 static void
-auth_cache_node_link_head(struct auth_cache *cache,
+auth_cache_node_link_head(struct auth_cache_shard *shard,
 			  struct auth_cache_node *node)
 {
-	node->prev = cache->head;
+	node->prev = shard->head;
 	node->next = NULL;
 
-	cache->head = node;
+	shard->head = node;
 	if (node->prev != NULL)
 		node->prev->next = node;
 	else
-		cache->tail = node;
+		shard->tail = node;
 }
 
 static void
-auth_cache_node_destroy(struct auth_cache *cache, struct auth_cache_node *node)
+auth_cache_node_destroy(struct auth_cache_shard *shard,
+			struct auth_cache_node *node)
 {
 	char *key = node->data;
 
-	auth_cache_node_unlink(cache, node);
+	auth_cache_node_unlink(shard, node);
 
-	cache->size_left += node->alloc_size;
-	hash_table_remove(cache->hash, key);
+	shard->size_left += node->alloc_size;
+	hash_table_remove(shard->hash, key);
 	i_free(node);
 }
 
@@ -198,8 +264,8 @@ static void sig_auth_cache_clear(const siginfo_t *si ATTR_UNUSED, void *context)
 static void sig_auth_cache_stats(const siginfo_t *si ATTR_UNUSED, void *context)
 {
 	struct auth_cache *cache = context;
-	unsigned int total_count;
-	size_t cache_used;
+	unsigned int i, total_count;
+	size_t cache_used = 0;
 
 	total_count = cache->hit_count + cache->miss_count;
 	i_info("Authentication cache hits %u/%u (%u%%)",
@@ -212,11 +278,16 @@ static void sig_auth_cache_stats(const siginfo_t *si ATTR_UNUSED, void *context)
 	       cache->pos_entries, cache->pos_size,
 	       cache->neg_entries, cache->neg_size);
 
-	cache_used = cache->max_size - cache->size_left;
+	for (i = 0; i < cache->shard_count; i++) {
+		cache_used += cache->shards[i].max_size -
+			cache->shards[i].size_left;
+	}
 	i_info("Authentication cache current size: "
-	       "%"PRIuSIZE_T" bytes used of %"PRIuSIZE_T" bytes (%u%%)",
+	       "%"PRIuSIZE_T" bytes used of %"PRIuSIZE_T" bytes (%u%%) "
+	       "in %u shards",
 	       cache_used, cache->max_size,
-	       (unsigned int)(cache_used * 100ULL / cache->max_size));
+	       (unsigned int)(cache_used * 100ULL / cache->max_size),
+	       cache->shard_count);
 
 	/* reset counters */
 	cache->hit_count = cache->miss_count = 0;
@@ -229,11 +300,21 @@ struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 )
 {
 	struct auth_cache *cache;
+	unsigned int i;
 
 	cache = i_new(struct auth_cache, 1);
-	hash_table_create(&cache->hash, default_pool, 0, str_hash, strcmp);
+	cache->shard_count = AUTH_CACHE_MAX_SHARDS;
+	while (cache->shard_count > 1 &&
+	       max_size / cache->shard_count < AUTH_CACHE_MIN_SHARD_SIZE)
+		cache->shard_count /= 2;
+	cache->shards = i_new(struct auth_cache_shard, cache->shard_count);
+	for (i = 0; i < cache->shard_count; i++) {
+		hash_table_create(&cache->shards[i].hash, default_pool, 0,
+				  str_hash, strcmp);
+		cache->shards[i].max_size = max_size / cache->shard_count;
+		cache->shards[i].size_left = cache->shards[i].max_size;
+	}
 	cache->max_size = max_size;
-	cache->size_left = max_size;
 	cache->ttl_secs = ttl_secs;
 	cache->neg_ttl_secs = neg_ttl_secs;
 
@@ -247,81 +328,63 @@ struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 void auth_cache_free(struct auth_cache **_cache)
 {
 	struct auth_cache *cache = *_cache;
+	unsigned int i;
 
 	*_cache = NULL;
 	lib_signals_unset_handler(SIGHUP, sig_auth_cache_clear, cache);
 	lib_signals_unset_handler(SIGUSR2, sig_auth_cache_stats, cache);
 
 	auth_cache_clear(cache);
-	hash_table_destroy(&cache->hash);
+	for (i = 0; i < cache->shard_count; i++)
+		hash_table_destroy(&cache->shards[i].hash);
+	i_free(cache->shards);
 	i_free(cache);
 }
 
 unsigned int auth_cache_clear(struct auth_cache *cache)
 {
-	unsigned int ret = hash_table_count(cache->hash);
-
-	while (cache->tail != NULL)
-		auth_cache_node_destroy(cache, cache->tail);
-	hash_table_clear(cache->hash, FALSE);
+	struct auth_cache_shard *shard;
+	unsigned int i, ret = 0;
+
+	for (i = 0; i < cache->shard_count; i++) {
+		shard = &cache->shards[i];
+		ret += hash_table_count(shard->hash);
+		while (shard->tail != NULL)
+			auth_cache_node_destroy(shard, shard->tail);
+		hash_table_clear(shard->hash, FALSE);
+	}
 	return ret;
 }
 
 static bool auth_cache_node_is_user(struct auth_cache_node *node,
 				    const char *username)
 {
-	const char *data = node->data;
-	unsigned int username_len;
-
-	/* The cache nodes begin with "P"/"U", passdb/userdb ID, optional
-	   "+" master user, "\t" and then usually followed by the username.
-	   It's too much trouble to keep track of all the cache keys, so we'll
-	   just match it as if it was the username. If e.g. '%n' is used in the
-	   cache key instead of '%u', it means that cache entries can be
-	   removed only when @domain isn't in the username parameter. */
-	if (*data != 'P' && *data != 'U')
-		return FALSE;
-	data++;
-
-	while (*data >= '0' && *data <= '9')
-		data++;
-	if (*data == '+') {
-		/* skip over +master_user */
-		while (*data != '\t' && *data != '\0')
-			data++;
-	}
-	if (*data != '\t')
-		return FALSE;
-	data++;
-
-	username_len = strlen(username);
-	return strncmp(data, username, username_len) == 0 &&
-		(data[username_len] == '\t' || data[username_len] == '\0');
-}
-
-static bool auth_cache_node_is_one_of_users(struct auth_cache_node *node,
-					    const char *const *usernames)
-{
-	unsigned int i;
+	const char *user;
+	unsigned int len;
 
-	for (i = 0; usernames[i] != NULL; i++) {
-		if (auth_cache_node_is_user(node, usernames[i]))
-			return TRUE;
-	}
-	return FALSE;
+	user = auth_cache_key_get_user(node->data, &len);
+	return user != NULL && len == strlen(username) &&
+		memcmp(user, username, len) == 0;
 }
 
 unsigned int auth_cache_clear_users(struct auth_cache *cache,
 				    const char *const *usernames)
 {
+	struct auth_cache_shard *shard;
 	struct auth_cache_node *node, *next;
-	unsigned int ret = 0;
+	unsigned int i, ret = 0;
 
-	for (node = cache->tail; node != NULL; node = next) {
-		next = node->next;
-		if (auth_cache_node_is_one_of_users(node, usernames)) {
-			auth_cache_node_destroy(cache, node);
-			ret++;
+	/* all of the user's entries are in the same shard */
+	for (i = 0; usernames[i] != NULL; i++) {
+		shard = &cache->shards[mem_hash(usernames[i],
+						strlen(usernames[i])) %
+				       cache->shard_count];
+		for (node = shard->tail; node != NULL; node = next) {
+			next = node->next;
+			if (auth_cache_node_is_user(node, usernames[i])) {
+				auth_cache_node_destroy(shard, node);
+				ret++;
+			}
 		}
 	}
 	return ret;
@@ -359,6 +422,7 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		  const char *key, struct auth_cache_node **node_r,
 		  bool *expired_r, bool *neg_expired_r)
 {
+	struct auth_cache_shard *shard;
 	struct auth_cache_node *node;
 	const char *value;
 	unsigned int ttl_secs;
@@ -368,7 +432,8 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 	*neg_expired_r = FALSE;
 
 	key = auth_request_expand_cache_key(request, key);
-	node = hash_table_lookup(cache->hash, key);
+	shard = auth_cache_get_shard(cache, key);
+	node = hash_table_lookup(shard->hash, key);
 	if (node == NULL) {
 		cache->miss_count++;
 		return NULL;
@@ -384,9 +449,9 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		*expired_r = TRUE;
 	} else {
 		/* move to head */
-		if (node != cache->head) {
-			auth_cache_node_unlink(cache, node);
-			auth_cache_node_link_head(cache, node);
+		if (node != shard->head) {
+			auth_cache_node_unlink(shard, node);
+			auth_cache_node_link_head(shard, node);
 		}
 	}
 	if (node->created < now - (time_t)cache->neg_ttl_secs)
@@ -398,58 +463,44 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 	return value;
 }
 
-void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
-		       const char *key, const char *value, bool last_success)
+static void
+auth_cache_insert_key(struct auth_cache *cache, const char *key,
+		      const char *value, bool last_success, time_t created)
 {
+	struct auth_cache_shard *shard;
         struct auth_cache_node *node;
 	size_t data_size, alloc_size, key_len, value_len = strlen(value);
-	char *hash_key, *current_username;
-
-	if (*value == '\0' && cache->neg_ttl_secs == 0) {
-		/* we're not caching negative entries */
-		return;
-	}
-
-	/* store into cache using the translated username, except if we're doing
-	   a master user login */
-	current_username = request->user;
-	if (request->translated_username != NULL &&
-	    request->requested_login_user == NULL &&
-	    request->master_user == NULL)
-		request->user = t_strdup_noconst(request->translated_username);
+	char *hash_key;
 
-	key = auth_request_expand_cache_key(request, key);
 	key_len = strlen(key);
-
-	request->user = current_username;
-
 	data_size = key_len + 1 + value_len + 1;
 	alloc_size = sizeof(struct auth_cache_node) -
 		sizeof(node->data) + data_size;
 
 	/* make sure we have enough space */
-	while (cache->size_left < alloc_size && cache->tail != NULL)
-		auth_cache_node_destroy(cache, cache->tail);
+	shard = auth_cache_get_shard(cache, key);
+	while (shard->size_left < alloc_size && shard->tail != NULL)
+		auth_cache_node_destroy(shard, shard->tail);
 
-	node = hash_table_lookup(cache->hash, key);
+	node = hash_table_lookup(shard->hash, key);
 	if (node != NULL) {
 		/* key is already in cache (probably expired), remove it */
-		auth_cache_node_destroy(cache, node);
+		auth_cache_node_destroy(shard, node);
 	}
 
 	/* @UNSAFE */
 	node = i_malloc(alloc_size);
-	node->created = time(NULL);
+	node->created = created;
 	node->alloc_size = alloc_size;
 	node->last_success = last_success;
 	memcpy(node->data, key, key_len);
 	memcpy(node->data + key_len + 1, value, value_len);
 
-	auth_cache_node_link_head(cache, node);
+	auth_cache_node_link_head(shard, node);
 
-	cache->size_left -= alloc_size;
+	shard->size_left -= alloc_size;
 	hash_key = node->data;
-	hash_table_insert(cache->hash, hash_key, node);
+	hash_table_insert(shard->hash, hash_key, node);
 
 	if (*value != '\0') {
 		cache->pos_entries++;
@@ -460,15 +511,183 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 	}
 }
 
+void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
+		       const char *key, const char *value, bool last_success)
+{
+	char *current_username;
+
+	if (*value == '\0' && cache->neg_ttl_secs == 0) {
+		/* we're not caching negative entries */
+		return;
+	}
+
+	/* store into cache using the translated username, except if we're doing
+	   a master user login */
+	current_username = request->user;
+	if (request->translated_username != NULL &&
+	    request->requested_login_user == NULL &&
+	    request->master_user == NULL)
+		request->user = t_strdup_noconst(request->translated_username);
+
+	key = auth_request_expand_cache_key(request, key);
+
+	request->user = current_username;
+
+	auth_cache_insert_key(cache, key, value, last_success, time(NULL));
+}
+
 void auth_cache_remove(struct auth_cache *cache,
 		       const struct auth_request *request, const char *key)
 {
+	struct auth_cache_shard *shard;
 	struct auth_cache_node *node;
 
 	key = auth_request_expand_cache_key(request, key);
-	node = hash_table_lookup(cache->hash, key);
+	shard = auth_cache_get_shard(cache, key);
+	node = hash_table_lookup(shard->hash, key);
 	if (node == NULL)
 		return;
 
-	auth_cache_node_destroy(cache, node);
+	auth_cache_node_destroy(shard, node);
+}
+
+static void
+auth_cache_snapshot_write(struct auth_cache *cache, struct ostream *output)
+{
+	struct auth_cache_node *node;
+	const char *value;
+	string_t *str;
+	unsigned int i;
+
+	str = t_str_new(256);
+	for (i = 0; i < cache->shard_count; i++) {
+		/* write the least recently used first, so that reading
+		   the snapshot restores the same LRU order */
+		for (node = cache->shards[i].tail; node != NULL;
+		     node = node->next) {
+			value = node->data + strlen(node->data) + 1;
+			str_truncate(str, 0);
+			str_printfa(str, "%ld\t%d\t", (long)node->created,
+				    node->last_success ? 1 : 0);
+			str_append_tabescaped(str, node->data);
+			str_append_c(str, '\t');
+			str_append_tabescaped(str, value);
+			str_append_c(str, '\n');
+			o_stream_nsend(output, str_data(str), str_len(str));
+		}
+	}
+}
+
+int auth_cache_snapshot_save(struct auth_cache *cache, const char *path,
+			     const char *fingerprint)
+{
+	struct ostream *output;
+	const char *temp_path;
+	int fd, ret = 0;
+
+	temp_path = t_strconcat(path, ".tmp", NULL);
+	/* the cache may contain passwords */
+	fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		i_error("open(%s) failed: %m", temp_path);
+		return -1;
+	}
+
+	output = o_stream_create_fd_file(fd, 0, FALSE);
+	o_stream_cork(output);
+	o_stream_nsend_str(output, t_strdup_printf(
+		AUTH_CACHE_SNAPSHOT_HEADER"\t%s\n", fingerprint));
+	auth_cache_snapshot_write(cache, output);
+	if (o_stream_nfinish(output) < 0) {
+		i_error("write(%s) failed: %s", temp_path,
+			o_stream_get_error(output));
+		ret = -1;
+	}
+	o_stream_destroy(&output);
+
+	if (close(fd) < 0) {
+		i_error("close(%s) failed: %m", temp_path);
+		ret = -1;
+	}
+	if (ret == 0 && rename(temp_path, path) < 0) {
+		i_error("rename(%s, %s) failed: %m", temp_path, path);
+		ret = -1;
+	}
+	if (ret < 0 && unlink(temp_path) < 0 && errno != ENOENT)
+		i_error("unlink(%s) failed: %m", temp_path);
+	return ret;
+}
+
+static int
+auth_cache_snapshot_read_line(struct auth_cache *cache, const char *line,
+			      time_t now, unsigned int *count)
+{
+	const char *const *args;
+	unsigned int ttl_secs;
+	time_t created;
+
+	/* <created> <last_success> <key> <value> */
+	args = t_strsplit_tabescaped(line);
+	if (str_array_length(args) != 4 ||
+	    str_to_time(args[0], &created) < 0 ||
+	    (args[1][0] != '0' && args[1][0] != '1'))
+		return -1;
+
+	if (*args[3] == '\0' && cache->neg_ttl_secs == 0) {
+		/* we're not caching negative entries */
+		return 0;
+	}
+	ttl_secs = *args[3] == '\0' ? cache->neg_ttl_secs : cache->ttl_secs;
+	if (created < now - (time_t)ttl_secs) {
+		/* TTL already expired */
+		return 0;
+	}
+	auth_cache_insert_key(cache, args[2], args[3], args[1][0] == '1',
+			      created);
+	*count += 1;
+	return 0;
+}
+
+int auth_cache_snapshot_load(struct auth_cache *cache, const char *path,
+			     const char *fingerprint, unsigned int *count_r)
+{
+	struct istream *input;
+	const char *line, *header;
+	time_t now = time(NULL);
+	int fd, ret = 0;
+
+	*count_r = 0;
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return 0;
+		i_error("open(%s) failed: %m", path);
+		return -1;
+	}
+
+	input = i_stream_create_fd(fd, (size_t)-1, TRUE);
+	header = t_strdup_printf(AUTH_CACHE_SNAPSHOT_HEADER"\t%s", fingerprint);
+	line = i_stream_read_next_line(input);
+	if (line == NULL || strcmp(line, header) != 0) {
+		/* written by a different version or with different
+		   passdbs/userdbs. the IDs in the keys can't be trusted. */
+		i_stream_destroy(&input);
+		return 0;
+	}
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		T_BEGIN {
+			ret = auth_cache_snapshot_read_line(cache, line, now,
+							    count_r);
+		} T_END;
+		if (ret < 0) {
+			i_error("Auth cache snapshot %s is corrupted", path);
+			break;
+		}
+	}
+	if (input->stream_errno != 0) {
+		i_error("read(%s) failed: %s", path, i_stream_get_error(input));
+		ret = -1;
+	}
+	i_stream_destroy(&input);
+	return ret;
 }
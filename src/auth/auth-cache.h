@@ -50,4 +50,16 @@ void auth_cache_remove(struct auth_cache *cache,
 		       const struct auth_request *request,
 		       const char *key);
 
+/* Write all the cache entries to the given file. The fingerprint should
+   identify the passdb/userdb configuration, since the cache keys contain their
+   ID numbers. Returns 0 if ok, -1 if failed. */
+int auth_cache_snapshot_save(struct auth_cache *cache, const char *path,
+			     const char *fingerprint);
+/* Insert the entries from a snapshot file written by auth_cache_snapshot_save() with
+   the same fingerprint. Entries with expired TTL are skipped. The snapshot is
+   ignored if it doesn't exist or the fingerprint doesn't match. Returns 0 if
+   ok, -1 if failed. */
+int auth_cache_snapshot_load(struct auth_cache *cache, const char *path,
+			     const char *fingerprint, unsigned int *count_r);
+
 #endif
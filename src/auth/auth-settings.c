@@ -215,6 +215,7 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(SET_SIZE, cache_size),
 	DEF(SET_TIME, cache_ttl),
 	DEF(SET_TIME, cache_negative_ttl),
+	DEF(SET_STR, cache_snapshot_path),
 	DEF(SET_STR, username_chars),
 	DEF(SET_STR, username_translation),
 	DEF(SET_STR, username_format),
@@ -235,6 +236,7 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(SET_BOOL, use_winbind),
 
 	DEF(SET_UINT, worker_max_count),
+	DEF(SET_UINT, worker_max_pending),
 
 	DEFLIST(passdbs, "passdb", &auth_passdb_setting_parser_info),
 	DEFLIST(userdbs, "userdb", &auth_userdb_setting_parser_info),
@@ -254,6 +256,7 @@ static const struct auth_settings auth_default_settings = {
 	.cache_size = 0,
 	.cache_ttl = 60*60,
 	.cache_negative_ttl = 60*60,
+	.cache_snapshot_path = "",
 	.username_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234567890.-_@",
 	.username_translation = "",
 	.username_format = "%Lu",
@@ -274,6 +277,7 @@ static const struct auth_settings auth_default_settings = {
 	.use_winbind = FALSE,
 
 	.worker_max_count = 30,
+	.worker_max_pending = 8,
 
 	.passdbs = ARRAY_INIT,
 	.userdbs = ARRAY_INIT,
@@ -376,6 +380,10 @@ static bool auth_settings_check(void *_set, pool_t pool,
 		*error_r = "auth_worker_max_count must be above zero";
 		return FALSE;
 	}
+	if (set->worker_max_pending == 0) {
+		*error_r = "auth_worker_max_pending must be above zero";
+		return FALSE;
+	}
 
 	if (set->cache_size > 0 && set->cache_size < 1024) {
 		/* probably a configuration error.
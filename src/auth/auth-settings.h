@@ -38,6 +38,7 @@ struct auth_settings {
 	uoff_t cache_size;
 	unsigned int cache_ttl;
 	unsigned int cache_negative_ttl;
+	const char *cache_snapshot_path;
 	const char *username_chars;
 	const char *username_translation;
 	const char *username_format;
@@ -56,6 +57,7 @@ struct auth_settings {
 	bool use_winbind;
 
 	unsigned int worker_max_count;
+	unsigned int worker_max_pending;
 
 	/* settings that don't have auth_ prefix: */
 	ARRAY(struct auth_passdb_settings *) passdbs;
@@ -2,6 +2,7 @@
 
 #include "auth-common.h"
 #include "ioloop.h"
+#include "lib-signals.h"
 #include "array.h"
 #include "aqueue.h"
 #include "net.h"
@@ -10,6 +11,7 @@
 #include "hex-binary.h"
 #include "str.h"
 #include "eacces-error.h"
+#include "time-util.h"
 #include "auth-request.h"
 #include "auth-worker-client.h"
 #include "auth-worker-server.h"
@@ -22,13 +24,19 @@
 #define AUTH_WORKER_ABORT_SECS 60
 #define AUTH_WORKER_DELAY_WARN_SECS 3
 #define AUTH_WORKER_DELAY_WARN_MIN_INTERVAL_SECS 300
+/* power-of-two buckets: <1, <2, <4, .. and the last one for the rest */
+#define AUTH_WORKER_HISTOGRAM_BUCKETS 18
 
 struct auth_worker_request {
 	unsigned int id;
-	time_t created;
+	struct timeval created;
 	const char *data;
 	auth_worker_callback_t *callback;
 	void *context;
+
+	/* LIST replies are streamed, so nothing else may be pending in the
+	   same connection while it's running */
+	unsigned int exclusive:1;
 };
 
 struct auth_worker_connection {
@@ -39,9 +47,12 @@ struct auth_worker_connection {
 	struct ostream *output;
 	struct timeout *to;
 
-	struct auth_worker_request *request;
+	/* requests sent to the worker, waiting for replies. the replies may
+	   come in any order. */
+	ARRAY(struct auth_worker_request *) requests;
 	unsigned int id_counter;
 
+	unsigned int exclusive:1;
 	unsigned int received_error:1;
 	unsigned int restart:1;
 	unsigned int shutdown:1;
@@ -53,6 +64,8 @@ static ARRAY(struct auth_worker_request *) worker_request_array;
 static struct aqueue *worker_request_queue;
 static time_t auth_worker_last_warn;
 static unsigned int auth_workers_throttle_count;
+static unsigned int auth_worker_queue_depths[AUTH_WORKER_HISTOGRAM_BUCKETS];
+static unsigned int auth_worker_latencies[AUTH_WORKER_HISTOGRAM_BUCKETS];
 
 static const char *worker_socket_path;
 
@@ -60,9 +73,55 @@ static void worker_input(struct auth_worker_connection *conn);
 static void auth_worker_destroy(struct auth_worker_connection **conn,
 				const char *reason, bool restart) ATTR_NULL(2);
 
+static unsigned int auth_worker_histogram_bucket(unsigned int value)
+{
+	unsigned int idx = 0;
+
+	while (value > 0 && idx < AUTH_WORKER_HISTOGRAM_BUCKETS-1) {
+		value >>= 1;
+		idx++;
+	}
+	return idx;
+}
+
+static const char *
+auth_worker_histogram_get(unsigned int histogram[AUTH_WORKER_HISTOGRAM_BUCKETS])
+{
+	string_t *str = t_str_new(128);
+	unsigned int i;
+
+	for (i = 0; i < AUTH_WORKER_HISTOGRAM_BUCKETS; i++) {
+		if (histogram[i] == 0)
+			continue;
+		if (str_len(str) > 0)
+			str_append_c(str, ' ');
+		if (i < AUTH_WORKER_HISTOGRAM_BUCKETS-1)
+			str_printfa(str, "<%u:%u", 1U << i, histogram[i]);
+		else
+			str_printfa(str, ">=%u:%u", 1U << (i-1), histogram[i]);
+	}
+	return str_len(str) == 0 ? "-" : str_c(str);
+}
+
+static void sig_auth_worker_stats(const siginfo_t *si ATTR_UNUSED,
+				  void *context ATTR_UNUSED)
+{
+	i_info("Auth workers: %u connections, %u idle, %u requests queued",
+	       array_count(&connections), idle_count,
+	       aqueue_count(worker_request_queue));
+	i_info("Auth worker queue depths: %s",
+	       auth_worker_histogram_get(auth_worker_queue_depths));
+	i_info("Auth worker latencies (msecs): %s",
+	       auth_worker_histogram_get(auth_worker_latencies));
+
+	/* reset counters */
+	memset(auth_worker_queue_depths, 0, sizeof(auth_worker_queue_depths));
+	memset(auth_worker_latencies, 0, sizeof(auth_worker_latencies));
+}
+
 static void auth_worker_idle_timeout(struct auth_worker_connection *conn)
 {
-	i_assert(conn->request == NULL);
+	i_assert(array_count(&conn->requests) == 0);
 
 	if (idle_count > 1)
 		auth_worker_destroy(&conn, NULL, FALSE);
@@ -72,16 +131,33 @@ static void auth_worker_idle_timeout(struct auth_worker_connection *conn)
 
 static void auth_worker_call_timeout(struct auth_worker_connection *conn)
 {
-	i_assert(conn->request != NULL);
+	i_assert(array_count(&conn->requests) > 0);
 
 	auth_worker_destroy(&conn, "Lookup timed out", TRUE);
 }
 
+static bool
+auth_worker_can_send(struct auth_worker_connection *conn,
+		     const struct auth_worker_request *request)
+{
+	unsigned int count = array_count(&conn->requests);
+
+	if (count == 0)
+		return TRUE;
+	if (conn->exclusive || request->exclusive ||
+	    conn->restart || conn->shutdown)
+		return FALSE;
+	return count < global_auth_settings->worker_max_pending;
+}
+
 static bool auth_worker_request_send(struct auth_worker_connection *conn,
 				     struct auth_worker_request *request)
 {
 	struct const_iovec iov[3];
-	unsigned int age_secs = ioloop_time - request->created;
+	unsigned int age_secs = ioloop_time - request->created.tv_sec;
+	unsigned int depth;
+
+	i_assert(auth_worker_can_send(conn, request));
 
 	if (age_secs >= AUTH_WORKER_ABORT_SECS) {
 		i_error("Aborting auth request that was queued for %d secs, "
@@ -113,13 +189,21 @@ static bool auth_worker_request_send(struct auth_worker_connection *conn,
 
 	o_stream_nsendv(conn->output, iov, 3);
 
-	i_assert(conn->request == NULL);
-	conn->request = request;
+	depth = array_count(&conn->requests) +
+		aqueue_count(worker_request_queue);
+	auth_worker_queue_depths[auth_worker_histogram_bucket(depth)]++;
 
-	timeout_remove(&conn->to);
-	conn->to = timeout_add(AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000,
-			       auth_worker_call_timeout, conn);
-	idle_count--;
+	if (array_count(&conn->requests) == 0) {
+		/* the timeout is reset whenever the worker replies to any
+		   of the pending requests */
+		timeout_remove(&conn->to);
+		conn->to = timeout_add(AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000,
+				       auth_worker_call_timeout, conn);
+		idle_count--;
+	}
+	array_append(&conn->requests, &request, 1);
+	if (request->exclusive)
+		conn->exclusive = TRUE;
 	return TRUE;
 }
 
@@ -127,15 +211,15 @@ static void auth_worker_request_send_next(struct auth_worker_connection *conn)
 {
 	struct auth_worker_request *request, *const *requestp;
 
-	do {
-		if (aqueue_count(worker_request_queue) == 0)
-			return;
-
+	while (aqueue_count(worker_request_queue) > 0) {
 		requestp = array_idx(&worker_request_array,
 				     aqueue_idx(worker_request_queue, 0));
 		request = *requestp;
+		if (!auth_worker_can_send(conn, request))
+			break;
 		aqueue_delete_tail(worker_request_queue);
-	} while (!auth_worker_request_send(conn, request));
+		(void)auth_worker_request_send(conn, request);
+	}
 }
 
 static void auth_worker_send_handshake(struct auth_worker_connection *conn)
@@ -182,6 +266,7 @@ static struct auth_worker_connection *auth_worker_create(void)
 
 	conn = i_new(struct auth_worker_connection, 1);
 	conn->fd = fd;
+	i_array_init(&conn->requests, 8);
 	conn->input = i_stream_create_fd(fd, AUTH_WORKER_MAX_LINE_LENGTH,
 					 FALSE);
 	conn->output = o_stream_create_fd(fd, (size_t)-1, FALSE);
@@ -201,6 +286,7 @@ static void auth_worker_destroy(struct auth_worker_connection **_conn,
 {
 	struct auth_worker_connection *conn = *_conn;
 	struct auth_worker_connection *const *conns;
+	struct auth_worker_request *const *requestp;
 	unsigned int idx;
 
 	*_conn = NULL;
@@ -219,15 +305,18 @@ static void auth_worker_destroy(struct auth_worker_connection **_conn,
 		}
 	}
 
-	if (conn->request == NULL)
+	if (array_count(&conn->requests) == 0)
 		idle_count--;
-
-	if (conn->request != NULL) {
-		i_error("auth worker: Aborted request: %s", reason);
-		conn->request->callback(t_strdup_printf(
+	else {
+		i_error("auth worker: Aborted %u requests: %s",
+			array_count(&conn->requests), reason);
+	}
+	array_foreach(&conn->requests, requestp) {
+		(*requestp)->callback(t_strdup_printf(
 				"FAIL\t%d", PASSDB_RESULT_INTERNAL_FAILURE),
-				conn->request->context);
+				(*requestp)->context);
 	}
+	array_free(&conn->requests);
 
 	if (conn->io != NULL)
 		io_remove(&conn->io);
@@ -256,26 +345,60 @@ static struct auth_worker_connection *auth_worker_find_free(void)
 	array_foreach_modifiable(&connections, conns) {
 		struct auth_worker_connection *conn = *conns;
 
-		if (conn->request == NULL)
+		if (array_count(&conn->requests) == 0)
 			return conn;
 	}
 	i_unreached();
 	return NULL;
 }
 
+static struct auth_worker_connection *
+auth_worker_find_least_busy(const struct auth_worker_request *request)
+{
+	struct auth_worker_connection *const *conns, *best = NULL;
+
+	/* all the workers are busy and no more can be created. pipeline the
+	   request to the worker with the fewest pending requests. workers
+	   handle them concurrently if the passdb/userdb supports it. */
+	array_foreach(&connections, conns) {
+		struct auth_worker_connection *conn = *conns;
+
+		if (!auth_worker_can_send(conn, request))
+			continue;
+		if (best == NULL || array_count(&conn->requests) <
+		    array_count(&best->requests))
+			best = conn;
+	}
+	return best;
+}
+
 static void auth_worker_request_handle(struct auth_worker_connection *conn,
-				       struct auth_worker_request *request,
-				       const char *line)
+				       unsigned int idx, const char *line)
 {
+	struct auth_worker_request *const *requestp, *request;
+	unsigned int msecs;
+
+	requestp = array_idx(&conn->requests, idx);
+	request = *requestp;
+
 	if (strncmp(line, "*\t", 2) == 0) {
 		/* multi-line reply, not finished yet */
 		timeout_reset(conn->to);
 	} else {
-		conn->request = NULL;
-		timeout_remove(&conn->to);
-		conn->to = timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
-				       auth_worker_idle_timeout, conn);
-		idle_count++;
+		array_delete(&conn->requests, idx, 1);
+		if (request->exclusive)
+			conn->exclusive = FALSE;
+		msecs = timeval_diff_msecs(&ioloop_timeval, &request->created);
+		auth_worker_latencies[auth_worker_histogram_bucket(msecs)]++;
+
+		if (array_count(&conn->requests) > 0)
+			timeout_reset(conn->to);
+		else {
+			timeout_remove(&conn->to);
+			conn->to = timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
+					       auth_worker_idle_timeout, conn);
+			idle_count++;
+		}
 	}
 
 	if (!request->callback(line, request->context) && conn->io != NULL)
@@ -327,10 +450,27 @@ static void auth_worker_success(struct auth_worker_connection *conn)
 	conn->received_error = FALSE;
 }
 
+static bool
+auth_worker_request_find(struct auth_worker_connection *conn,
+			 unsigned int id, unsigned int *idx_r)
+{
+	struct auth_worker_request *const *requests;
+	unsigned int i, count;
+
+	requests = array_get(&conn->requests, &count);
+	for (i = 0; i < count; i++) {
+		if (requests[i]->id == id) {
+			*idx_r = i;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
 static void worker_input(struct auth_worker_connection *conn)
 {
 	const char *line, *id_str;
-	unsigned int id;
+	unsigned int id, idx;
 
 	switch (i_stream_read(conn->input)) {
 	case 0:
@@ -372,24 +512,19 @@ static void worker_input(struct auth_worker_connection *conn)
 		    str_to_uint(t_strdup_until(id_str, line), &id) < 0)
 			continue;
 
-		if (conn->request != NULL && id == conn->request->id) {
-			auth_worker_request_handle(conn, conn->request,
-						   line + 1);
-		} else {
-			if (conn->request != NULL) {
-				i_error("BUG: Worker sent reply with id %u, "
-					"expected %u", id, conn->request->id);
-			} else {
-				i_error("BUG: Worker sent reply with id %u, "
-					"none was expected", id);
-			}
+		if (auth_worker_request_find(conn, id, &idx))
+			auth_worker_request_handle(conn, idx, line + 1);
+		else {
+			i_error("BUG: Worker sent reply with id %u, "
+				"which isn't pending", id);
 			auth_worker_destroy(&conn, "Worker is buggy", TRUE);
 			return;
 		}
 	}
 
-	if (conn->request != NULL) {
-		/* there's still a pending request */
+	if (array_count(&conn->requests) > 0 &&
+	    (conn->restart || conn->shutdown)) {
+		/* wait for the pending requests to finish */
 	} else if (conn->restart)
 		auth_worker_destroy(&conn, "Max requests limit", TRUE);
 	else if (conn->shutdown)
@@ -406,10 +541,11 @@ auth_worker_call(pool_t pool, const char *data,
 	struct auth_worker_request *request;
 
 	request = p_new(pool, struct auth_worker_request, 1);
-	request->created = ioloop_time;
+	request->created = ioloop_timeval;
 	request->data = p_strdup(pool, data);
 	request->callback = callback;
 	request->context = context;
+	request->exclusive = strncmp(data, "LIST\t", 5) == 0;
 
 	if (aqueue_count(worker_request_queue) > 0) {
 		/* requests are already being queued, no chance of
@@ -421,6 +557,8 @@ auth_worker_call(pool_t pool, const char *data,
 			/* no free connections, create a new one */
 			conn = auth_worker_create();
 		}
+		if (conn == NULL)
+			conn = auth_worker_find_least_busy(request);
 	}
 	if (conn != NULL) {
 		if (!auth_worker_request_send(conn, request))
@@ -448,12 +586,20 @@ void auth_worker_server_init(void)
 	worker_request_queue = aqueue_init(&worker_request_array.arr);
 
 	i_array_init(&connections, 16);
+
+	if (!worker) {
+		lib_signals_set_handler(SIGUSR2, LIBSIG_FLAGS_SAFE,
+					sig_auth_worker_stats, NULL);
+	}
 }
 
 void auth_worker_server_deinit(void)
 {
 	struct auth_worker_connection **connp, *conn;
 
+	if (!worker)
+		lib_signals_unset_handler(SIGUSR2, sig_auth_worker_stats, NULL);
+
 	while (array_count(&connections) > 0) {
 		connp = array_idx_modifiable(&connections, 0);
 		conn = *connp;
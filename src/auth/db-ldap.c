@@ -112,6 +112,8 @@ static struct setting_def setting_defs[] = {
 	DEF_INT(ldap_version),
 	DEF_STR(debug_level),
 	DEF_STR(ldaprc_path),
+	DEF_INT(connections),
+	DEF_INT(max_pending_requests),
 	DEF_STR(user_attrs),
 	DEF_STR(user_filter),
 	DEF_STR(pass_attrs),
@@ -149,6 +151,8 @@ static struct ldap_settings default_ldap_settings = {
 	.ldap_version = 3,
 	.debug_level = "0",
 	.ldaprc_path = "",
+	.connections = 1,
+	.max_pending_requests = DB_LDAP_MAX_PENDING_REQUESTS,
 	.user_attrs = "homeDirectory=home,uidNumber=uid,gidNumber=gid",
 	.user_filter = "(&(objectClass=posixAccount)(uid=%u))",
 	.pass_attrs = "uid=user,userPassword=password",
@@ -164,6 +168,7 @@ static struct ldap_connection *ldap_connections = NULL;
 
 static int db_ldap_bind(struct ldap_connection *conn);
 static void db_ldap_conn_close(struct ldap_connection *conn);
+static void db_ldap_result_unref(struct db_ldap_result **res);
 struct db_ldap_result_iterate_context *
 db_ldap_result_iterate_init_full(struct ldap_connection *conn,
 				 struct ldap_request_search *ldap_request,
@@ -346,6 +351,96 @@ static int db_ldap_request_search(struct ldap_connection *conn,
 	return 1;
 }
 
+static bool
+db_ldap_search_can_coalesce(const struct ldap_request_search *srequest)
+{
+	const struct ldap_field *field;
+
+	/* iterations return multiple entries, and @name fields need
+	   subsearches whose results are saved to the request itself */
+	if (srequest->multi_entry)
+		return FALSE;
+	array_foreach(srequest->attr_map, field) {
+		if (field->value_is_dn)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static bool
+db_ldap_search_coalesce(struct ldap_connection *conn,
+			struct ldap_request_search *srequest)
+{
+	struct ldap_request_search *leader, **tailp;
+
+	if (!db_ldap_search_can_coalesce(srequest))
+		return FALSE;
+
+	leader = hash_table_lookup(conn->searches, srequest->filter);
+	if (leader == NULL) {
+		hash_table_insert(conn->searches, srequest->filter, srequest);
+		srequest->coalesce_registered = TRUE;
+		return FALSE;
+	}
+	if (leader->attributes != srequest->attributes ||
+	    strcmp(leader->base, srequest->base) != 0) {
+		/* same filter, but otherwise different search */
+		return FALSE;
+	}
+
+	for (tailp = &leader->coalesced; *tailp != NULL;
+	     tailp = &(*tailp)->coalesced_next) ;
+	*tailp = srequest;
+	auth_request_log_debug(srequest->request.auth_request, "ldap",
+			       "Waiting for an identical search in progress: %s",
+			       srequest->filter);
+	return TRUE;
+}
+
+static void
+db_ldap_request_callback(struct ldap_connection *conn,
+			 struct ldap_request *request,
+			 struct db_ldap_result *res)
+{
+	struct ldap_request_search *srequest, *coalesced = NULL, *next;
+	struct db_ldap_result *entry = NULL;
+
+	if (request->type == LDAP_REQUEST_TYPE_SEARCH) {
+		srequest = (struct ldap_request_search *)request;
+		if (srequest->coalesce_registered) {
+			hash_table_remove(conn->main_conn->searches,
+					  srequest->filter);
+			srequest->coalesce_registered = FALSE;
+		}
+		/* the callback may reuse the request's memory */
+		coalesced = srequest->coalesced;
+		srequest->coalesced = NULL;
+		if (res != NULL && srequest->result != NULL) {
+			entry = srequest->result;
+			entry->refcount++;
+		}
+	}
+
+	T_BEGIN {
+		if (entry != NULL)
+			request->callback(conn, request, entry->msg);
+		request->callback(conn, request, res == NULL ? NULL : res->msg);
+	} T_END;
+
+	for (; coalesced != NULL; coalesced = next) {
+		next = coalesced->coalesced_next;
+		request = &coalesced->request;
+		T_BEGIN {
+			if (entry != NULL)
+				request->callback(conn, request, entry->msg);
+			request->callback(conn, request,
+					  res == NULL ? NULL : res->msg);
+		} T_END;
+	}
+	if (entry != NULL)
+		db_ldap_result_unref(&entry);
+}
+
 static bool db_ldap_request_queue_next(struct ldap_connection *conn)
 {
 	struct ldap_request *const *requestp, *request;
@@ -360,7 +455,7 @@ static bool db_ldap_request_queue_next(struct ldap_connection *conn)
 		/* no non-pending requests */
 		return FALSE;
 	}
-	if (conn->pending_count > DB_LDAP_MAX_PENDING_REQUESTS) {
+	if (conn->pending_count >= conn->set.max_pending_requests) {
 		/* wait until server has replied to some requests */
 		return FALSE;
 	}
@@ -414,7 +509,7 @@ static bool db_ldap_request_queue_next(struct ldap_connection *conn)
 	} else {
 		/* broken request, remove from queue */
 		aqueue_delete_tail(conn->request_queue);
-		request->callback(conn, request, NULL);
+		db_ldap_request_callback(conn, request, NULL);
 		return TRUE;
 	}
 }
@@ -442,16 +537,48 @@ db_ldap_check_limits(struct ldap_connection *conn, struct ldap_request *request)
 	return TRUE;
 }
 
+static struct ldap_connection *
+db_ldap_conn_get_least_busy(struct ldap_connection *main_conn)
+{
+	struct ldap_connection *const *connp, *conn = NULL;
+
+	array_foreach(&main_conn->conns, connp) {
+		if (conn == NULL ||
+		    aqueue_count((*connp)->request_queue) <
+		    aqueue_count(conn->request_queue))
+			conn = *connp;
+	}
+	return conn;
+}
+
 void db_ldap_request(struct ldap_connection *conn,
 		     struct ldap_request *request)
 {
+	struct ldap_request_search *srequest;
+
 	i_assert(request->auth_request != NULL);
 
 	request->msgid = -1;
 	request->create_time = ioloop_time;
 
+	conn = conn->main_conn;
+	if (request->type == LDAP_REQUEST_TYPE_SEARCH) {
+		srequest = (struct ldap_request_search *)request;
+		srequest->coalesced = NULL;
+		srequest->coalesced_next = NULL;
+		srequest->coalesce_registered = FALSE;
+		if (db_ldap_search_coalesce(conn, srequest))
+			return;
+		/* iterations must stay in the main connection, because
+		   the userdb iterator enables/disables its input */
+		if (!srequest->multi_entry)
+			conn = db_ldap_conn_get_least_busy(conn);
+	} else {
+		conn = db_ldap_conn_get_least_busy(conn);
+	}
+
 	if (!db_ldap_check_limits(conn, request)) {
-		request->callback(conn, request, NULL);
+		db_ldap_request_callback(conn, request, NULL);
 		return;
 	}
 
@@ -528,7 +655,7 @@ static void db_ldap_abort_requests(struct ldap_connection *conn,
 			auth_request_log_info(request->auth_request, "ldap",
 					      "%s", reason);
 		}
-		request->callback(conn, request, NULL);
+		db_ldap_request_callback(conn, request, NULL);
 		max_count--;
 	}
 }
@@ -812,12 +939,7 @@ db_ldap_handle_request_result(struct ldap_connection *conn,
 		aqueue_delete(conn->request_queue, idx);
 	}
 
-	T_BEGIN {
-		if (res != NULL && srequest != NULL && srequest->result != NULL)
-			request->callback(conn, request, srequest->result->msg);
-
-		request->callback(conn, request, res->msg);
-	} T_END;
+	db_ldap_request_callback(conn, request, res);
 
 	if (idx > 0) {
 		/* see if there are timed out requests */
@@ -1742,10 +1864,31 @@ static struct ldap_connection *ldap_conn_find(const char *config_path)
 	return NULL;
 }
 
+static void db_ldap_conn_add(struct ldap_connection *main_conn)
+{
+	struct ldap_connection *conn;
+
+	conn = p_new(main_conn->pool, struct ldap_connection, 1);
+	conn->pool = main_conn->pool;
+	conn->refcount = 1;
+	conn->main_conn = main_conn;
+
+	conn->conn_state = LDAP_CONN_STATE_DISCONNECTED;
+	conn->default_bind_msgid = -1;
+	conn->fd = -1;
+	conn->config_path = main_conn->config_path;
+	conn->set = main_conn->set;
+
+	i_array_init(&conn->request_array, 512);
+	conn->request_queue = aqueue_init(&conn->request_array.arr);
+	array_append(&main_conn->conns, &conn, 1);
+}
+
 struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 {
 	struct ldap_connection *conn;
 	const char *str, *error;
+	unsigned int i;
 	pool_t pool;
 
 	/* see if it already exists */
@@ -1799,18 +1942,41 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
         conn->set.ldap_deref = deref2str(conn->set.deref);
 	conn->set.ldap_scope = scope2str(conn->set.scope);
 
+	if (conn->set.connections == 0)
+		i_fatal("LDAP: connections must be at least 1");
+	if (conn->set.max_pending_requests == 0)
+		i_fatal("LDAP: max_pending_requests must be at least 1");
+
 	i_array_init(&conn->request_array, 512);
 	conn->request_queue = aqueue_init(&conn->request_array.arr);
 
+	conn->main_conn = conn;
+	i_array_init(&conn->conns, conn->set.connections);
+	array_append(&conn->conns, &conn, 1);
+	for (i = 1; i < conn->set.connections; i++)
+		db_ldap_conn_add(conn);
+	hash_table_create(&conn->searches, default_pool, 0, str_hash, strcmp);
+
 	conn->next = ldap_connections;
         ldap_connections = conn;
 	return conn;
 }
 
+static void db_ldap_conn_deinit(struct ldap_connection *conn)
+{
+	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
+	i_assert(conn->pending_count == 0);
+	db_ldap_conn_close(conn);
+	i_assert(conn->to == NULL);
+
+	array_free(&conn->request_array);
+	aqueue_deinit(&conn->request_queue);
+}
+
 void db_ldap_unref(struct ldap_connection **_conn)
 {
         struct ldap_connection *conn = *_conn;
-	struct ldap_connection **p;
+	struct ldap_connection **p, *const *connp;
 
 	*_conn = NULL;
 	i_assert(conn->refcount >= 0);
@@ -1824,13 +1990,11 @@ void db_ldap_unref(struct ldap_connection **_conn)
 		}
 	}
 
-	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
-	i_assert(conn->pending_count == 0);
-	db_ldap_conn_close(conn);
-	i_assert(conn->to == NULL);
-
-	array_free(&conn->request_array);
-	aqueue_deinit(&conn->request_queue);
+	array_foreach(&conn->conns, connp)
+		db_ldap_conn_deinit(*connp);
+	i_assert(hash_table_count(conn->searches) == 0);
+	hash_table_destroy(&conn->searches);
+	array_free(&conn->conns);
 
 	pool_unref(&conn->pool);
 }
@@ -5,7 +5,8 @@
    This define enables them until the code here can be refactored */
 #define LDAP_DEPRECATED 1
 
-/* Maximum number of pending requests before delaying new requests. */
+/* Default maximum number of pending requests per connection before delaying
+   new requests. */
 #define DB_LDAP_MAX_PENDING_REQUESTS 8
 /* If LDAP connection is down, fail requests after waiting for this long. */
 #define DB_LDAP_REQUEST_DISCONNECT_TIMEOUT_SECS 4
@@ -55,6 +56,9 @@ struct ldap_settings {
 	const char *ldaprc_path;
 	const char *debug_level;
 
+	unsigned int connections;
+	unsigned int max_pending_requests;
+
 	const char *user_attrs;
 	const char *user_filter;
 	const char *pass_attrs;
@@ -126,7 +130,13 @@ struct ldap_request_search {
 	ARRAY(struct ldap_request_named_result) named_results;
 	unsigned int name_idx;
 
+	/* Identical searches that were sent while this one was in progress.
+	   They get the same result instead of being sent separately. */
+	struct ldap_request_search *coalesced, *coalesced_next;
+
 	bool multi_entry;
+	/* This search is in the connection's searches hash */
+	bool coalesce_registered;
 };
 
 struct ldap_request_bind {
@@ -152,6 +162,15 @@ struct ldap_connection {
 	pool_t pool;
 	int refcount;
 
+	/* The connection returned by db_ldap_init(). Its requests are
+	   spread to all the connections in its conns array, which includes
+	   itself. The rest of the connections are owned by it and share its
+	   settings. */
+	struct ldap_connection *main_conn;
+	ARRAY(struct ldap_connection *) conns;
+	/* filter => search in progress, for coalescing identical searches */
+	HASH_TABLE(const char *, struct ldap_request_search *) searches;
+
 	char *config_path;
         struct ldap_settings set;
 
@@ -4,6 +4,9 @@
 
 #if defined(PASSDB_SQL) || defined(USERDB_SQL)
 
+#include "array.h"
+#include "str.h"
+#include "var-expand.h"
 #include "settings.h"
 #include "auth-request.h"
 #include "auth-worker-client.h"
@@ -61,6 +64,154 @@ static const char *parse_setting(const char *key, const char *value,
 				       &conn->set, key, value);
 }
 
+static bool
+db_sql_query_literal_is_param(const char *template, const char *p,
+			      const char *end)
+{
+	/* '%x' where the literal contains only a single variable and isn't
+	   a part of a longer literal with '' escapes */
+	if (p != template && p[-1] == '\'')
+		return FALSE;
+	if (end[1] == '\'')
+		return FALSE;
+	return p[1] == '%' && end - p > 2 &&
+		memchr(p + 2, '%', end - (p + 2)) == NULL;
+}
+
+static bool
+db_sql_query_convert(pool_t pool, const char *template, string_t *dest,
+		     ARRAY_TYPE(const_string) *params)
+{
+	const char *p, *end, *param;
+
+	for (p = template; *p != '\0'; p++) {
+		if (*p == '%' || *p == '?' || *p == '\\')
+			return FALSE;
+		if (*p != '\'' && *p != '"') {
+			str_append_c(dest, *p);
+			continue;
+		}
+
+		end = strchr(p + 1, *p);
+		if (end == NULL || memchr(p, '\\', end - p) != NULL)
+			return FALSE;
+		if (*p == '\'' &&
+		    db_sql_query_literal_is_param(template, p, end)) {
+			str_append_c(dest, '?');
+			param = p_strdup_until(pool, p + 1, end);
+			array_append(params, &param, 1);
+		} else if (memchr(p, '%', end - p) != NULL) {
+			return FALSE;
+		} else {
+			str_append_n(dest, p, end - p + 1);
+		}
+		p = end;
+	}
+	return TRUE;
+}
+
+static void
+db_sql_query_init(struct sql_connection *conn, struct db_sql_query *query,
+		  const char *template)
+{
+	ARRAY_TYPE(const_string) params;
+	string_t *query_template;
+
+	query->template = template;
+	p_array_init(&params, conn->pool, 4);
+	T_BEGIN {
+		query_template = t_str_new(256);
+		if (db_sql_query_convert(conn->pool, template,
+					 query_template, &params)) {
+			query->prep_stmt = sql_prepared_statement_init(conn->db,
+						str_c(query_template));
+		}
+	} T_END;
+	array_append_zero(&params);
+	query->params = array_idx(&params, 0);
+}
+
+static void db_sql_query_deinit(struct db_sql_query *query)
+{
+	if (query->prep_stmt != NULL)
+		sql_prepared_statement_deinit(&query->prep_stmt);
+}
+
+static struct sql_statement *
+db_sql_statement_init(struct db_sql_query *query,
+		      struct auth_request *auth_request)
+{
+	const struct var_expand_table *table;
+	struct sql_statement *stmt;
+	string_t *value;
+	unsigned int i;
+
+	table = auth_request_get_var_expand_table(auth_request, NULL);
+	value = t_str_new(128);
+	stmt = sql_statement_init_prepared(query->prep_stmt);
+	for (i = 0; query->params[i] != NULL; i++) {
+		str_truncate(value, 0);
+		var_expand(value, query->params[i], table);
+		sql_statement_bind_str(stmt, i, str_c(value));
+	}
+	return stmt;
+}
+
+static const char *
+db_sql_query_expand(struct db_sql_query *query,
+		    struct auth_request *auth_request,
+		    auth_request_escape_func_t *escape_func)
+{
+	string_t *str;
+
+	str = t_str_new(512);
+	var_expand(str, query->template,
+		   auth_request_get_var_expand_table(auth_request,
+						     escape_func));
+	return str_c(str);
+}
+
+#undef db_sql_query
+#undef sql_query
+#undef sql_statement_query
+void db_sql_query(struct sql_connection *conn, struct db_sql_query *query,
+		  struct auth_request *auth_request,
+		  auth_request_escape_func_t *escape_func,
+		  sql_query_callback_t *callback, void *context)
+{
+	struct sql_statement *stmt;
+	const char *query_str = NULL;
+
+	if (query->prep_stmt == NULL || auth_request->set->debug) {
+		query_str = db_sql_query_expand(query, auth_request,
+						escape_func);
+		auth_request_log_debug(auth_request, "sql",
+				       "query: %s", query_str);
+	}
+	if (query->prep_stmt == NULL)
+		sql_query(conn->db, query_str, callback, context);
+	else {
+		stmt = db_sql_statement_init(query, auth_request);
+		sql_statement_query(&stmt, callback, context);
+	}
+}
+
+void db_sql_update(struct db_sql_query *query,
+		   struct auth_request *auth_request,
+		   auth_request_escape_func_t *escape_func,
+		   struct sql_transaction_context *trans)
+{
+	struct sql_statement *stmt;
+
+	if (query->prep_stmt == NULL) {
+		sql_update(trans, db_sql_query_expand(query, auth_request,
+						      escape_func));
+	} else {
+		stmt = db_sql_statement_init(query, auth_request);
+		sql_update_stmt(trans, &stmt);
+	}
+}
+
 struct sql_connection *db_sql_init(const char *config_path, bool userdb)
 {
 	struct sql_connection *conn;
@@ -109,6 +260,13 @@ struct sql_connection *db_sql_init(const char *config_path, bool userdb)
 	}
 	conn->db = sql_init(conn->set.driver, conn->set.connect);
 
+	db_sql_query_init(conn, &conn->password_query,
+			  conn->set.password_query);
+	db_sql_query_init(conn, &conn->user_query, conn->set.user_query);
+	db_sql_query_init(conn, &conn->update_query, conn->set.update_query);
+	db_sql_query_init(conn, &conn->iterate_query,
+			  conn->set.iterate_query);
+
 	conn->next = connections;
 	connections = conn;
 	return conn;
@@ -126,6 +284,10 @@ void db_sql_unref(struct sql_connection **_conn)
 	if (--conn->refcount > 0)
 		return;
 
+	db_sql_query_deinit(&conn->password_query);
+	db_sql_query_deinit(&conn->user_query);
+	db_sql_query_deinit(&conn->update_query);
+	db_sql_query_deinit(&conn->iterate_query);
 	sql_deinit(&conn->db);
 	pool_unref(&conn->pool);
 }
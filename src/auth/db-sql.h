@@ -2,6 +2,7 @@
 #define DB_SQL_H
 
 #include "sql-api.h"
+#include "auth-request.h"
 
 struct sql_settings {
 	const char *driver;
@@ -14,6 +15,16 @@ struct sql_settings {
 	bool userdb_warning_disable;
 };
 
+struct db_sql_query {
+	/* the query setting as var_expand() template */
+	const char *template;
+	/* NULL if the template couldn't be converted to a prepared statement.
+	   Otherwise each '%x' is replaced by a '?' parameter and params
+	   contains the var_expand() templates for the parameters. */
+	struct sql_prepared_statement *prep_stmt;
+	const char *const *params;
+};
+
 struct sql_connection {
 	struct sql_connection *next;
 
@@ -24,6 +35,9 @@ struct sql_connection {
 	struct sql_settings set;
 	struct sql_db *db;
 
+	struct db_sql_query password_query, user_query;
+	struct db_sql_query update_query, iterate_query;
+
 	unsigned int default_password_query:1;
 	unsigned int default_user_query:1;
 	unsigned int default_update_query:1;
@@ -37,6 +51,24 @@ void db_sql_unref(struct sql_connection **conn);
 void db_sql_connect(struct sql_connection *conn);
 void db_sql_success(struct sql_connection *conn);
 
+/* Execute the query for the auth request. Values that can't be given as
+   statement parameters are escaped with escape_func. */
+void db_sql_query(struct sql_connection *conn, struct db_sql_query *query,
+		  struct auth_request *auth_request,
+		  auth_request_escape_func_t *escape_func,
+		  sql_query_callback_t *callback, void *context);
+#define db_sql_query(conn, query, auth_request, escape_func, callback, context) \
+	db_sql_query(conn, query + \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			struct sql_result *, typeof(context))), \
+		auth_request, escape_func, \
+		(sql_query_callback_t *)callback, context)
+/* Add the query for the auth request to the transaction. */
+void db_sql_update(struct db_sql_query *query,
+		   struct auth_request *auth_request,
+		   auth_request_escape_func_t *escape_func,
+		   struct sql_transaction_context *trans);
+
 void db_sql_check_userdb_warning(struct sql_connection *conn);
 
 #endif
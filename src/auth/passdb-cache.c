@@ -1,6 +1,8 @@
 /* Copyright (c) 2004-2014 Dovecot authors, see the included COPYING file */
 
 #include "auth-common.h"
+#include "array.h"
+#include "crc32.h"
 #include "restrict-process-size.h"
 #include "password-scheme.h"
 #include "passdb.h"
@@ -9,6 +11,7 @@
 #include <stdlib.h>
 
 struct auth_cache *passdb_cache = NULL;
+static char *passdb_cache_snapshot_path, *passdb_cache_fingerprint;
 
 static void
 passdb_cache_log_hit(struct auth_request *request, const char *value)
@@ -127,8 +130,32 @@ bool passdb_cache_lookup_credentials(struct auth_request *request,
 	return TRUE;
 }
 
+static const char *passdb_cache_get_fingerprint(const struct auth_settings *set)
+{
+	struct auth_passdb_settings *const *passdbs;
+	struct auth_userdb_settings *const *userdbs;
+	uint32_t crc = 0;
+
+	/* the cache keys contain the passdb/userdb IDs, which are assigned
+	   in the order they're configured */
+	if (array_is_created(&set->passdbs)) {
+		array_foreach(&set->passdbs, passdbs) {
+			crc = crc32_str_more(crc, (*passdbs)->driver);
+			crc = crc32_str_more(crc, (*passdbs)->args);
+		}
+	}
+	if (array_is_created(&set->userdbs)) {
+		array_foreach(&set->userdbs, userdbs) {
+			crc = crc32_str_more(crc, (*userdbs)->driver);
+			crc = crc32_str_more(crc, (*userdbs)->args);
+		}
+	}
+	return t_strdup_printf("%08x", crc);
+}
+
 void passdb_cache_init(const struct auth_settings *set)
 {
+	unsigned int count;
 	rlim_t limit;
 
 	if (set->cache_size == 0 || set->cache_ttl == 0)
@@ -143,10 +170,32 @@ void passdb_cache_init(const struct auth_settings *set)
 	}
 	passdb_cache = auth_cache_new(set->cache_size, set->cache_ttl,
 				      set->cache_negative_ttl);
+
+	if (*set->cache_snapshot_path != '\0') {
+		passdb_cache_snapshot_path = i_strdup(set->cache_snapshot_path);
+		passdb_cache_fingerprint =
+			i_strdup(passdb_cache_get_fingerprint(set));
+		if (auth_cache_snapshot_load(passdb_cache,
+					     passdb_cache_snapshot_path,
+					     passdb_cache_fingerprint,
+					     &count) == 0 && set->debug) {
+			i_debug("Loaded %u auth cache entries from %s",
+				count, passdb_cache_snapshot_path);
+		}
+	}
 }
 
 void passdb_cache_deinit(void)
 {
-	if (passdb_cache != NULL)
-		auth_cache_free(&passdb_cache);
+	if (passdb_cache == NULL)
+		return;
+
+	if (passdb_cache_snapshot_path != NULL) {
+		(void)auth_cache_snapshot_save(passdb_cache,
+					       passdb_cache_snapshot_path,
+					       passdb_cache_fingerprint);
+		i_free_and_null(passdb_cache_snapshot_path);
+		i_free_and_null(passdb_cache_fingerprint);
+	}
+	auth_cache_free(&passdb_cache);
 }
@@ -1,10 +1,16 @@
 /* Copyright (c) 2013-2014 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
+#include "lib-signals.h"
 #include "auth-request.h"
 #include "auth-cache.h"
 #include "test-common.h"
 
+#include <unistd.h>
+
+#define TEST_SNAPSHOT_PATH ".test-auth-cache.snapshot"
+
 const struct var_expand_table auth_request_var_expand_static_tab[] = {
 	/* these 3 must be in this order */
 	{ 'u', NULL, "user" },
@@ -18,10 +24,16 @@ const struct var_expand_table auth_request_var_expand_static_tab[] = {
 };
 
 const struct var_expand_table *
-auth_request_get_var_expand_table(const struct auth_request *auth_request ATTR_UNUSED,
+auth_request_get_var_expand_table(const struct auth_request *auth_request,
 				  auth_request_escape_func_t *escape_func ATTR_UNUSED)
 {
-	return auth_request_var_expand_static_tab;
+	struct var_expand_table *tab;
+
+	tab = t_malloc(sizeof(auth_request_var_expand_static_tab));
+	memcpy(tab, auth_request_var_expand_static_tab,
+	       sizeof(auth_request_var_expand_static_tab));
+	tab[0].value = auth_request->user;
+	return tab;
 }
 
 static void test_auth_cache_parse_key(void)
@@ -59,10 +71,83 @@ static void test_auth_cache_parse_key(void)
 	test_end();
 }
 
+static const char *
+test_auth_cache_lookup(struct auth_cache *cache, const char *user,
+		       bool *last_success_r)
+{
+	struct auth_request request;
+	struct auth_cache_node *node;
+	const char *value;
+	bool expired, neg_expired;
+
+	memset(&request, 0, sizeof(request));
+	request.user = t_strdup_noconst(user);
+	value = auth_cache_lookup(cache, &request, "%u", &node,
+				  &expired, &neg_expired);
+	if (value != NULL)
+		*last_success_r = node->last_success;
+	return value;
+}
+
+static void test_auth_cache_snapshot(void)
+{
+	static const char *const clear_users[] = { "user5", "user7", NULL };
+	struct ioloop *ioloop;
+	struct auth_cache *cache;
+	struct auth_request request;
+	const char *value;
+	unsigned int i, count;
+	bool last_success;
+
+	test_begin("auth cache snapshot");
+	ioloop = io_loop_create();
+	lib_signals_init();
+	cache = auth_cache_new(1024*1024, 3600, 3600);
+	memset(&request, 0, sizeof(request));
+	for (i = 0; i < 100; i++) {
+		request.user = p_strdup_printf(pool_datastack_create(),
+					       "user%u", i);
+		auth_cache_insert(cache, &request, "%u",
+				  i == 3 ? "" : t_strdup_printf("pass\t%u", i),
+				  i % 2 == 0);
+	}
+	test_assert(auth_cache_snapshot_save(cache, TEST_SNAPSHOT_PATH,
+					     "fp") == 0);
+	auth_cache_free(&cache);
+
+	cache = auth_cache_new(1024*1024, 3600, 3600);
+	test_assert(auth_cache_snapshot_load(cache, TEST_SNAPSHOT_PATH,
+					     "other", &count) == 0);
+	test_assert(count == 0);
+	test_assert(auth_cache_snapshot_load(cache, TEST_SNAPSHOT_PATH,
+					     "fp", &count) == 0);
+	test_assert(count == 100);
+	for (i = 0; i < 100; i++) {
+		value = test_auth_cache_lookup(cache,
+					       t_strdup_printf("user%u", i),
+					       &last_success);
+		test_assert(value != NULL && strcmp(value, i == 3 ? "" :
+				t_strdup_printf("pass\t%u", i)) == 0);
+		test_assert(value != NULL && last_success == (i % 2 == 0));
+	}
+
+	test_assert(auth_cache_clear_users(cache, clear_users) == 2);
+	test_assert(test_auth_cache_lookup(cache, "user5", &last_success) == NULL);
+	test_assert(test_auth_cache_lookup(cache, "user6", &last_success) != NULL);
+	test_assert(auth_cache_clear(cache) == 98);
+
+	auth_cache_free(&cache);
+	lib_signals_deinit();
+	io_loop_destroy(&ioloop);
+	(void)unlink(TEST_SNAPSHOT_PATH);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*test_functions[])(void) = {
 		test_auth_cache_parse_key,
+		test_auth_cache_snapshot,
 		NULL
 	};
 	return test_run(test_functions);
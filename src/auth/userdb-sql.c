@@ -109,22 +109,14 @@ static void userdb_sql_lookup(struct auth_request *auth_request,
 	struct sql_userdb_module *module =
 		(struct sql_userdb_module *)_module;
 	struct userdb_sql_request *sql_request;
-	string_t *query;
-
-	query = t_str_new(512);
-	var_expand(query, module->conn->set.user_query,
-		   auth_request_get_var_expand_table(auth_request,
-						     userdb_sql_escape));
 
 	auth_request_ref(auth_request);
 	sql_request = i_new(struct userdb_sql_request, 1);
 	sql_request->callback = callback;
 	sql_request->auth_request = auth_request;
 
-	auth_request_log_debug(auth_request, "sql", "%s", str_c(query));
-
-	sql_query(module->conn->db, str_c(query),
-		  sql_query_callback, sql_request);
+	db_sql_query(module->conn, &module->conn->user_query, auth_request,
+		     userdb_sql_escape, sql_query_callback, sql_request);
 }
 
 static void sql_iter_query_callback(struct sql_result *sql_result,
@@ -147,12 +139,6 @@ userdb_sql_iterate_init(struct auth_request *auth_request,
 	struct sql_userdb_module *module =
 		(struct sql_userdb_module *)_module;
 	struct sql_userdb_iterate_context *ctx;
-	string_t *query;
-
-	query = t_str_new(512);
-	var_expand(query, module->conn->set.iterate_query,
-		   auth_request_get_var_expand_table(auth_request,
-						     userdb_sql_escape));
 
 	ctx = i_new(struct sql_userdb_iterate_context, 1);
 	ctx->ctx.auth_request = auth_request;
@@ -160,9 +146,8 @@ userdb_sql_iterate_init(struct auth_request *auth_request,
 	ctx->ctx.context = context;
 	auth_request_ref(auth_request);
 
-	sql_query(module->conn->db, str_c(query),
-		  sql_iter_query_callback, ctx);
-	auth_request_log_debug(auth_request, "sql", "%s", str_c(query));
+	db_sql_query(module->conn, &module->conn->iterate_query, auth_request,
+		     userdb_sql_escape, sql_iter_query_callback, ctx);
 	return &ctx->ctx;
 }
 
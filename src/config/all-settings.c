@@ -29,6 +29,7 @@ struct mail_storage_settings {
 	uoff_t mail_attachment_min_size;
 	const char *mail_attribute_dict;
 	unsigned int mail_prefetch_count;
+	unsigned int mail_search_workers;
 	const char *mail_cache_fields;
 	const char *mail_always_cache_fields;
 	const char *mail_never_cache_fields;
@@ -43,6 +44,7 @@ struct mail_storage_settings {
 	bool dotlock_use_excl;
 	bool mail_nfs_storage;
 	bool mail_nfs_index;
+	bool mail_index_group_commit;
 	bool mailbox_list_index;
 	bool mail_debug;
 	bool mail_full_filesystem_access;
@@ -170,6 +172,8 @@ struct mdbox_settings {
 	bool mdbox_preallocate_space;
 	uoff_t mdbox_rotate_size;
 	unsigned int mdbox_rotate_interval;
+	unsigned int mdbox_purge_workers;
+	uoff_t mdbox_purge_max_io_rate;
 };
 /* ../../src/lib-settings/settings.h */
 #define DEF_STRUCT_STR(name, struct_name) \
@@ -560,6 +564,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(SET_SIZE, mail_attachment_min_size),
 	DEF(SET_STR_VARS, mail_attribute_dict),
 	DEF(SET_UINT, mail_prefetch_count),
+	DEF(SET_UINT, mail_search_workers),
 	DEF(SET_STR, mail_cache_fields),
 	DEF(SET_STR, mail_always_cache_fields),
 	DEF(SET_STR, mail_never_cache_fields),
@@ -574,6 +579,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(SET_BOOL, dotlock_use_excl),
 	DEF(SET_BOOL, mail_nfs_storage),
 	DEF(SET_BOOL, mail_nfs_index),
+	DEF(SET_BOOL, mail_index_group_commit),
 	DEF(SET_BOOL, mailbox_list_index),
 	DEF(SET_BOOL, mail_debug),
 	DEF(SET_BOOL, mail_full_filesystem_access),
@@ -596,6 +602,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_attachment_min_size = 1024*128,
 	.mail_attribute_dict = "",
 	.mail_prefetch_count = 0,
+	.mail_search_workers = 1,
 	.mail_cache_fields = "flags",
 	.mail_always_cache_fields = "",
 	.mail_never_cache_fields = "imap.envelope",
@@ -610,6 +617,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.dotlock_use_excl = TRUE,
 	.mail_nfs_storage = FALSE,
 	.mail_nfs_index = FALSE,
+	.mail_index_group_commit = FALSE,
 	.mailbox_list_index = FALSE,
 	.mail_debug = FALSE,
 	.mail_full_filesystem_access = FALSE,
@@ -1037,13 +1045,17 @@ static const struct setting_define mdbox_setting_defines[] = {
 	DEF(SET_BOOL, mdbox_preallocate_space),
 	DEF(SET_SIZE, mdbox_rotate_size),
 	DEF(SET_TIME, mdbox_rotate_interval),
+	DEF(SET_UINT, mdbox_purge_workers),
+	DEF(SET_SIZE, mdbox_purge_max_io_rate),
 
 	SETTING_DEFINE_LIST_END
 };
 static const struct mdbox_settings mdbox_default_settings = {
 	.mdbox_preallocate_space = FALSE,
 	.mdbox_rotate_size = 2*1024*1024,
-	.mdbox_rotate_interval = 0
+	.mdbox_rotate_interval = 0,
+	.mdbox_purge_workers = 1,
+	.mdbox_purge_max_io_rate = 0
 };
 static const struct setting_parser_info mdbox_setting_parser_info = {
 	.module_name = "mdbox",
@@ -1329,6 +1341,8 @@ struct director_settings {
 	const char *director_username_hash;
 	unsigned int director_user_expire;
 	unsigned int director_doveadm_port;
+	bool director_consistent_hashing;
+	unsigned int director_host_load_factor;
 };
 /* ../../src/dict/dict-settings.h */
 extern const struct setting_parser_info dict_setting_parser_info;
@@ -1371,6 +1385,7 @@ struct auth_settings {
 	uoff_t cache_size;
 	unsigned int cache_ttl;
 	unsigned int cache_negative_ttl;
+	const char *cache_snapshot_path;
 	const char *username_chars;
 	const char *username_translation;
 	const char *username_format;
@@ -1389,6 +1404,7 @@ struct auth_settings {
 	bool use_winbind;
 
 	unsigned int worker_max_count;
+	unsigned int worker_max_pending;
 
 	/* settings that don't have auth_ prefix: */
 	ARRAY(struct auth_passdb_settings *) passdbs;
@@ -3412,6 +3428,17 @@ director_settings_verify(void *_set, pool_t pool ATTR_UNUSED, const char **error
 		*error_r = "director_user_expire is too low";
 		return FALSE;
 	}
+	if (set->director_host_load_factor != 0 &&
+	    set->director_host_load_factor < 100) {
+		*error_r = "director_host_load_factor must be 0 or at least 100";
+		return FALSE;
+	}
+	if (set->director_host_load_factor != 0 &&
+	    !set->director_consistent_hashing) {
+		*error_r = "director_host_load_factor requires "
+			"director_consistent_hashing=yes";
+		return FALSE;
+	}
 	return TRUE;
 }
 /* </settings checks> */
@@ -3454,6 +3481,8 @@ static const struct setting_define director_setting_defines[] = {
 	DEF(SET_STR, director_username_hash),
 	DEF(SET_TIME, director_user_expire),
 	DEF(SET_UINT, director_doveadm_port),
+	DEF(SET_BOOL, director_consistent_hashing),
+	DEF(SET_UINT, director_host_load_factor),
 
 	SETTING_DEFINE_LIST_END
 };
@@ -3464,7 +3493,9 @@ const struct director_settings director_default_settings = {
 	.director_mail_servers = "",
 	.director_username_hash = "%Lu",
 	.director_user_expire = 60*15,
-	.director_doveadm_port = 0
+	.director_doveadm_port = 0,
+	.director_consistent_hashing = FALSE,
+	.director_host_load_factor = 0
 };
 const struct setting_parser_info director_setting_parser_info = {
 	.module_name = "director",
@@ -3691,6 +3722,10 @@ static bool auth_settings_check(void *_set, pool_t pool,
 		*error_r = "auth_worker_max_count must be above zero";
 		return FALSE;
 	}
+	if (set->worker_max_pending == 0) {
+		*error_r = "auth_worker_max_pending must be above zero";
+		return FALSE;
+	}
 
 	if (set->cache_size > 0 && set->cache_size < 1024) {
 		/* probably a configuration error.
@@ -3911,6 +3946,7 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(SET_SIZE, cache_size),
 	DEF(SET_TIME, cache_ttl),
 	DEF(SET_TIME, cache_negative_ttl),
+	DEF(SET_STR, cache_snapshot_path),
 	DEF(SET_STR, username_chars),
 	DEF(SET_STR, username_translation),
 	DEF(SET_STR, username_format),
@@ -3931,6 +3967,7 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(SET_BOOL, use_winbind),
 
 	DEF(SET_UINT, worker_max_count),
+	DEF(SET_UINT, worker_max_pending),
 
 	DEFLIST(passdbs, "passdb", &auth_passdb_setting_parser_info),
 	DEFLIST(userdbs, "userdb", &auth_userdb_setting_parser_info),
@@ -3949,6 +3986,7 @@ static const struct auth_settings auth_default_settings = {
 	.cache_size = 0,
 	.cache_ttl = 60*60,
 	.cache_negative_ttl = 60*60,
+	.cache_snapshot_path = "",
 	.username_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234567890.-_@",
 	.username_translation = "",
 	.username_format = "%Lu",
@@ -3969,6 +4007,7 @@ static const struct auth_settings auth_default_settings = {
 	.use_winbind = FALSE,
 
 	.worker_max_count = 30,
+	.worker_max_pending = 8,
 
 	.passdbs = ARRAY_INIT,
 	.userdbs = ARRAY_INIT,
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "llist.h"
 #include "ostream.h"
 #include "str.h"
 #include "dict-client.h"
@@ -44,6 +45,66 @@ static int cmd_lookup(struct dict_connection *conn, const char *line)
 	return 0;
 }
 
+static void
+cmd_lookup_async_callback(const struct dict_lookup_result *result,
+			  struct dict_connection_lookup *lookup)
+{
+	struct dict_connection *conn = lookup->conn;
+	const char *reply;
+
+	if (conn == NULL) {
+		/* connection was already destroyed */
+		i_free(lookup);
+		return;
+	}
+	DLLIST_REMOVE(&conn->lookups, lookup);
+
+	if (result->ret > 0) {
+		reply = t_strdup_printf("%c%c%u\t%s\n",
+					DICT_PROTOCOL_REPLY_ASYNC_LOOKUP,
+					DICT_PROTOCOL_REPLY_OK, lookup->id,
+					result->value);
+	} else {
+		reply = t_strdup_printf("%c%c%u\n",
+					DICT_PROTOCOL_REPLY_ASYNC_LOOKUP,
+					result->ret == 0 ?
+					DICT_PROTOCOL_REPLY_NOTFOUND :
+					DICT_PROTOCOL_REPLY_FAIL, lookup->id);
+	}
+	o_stream_nsend_str(conn->output, reply);
+	i_free(lookup);
+}
+
+static int cmd_lookup_async(struct dict_connection *conn, const char *line)
+{
+	struct dict_connection_lookup *lookup;
+	const char *const *args;
+	unsigned int id;
+
+	if (conn->iter_ctx != NULL) {
+		i_error("dict client: LOOKUP: Can't lookup while iterating");
+		return -1;
+	}
+
+	/* <id> <key> */
+	args = t_strsplit_tab(line);
+	if (str_array_length(args) != 2 || str_to_uint(args[0], &id) < 0) {
+		i_error("dict client: LOOKUP: broken input");
+		return -1;
+	}
+
+	/* with async backends the reply is sent once the backend has
+	   answered, so the following commands are processed meanwhile.
+	   the reply contains the ID, so the order doesn't matter. */
+	lookup = i_new(struct dict_connection_lookup, 1);
+	lookup->conn = conn;
+	lookup->id = id;
+	DLLIST_PREPEND(&conn->lookups, lookup);
+	dict_lookup_async(conn->dict, args[1], cmd_lookup_async_callback,
+			  lookup);
+	return 0;
+}
+
 static int cmd_iterate_flush(struct dict_connection *conn)
 {
 	string_t *str;
@@ -349,6 +410,7 @@ static int cmd_atomic_inc(struct dict_connection *conn, const char *line)
 
 static struct dict_client_cmd cmds[] = {
 	{ DICT_PROTOCOL_CMD_LOOKUP, cmd_lookup },
+	{ DICT_PROTOCOL_CMD_LOOKUP_ASYNC, cmd_lookup_async },
 	{ DICT_PROTOCOL_CMD_ITERATE, cmd_iterate },
 	{ DICT_PROTOCOL_CMD_BEGIN, cmd_begin },
 	{ DICT_PROTOCOL_CMD_COMMIT, cmd_commit },
@@ -20,7 +20,7 @@ static struct dict_connection *dict_connections;
 static int dict_connection_parse_handshake(struct dict_connection *conn,
 					   const char *line)
 {
-	const char *username, *name, *value_type;
+	const char *username, *name, *value_type, *minor;
 
 	if (*line++ != DICT_PROTOCOL_CMD_HELLO)
 		return -1;
@@ -30,10 +30,13 @@ static int dict_connection_parse_handshake(struct dict_connection *conn,
 	    *line++ != '\t')
 		return -1;
 
-	/* skip minor version */
+	/* get minor version */
+	minor = line;
 	while (*line != '\t' && *line != '\0') line++;
 
-	if (*line++ != '\t')
+	if (*line++ != '\t' ||
+	    str_to_uint(t_strdup_until(minor, line - 1),
+			&conn->minor_version) < 0)
 		return -1;
 
 	/* get value type */
@@ -127,6 +130,14 @@ static void dict_connection_input(struct dict_connection *conn)
 			dict_connection_destroy(conn);
 			return;
 		}
+		if (conn->minor_version > 0) {
+			/* older clients don't expect a reply to the
+			   handshake */
+			o_stream_nsend_str(conn->output, t_strdup_printf(
+				"%c%u\t%u\n", DICT_PROTOCOL_CMD_HELLO,
+				DICT_CLIENT_PROTOCOL_MAJOR_VERSION,
+				DICT_CLIENT_PROTOCOL_MINOR_VERSION));
+		}
 	}
 
 	while ((line = i_stream_next_line(conn->input)) != NULL) {
@@ -158,9 +169,16 @@ struct dict_connection *dict_connection_create(int fd)
 void dict_connection_destroy(struct dict_connection *conn)
 {
 	struct dict_connection_transaction *transaction;
+	struct dict_connection_lookup *lookup;
 
 	DLLIST_REMOVE(&dict_connections, conn);
 
+	/* the lookups are freed by their callbacks, which are called at
+	   the latest by dict_deinit() */
+	for (lookup = conn->lookups; lookup != NULL; lookup = lookup->next)
+		lookup->conn = NULL;
+	conn->lookups = NULL;
+
 	if (array_is_created(&conn->transactions)) {
 		array_foreach_modifiable(&conn->transactions, transaction)
 			dict_transaction_rollback(&transaction->ctx);
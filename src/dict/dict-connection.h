@@ -9,6 +9,13 @@ struct dict_connection_transaction {
 	struct dict_transaction_context *ctx;
 };
 
+struct dict_connection_lookup {
+	struct dict_connection_lookup *prev, *next;
+	/* NULL if the connection was already destroyed */
+	struct dict_connection *conn;
+	unsigned int id;
+};
+
 struct dict_connection {
 	struct dict_connection *prev, *next;
 	struct dict_server *server;
@@ -17,6 +24,7 @@ struct dict_connection {
 	char *name;
 	struct dict *dict;
 	enum dict_data_type value_type;
+	unsigned int minor_version;
 
 	int fd;
 	struct io *io;
@@ -26,6 +34,9 @@ struct dict_connection {
 	struct dict_iterate_context *iter_ctx;
 	enum dict_iterate_flags iter_flags;
 
+	/* async lookups waiting for a reply from the dict backend */
+	struct dict_connection_lookup *lookups;
+
 	/* There are only a few transactions per client, so keeping them in
 	   array is fast enough */
 	ARRAY(struct dict_connection_transaction) transactions;
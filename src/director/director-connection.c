@@ -124,7 +124,6 @@ struct director_connection {
 	unsigned int synced:1;
 	unsigned int wrong_host:1;
 	unsigned int verifying_left:1;
-	unsigned int users_unsorted:1;
 };
 
 static void director_connection_disconnected(struct director_connection **conn);
@@ -584,10 +583,8 @@ director_handshake_cmd_user(struct director_connection *conn,
 
 	(void)director_user_refresh(conn, username_hash, host,
 				    timestamp, weak, &user);
-	if (user->timestamp < timestamp) {
-		conn->users_unsorted = TRUE;
-		user->timestamp = timestamp;
-	}
+	if (user->timestamp < timestamp)
+		user_directory_set_timestamp(conn->dir->users, user, timestamp);
 	return TRUE;
 }
 
@@ -982,12 +979,6 @@ static bool director_handshake_cmd_done(struct director_connection *conn)
 	unsigned int handshake_secs = time(NULL) - conn->created;
 	string_t *str;
 
-	if (conn->users_unsorted && conn->user_iter == NULL) {
-		/* we sent our user list before receiving remote's */
-		conn->users_unsorted = FALSE;
-		user_directory_sort(conn->dir->users);
-	}
-
 	if (handshake_secs >= DIRECTOR_HANDSHAKE_WARN_SECS || director_debug) {
 		str = t_str_new(128);
 		str_printfa(str, "director(%s): Handshake took %u secs, "
@@ -1498,12 +1489,6 @@ static int director_connection_send_users(struct director_connection *conn)
 	user_directory_iter_deinit(&conn->user_iter);
 	director_connection_send(conn, "DONE\n");
 
-	if (conn->users_unsorted && conn->handshake_received) {
-		/* we received remote's list of users before sending ours */
-		conn->users_unsorted = FALSE;
-		user_directory_sort(conn->dir->users);
-	}
-
 	ret = o_stream_flush(conn->output);
 	timeout_reset(conn->to_ping);
 	return ret;
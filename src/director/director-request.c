@@ -279,8 +279,8 @@ bool director_request_continue(struct director_request *request)
 				  request->username_hash);
 			return FALSE;
 		}
-		host = mail_host_get_by_hash(dir->mail_hosts,
-					     request->username_hash);
+		host = mail_host_get_by_hash_bounded(dir->mail_hosts,
+						     request->username_hash);
 		if (host == NULL) {
 			/* all hosts have been removed */
 			request->delay_reason = REQUEST_DELAY_NOHOSTS;
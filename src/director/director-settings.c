@@ -73,6 +73,8 @@ static const struct setting_define director_setting_defines[] = {
 	DEF(SET_STR, director_username_hash),
 	DEF(SET_TIME, director_user_expire),
 	DEF(SET_UINT, director_doveadm_port),
+	DEF(SET_BOOL, director_consistent_hashing),
+	DEF(SET_UINT, director_host_load_factor),
 
 	SETTING_DEFINE_LIST_END
 };
@@ -84,7 +86,9 @@ const struct director_settings director_default_settings = {
 	.director_mail_servers = "",
 	.director_username_hash = "%Lu",
 	.director_user_expire = 60*15,
-	.director_doveadm_port = 0
+	.director_doveadm_port = 0,
+	.director_consistent_hashing = FALSE,
+	.director_host_load_factor = 0
 };
 
 const struct setting_parser_info director_setting_parser_info = {
@@ -110,6 +114,17 @@ director_settings_verify(void *_set, pool_t pool ATTR_UNUSED, const char **error
 		*error_r = "director_user_expire is too low";
 		return FALSE;
 	}
+	if (set->director_host_load_factor != 0 &&
+	    set->director_host_load_factor < 100) {
+		*error_r = "director_host_load_factor must be 0 or at least 100";
+		return FALSE;
+	}
+	if (set->director_host_load_factor != 0 &&
+	    !set->director_consistent_hashing) {
+		*error_r = "director_host_load_factor requires "
+			"director_consistent_hashing=yes";
+		return FALSE;
+	}
 	return TRUE;
 }
 /* </settings checks> */
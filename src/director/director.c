@@ -709,7 +709,7 @@ void director_move_user(struct director *dir, struct director_host *src,
 		user->host->user_count--;
 		user->host = host;
 		user->host->user_count++;
-		user->timestamp = ioloop_time;
+		user_directory_refresh(dir->users, user);
 	}
 	if (user->kill_state == USER_KILL_STATE_NONE) {
 		ctx = i_new(struct director_kill_context, 1);
@@ -841,6 +841,9 @@ director_init(const struct director_settings *set,
 	dir->users = user_directory_init(set->director_user_expire,
 					 set->director_username_hash);
 	dir->mail_hosts = mail_hosts_init();
+	mail_hosts_set_consistent_hashing(dir->mail_hosts,
+					  set->director_consistent_hashing,
+					  set->director_host_load_factor);
 
 	dir->ipc_proxy = ipc_client_init(DIRECTOR_IPC_PROXY_PATH);
 	dir->ring_min_version = DIRECTOR_VERSION_MINOR;
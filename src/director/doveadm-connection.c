@@ -63,6 +63,9 @@ static void doveadm_cmd_host_list_removed(struct doveadm_connection *conn)
 	int ret;
 
 	orig_hosts_list = mail_hosts_init();
+	mail_hosts_set_consistent_hashing(orig_hosts_list,
+		conn->dir->set->director_consistent_hashing,
+		conn->dir->set->director_host_load_factor);
 	(void)mail_hosts_parse_and_add(orig_hosts_list,
 				       conn->dir->set->director_mail_servers);
 
@@ -234,6 +237,71 @@ doveadm_cmd_host_remove(struct doveadm_connection *conn, const char *line)
 	return TRUE;
 }
 
+static bool
+doveadm_cmd_host_simulate(struct doveadm_connection *conn, const char *line)
+{
+	struct director *dir = conn->dir;
+	const char *const *args;
+	struct mail_host_list *sim_hosts;
+	struct mail_host *host, *old_host, *new_host;
+	struct user_directory_iter *iter;
+	struct user *user;
+	struct ip_addr ip;
+	unsigned int vhost_count = UINT_MAX, moved = 0, total = 0;
+	bool remove;
+
+	/* HOST-SIMULATE set|remove <ip> [<vhost count>]: report how many
+	   of the currently known users would hash to a different host */
+	args = t_strsplit_tab(line);
+	if (str_array_length(args) < 2 ||
+	    (strcmp(args[0], "set") != 0 && strcmp(args[0], "remove") != 0) ||
+	    net_addr2ip(args[1], &ip) < 0 ||
+	    (args[2] != NULL && str_to_uint(args[2], &vhost_count) < 0)) {
+		i_error("doveadm sent invalid HOST-SIMULATE parameters: %s",
+			line);
+		return FALSE;
+	}
+	remove = strcmp(args[0], "remove") == 0;
+	if (vhost_count > MAX_VALID_VHOST_COUNT && vhost_count != UINT_MAX) {
+		o_stream_nsend_str(conn->output, "vhost count too large\n");
+		return TRUE;
+	}
+
+	sim_hosts = mail_hosts_dup(dir->mail_hosts);
+	host = mail_host_lookup(sim_hosts, &ip);
+	if (remove) {
+		if (host == NULL) {
+			mail_hosts_deinit(&sim_hosts);
+			o_stream_nsend_str(conn->output, "NOTFOUND\n");
+			return TRUE;
+		}
+		mail_host_remove(sim_hosts, host);
+	} else {
+		if (host == NULL)
+			host = mail_host_add_ip(sim_hosts, &ip);
+		if (vhost_count != UINT_MAX)
+			mail_host_set_vhost_count(sim_hosts, host, vhost_count);
+	}
+
+	iter = user_directory_iter_init(dir->users);
+	while ((user = user_directory_iter_next(iter)) != NULL) {
+		old_host = mail_host_get_by_hash(dir->mail_hosts,
+						 user->username_hash);
+		new_host = mail_host_get_by_hash(sim_hosts,
+						 user->username_hash);
+		if (old_host == NULL || new_host == NULL ||
+		    !net_ip_compare(&old_host->ip, &new_host->ip))
+			moved++;
+		total++;
+	}
+	user_directory_iter_deinit(&iter);
+	mail_hosts_deinit(&sim_hosts);
+
+	o_stream_nsend_str(conn->output,
+			   t_strdup_printf("%u\t%u\n", moved, total));
+	return TRUE;
+}
+
 static void
 doveadm_cmd_host_flush_all(struct doveadm_connection *conn)
 {
@@ -426,6 +494,8 @@ static void doveadm_connection_input(struct doveadm_connection *conn)
 			ret = doveadm_cmd_host_set(conn, args);
 		else if (strcmp(cmd, "HOST-REMOVE") == 0)
 			ret = doveadm_cmd_host_remove(conn, args);
+		else if (strcmp(cmd, "HOST-SIMULATE") == 0)
+			ret = doveadm_cmd_host_simulate(conn, args);
 		else if (strcmp(cmd, "HOST-FLUSH") == 0)
 			ret = doveadm_cmd_host_flush(conn, args);
 		else if (strcmp(cmd, "USER-LOOKUP") == 0)
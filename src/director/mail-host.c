@@ -2,14 +2,24 @@
 
 #include "lib.h"
 #include "array.h"
+#include "md5.h"
 #include "mail-host.h"
 
 #define VHOST_MULTIPLIER 100
 
+struct mail_vhost {
+	unsigned int point;
+	struct mail_host *host;
+};
+
 struct mail_host_list {
 	ARRAY_TYPE(mail_host) hosts;
-	ARRAY(struct mail_host *) vhosts;
+	/* consistent hash ring sorted by point, or with consistent_hashing
+	   disabled each host repeated vhost_count times */
+	ARRAY(struct mail_vhost) vhosts;
+	unsigned int load_factor;
 	bool hosts_unsorted;
+	bool consistent_hashing;
 };
 
 static int
@@ -18,18 +28,59 @@ mail_host_cmp(struct mail_host *const *h1, struct mail_host *const *h2)
 	return net_ip_cmp(&(*h1)->ip, &(*h2)->ip);
 }
 
+static int
+mail_vhost_cmp(const struct mail_vhost *v1, const struct mail_vhost *v2)
+{
+	if (v1->point < v2->point)
+		return -1;
+	if (v1->point > v2->point)
+		return 1;
+	/* point collision - keep the order same in all directors */
+	return net_ip_cmp(&v1->host->ip, &v2->host->ip);
+}
+
+static void mail_vhosts_add(struct mail_host_list *list,
+			    struct mail_host *host)
+{
+	struct mail_vhost *vhost;
+	unsigned char digest[MD5_RESULTLEN];
+	const char *ip_str = net_ip2addr(&host->ip);
+	unsigned int i;
+
+	/* the points depend only on the host's IP, so adding or removing a
+	   host moves only the users between it and its neighbours */
+	for (i = 0; i < host->vhost_count; i++) T_BEGIN {
+		const char *str = t_strdup_printf("%s-%u", ip_str, i);
+
+		md5_get_digest(str, strlen(str), digest);
+		vhost = array_append_space(&list->vhosts);
+		vhost->point = (digest[0] << 24) | (digest[1] << 16) |
+			(digest[2] << 8) | digest[3];
+		vhost->host = host;
+	} T_END;
+}
+
 static void mail_hosts_sort(struct mail_host_list *list)
 {
 	struct mail_host *const *hostp;
+	struct mail_vhost *vhost;
 	unsigned int i;
 
 	array_sort(&list->hosts, mail_host_cmp);
 
 	/* rebuild vhosts */
 	array_clear(&list->vhosts);
-	array_foreach(&list->hosts, hostp) {
-		for (i = 0; i < (*hostp)->vhost_count; i++)
-			array_append(&list->vhosts, hostp, 1);
+	if (list->consistent_hashing) {
+		array_foreach(&list->hosts, hostp)
+			mail_vhosts_add(list, *hostp);
+		array_sort(&list->vhosts, mail_vhost_cmp);
+	} else {
+		array_foreach(&list->hosts, hostp) {
+			for (i = 0; i < (*hostp)->vhost_count; i++) {
+				vhost = array_append_space(&list->vhosts);
+				vhost->host = *hostp;
+			}
+		}
 	}
 	list->hosts_unsorted = FALSE;
 }
@@ -205,10 +256,44 @@ mail_host_lookup(struct mail_host_list *list, const struct ip_addr *ip)
 	return NULL;
 }
 
-struct mail_host *
-mail_host_get_by_hash(struct mail_host_list *list, unsigned int hash)
+static unsigned int
+mail_vhosts_find(const struct mail_vhost *vhosts, unsigned int count,
+		 unsigned int hash)
 {
-	struct mail_host *const *vhosts;
+	unsigned int idx, left_idx, right_idx;
+
+	/* find the first point >= hash, wrapping to the beginning */
+	left_idx = 0; right_idx = count;
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (vhosts[idx].point < hash)
+			left_idx = idx + 1;
+		else
+			right_idx = idx;
+	}
+	return left_idx == count ? 0 : left_idx;
+}
+
+static bool
+mail_host_is_full(struct mail_host_list *list, struct mail_host *host,
+		  unsigned int total_users, unsigned int total_vhosts)
+{
+	uint64_t max_users;
+
+	/* the host's share of users by its vhost_count, plus the allowed
+	   load_factor-% overflow. rounded up so there's always room. */
+	max_users = (uint64_t)(total_users + 1) * host->vhost_count *
+		list->load_factor;
+	max_users = (max_users + (uint64_t)total_vhosts * 100 - 1) /
+		((uint64_t)total_vhosts * 100);
+	return host->user_count >= max_users;
+}
+
+static const struct mail_vhost *
+mail_host_get_vhosts(struct mail_host_list *list, unsigned int hash,
+		     unsigned int *idx_r, unsigned int *count_r)
+{
+	const struct mail_vhost *vhosts;
 	unsigned int count;
 
 	if (list->hosts_unsorted)
@@ -217,8 +302,56 @@ mail_host_get_by_hash(struct mail_host_list *list, unsigned int hash)
 	vhosts = array_get(&list->vhosts, &count);
 	if (count == 0)
 		return NULL;
+	*idx_r = !list->consistent_hashing ? hash % count :
+		mail_vhosts_find(vhosts, count, hash);
+	*count_r = count;
+	return vhosts;
+}
+
+struct mail_host *
+mail_host_get_by_hash(struct mail_host_list *list, unsigned int hash)
+{
+	const struct mail_vhost *vhosts;
+	unsigned int idx, count;
+
+	vhosts = mail_host_get_vhosts(list, hash, &idx, &count);
+	return vhosts == NULL ? NULL : vhosts[idx].host;
+}
 
-	return vhosts[hash % count];
+struct mail_host *
+mail_host_get_by_hash_bounded(struct mail_host_list *list, unsigned int hash)
+{
+	const struct mail_vhost *vhosts;
+	struct mail_host *const *hostp;
+	unsigned int i, idx, start_idx, count, total_users = 0;
+
+	vhosts = mail_host_get_vhosts(list, hash, &idx, &count);
+	if (vhosts == NULL)
+		return NULL;
+	start_idx = idx;
+	if (list->load_factor == 0 || !list->consistent_hashing)
+		return vhosts[idx].host;
+
+	/* bounded loads: walk the ring clockwise past hosts that already
+	   have too many users */
+	array_foreach(&list->hosts, hostp)
+		total_users += (*hostp)->user_count;
+	for (i = 0; i < count; i++) {
+		if (!mail_host_is_full(list, vhosts[idx].host,
+				       total_users, count))
+			return vhosts[idx].host;
+		idx = (idx + 1) % count;
+	}
+	return vhosts[start_idx].host;
+}
+
+void mail_hosts_set_consistent_hashing(struct mail_host_list *list,
+				       bool consistent_hashing,
+				       unsigned int load_factor)
+{
+	list->consistent_hashing = consistent_hashing;
+	list->load_factor = load_factor;
+	list->hosts_unsorted = TRUE;
 }
 
 const ARRAY_TYPE(mail_host) *mail_hosts_get(struct mail_host_list *list)
@@ -267,6 +400,8 @@ struct mail_host_list *mail_hosts_dup(const struct mail_host_list *src)
 	struct mail_host *const *hostp, *dest_host;
 
 	dest = mail_hosts_init();
+	dest->consistent_hashing = src->consistent_hashing;
+	dest->load_factor = src->load_factor;
 	array_foreach(&src->hosts, hostp) {
 		dest_host = mail_host_dup(*hostp);
 		array_append(&dest->hosts, &dest_host, 1);
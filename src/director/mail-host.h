@@ -17,8 +17,21 @@ struct mail_host *
 mail_host_add_ip(struct mail_host_list *list, const struct ip_addr *ip);
 struct mail_host *
 mail_host_lookup(struct mail_host_list *list, const struct ip_addr *ip);
+/* Returns the host for the username hash, or NULL if there are no hosts
+   with vhost_count > 0. */
 struct mail_host *
 mail_host_get_by_hash(struct mail_host_list *list, unsigned int hash);
+/* Same as mail_host_get_by_hash(), but with a load_factor skip the hosts
+   that already have too many users. Use this for assigning new users. */
+struct mail_host *
+mail_host_get_by_hash_bounded(struct mail_host_list *list, unsigned int hash);
+/* Use a consistent hash ring for mapping username hashes to hosts instead of
+   hash modulo vhosts. All directors must use the same setting. load_factor
+   skips hosts that already have more than load_factor-% of their fair share
+   of users (e.g. 125). 0 disables the bound. */
+void mail_hosts_set_consistent_hashing(struct mail_host_list *list,
+				       bool consistent_hashing,
+				       unsigned int load_factor);
 
 int mail_hosts_parse_and_add(struct mail_host_list *list,
 			     const char *hosts_string);
@@ -0,0 +1,156 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "mail-host.h"
+#include "test-common.h"
+
+#include <stdlib.h>
+
+#define TEST_HOST_COUNT 10
+#define TEST_HASH_COUNT 10000
+
+static struct mail_host *
+test_host_add(struct mail_host_list *list, unsigned int n)
+{
+	struct ip_addr ip;
+
+	if (net_addr2ip(t_strdup_printf("10.0.0.%u", n), &ip) < 0)
+		i_unreached();
+	return mail_host_add_ip(list, &ip);
+}
+
+static unsigned int test_hash(unsigned int i)
+{
+	/* spread the hashes over the whole 32bit space */
+	return i * 2654435761U;
+}
+
+static void test_mail_host_modulo(void)
+{
+	struct mail_host_list *list;
+	struct mail_host *host1, *host2;
+
+	test_begin("mail host modulo");
+	list = mail_hosts_init();
+	host2 = test_host_add(list, 2);
+	host1 = test_host_add(list, 1);
+	/* without consistent hashing the hosts are repeated vhost_count
+	   times in IP order */
+	test_assert(mail_host_get_by_hash(list, 0) == host1);
+	test_assert(mail_host_get_by_hash(list, 99) == host1);
+	test_assert(mail_host_get_by_hash(list, 100) == host2);
+	test_assert(mail_host_get_by_hash(list, 200) == host1);
+	mail_host_set_vhost_count(list, host1, 1);
+	test_assert(mail_host_get_by_hash(list, 0) == host1);
+	test_assert(mail_host_get_by_hash(list, 1) == host2);
+	test_assert(mail_host_get_by_hash_bounded(list, 101) == host1);
+	mail_hosts_deinit(&list);
+	test_end();
+}
+
+static void test_mail_host_ring_add_remove(void)
+{
+	struct mail_host_list *list;
+	struct mail_host *orig[TEST_HASH_COUNT], *new_host, *host;
+	unsigned int i, moved;
+
+	test_begin("mail host ring add/remove");
+	list = mail_hosts_init();
+	mail_hosts_set_consistent_hashing(list, TRUE, 0);
+	for (i = 1; i <= TEST_HOST_COUNT; i++)
+		(void)test_host_add(list, i);
+	for (i = 0; i < TEST_HASH_COUNT; i++)
+		orig[i] = mail_host_get_by_hash(list, test_hash(i));
+
+	/* adding a host moves users only to it, and only about 1/N */
+	new_host = test_host_add(list, TEST_HOST_COUNT + 1);
+	moved = 0;
+	for (i = 0; i < TEST_HASH_COUNT; i++) {
+		host = mail_host_get_by_hash(list, test_hash(i));
+		if (host != orig[i]) {
+			test_assert(host == new_host);
+			moved++;
+		}
+	}
+	test_assert(moved > 0 && moved < TEST_HASH_COUNT * 2 / TEST_HOST_COUNT);
+
+	/* removing it again moves the same users back */
+	mail_host_remove(list, new_host);
+	for (i = 0; i < TEST_HASH_COUNT; i++)
+		test_assert(mail_host_get_by_hash(list, test_hash(i)) == orig[i]);
+
+	/* removing an existing host moves only its own users */
+	host = orig[0];
+	mail_host_remove(list, host);
+	for (i = 0; i < TEST_HASH_COUNT; i++) {
+		new_host = mail_host_get_by_hash(list, test_hash(i));
+		test_assert(new_host != host);
+		if (orig[i] != host)
+			test_assert(new_host == orig[i]);
+	}
+	mail_hosts_deinit(&list);
+	test_end();
+}
+
+static void test_mail_host_ring_vhost_count(void)
+{
+	struct mail_host_list *list;
+	struct mail_host *host1, *host2;
+	unsigned int i;
+
+	test_begin("mail host ring vhost count");
+	list = mail_hosts_init();
+	mail_hosts_set_consistent_hashing(list, TRUE, 0);
+	host1 = test_host_add(list, 1);
+	host2 = test_host_add(list, 2);
+	mail_host_set_vhost_count(list, host1, 0);
+	for (i = 0; i < 100; i++)
+		test_assert(mail_host_get_by_hash(list, test_hash(i)) == host2);
+	mail_host_set_vhost_count(list, host2, 0);
+	test_assert(mail_host_get_by_hash(list, 0) == NULL);
+	mail_hosts_deinit(&list);
+	test_end();
+}
+
+static void test_mail_host_ring_bounded_load(void)
+{
+	struct mail_host_list *list;
+	struct mail_host *hosts[TEST_HOST_COUNT], *host;
+	unsigned int i;
+
+	test_begin("mail host ring bounded load");
+	list = mail_hosts_init();
+	mail_hosts_set_consistent_hashing(list, TRUE, 125);
+	for (i = 0; i < TEST_HOST_COUNT; i++)
+		hosts[i] = test_host_add(list, i + 1);
+
+	/* assign users one by one, the way the director would */
+	for (i = 0; i < TEST_HASH_COUNT; i++) {
+		host = mail_host_get_by_hash_bounded(list, test_hash(i));
+		host->user_count++;
+	}
+	for (i = 0; i < TEST_HOST_COUNT; i++) {
+		test_assert(hosts[i]->user_count <=
+			    TEST_HASH_COUNT / TEST_HOST_COUNT * 125 / 100 + 1);
+	}
+
+	/* a full host is skipped, but it's still the ring position */
+	host = mail_host_get_by_hash_bounded(list, 0);
+	host->user_count += TEST_HASH_COUNT;
+	test_assert(mail_host_get_by_hash_bounded(list, 0) != host);
+	test_assert(mail_host_get_by_hash(list, 0) == host);
+	mail_hosts_deinit(&list);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_mail_host_modulo,
+		test_mail_host_ring_add_remove,
+		test_mail_host_ring_vhost_count,
+		test_mail_host_ring_bounded_load,
+		NULL
+	};
+	return test_run(test_functions);
+}
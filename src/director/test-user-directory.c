@@ -91,12 +91,46 @@ static void test_user_directory_random(void)
 	test_end();
 }
 
+static void test_user_directory_lookup(void)
+{
+	const unsigned int count = 10000;
+	struct user_directory *dir;
+	struct mail_host *host1 = t_new(struct mail_host, 1);
+	struct mail_host *host2 = t_new(struct mail_host, 1);
+	struct user *user;
+	unsigned int i;
+
+	test_begin("user directory lookup");
+	dir = user_directory_init(USER_DIR_TIMEOUT, "%u");
+	/* colliding low bits to exercise the probing */
+	for (i = 0; i < count; i++) {
+		(void)user_directory_add(dir, i << 16, i % 2 == 0 ? host1 : host2,
+					 ioloop_time - rand()%100);
+	}
+	user = user_directory_lookup(dir, 2 << 16);
+	test_assert(user != NULL && user->host == host1);
+	user_directory_set_timestamp(dir, user, ioloop_time - 1000);
+	test_assert(user->timestamp == ioloop_time - 1000);
+	verify_user_directory(dir, count);
+
+	user_directory_remove_host(dir, host1);
+	test_assert(host1->user_count == 0 && host2->user_count == count/2);
+	verify_user_directory(dir, count/2);
+	for (i = 0; i < count; i++) {
+		user = user_directory_lookup(dir, i << 16);
+		test_assert((user != NULL) == (i % 2 != 0));
+	}
+	user_directory_deinit(&dir);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*test_functions[])(void) = {
 		test_user_directory_ascending,
 		test_user_directory_descending,
 		test_user_directory_random,
+		test_user_directory_lookup,
 		NULL
 	};
 	ioloop_time = 1234567890;
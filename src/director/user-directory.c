@@ -3,7 +3,6 @@
 #include "lib.h"
 #include "ioloop.h"
 #include "array.h"
-#include "hash.h"
 #include "llist.h"
 #include "mail-user-hash.h"
 #include "mail-host.h"
@@ -15,17 +14,37 @@
 #define USER_NEAR_EXPIRING_MIN 3
 #define USER_NEAR_EXPIRING_MAX 30
 
+/* users are allocated in chunks of this many */
+#define USER_DIRECTORY_CHUNK_COUNT 1024
+#define USER_DIRECTORY_INITIAL_TABLE_SIZE 1024
+/* max. seconds indexed by the timestamp wheel */
+#define USER_DIRECTORY_MAX_WHEEL_SIZE 65536
+
 struct user_directory_iter {
 	struct user_directory *dir;
 	struct user *pos;
 };
 
 struct user_directory {
-	/* unsigned int username_hash => user */
-	HASH_TABLE(void *, struct user *) hash;
+	/* open addressing table of username_hash => user, with linear
+	   probing. username_hash is already MD5-based, so it's used directly
+	   as the table index. */
+	struct user **table;
+	unsigned int table_size, table_count;
+
 	/* sorted by time */
 	struct user *head, *tail;
-	struct user *prev_insert_pos;
+	/* timestamp % wheel_size => the last user in the list with that
+	   timestamp. Only valid for users whose timestamp is less than
+	   wheel_size seconds older than tail's, so out of order timestamps
+	   can be inserted without walking through the list. */
+	struct user **wheel;
+	unsigned int wheel_size;
+
+	/* all users are allocated from these. unused ones are in
+	   free_users list, linked via next. */
+	ARRAY(struct user *) user_chunks;
+	struct user *free_users;
 
 	ARRAY(struct user_directory_iter *) iters;
 
@@ -36,6 +55,96 @@ struct user_directory {
 	unsigned int user_near_expiring_secs;
 };
 
+static struct user **
+user_directory_table_find(struct user_directory *dir,
+			  unsigned int username_hash)
+{
+	unsigned int idx, mask = dir->table_size - 1;
+
+	for (idx = username_hash & mask;; idx = (idx + 1) & mask) {
+		if (dir->table[idx] == NULL ||
+		    dir->table[idx]->username_hash == username_hash)
+			return &dir->table[idx];
+	}
+}
+
+static void user_directory_table_grow(struct user_directory *dir)
+{
+	struct user **old_table = dir->table;
+	unsigned int i, old_size = dir->table_size;
+
+	dir->table_size *= 2;
+	dir->table = i_new(struct user *, dir->table_size);
+	for (i = 0; i < old_size; i++) {
+		if (old_table[i] != NULL) {
+			*user_directory_table_find(dir,
+				old_table[i]->username_hash) = old_table[i];
+		}
+	}
+	i_free(old_table);
+}
+
+static void user_directory_table_insert(struct user_directory *dir,
+					struct user *user)
+{
+	struct user **userp;
+
+	if ((dir->table_count + 1) * 4 > dir->table_size * 3)
+		user_directory_table_grow(dir);
+
+	userp = user_directory_table_find(dir, user->username_hash);
+	i_assert(*userp == NULL);
+	*userp = user;
+	dir->table_count++;
+}
+
+static void user_directory_table_remove(struct user_directory *dir,
+					struct user *user)
+{
+	unsigned int i, j, k, mask = dir->table_size - 1;
+
+	i = user_directory_table_find(dir, user->username_hash) - dir->table;
+	i_assert(dir->table[i] == user);
+
+	/* shift back the following entries that would no longer be
+	   found after the hole */
+	for (j = (i + 1) & mask; dir->table[j] != NULL; j = (j + 1) & mask) {
+		k = dir->table[j]->username_hash & mask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		dir->table[i] = dir->table[j];
+		i = j;
+	}
+	dir->table[i] = NULL;
+	dir->table_count--;
+}
+
+static struct user *user_alloc(struct user_directory *dir)
+{
+	struct user *user, *chunk;
+	unsigned int i;
+
+	if (dir->free_users == NULL) {
+		chunk = i_new(struct user, USER_DIRECTORY_CHUNK_COUNT);
+		array_append(&dir->user_chunks, &chunk, 1);
+		for (i = USER_DIRECTORY_CHUNK_COUNT; i > 0; i--) {
+			chunk[i-1].next = dir->free_users;
+			dir->free_users = &chunk[i-1];
+		}
+	}
+	user = dir->free_users;
+	dir->free_users = user->next;
+	memset(user, 0, sizeof(*user));
+	return user;
+}
+
+static bool
+user_directory_wheel_covers(struct user_directory *dir, unsigned int timestamp)
+{
+	return dir->tail != NULL &&
+		(uint64_t)timestamp + dir->wheel_size > dir->tail->timestamp;
+}
+
 static void user_move_iters(struct user_directory *dir, struct user *user)
 {
 	struct user_directory_iter *const *iterp;
@@ -44,9 +153,69 @@ static void user_move_iters(struct user_directory *dir, struct user *user)
 		if ((*iterp)->pos == user)
 			(*iterp)->pos = user->next;
 	}
+}
+
+static void user_list_remove(struct user_directory *dir, struct user *user)
+{
+	struct user **wheelp = &dir->wheel[user->timestamp % dir->wheel_size];
 
-	if (dir->prev_insert_pos == user)
-		dir->prev_insert_pos = user->next;
+	if (*wheelp == user) {
+		*wheelp = user->prev != NULL &&
+			user->prev->timestamp == user->timestamp ?
+			user->prev : NULL;
+	}
+	DLLIST2_REMOVE(&dir->head, &dir->tail, user);
+}
+
+static void user_list_insert(struct user_directory *dir, struct user *user)
+{
+	struct user *pos = NULL, *wpos;
+	unsigned int ts = user->timestamp, min_ts;
+
+	if (dir->tail == NULL || dir->tail->timestamp <= ts) {
+		DLLIST2_APPEND(&dir->head, &dir->tail, user);
+		dir->wheel[ts % dir->wheel_size] = user;
+		return;
+	}
+	if (ts < dir->head->timestamp) {
+		DLLIST2_PREPEND(&dir->head, &dir->tail, user);
+		if (user_directory_wheel_covers(dir, ts))
+			dir->wheel[ts % dir->wheel_size] = user;
+		return;
+	}
+
+	/* find the closest earlier timestamp from the wheel. this normally
+	   happens only while importing users during handshake. */
+	min_ts = dir->head->timestamp;
+	if (dir->tail->timestamp >= dir->wheel_size &&
+	    min_ts <= dir->tail->timestamp - dir->wheel_size)
+		min_ts = dir->tail->timestamp - dir->wheel_size + 1;
+	for (; ts >= min_ts; ts--) {
+		wpos = dir->wheel[ts % dir->wheel_size];
+		if (wpos != NULL && wpos->timestamp == ts) {
+			pos = wpos;
+			break;
+		}
+		if (ts == 0)
+			break;
+	}
+	ts = user->timestamp;
+	if (pos == NULL)
+		pos = dir->head;
+	/* the wheel position is normally already the last user <= ts,
+	   but if it wasn't indexed walk forward */
+	while (pos->next != NULL && pos->next->timestamp <= ts)
+		pos = pos->next;
+
+	user->prev = pos;
+	user->next = pos->next;
+	pos->next = user;
+	if (user->next != NULL)
+		user->next->prev = user;
+	else
+		dir->tail = user;
+	if (user_directory_wheel_covers(dir, ts))
+		dir->wheel[ts % dir->wheel_size] = user;
 }
 
 static void user_free(struct user_directory *dir, struct user *user)
@@ -56,9 +225,10 @@ static void user_free(struct user_directory *dir, struct user *user)
 
 	user_move_iters(dir, user);
 
-	hash_table_remove(dir->hash, POINTER_CAST(user->username_hash));
-	DLLIST2_REMOVE(&dir->head, &dir->tail, user);
-	i_free(user);
+	user_directory_table_remove(dir, user);
+	user_list_remove(dir, user);
+	user->next = dir->free_users;
+	dir->free_users = user;
 }
 
 static bool user_directory_user_has_connections(struct user_directory *dir,
@@ -97,7 +267,7 @@ struct user *user_directory_lookup(struct user_directory *dir,
 	struct user *user;
 
 	user_directory_drop_expired(dir);
-	user = hash_table_lookup(dir->hash, POINTER_CAST(username_hash));
+	user = *user_directory_table_find(dir, username_hash);
 	if (user != NULL && !user_directory_user_has_connections(dir, user)) {
 		user_free(dir, user);
 		user = NULL;
@@ -105,48 +275,6 @@ struct user *user_directory_lookup(struct user_directory *dir,
 	return user;
 }
 
-static void
-user_directory_insert_backwards(struct user_directory *dir,
-				struct user *pos, struct user *user)
-{
-	for (; pos != NULL; pos = pos->prev) {
-		if (pos->timestamp <= user->timestamp)
-			break;
-	}
-	if (pos == NULL)
-		DLLIST2_PREPEND(&dir->head, &dir->tail, user);
-	else {
-		user->prev = pos;
-		user->next = pos->next;
-		user->prev->next = user;
-		if (user->next != NULL)
-			user->next->prev = user;
-		else
-			dir->tail = user;
-	}
-}
-
-static void
-user_directory_insert_forwards(struct user_directory *dir,
-			       struct user *pos, struct user *user)
-{
-	for (; pos != NULL; pos = pos->next) {
-		if (pos->timestamp >= user->timestamp)
-			break;
-	}
-	if (pos == NULL)
-		DLLIST2_APPEND(&dir->head, &dir->tail, user);
-	else {
-		user->prev = pos->prev;
-		user->next = pos;
-		if (user->prev != NULL)
-			user->prev->next = user;
-		else
-			dir->head = user;
-		user->next->prev = user;
-	}
-}
-
 struct user *
 user_directory_add(struct user_directory *dir, unsigned int username_hash,
 		   struct mail_host *host, time_t timestamp)
@@ -157,44 +285,32 @@ user_directory_add(struct user_directory *dir, unsigned int username_hash,
 	if (timestamp > ioloop_time)
 		timestamp = ioloop_time;
 
-	user = i_new(struct user, 1);
+	user = user_alloc(dir);
 	user->username_hash = username_hash;
 	user->host = host;
 	user->host->user_count++;
 	user->timestamp = timestamp;
 
-	if (dir->tail == NULL || (time_t)dir->tail->timestamp <= timestamp)
-		DLLIST2_APPEND(&dir->head, &dir->tail, user);
-	else {
-		/* need to insert to correct position. we should get here
-		   only when handshaking. the handshaking USER requests should
-		   come sorted by timestamp. so keep track of the previous
-		   insert position, the next USER should be inserted after
-		   it. */
-		if (dir->prev_insert_pos == NULL) {
-			/* find the position starting from tail */
-			user_directory_insert_backwards(dir, dir->tail, user);
-		} else if (timestamp < (time_t)dir->prev_insert_pos->timestamp) {
-			user_directory_insert_backwards(dir, dir->prev_insert_pos,
-							user);
-		} else {
-			user_directory_insert_forwards(dir, dir->prev_insert_pos,
-						       user);
-		}
-	}
-
-	dir->prev_insert_pos = user;
-	hash_table_insert(dir->hash, POINTER_CAST(user->username_hash), user);
+	user_list_insert(dir, user);
+	user_directory_table_insert(dir, user);
 	return user;
 }
 
 void user_directory_refresh(struct user_directory *dir, struct user *user)
 {
-	user_move_iters(dir, user);
+	user_directory_set_timestamp(dir, user, ioloop_time);
+}
 
-	user->timestamp = ioloop_time;
-	DLLIST2_REMOVE(&dir->head, &dir->tail, user);
-	DLLIST2_APPEND(&dir->head, &dir->tail, user);
+void user_directory_set_timestamp(struct user_directory *dir,
+				  struct user *user, time_t timestamp)
+{
+	if (timestamp > ioloop_time)
+		timestamp = ioloop_time;
+
+	user_move_iters(dir, user);
+	user_list_remove(dir, user);
+	user->timestamp = timestamp;
+	user_list_insert(dir, user);
 }
 
 void user_directory_remove_host(struct user_directory *dir,
@@ -210,44 +326,6 @@ void user_directory_remove_host(struct user_directory *dir,
 	}
 }
 
-static int user_timestamp_cmp(struct user *const *user1,
-			      struct user *const *user2)
-{
-	if ((*user1)->timestamp < (*user2)->timestamp)
-		return -1;
-	if ((*user1)->timestamp > (*user2)->timestamp)
-		return 1;
-	return 0;
-}
-
-void user_directory_sort(struct user_directory *dir)
-{
-	ARRAY(struct user *) users;
-	struct user *user, *const *userp;
-	unsigned int i, users_count = hash_table_count(dir->hash);
-
-	if (users_count == 0) {
-		i_assert(dir->head == NULL);
-		return;
-	}
-
-	/* place all users into array and sort it */
-	i_array_init(&users, users_count);
-	user = dir->head;
-	for (i = 0; i < users_count; i++, user = user->next)
-		array_append(&users, &user, 1);
-	i_assert(user == NULL);
-	array_sort(&users, user_timestamp_cmp);
-
-	/* recreate the linked list */
-	dir->head = dir->tail = NULL;
-	array_foreach(&users, userp)
-		DLLIST2_APPEND(&dir->head, &dir->tail, *userp);
-	i_assert(dir->head != NULL &&
-		 dir->head->timestamp <= dir->tail->timestamp);
-	array_free(&users);
-}
-
 unsigned int user_directory_get_username_hash(struct user_directory *dir,
 					      const char *username)
 {
@@ -288,7 +366,13 @@ user_directory_init(unsigned int timeout_secs, const char *username_hash_fmt)
 	i_assert(dir->timeout_secs/2 > dir->user_near_expiring_secs);
 
 	dir->username_hash_fmt = i_strdup(username_hash_fmt);
-	hash_table_create_direct(&dir->hash, default_pool, 0);
+	dir->table_size = USER_DIRECTORY_INITIAL_TABLE_SIZE;
+	dir->table = i_new(struct user *, dir->table_size);
+	dir->wheel_size = nearest_power(timeout_secs + USER_NEAR_EXPIRING_MAX);
+	if (dir->wheel_size > USER_DIRECTORY_MAX_WHEEL_SIZE)
+		dir->wheel_size = USER_DIRECTORY_MAX_WHEEL_SIZE;
+	dir->wheel = i_new(struct user *, dir->wheel_size);
+	i_array_init(&dir->user_chunks, 16);
 	i_array_init(&dir->iters, 8);
 	return dir;
 }
@@ -296,6 +380,7 @@ user_directory_init(unsigned int timeout_secs, const char *username_hash_fmt)
 void user_directory_deinit(struct user_directory **_dir)
 {
 	struct user_directory *dir = *_dir;
+	struct user **chunkp;
 
 	*_dir = NULL;
 
@@ -303,7 +388,11 @@ void user_directory_deinit(struct user_directory **_dir)
 
 	while (dir->head != NULL)
 		user_free(dir, dir->head);
-	hash_table_destroy(&dir->hash);
+	array_foreach_modifiable(&dir->user_chunks, chunkp)
+		i_free(*chunkp);
+	array_free(&dir->user_chunks);
+	i_free(dir->table);
+	i_free(dir->wheel);
 	array_free(&dir->iters);
 	i_free(dir->username_hash_fmt);
 	i_free(dir);
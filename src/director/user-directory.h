@@ -28,6 +28,8 @@ struct user {
 	   even if they happen it doesn't matter - the users are just
 	   redirected to same server */
 	unsigned int username_hash;
+	/* don't change directly - use user_directory_refresh() or
+	   user_directory_set_timestamp() to keep the list sorted */
 	unsigned int timestamp;
 
 	struct mail_host *host;
@@ -60,14 +62,14 @@ user_directory_add(struct user_directory *dir, unsigned int username_hash,
 		   struct mail_host *host, time_t timestamp);
 /* Refresh user's timestamp */
 void user_directory_refresh(struct user_directory *dir, struct user *user);
+/* Change user's timestamp and move it to the correct position. This is
+   used when importing remote director's user list during handshake. */
+void user_directory_set_timestamp(struct user_directory *dir,
+				  struct user *user, time_t timestamp);
 
 /* Remove all users that have pointers to given host */
 void user_directory_remove_host(struct user_directory *dir,
 				struct mail_host *host);
-/* Sort users based on the timestamp. This is called only after updating
-   timestamps based on remote director's user list after handshake. */
-void user_directory_sort(struct user_directory *dir);
-
 unsigned int user_directory_get_username_hash(struct user_directory *dir,
 					      const char *username);
 
@@ -22,6 +22,7 @@ struct director_context {
 	const char *users_path;
 	struct istream *input;
 	bool explicit_socket_path;
+	bool simulate;
 };
 
 struct user_list {
@@ -101,6 +102,9 @@ cmd_director_init(int argc, char *argv[], const char *getopt_args,
 		case 'f':
 			ctx->users_path = optarg;
 			break;
+		case 'n':
+			ctx->simulate = TRUE;
+			break;
 		default:
 			director_cmd_help(cmd);
 		}
@@ -353,6 +357,33 @@ static void cmd_director_map(int argc, char *argv[])
 	pool_unref(&pool);
 }
 
+static void
+director_read_simulate_reply(struct director_context *ctx,
+			     const struct ip_addr *ip)
+{
+	const char *line, *const *args;
+	unsigned int moved, total;
+
+	line = i_stream_read_next_line(ctx->input);
+	if (line != NULL && strcmp(line, "NOTFOUND") == 0) {
+		fprintf(stderr, "%s: doesn't exist\n", net_ip2addr(ip));
+		if (doveadm_exit_code == 0)
+			doveadm_exit_code = DOVEADM_EX_NOTFOUND;
+		return;
+	}
+	args = line == NULL ? NULL : t_strsplit_tab(line);
+	if (args == NULL || str_array_length(args) != 2 ||
+	    str_to_uint(args[0], &moved) < 0 ||
+	    str_to_uint(args[1], &total) < 0) {
+		fprintf(stderr, "%s: %s\n", net_ip2addr(ip),
+			line == NULL ? "failed" : line);
+		doveadm_exit_code = EX_TEMPFAIL;
+		return;
+	}
+	printf("%s: %u of %u users would be moved\n",
+	       net_ip2addr(ip), moved, total);
+}
+
 static void cmd_director_add(int argc, char *argv[])
 {
 	struct director_context *ctx;
@@ -360,7 +391,7 @@ static void cmd_director_add(int argc, char *argv[])
 	unsigned int i, ips_count, vhost_count = UINT_MAX;
 	const char *host, *cmd, *line;
 
-	ctx = cmd_director_init(argc, argv, "a:", cmd_director_add);
+	ctx = cmd_director_init(argc, argv, "a:n", cmd_director_add);
 	host = argv[optind++];
 	if (host == NULL)
 		director_cmd_help(cmd_director_add);
@@ -373,14 +404,16 @@ static void cmd_director_add(int argc, char *argv[])
 
 	director_get_host(host, &ips, &ips_count);
 	for (i = 0; i < ips_count; i++) {
-		cmd = vhost_count == UINT_MAX ?
-			t_strdup_printf("HOST-SET\t%s\n",
-					net_ip2addr(&ips[i])) :
-			t_strdup_printf("HOST-SET\t%s\t%u\n",
-					net_ip2addr(&ips[i]), vhost_count);
-		director_send(ctx, cmd);
-	}
-	for (i = 0; i < ips_count; i++) {
+		cmd = t_strdup_printf("%s\t%s",
+			ctx->simulate ? "HOST-SIMULATE\tset" : "HOST-SET",
+			net_ip2addr(&ips[i]));
+		if (vhost_count != UINT_MAX)
+			cmd = t_strdup_printf("%s\t%u", cmd, vhost_count);
+		director_send(ctx, t_strconcat(cmd, "\n", NULL));
+	}
+	for (i = 0; i < ips_count && ctx->simulate; i++)
+		director_read_simulate_reply(ctx, &ips[i]);
+	for (i = 0; i < ips_count && !ctx->simulate; i++) {
 		line = i_stream_read_next_line(ctx->input);
 		if (line == NULL || strcmp(line, "OK") != 0) {
 			fprintf(stderr, "%s: %s\n", net_ip2addr(&ips[i]),
@@ -400,17 +433,20 @@ static void cmd_director_remove(int argc, char *argv[])
 	unsigned int i, ips_count;
 	const char *host, *line;
 
-	ctx = cmd_director_init(argc, argv, "a:", cmd_director_remove);
+	ctx = cmd_director_init(argc, argv, "a:n", cmd_director_remove);
 	host = argv[optind++];
 	if (host == NULL || argv[optind] != NULL)
 		director_cmd_help(cmd_director_remove);
 
 	director_get_host(host, &ips, &ips_count);
 	for (i = 0; i < ips_count; i++) {
-		director_send(ctx, t_strdup_printf(
-			"HOST-REMOVE\t%s\n", net_ip2addr(&ips[i])));
+		director_send(ctx, t_strdup_printf("%s\t%s\n",
+			ctx->simulate ? "HOST-SIMULATE\tremove" : "HOST-REMOVE",
+			net_ip2addr(&ips[i])));
 	}
-	for (i = 0; i < ips_count; i++) {
+	for (i = 0; i < ips_count && ctx->simulate; i++)
+		director_read_simulate_reply(ctx, &ips[i]);
+	for (i = 0; i < ips_count && !ctx->simulate; i++) {
 		line = i_stream_read_next_line(ctx->input);
 		if (line != NULL && strcmp(line, "NOTFOUND") == 0) {
 			fprintf(stderr, "%s: doesn't exist\n",
@@ -692,9 +728,9 @@ struct doveadm_cmd doveadm_cmd_director[] = {
 	{ cmd_director_map, "director map",
 	  "[-a <director socket path>] [-f <users file>] [<host>]" },
 	{ cmd_director_add, "director add",
-	  "[-a <director socket path>] <host> [<vhost count>]" },
+	  "[-a <director socket path>] [-n] <host> [<vhost count>]" },
 	{ cmd_director_remove, "director remove",
-	  "[-a <director socket path>] <host>" },
+	  "[-a <director socket path>] [-n] <host>" },
 	{ cmd_director_move, "director move",
 	  "[-a <director socket path>] <user> <host>" },
 	{ cmd_director_flush, "director flush",
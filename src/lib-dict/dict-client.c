@@ -43,13 +43,18 @@ struct client_dict {
 	struct timeout *to_idle;
 
 	struct client_dict_transaction_context *transactions;
+	struct client_dict_lookup *lookups;
 
 	unsigned int connect_counter;
 	unsigned int transaction_id_counter;
+	unsigned int lookup_id_counter;
 	unsigned int async_commits;
+	/* valid only after server_version_received */
+	unsigned int server_minor_version;
 
 	unsigned int in_iteration:1;
 	unsigned int handshaked:1;
+	unsigned int server_version_received:1;
 };
 
 struct client_dict_iterate_context {
@@ -59,6 +64,14 @@ struct client_dict_iterate_context {
 	bool failed;
 };
 
+struct client_dict_lookup {
+	struct client_dict_lookup *prev, *next;
+
+	unsigned int id;
+	dict_lookup_callback_t *callback;
+	void *context;
+};
+
 struct client_dict_transaction_context {
 	struct dict_transaction_context ctx;
 	struct client_dict_transaction_context *prev, *next;
@@ -78,6 +91,7 @@ struct client_dict_transaction_context {
 
 static int client_dict_connect(struct client_dict *dict);
 static void client_dict_disconnect(struct client_dict *dict);
+static void dict_async_input(struct client_dict *dict);
 
 const char *dict_client_escape(const char *src)
 {
@@ -240,6 +254,18 @@ client_dict_send_transaction_query(struct client_dict_transaction_context *ctx,
 	return 0;
 }
 
+static void client_dict_async_io_update(struct client_dict *dict)
+{
+	bool pending = dict->async_commits > 0 || dict->lookups != NULL;
+
+	/* while iterating the replies are read by the iteration code */
+	if (pending && dict->io == NULL && !dict->in_iteration &&
+	    dict->fd != -1)
+		dict->io = io_add(dict->fd, IO_READ, dict_async_input, dict);
+	else if ((!pending || dict->in_iteration) && dict->io != NULL)
+		io_remove(&dict->io);
+}
+
 static struct client_dict_transaction_context *
 client_dict_transaction_find(struct client_dict *dict, unsigned int id)
 {
@@ -270,15 +296,77 @@ client_dict_finish_transaction(struct client_dict *dict,
 	/* the callback may call the dict code again, so remove this
 	   transaction before calling it */
 	i_assert(dict->async_commits > 0);
-	if (--dict->async_commits == 0)
-		io_remove(&dict->io);
+	dict->async_commits--;
 	DLLIST_REMOVE(&dict->transactions, ctx);
+	client_dict_async_io_update(dict);
 
 	if (ctx->callback != NULL)
 		ctx->callback(ret, ctx->context);
 	i_free(ctx);
 }
 
+static void
+client_dict_finish_lookup(struct client_dict *dict, unsigned int id,
+			  const struct dict_lookup_result *result)
+{
+	struct client_dict_lookup *lookup;
+
+	for (lookup = dict->lookups; lookup != NULL; lookup = lookup->next) {
+		if (lookup->id == id)
+			break;
+	}
+	if (lookup == NULL) {
+		i_error("dict-client: Unknown lookup id %u", id);
+		return;
+	}
+
+	/* the callback may call the dict code again */
+	DLLIST_REMOVE(&dict->lookups, lookup);
+	client_dict_async_io_update(dict);
+
+	lookup->callback(result, lookup->context);
+	i_free(lookup);
+}
+
+static void
+client_dict_async_lookup_reply(struct client_dict *dict, const char *line)
+{
+	struct dict_lookup_result result;
+	const char *p;
+	unsigned int id;
+
+	/* <O|N|F><id> [<value>] */
+	memset(&result, 0, sizeof(result));
+	switch (*line) {
+	case DICT_PROTOCOL_REPLY_OK:
+		result.ret = 1;
+		break;
+	case DICT_PROTOCOL_REPLY_NOTFOUND:
+		result.ret = 0;
+		break;
+	case DICT_PROTOCOL_REPLY_FAIL:
+		result.ret = -1;
+		break;
+	default:
+		i_error("dict-client: Invalid async lookup line: %s", line);
+		return;
+	}
+	p = strchr(++line, '\t');
+	if (str_to_uint(p == NULL ? line : t_strdup_until(line, p), &id) < 0) {
+		i_error("dict-client: Invalid ID");
+		return;
+	}
+	if (result.ret > 0) {
+		if (p == NULL) {
+			i_error("dict-client: Async lookup reply without value");
+			result.ret = -1;
+		} else {
+			result.value = dict_client_unescape(p + 1);
+		}
+	}
+	client_dict_finish_lookup(dict, id, &result);
+}
+
 static ssize_t client_dict_read_timeout(struct client_dict *dict)
 {
 	time_t now, timeout;
@@ -310,6 +398,19 @@ static ssize_t client_dict_read_timeout(struct client_dict *dict)
 	return ret;
 }
 
+static void
+client_dict_handshake_reply(struct client_dict *dict, const char *line)
+{
+	const char *const *args = t_strsplit_tab(line);
+
+	/* <major-version> <minor-version> */
+	if (str_array_length(args) < 2 ||
+	    str_to_uint(args[1], &dict->server_minor_version) < 0) {
+		i_error("dict-client: Invalid handshake reply: %s", line);
+		dict->server_minor_version = 0;
+	}
+}
+
 static int client_dict_read_one_line(struct client_dict *dict, char **line_r)
 {
 	unsigned int id;
@@ -340,6 +441,16 @@ static int client_dict_read_one_line(struct client_dict *dict, char **line_r)
 			break;
 		}
 	}
+	if (!dict->server_version_received) {
+		/* newer servers reply to the handshake before anything else.
+		   older ones don't reply to it at all. */
+		dict->server_version_received = TRUE;
+		if (*line == DICT_PROTOCOL_CMD_HELLO) {
+			client_dict_handshake_reply(dict, line + 1);
+			return 0;
+		}
+		dict->server_minor_version = 0;
+	}
 	if (*line == DICT_PROTOCOL_REPLY_ASYNC_COMMIT) {
 		switch (line[1]) {
 		case DICT_PROTOCOL_REPLY_OK:
@@ -363,6 +474,12 @@ static int client_dict_read_one_line(struct client_dict *dict, char **line_r)
 		client_dict_finish_transaction(dict, id, ret);
 		return 0;
 	}
+	if (*line == DICT_PROTOCOL_REPLY_ASYNC_LOOKUP) {
+		T_BEGIN {
+			client_dict_async_lookup_reply(dict, line + 1);
+		} T_END;
+		return 0;
+	}
 	*line_r = line;
 	return 1;
 }
@@ -370,7 +487,7 @@ static int client_dict_read_one_line(struct client_dict *dict, char **line_r)
 static bool client_dict_is_finished(struct client_dict *dict)
 {
 	return dict->transactions == NULL && !dict->in_iteration &&
-		dict->async_commits == 0;
+		dict->async_commits == 0 && dict->lookups == NULL;
 }
 
 static void client_dict_timeout(struct client_dict *dict)
@@ -448,9 +565,12 @@ static int client_dict_connect(struct client_dict *dict)
 static void client_dict_disconnect(struct client_dict *dict)
 {
 	struct client_dict_transaction_context *ctx, *next;
+	struct client_dict_lookup *lookup;
+	struct dict_lookup_result result;
 
 	dict->connect_counter++;
 	dict->handshaked = FALSE;
+	dict->server_version_received = FALSE;
 
 	/* abort all pending async commits */
 	for (ctx = dict->transactions; ctx != NULL; ctx = next) {
@@ -473,6 +593,17 @@ static void client_dict_disconnect(struct client_dict *dict)
 			i_error("close(%s) failed: %m", dict->path);
 		dict->fd = -1;
 	}
+
+	/* abort all pending async lookups. this is done only after the
+	   connection is gone, so the callbacks can already reconnect. */
+	memset(&result, 0, sizeof(result));
+	result.ret = -1;
+	while (dict->lookups != NULL) {
+		lookup = dict->lookups;
+		DLLIST_REMOVE(&dict->lookups, lookup);
+		lookup->callback(&result, lookup->context);
+		i_free(lookup);
+	}
 }
 
 static int
@@ -519,6 +650,7 @@ static void client_dict_deinit(struct dict *_dict)
 
         client_dict_disconnect(dict);
 	i_assert(dict->transactions == NULL);
+	i_assert(dict->lookups == NULL);
 	pool_unref(&dict->pool);
 }
 
@@ -531,8 +663,10 @@ static int client_dict_wait(struct dict *_dict)
 	if (!dict->handshaked)
 		return -1;
 
-	while (dict->async_commits > 0) {
+	while (dict->async_commits > 0 || dict->lookups != NULL) {
 		if (client_dict_read_one_line(dict, &line) < 0) {
+			/* fail all the pending commits and lookups */
+			client_dict_disconnect(dict);
 			ret = -1;
 			break;
 		}
@@ -571,6 +705,57 @@ static int client_dict_lookup(struct dict *_dict, pool_t pool,
 	}
 }
 
+static void
+client_dict_lookup_async(struct dict *_dict, const char *key,
+			 dict_lookup_callback_t *callback, void *context)
+{
+	struct client_dict *dict = (struct client_dict *)_dict;
+	struct client_dict_lookup *lookup;
+	struct dict_lookup_result result;
+	unsigned int id;
+	int ret;
+
+	if (dict->in_iteration) {
+		i_error("dict-client: Can't lookup while iterating");
+		ret = -1;
+	} else if (!dict->server_version_received ||
+		   dict->server_minor_version < 1) {
+		/* the server's version isn't known until it has replied to
+		   something, and older servers don't support the async
+		   lookup command */
+		memset(&result, 0, sizeof(result));
+		T_BEGIN {
+			result.ret = client_dict_lookup(_dict,
+				pool_datastack_create(), key, &result.value);
+			callback(&result, context);
+		} T_END;
+		return;
+	} else T_BEGIN {
+		const char *query;
+
+		id = ++dict->lookup_id_counter;
+		query = t_strdup_printf("%c%u\t%s\n",
+					DICT_PROTOCOL_CMD_LOOKUP_ASYNC, id,
+					dict_client_escape(key));
+		ret = client_dict_send_query(dict, query);
+	} T_END;
+	if (ret < 0) {
+		memset(&result, 0, sizeof(result));
+		result.ret = -1;
+		callback(&result, context);
+		return;
+	}
+
+	/* don't wait for the reply. the lookups are pipelined, and the server
+	   may reply to them in any order. */
+	lookup = i_new(struct client_dict_lookup, 1);
+	lookup->id = id;
+	lookup->callback = callback;
+	lookup->context = context;
+	DLLIST_PREPEND(&dict->lookups, lookup);
+	client_dict_async_io_update(dict);
+}
+
 static struct dict_iterate_context *
 client_dict_iterate_init(struct dict *_dict, const char *const *paths,
 			 enum dict_iterate_flags flags)
@@ -581,6 +766,7 @@ client_dict_iterate_init(struct dict *_dict, const char *const *paths,
 	if (dict->in_iteration)
 		i_panic("dict-client: Only one iteration supported");
 	dict->in_iteration = TRUE;
+	client_dict_async_io_update(dict);
 
 	ctx = i_new(struct client_dict_iterate_context, 1);
 	ctx->ctx.dict = _dict;
@@ -662,6 +848,7 @@ static int client_dict_iterate_deinit(struct dict_iterate_context *_ctx)
 	pool_unref(&ctx->pool);
 	i_free(ctx);
 	dict->in_iteration = FALSE;
+	client_dict_async_io_update(dict);
 
 	client_dict_add_timeout(dict);
 	return ret;
@@ -690,10 +877,13 @@ static void dict_async_input(struct client_dict *dict)
 
 	do {
 		ret = client_dict_read_one_line(dict, &line);
-	} while (ret == 0 && i_stream_get_data_size(dict->input) > 0);
+	} while (ret == 0 && dict->input != NULL &&
+		 i_stream_get_data_size(dict->input) > 0);
 
 	if (ret < 0)
-		io_remove(&dict->io);
+		client_dict_disconnect(dict);
+	else
+		client_dict_add_timeout(dict);
 }
 
 static int
@@ -721,10 +911,8 @@ client_dict_transaction_commit(struct dict_transaction_context *_ctx,
 			ctx->callback = callback;
 			ctx->context = context;
 			ctx->async = TRUE;
-			if (dict->async_commits++ == 0) {
-				dict->io = io_add(dict->fd, IO_READ,
-						  dict_async_input, dict);
-			}
+			dict->async_commits++;
+			client_dict_async_io_update(dict);
 		} else {
 			/* sync commit, read reply */
 			line = client_dict_read_line(dict);
@@ -851,6 +1039,7 @@ struct dict dict_driver_client = {
 		client_dict_set,
 		client_dict_unset,
 		client_dict_append,
-		client_dict_atomic_inc
+		client_dict_atomic_inc,
+		client_dict_lookup_async
 	}
 };
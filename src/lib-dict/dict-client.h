@@ -6,15 +6,19 @@
 #define DEFAULT_DICT_SERVER_SOCKET_FNAME "dict"
 
 #define DICT_CLIENT_PROTOCOL_MAJOR_VERSION 2
-#define DICT_CLIENT_PROTOCOL_MINOR_VERSION 0
+#define DICT_CLIENT_PROTOCOL_MINOR_VERSION 1
 
 #define DICT_CLIENT_MAX_LINE_LENGTH (64*1024)
 
 enum {
         /* <major-version> <minor-version> <value type> <user> <dict name> */
+	/* minor-version 1+: the server replies with
+	   H<major-version> <minor-version> before any other reply */
 	DICT_PROTOCOL_CMD_HELLO = 'H',
 
 	DICT_PROTOCOL_CMD_LOOKUP = 'L', /* <key> */
+	/* minor-version 1+: reply is sent as ASYNC_LOOKUP with the same <id> */
+	DICT_PROTOCOL_CMD_LOOKUP_ASYNC = 'K', /* <id> <key> */
 	DICT_PROTOCOL_CMD_ITERATE = 'I', /* <flags> <path> */
 
 	DICT_PROTOCOL_CMD_BEGIN = 'B', /* <id> */
@@ -32,7 +36,8 @@ enum {
 	DICT_PROTOCOL_REPLY_OK = 'O', /* <value> */
 	DICT_PROTOCOL_REPLY_NOTFOUND = 'N',
 	DICT_PROTOCOL_REPLY_FAIL = 'F',
-	DICT_PROTOCOL_REPLY_ASYNC_COMMIT = 'A'
+	DICT_PROTOCOL_REPLY_ASYNC_COMMIT = 'A', /* <O|N|F><id> */
+	DICT_PROTOCOL_REPLY_ASYNC_LOOKUP = 'L' /* <O|N|F><id> [<value>] */
 };
 
 const char *dict_client_escape(const char *src);
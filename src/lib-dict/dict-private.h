@@ -36,6 +36,11 @@ struct dict_vfuncs {
 		       const char *key, const char *value);
 	void (*atomic_inc)(struct dict_transaction_context *ctx,
 			   const char *key, long long diff);
+
+	void (*lookup_async)(struct dict *dict, const char *key,
+			     dict_lookup_callback_t *callback, void *context);
+	int (*lookup_multi)(struct dict *dict, pool_t pool,
+			    const char *const *keys, const char **values_r);
 };
 
 struct dict {
@@ -62,4 +67,8 @@ extern struct dict dict_driver_memcached_ascii;
 extern struct dict dict_driver_redis;
 extern struct dict dict_driver_cdb;
 
+/* Close the redis connections that were left open for the following
+   dict_init()s. */
+void dict_redis_idle_connections_deinit(void);
+
 #endif
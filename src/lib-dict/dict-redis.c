@@ -10,11 +10,16 @@
 
 #define REDIS_DEFAULT_PORT 6379
 #define REDIS_DEFAULT_LOOKUP_TIMEOUT_MSECS (1000*30)
+/* Keep this many connections open after dict_deinit(), so the following
+   dict_init()s to the same server can use them without reconnecting. */
+#define REDIS_MAX_IDLE_CONNECTIONS 4
 #define DICT_USERNAME_SEPARATOR '/'
 
 enum redis_input_state {
 	/* expecting $-1 / $<size> followed by GET reply */
 	REDIS_INPUT_STATE_GET,
+	/* expecting *<nreplies> followed by GET replies */
+	REDIS_INPUT_STATE_MGET,
 	/* expecting +QUEUED */
 	REDIS_INPUT_STATE_MULTI,
 	/* expecting +OK reply for DISCARD */
@@ -31,8 +36,11 @@ struct redis_connection {
 
 	string_t *last_reply;
 	unsigned int bytes_left;
-	bool value_not_found;
-	bool value_received;
+
+	/* values of the current lookup, NULL if not found */
+	pool_t values_pool;
+	ARRAY(const char *) values;
+	unsigned int values_count;
 };
 
 struct redis_dict_reply {
@@ -49,7 +57,7 @@ struct redis_dict {
 	unsigned int timeout_msecs;
 
 	struct ioloop *ioloop;
-	struct redis_connection conn;
+	struct redis_connection *conn;
 
 	ARRAY(enum redis_input_state) input_states;
 	ARRAY(struct redis_dict_reply) replies;
@@ -65,6 +73,7 @@ struct redis_dict_transaction_context {
 };
 
 static struct connection_list *redis_connections;
+static ARRAY(struct redis_connection *) redis_idle_connections;
 
 static void
 redis_input_state_add(struct redis_dict *dict, enum redis_input_state state)
@@ -82,6 +91,8 @@ static void redis_conn_destroy(struct connection *_conn)
 	struct redis_connection *conn = (struct redis_connection *)_conn;
 	const struct redis_dict_reply *reply;
 
+	i_assert(conn->dict != NULL);
+
 	conn->dict->connected = FALSE;
 	connection_disconnect(_conn);
 
@@ -103,18 +114,32 @@ static void redis_wait(struct redis_dict *dict)
 	i_assert(dict->ioloop == NULL);
 
 	dict->ioloop = io_loop_create();
-	connection_switch_ioloop(&dict->conn.conn);
+	connection_switch_ioloop(&dict->conn->conn);
 
 	do {
 		io_loop_run(dict->ioloop);
 	} while (array_count(&dict->input_states) > 0);
 
 	io_loop_set_current(prev_ioloop);
-	connection_switch_ioloop(&dict->conn.conn);
+	connection_switch_ioloop(&dict->conn->conn);
 	io_loop_set_current(dict->ioloop);
 	io_loop_destroy(&dict->ioloop);
 }
 
+static void redis_input_value(struct redis_connection *conn, const char *value)
+{
+	const char *value_dup;
+
+	i_assert(array_count(&conn->values) < conn->values_count);
+
+	value_dup = value == NULL ? NULL : p_strdup(conn->values_pool, value);
+	array_append(&conn->values, &value_dup, 1);
+
+	if (conn->dict->ioloop != NULL)
+		io_loop_stop(conn->dict->ioloop);
+	redis_input_state_remove(conn->dict);
+}
+
 static int redis_input_get(struct redis_connection *conn)
 {
 	const unsigned char *data;
@@ -127,11 +152,7 @@ static int redis_input_get(struct redis_connection *conn)
 		if (line == NULL)
 			return 0;
 		if (strcmp(line, "$-1") == 0) {
-			conn->value_received = TRUE;
-			conn->value_not_found = TRUE;
-			if (conn->dict->ioloop != NULL)
-				io_loop_stop(conn->dict->ioloop);
-			redis_input_state_remove(conn->dict);
+			redis_input_value(conn, NULL);
 			return 1;
 		}
 		if (line[0] != '$' || str_to_uint(line+1, &conn->bytes_left) < 0) {
@@ -154,12 +175,9 @@ static int redis_input_get(struct redis_connection *conn)
 		return 0;
 
 	/* reply fully read - drop trailing CRLF */
-	conn->value_received = TRUE;
 	str_truncate(conn->last_reply, str_len(conn->last_reply)-2);
-
-	if (conn->dict->ioloop != NULL)
-		io_loop_stop(conn->dict->ioloop);
-	redis_input_state_remove(conn->dict);
+	redis_input_value(conn, str_c(conn->last_reply));
+	str_truncate(conn->last_reply, 0);
 	return 1;
 }
 
@@ -192,6 +210,16 @@ static int redis_conn_input_more(struct redis_connection *conn)
 	switch (state) {
 	case REDIS_INPUT_STATE_GET:
 		i_unreached();
+	case REDIS_INPUT_STATE_MGET:
+		/* the GET states for the values were already added */
+		if (line[0] != '*' || str_to_uint(line+1, &num_replies) < 0)
+			break;
+		if (num_replies != conn->values_count) {
+			i_error("redis: MGET expected %u replies, not %u",
+				conn->values_count, num_replies);
+			return -1;
+		}
+		return 1;
 	case REDIS_INPUT_STATE_MULTI:
 	case REDIS_INPUT_STATE_DISCARD:
 		if (line[0] != '+')
@@ -279,6 +307,100 @@ static const struct connection_vfuncs redis_conn_vfuncs = {
 	.client_connected = redis_conn_connected
 };
 
+static void redis_connection_free(struct redis_connection *conn)
+{
+	connection_deinit(&conn->conn);
+	str_free(&conn->last_reply);
+	array_free(&conn->values);
+	pool_unref(&conn->values_pool);
+	i_free(conn);
+}
+
+static struct redis_connection *
+redis_connection_get_idle(const struct ip_addr *ip, unsigned int port)
+{
+	struct redis_connection *const *conns, *conn;
+	unsigned int i, count;
+
+	if (!array_is_created(&redis_idle_connections))
+		return NULL;
+
+	conns = array_get(&redis_idle_connections, &count);
+	for (i = count; i > 0; i--) {
+		conn = conns[i-1];
+		if (conn->conn.port != port || !net_ip_compare(&conn->conn.ip, ip))
+			continue;
+		array_delete(&redis_idle_connections, i-1, 1);
+
+		/* an idle connection shouldn't have anything to read. if it
+		   does, it's most likely disconnected. */
+		if (i_stream_read(conn->conn.input) == 0)
+			return conn;
+		redis_connection_free(conn);
+		return redis_connection_get_idle(ip, port);
+	}
+	return NULL;
+}
+
+static void redis_connection_get(struct redis_dict *dict)
+{
+	struct redis_connection *conn;
+
+	conn = redis_connection_get_idle(&dict->ip, dict->port);
+	if (conn != NULL) {
+		conn->conn.io = io_add(conn->conn.fd_in, IO_READ,
+				       *redis_connections->v.input,
+				       &conn->conn);
+		dict->connected = TRUE;
+	} else {
+		conn = i_new(struct redis_connection, 1);
+		connection_init_client_ip(redis_connections, &conn->conn,
+					  &dict->ip, dict->port);
+		conn->last_reply = str_new(default_pool, 256);
+		conn->values_pool =
+			pool_alloconly_create("redis lookup values", 256);
+		i_array_init(&conn->values, 4);
+	}
+	conn->dict = dict;
+	dict->conn = conn;
+}
+
+static void redis_connection_put(struct redis_dict *dict)
+{
+	struct redis_connection *conn = dict->conn;
+
+	dict->conn = NULL;
+	if (!dict->connected || array_count(&dict->input_states) > 0) {
+		redis_connection_free(conn);
+		return;
+	}
+	if (!array_is_created(&redis_idle_connections))
+		i_array_init(&redis_idle_connections, REDIS_MAX_IDLE_CONNECTIONS);
+	if (array_count(&redis_idle_connections) >= REDIS_MAX_IDLE_CONNECTIONS) {
+		redis_connection_free(conn);
+		return;
+	}
+
+	/* nothing is expected to be read while the connection is idle */
+	io_remove(&conn->conn.io);
+	conn->dict = NULL;
+	array_append(&redis_idle_connections, &conn, 1);
+}
+
+void dict_redis_idle_connections_deinit(void)
+{
+	struct redis_connection *const *connp;
+
+	if (array_is_created(&redis_idle_connections)) {
+		array_foreach(&redis_idle_connections, connp)
+			redis_connection_free(*connp);
+		array_free(&redis_idle_connections);
+	}
+	if (redis_connections != NULL &&
+	    redis_connections->connections == NULL)
+		connection_list_deinit(&redis_connections);
+}
+
 static const char *redis_escape_username(const char *username)
 {
 	const char *p;
@@ -357,11 +479,8 @@ redis_dict_init(struct dict *driver, const char *uri,
 		i_free(dict);
 		return -1;
 	}
-	connection_init_client_ip(redis_connections, &dict->conn.conn,
-				  &dict->ip, dict->port);
 	dict->dict = *driver;
-	dict->conn.last_reply = str_new(default_pool, 256);
-	dict->conn.dict = dict;
+	redis_connection_get(dict);
 
 	i_array_init(&dict->input_states, 4);
 	i_array_init(&dict->replies, 4);
@@ -384,8 +503,7 @@ static void redis_dict_deinit(struct dict *_dict)
 		i_assert(dict->connected);
 		redis_wait(dict);
 	}
-	connection_deinit(&dict->conn.conn);
-	str_free(&dict->conn.last_reply);
+	redis_connection_put(dict);
 	array_free(&dict->replies);
 	array_free(&dict->input_states);
 	i_free(dict->key_prefix);
@@ -420,26 +538,49 @@ redis_dict_get_full_key(struct redis_dict *dict, const char *key)
 	return key;
 }
 
+static void
+redis_append_command(string_t *cmd, const char *name,
+		     const char *const *keys, unsigned int count)
+{
+	unsigned int i;
+
+	str_printfa(cmd, "*%u\r\n$%u\r\n%s\r\n", count + 1,
+		    (unsigned int)strlen(name), name);
+	for (i = 0; i < count; i++) {
+		str_printfa(cmd, "$%u\r\n%s\r\n",
+			    (unsigned int)strlen(keys[i]), keys[i]);
+	}
+}
+
 static int
 redis_dict_lookup_real(struct redis_dict *dict, pool_t pool,
-		       const char *key, const char **value_r)
+		       const char *const *keys, const char **values_r)
 {
+	struct redis_connection *conn = dict->conn;
 	struct timeout *to;
-	const char *cmd;
+	const char **full_keys, *const *values;
 	struct ioloop *prev_ioloop = current_ioloop;
+	unsigned int i, count = str_array_length(keys);
+	string_t *cmd;
 
-	key = redis_dict_get_full_key(dict, key);
+	i_assert(count > 0);
+
+	full_keys = t_new(const char *, count + 1);
+	for (i = 0; i < count; i++) {
+		full_keys[i] = redis_dict_get_full_key(dict, keys[i]);
+	}
 
-	dict->conn.value_received = FALSE;
-	dict->conn.value_not_found = FALSE;
+	p_clear(conn->values_pool);
+	array_clear(&conn->values);
+	conn->values_count = count;
 
 	i_assert(dict->ioloop == NULL);
 
 	dict->ioloop = io_loop_create();
-	connection_switch_ioloop(&dict->conn.conn);
+	connection_switch_ioloop(&conn->conn);
 
-	if (dict->conn.conn.fd_in == -1 &&
-	    connection_client_connect(&dict->conn.conn) < 0) {
+	if (conn->conn.fd_in == -1 &&
+	    connection_client_connect(&conn->conn) < 0) {
 		i_error("redis: Couldn't connect to %s:%u",
 			net_ip2addr(&dict->ip), dict->port);
 	} else {
@@ -451,12 +592,19 @@ redis_dict_lookup_real(struct redis_dict *dict, pool_t pool,
 		}
 
 		if (dict->connected) {
-			cmd = t_strdup_printf("*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n",
-					      (int)strlen(key), key);
-			o_stream_nsend_str(dict->conn.conn.output, cmd);
-
-			str_truncate(dict->conn.last_reply, 0);
-			redis_input_state_add(dict, REDIS_INPUT_STATE_GET);
+			/* use a single MGET for multiple keys, so they're all
+			   looked up with one roundtrip */
+			cmd = t_str_new(128);
+			redis_append_command(cmd, count == 1 ? "GET" : "MGET",
+					     full_keys, count);
+			o_stream_nsend(conn->conn.output,
+				       str_data(cmd), str_len(cmd));
+
+			str_truncate(conn->last_reply, 0);
+			if (count > 1)
+				redis_input_state_add(dict, REDIS_INPUT_STATE_MGET);
+			for (i = 0; i < count; i++)
+				redis_input_state_add(dict, REDIS_INPUT_STATE_GET);
 			do {
 				io_loop_run(dict->ioloop);
 			} while (array_count(&dict->input_states) > 0);
@@ -465,35 +613,56 @@ redis_dict_lookup_real(struct redis_dict *dict, pool_t pool,
 	}
 
 	io_loop_set_current(prev_ioloop);
-	connection_switch_ioloop(&dict->conn.conn);
+	connection_switch_ioloop(&conn->conn);
 	io_loop_set_current(dict->ioloop);
 	io_loop_destroy(&dict->ioloop);
 
-	if (!dict->conn.value_received) {
+	if (array_count(&conn->values) != count) {
 		/* we failed in some way. make sure we disconnect since the
 		   connection state isn't known anymore */
-		redis_conn_destroy(&dict->conn.conn);
+		redis_conn_destroy(&conn->conn);
 		return -1;
 	}
-	if (dict->conn.value_not_found)
-		return 0;
-
-	*value_r = p_strdup(pool, str_c(dict->conn.last_reply));
-	return 1;
+	values = array_idx(&conn->values, 0);
+	for (i = 0; i < count; i++)
+		values_r[i] = p_strdup(pool, values[i]);
+	return 0;
 }
 
 static int redis_dict_lookup(struct dict *_dict, pool_t pool,
 			     const char *key, const char **value_r)
 {
 	struct redis_dict *dict = (struct redis_dict *)_dict;
+	const char *keys[2];
 	int ret;
 
 	i_assert(!dict->transaction_open);
 
+	keys[0] = key;
+	keys[1] = NULL;
 	if (pool->datastack_pool)
-		ret = redis_dict_lookup_real(dict, pool, key, value_r);
+		ret = redis_dict_lookup_real(dict, pool, keys, value_r);
 	else T_BEGIN {
-		ret = redis_dict_lookup_real(dict, pool, key, value_r);
+		ret = redis_dict_lookup_real(dict, pool, keys, value_r);
+	} T_END;
+	if (ret < 0)
+		return -1;
+	return *value_r != NULL ? 1 : 0;
+}
+
+static int redis_dict_lookup_multi(struct dict *_dict, pool_t pool,
+				   const char *const *keys,
+				   const char **values_r)
+{
+	struct redis_dict *dict = (struct redis_dict *)_dict;
+	int ret;
+
+	i_assert(!dict->transaction_open);
+
+	if (pool->datastack_pool)
+		ret = redis_dict_lookup_real(dict, pool, keys, values_r);
+	else T_BEGIN {
+		ret = redis_dict_lookup_real(dict, pool, keys, values_r);
 	} T_END;
 	return ret;
 }
@@ -510,8 +679,8 @@ redis_transaction_init(struct dict *_dict)
 	ctx = i_new(struct redis_dict_transaction_context, 1);
 	ctx->ctx.dict = _dict;
 
-	if (dict->conn.conn.fd_in == -1 &&
-	    connection_client_connect(&dict->conn.conn) < 0) {
+	if (dict->conn->conn.fd_in == -1 &&
+	    connection_client_connect(&dict->conn->conn) < 0) {
 		i_error("redis: Couldn't connect to %s:%u",
 			net_ip2addr(&dict->ip), dict->port);
 	} else if (!dict->connected) {
@@ -538,12 +707,12 @@ redis_transaction_commit(struct dict_transaction_context *_ctx, bool async,
 
 	if (ctx->failed) {
 		/* make sure we're disconnected */
-		redis_conn_destroy(&dict->conn.conn);
+		redis_conn_destroy(&dict->conn->conn);
 		ret = -1;
 	} else if (_ctx->changed) {
 		i_assert(ctx->cmd_count > 0);
 
-		o_stream_nsend_str(dict->conn.conn.output,
+		o_stream_nsend_str(dict->conn->conn.output,
 				   "*1\r\n$4\r\nEXEC\r\n");
 		reply = array_append_space(&dict->replies);
 		reply->callback = callback;
@@ -574,9 +743,9 @@ static void redis_transaction_rollback(struct dict_transaction_context *_ctx)
 
 	if (ctx->failed) {
 		/* make sure we're disconnected */
-		redis_conn_destroy(&dict->conn.conn);
+		redis_conn_destroy(&dict->conn->conn);
 	} else if (_ctx->changed) {
-		o_stream_nsend_str(dict->conn.conn.output,
+		o_stream_nsend_str(dict->conn->conn.output,
 				   "*1\r\n$7\r\nDISCARD\r\n");
 		reply = array_append_space(&dict->replies);
 		reply->reply_count = 1;
@@ -600,7 +769,7 @@ static int redis_check_transaction(struct redis_dict_transaction_context *ctx)
 		return 0;
 
 	redis_input_state_add(dict, REDIS_INPUT_STATE_MULTI);
-	if (o_stream_send_str(dict->conn.conn.output,
+	if (o_stream_send_str(dict->conn->conn.output,
 			      "*1\r\n$5\r\nMULTI\r\n") < 0) {
 		ctx->failed = TRUE;
 		return -1;
@@ -623,7 +792,7 @@ static void redis_set(struct dict_transaction_context *_ctx,
 	cmd = t_strdup_printf("*3\r\n$3\r\nSET\r\n$%u\r\n%s\r\n$%u\r\n%s\r\n",
 			      (unsigned int)strlen(key), key,
 			      (unsigned int)strlen(value), value);
-	if (o_stream_send_str(dict->conn.conn.output, cmd) < 0)
+	if (o_stream_send_str(dict->conn->conn.output, cmd) < 0)
 		ctx->failed = TRUE;
 	redis_input_state_add(dict, REDIS_INPUT_STATE_MULTI);
 	ctx->cmd_count++;
@@ -643,7 +812,7 @@ static void redis_unset(struct dict_transaction_context *_ctx,
 	key = redis_dict_get_full_key(dict, key);
 	cmd = t_strdup_printf("*2\r\n$3\r\nDEL\r\n$%u\r\n%s\r\n",
 			      (unsigned int)strlen(key), key);
-	if (o_stream_send_str(dict->conn.conn.output, cmd) < 0)
+	if (o_stream_send_str(dict->conn->conn.output, cmd) < 0)
 		ctx->failed = TRUE;
 	redis_input_state_add(dict, REDIS_INPUT_STATE_MULTI);
 	ctx->cmd_count++;
@@ -664,7 +833,7 @@ static void redis_append(struct dict_transaction_context *_ctx,
 	cmd = t_strdup_printf("*3\r\n$6\r\nAPPEND\r\n$%u\r\n%s\r\n$%u\r\n%s\r\n",
 			      (unsigned int)strlen(key), key,
 			      (unsigned int)strlen(value), value);
-	if (o_stream_send_str(dict->conn.conn.output, cmd) < 0)
+	if (o_stream_send_str(dict->conn->conn.output, cmd) < 0)
 		ctx->failed = TRUE;
 	redis_input_state_add(dict, REDIS_INPUT_STATE_MULTI);
 	ctx->cmd_count++;
@@ -686,7 +855,7 @@ static void redis_atomic_inc(struct dict_transaction_context *_ctx,
 	cmd = t_strdup_printf("*3\r\n$6\r\nINCRBY\r\n$%u\r\n%s\r\n$%u\r\n%s\r\n",
 			      (unsigned int)strlen(key), key,
 			      (unsigned int)strlen(diffstr), diffstr);
-	if (o_stream_send_str(dict->conn.conn.output, cmd) < 0)
+	if (o_stream_send_str(dict->conn->conn.output, cmd) < 0)
 		ctx->failed = TRUE;
 	redis_input_state_add(dict, REDIS_INPUT_STATE_MULTI);
 	ctx->cmd_count++;
@@ -708,6 +877,8 @@ struct dict dict_driver_redis = {
 		redis_set,
 		redis_unset,
 		redis_append,
-		redis_atomic_inc
+		redis_atomic_inc,
+		NULL,
+		redis_dict_lookup_multi
 	}
 };
@@ -21,4 +21,5 @@ void dict_drivers_unregister_builtin(void)
 	dict_driver_unregister(&dict_driver_memcached);
 	dict_driver_unregister(&dict_driver_memcached_ascii);
 	dict_driver_unregister(&dict_driver_redis);
+	dict_redis_idle_connections_deinit();
 }
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "hash.h"
 #include "istream.h"
 #include "str.h"
 #include "sql-api-private.h"
@@ -29,6 +30,8 @@ struct sql_dict {
 	const char *username;
 	const struct dict_sql_settings *set;
 	unsigned int prev_map_match_idx;
+	/* query template => prepared statement */
+	HASH_TABLE(char *, struct sql_prepared_statement *) prep_stmt_hash;
 
 	unsigned int has_on_duplicate_key:1;
 };
@@ -96,6 +99,8 @@ sql_dict_init(struct dict *driver, const char *uri,
 
 	dict->db = sql_db_cache_new(dict_sql_db_cache, driver->name,
 				    dict->set->connect);
+	hash_table_create(&dict->prep_stmt_hash, default_pool, 0,
+			  str_hash, strcmp);
 	*dict_r = &dict->dict;
 	return 0;
 }
@@ -103,6 +108,18 @@ sql_dict_init(struct dict *driver, const char *uri,
 static void sql_dict_deinit(struct dict *_dict)
 {
 	struct sql_dict *dict = (struct sql_dict *)_dict;
+	struct hash_iterate_context *iter;
+	struct sql_prepared_statement *prep_stmt;
+	char *query;
+
+	iter = hash_table_iterate_init(dict->prep_stmt_hash);
+	while (hash_table_iterate(iter, dict->prep_stmt_hash,
+				  &query, &prep_stmt)) {
+		sql_prepared_statement_deinit(&prep_stmt);
+		i_free(query);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&dict->prep_stmt_hash);
 
 	sql_deinit(&dict->db);
 	pool_unref(&dict->pool);
@@ -205,9 +222,9 @@ static void
 sql_dict_where_build(struct sql_dict *dict, const struct dict_sql_map *map,
 		     const ARRAY_TYPE(const_string) *values_arr,
 		     char key1, enum sql_recurse_type recurse_type,
-		     string_t *query)
+		     string_t *query, ARRAY_TYPE(const_string) *params)
 {
-	const char *const *sql_fields, *const *values;
+	const char *const *sql_fields, *const *values, *value;
 	unsigned int i, count, count2, exact_count;
 	bool priv = key1 == DICT_PATH_PRIVATE[0];
 
@@ -227,8 +244,8 @@ sql_dict_where_build(struct sql_dict *dict, const struct dict_sql_map *map,
 	for (i = 0; i < exact_count; i++) {
 		if (i > 0)
 			str_append(query, " AND");
-		str_printfa(query, " %s = '%s'", sql_fields[i],
-			    sql_escape_string(dict->db, values[i]));
+		str_printfa(query, " %s = ?", sql_fields[i]);
+		array_append(params, &values[i], 1);
 	}
 	switch (recurse_type) {
 	case SQL_DICT_RECURSE_NONE:
@@ -237,12 +254,12 @@ sql_dict_where_build(struct sql_dict *dict, const struct dict_sql_map *map,
 		if (i > 0)
 			str_append(query, " AND");
 		if (i < count2) {
-			str_printfa(query, " %s LIKE '%s/%%' AND "
-				    "%s NOT LIKE '%s/%%/%%'",
-				    sql_fields[i],
-				    sql_escape_string(dict->db, values[i]),
-				    sql_fields[i],
-				    sql_escape_string(dict->db, values[i]));
+			str_printfa(query, " %s LIKE ? AND %s NOT LIKE ?",
+				    sql_fields[i], sql_fields[i]);
+			value = t_strconcat(values[i], "/%", NULL);
+			array_append(params, &value, 1);
+			value = t_strconcat(values[i], "/%/%", NULL);
+			array_append(params, &value, 1);
 		} else {
 			str_printfa(query, " %s LIKE '%%' AND "
 				    "%s NOT LIKE '%%/%%'",
@@ -253,17 +270,45 @@ sql_dict_where_build(struct sql_dict *dict, const struct dict_sql_map *map,
 		if (i < count2) {
 			if (i > 0)
 				str_append(query, " AND");
-			str_printfa(query, " %s LIKE '%s/%%'", sql_fields[i],
-				    sql_escape_string(dict->db, values[i]));
+			str_printfa(query, " %s LIKE ?", sql_fields[i]);
+			value = t_strconcat(values[i], "/%", NULL);
+			array_append(params, &value, 1);
 		}
 		break;
 	}
 	if (priv) {
 		if (count2 > 0)
 			str_append(query, " AND");
-		str_printfa(query, " %s = '%s'", map->username_field,
-			    sql_escape_string(dict->db, dict->username));
+		str_printfa(query, " %s = ?", map->username_field);
+		array_append(params, &dict->username, 1);
+	}
+}
+
+static struct sql_statement *
+sql_dict_statement_init(struct sql_dict *dict, const char *query,
+			const ARRAY_TYPE(const_string) *params, bool prepare)
+{
+	struct sql_prepared_statement *prep_stmt;
+	struct sql_statement *stmt;
+	const char *const *param;
+
+	if (!prepare)
+		stmt = sql_statement_init(dict->db, query);
+	else {
+		prep_stmt = hash_table_lookup(dict->prep_stmt_hash, query);
+		if (prep_stmt == NULL) {
+			prep_stmt = sql_prepared_statement_init(dict->db,
+								query);
+			hash_table_insert(dict->prep_stmt_hash,
+					  i_strdup(query), prep_stmt);
+		}
+		stmt = sql_statement_init_prepared(prep_stmt);
+	}
+	array_foreach(params, param) {
+		sql_statement_bind_str(stmt, array_foreach_idx(params, param),
+				       *param);
 	}
+	return stmt;
 }
 
 static int sql_dict_lookup(struct dict *_dict, pool_t pool,
@@ -284,12 +329,17 @@ static int sql_dict_lookup(struct dict *_dict, pool_t pool,
 
 	T_BEGIN {
 		string_t *query = t_str_new(256);
+		ARRAY_TYPE(const_string) params;
+		struct sql_statement *stmt;
 
+		t_array_init(&params, 8);
 		str_printfa(query, "SELECT %s FROM %s",
 			    map->value_field, map->table);
 		sql_dict_where_build(dict, map, &values, key[0],
-				     SQL_DICT_RECURSE_NONE, query);
-		result = sql_query_s(dict->db, str_c(query));
+				     SQL_DICT_RECURSE_NONE, query, &params);
+		stmt = sql_dict_statement_init(dict, str_c(query),
+					       &params, TRUE);
+		result = sql_statement_query_s(&stmt);
 	} T_END;
 
 	ret = sql_result_next_row(result);
@@ -358,7 +408,10 @@ static bool sql_dict_iterate_next_query(struct sql_dict_iterate_context *ctx)
 
 	T_BEGIN {
 		string_t *query = t_str_new(256);
+		ARRAY_TYPE(const_string) params;
+		struct sql_statement *stmt;
 
+		t_array_init(&params, 8);
 		str_append(query, "SELECT ");
 		if ((ctx->flags & DICT_ITERATE_FLAG_NO_VALUE) == 0)
 			str_printfa(query, "%s,", map->value_field);
@@ -382,7 +435,7 @@ static bool sql_dict_iterate_next_query(struct sql_dict_iterate_context *ctx)
 			SQL_DICT_RECURSE_ONE : SQL_DICT_RECURSE_FULL;
 		sql_dict_where_build(dict, map, &values,
 				     ctx->paths[ctx->path_idx][0],
-				     recurse_type, query);
+				     recurse_type, query, &params);
 
 		if ((ctx->flags & DICT_ITERATE_FLAG_SORT_BY_KEY) != 0) {
 			str_append(query, " ORDER BY ");
@@ -393,7 +446,9 @@ static bool sql_dict_iterate_next_query(struct sql_dict_iterate_context *ctx)
 			}
 		} else if ((ctx->flags & DICT_ITERATE_FLAG_SORT_BY_VALUE) != 0)
 			str_printfa(query, " ORDER BY %s", map->value_field);
-		ctx->result = sql_query_s(dict->db, str_c(query));
+		stmt = sql_dict_statement_init(dict, str_c(query),
+					       &params, FALSE);
+		ctx->result = sql_statement_query_s(&stmt);
 	} T_END;
 
 	ctx->map = map;
@@ -647,7 +702,10 @@ sql_dict_update_query(const struct dict_sql_build_query *build)
 {
 	struct sql_dict *dict = build->dict;
 	const struct dict_sql_build_query_field *fields;
+	ARRAY_TYPE(const_string) params;
+	struct sql_statement *stmt;
 	unsigned int i, field_count;
+	const char *ret;
 	string_t *query;
 
 	i_assert(build->inc);
@@ -667,9 +725,15 @@ sql_dict_update_query(const struct dict_sql_build_query *build)
 		str_append(query, fields[i].value);
 	}
 
+	t_array_init(&params, 4);
 	sql_dict_where_build(dict, fields[0].map, build->extra_values,
-			     build->key1, SQL_DICT_RECURSE_NONE, query);
-	return str_c(query);
+			     build->key1, SQL_DICT_RECURSE_NONE, query, &params);
+	/* the number of affected rows is needed, so this can't be
+	   given as a statement */
+	stmt = sql_dict_statement_init(dict, str_c(query), &params, FALSE);
+	ret = sql_statement_get_query(stmt);
+	sql_statement_abort(&stmt);
+	return ret;
 }
 
 static void sql_dict_set(struct dict_transaction_context *_ctx,
@@ -732,11 +796,16 @@ static void sql_dict_unset(struct dict_transaction_context *_ctx,
 
 	T_BEGIN {
 		string_t *query = t_str_new(256);
+		ARRAY_TYPE(const_string) params;
+		struct sql_statement *stmt;
 
+		t_array_init(&params, 4);
 		str_printfa(query, "DELETE FROM %s", map->table);
 		sql_dict_where_build(dict, map, &values, key[0],
-				     SQL_DICT_RECURSE_NONE, query);
-		sql_update(ctx->sql_ctx, str_c(query));
+				     SQL_DICT_RECURSE_NONE, query, &params);
+		stmt = sql_dict_statement_init(dict, str_c(query),
+					       &params, FALSE);
+		sql_update_stmt(ctx->sql_ctx, &stmt);
 	} T_END;
 }
 
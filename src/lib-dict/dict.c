@@ -108,6 +108,106 @@ int dict_lookup(struct dict *dict, pool_t pool, const char *key,
 	return dict->v.lookup(dict, pool, key, value_r);
 }
 
+#undef dict_lookup_async
+void dict_lookup_async(struct dict *dict, const char *key,
+		       dict_lookup_callback_t *callback, void *context)
+{
+	struct dict_lookup_result result;
+
+	i_assert(dict_key_prefix_is_valid(key));
+
+	if (dict->v.lookup_async != NULL) {
+		dict->v.lookup_async(dict, key, callback, context);
+		return;
+	}
+
+	/* the driver doesn't support async lookups - do it synchronously */
+	memset(&result, 0, sizeof(result));
+	T_BEGIN {
+		result.ret = dict->v.lookup(dict, pool_datastack_create(),
+					    key, &result.value);
+		callback(&result, context);
+	} T_END;
+}
+
+struct dict_lookup_multi_value {
+	pool_t pool;
+	const char **value_r;
+	bool *failed_r;
+};
+
+static void
+dict_lookup_multi_callback(const struct dict_lookup_result *result,
+			   void *context)
+{
+	struct dict_lookup_multi_value *value = context;
+
+	if (result->ret < 0)
+		*value->failed_r = TRUE;
+	else if (result->ret > 0)
+		*value->value_r = p_strdup(value->pool, result->value);
+}
+
+static int
+dict_lookup_multi_async(struct dict *dict, pool_t pool,
+			const char *const *keys, const char **values_r)
+{
+	struct dict_lookup_multi_value *values;
+	pool_t value_pool;
+	unsigned int i, count = str_array_length(keys);
+	bool failed = FALSE;
+
+	/* the callbacks may be called in a different data stack frame, so
+	   the values can't be allocated from the caller's pool directly */
+	value_pool = pool_alloconly_create("dict lookup multi", 256);
+	values = p_new(value_pool, struct dict_lookup_multi_value, count);
+	for (i = 0; i < count; i++) {
+		values[i].pool = value_pool;
+		values[i].value_r = &values_r[i];
+		values[i].failed_r = &failed;
+		dict->v.lookup_async(dict, keys[i], dict_lookup_multi_callback,
+				     &values[i]);
+	}
+	if (dict_wait(dict) < 0)
+		failed = TRUE;
+
+	for (i = 0; i < count; i++)
+		values_r[i] = p_strdup(pool, values_r[i]);
+	pool_unref(&value_pool);
+	return failed ? -1 : 0;
+}
+
+int dict_lookup_multi(struct dict *dict, pool_t pool,
+		      const char *const *keys, const char **values_r)
+{
+	unsigned int i;
+	int ret, ret2;
+
+	for (i = 0; keys[i] != NULL; i++) {
+		i_assert(dict_key_prefix_is_valid(keys[i]));
+		values_r[i] = NULL;
+	}
+	if (i == 0)
+		return 0;
+
+	if (dict->v.lookup_multi != NULL)
+		return dict->v.lookup_multi(dict, pool, keys, values_r);
+	if (dict->v.lookup_async != NULL) {
+		/* pipeline the lookups */
+		return dict_lookup_multi_async(dict, pool, keys, values_r);
+	}
+	ret = 0;
+	for (i = 0; keys[i] != NULL; i++) {
+		ret2 = dict->v.lookup(dict, pool, keys[i], &values_r[i]);
+		if (ret2 <= 0) {
+			values_r[i] = NULL;
+			if (ret2 < 0)
+				ret = -1;
+		}
+	}
+	return ret;
+}
+
 struct dict_iterate_context *
 dict_iterate_init(struct dict *dict, const char *path, 
 		  enum dict_iterate_flags flags)
@@ -18,7 +18,16 @@ enum dict_data_type {
 	DICT_DATA_TYPE_UINT32
 };
 
+struct dict_lookup_result {
+	/* 1 if found, 0 if not found, -1 if lookup failed */
+	int ret;
+	/* the found value, or NULL */
+	const char *value;
+};
+
 typedef void dict_transaction_commit_callback_t(int ret, void *context);
+typedef void dict_lookup_callback_t(const struct dict_lookup_result *result,
+				    void *context);
 
 void dict_driver_register(struct dict *driver);
 void dict_driver_unregister(struct dict *driver);
@@ -36,14 +45,32 @@ int dict_init(const char *uri, enum dict_data_type value_type,
 	      const char **error_r);
 /* Close dictionary. */
 void dict_deinit(struct dict **dict);
-/* Wait for all pending asynchronous transaction commits to finish.
-   Returns 0 if ok, -1 if error. */
+/* Wait for all pending asynchronous lookups and transaction commits to
+   finish. Returns 0 if ok, -1 if error. */
 int dict_wait(struct dict *dict);
 
 /* Lookup value for key. Set it to NULL if it's not found.
    Returns 1 if found, 0 if not found and -1 if lookup failed. */
 int dict_lookup(struct dict *dict, pool_t pool,
 		const char *key, const char **value_r);
+/* Lookup value for key asynchronously. The callback is called once the reply
+   is available, which happens immediately with drivers that don't support
+   asynchronous lookups. The result is valid only during the callback. Many
+   lookups may be pending at the same time, and their callbacks may be called
+   in any order. Use dict_wait() to wait for all of them to finish. */
+void dict_lookup_async(struct dict *dict, const char *key,
+		       dict_lookup_callback_t *callback, void *context);
+#define dict_lookup_async(dict, key, callback, context) \
+	dict_lookup_async(dict, key + CALLBACK_TYPECHECK(callback, \
+		void (*)(const struct dict_lookup_result *, typeof(context))), \
+		(dict_lookup_callback_t *)callback, context)
+
+/* Lookup values for all the NULL-terminated keys. values_r[n] is set to the
+   value of keys[n], or NULL if it's not found. Drivers that support it do
+   this with a single roundtrip to the server. Returns 0 if ok, -1 if any of
+   the lookups failed. */
+int dict_lookup_multi(struct dict *dict, pool_t pool,
+		      const char *const *keys, const char **values_r);
 
 /* Iterate through all values in a path. flag indicates how iteration
    is carried out */
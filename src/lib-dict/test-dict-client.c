@@ -0,0 +1,216 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "str.h"
+#include "net.h"
+#include "write-full.h"
+#include "dict-private.h"
+#include "dict-client.h"
+#include "test-common.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define TEST_SOCKET_PATH ".test-dict-client.sock"
+
+struct test_lookup {
+	int ret;
+	char *value;
+};
+
+extern struct dict dict_driver_client;
+
+static void test_server_reply(int fd, const char *reply)
+{
+	if (write_full(fd, reply, strlen(reply)) < 0)
+		i_fatal("write() failed: %m");
+}
+
+static void ATTR_NORETURN
+test_server_run(int listen_fd, bool async_support)
+{
+	struct istream *input;
+	string_t *pending;
+	const char *line, *const *args;
+	unsigned int pending_count = 0;
+	int fd;
+
+	fd = accept(listen_fd, NULL, NULL);
+	if (fd < 0)
+		i_fatal("accept() failed: %m");
+	net_set_nonblock(fd, FALSE);
+	input = i_stream_create_fd(fd, (size_t)-1, FALSE);
+	pending = t_str_new(128);
+
+	/* the values tell which command the key was looked up with */
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		switch (*line++) {
+		case DICT_PROTOCOL_CMD_HELLO:
+			if (async_support) {
+				test_server_reply(fd, t_strdup_printf("H%u\t%u\n",
+					DICT_CLIENT_PROTOCOL_MAJOR_VERSION,
+					DICT_CLIENT_PROTOCOL_MINOR_VERSION));
+			}
+			break;
+		case DICT_PROTOCOL_CMD_LOOKUP:
+			if (strcmp(line, "priv/missing") == 0)
+				test_server_reply(fd, "N\n");
+			else {
+				test_server_reply(fd, t_strdup_printf(
+					"OL:%s\n", line));
+			}
+			break;
+		case DICT_PROTOCOL_CMD_LOOKUP_ASYNC:
+			if (!async_support)
+				_exit(1);
+			args = t_strsplit_tab(line);
+			/* reply to the async lookups two at a time in
+			   reverse order */
+			str_insert(pending, 0, t_strdup_printf(
+				"LO%s\tK:%s\n", args[0], args[1]));
+			if (++pending_count == 2) {
+				test_server_reply(fd, str_c(pending));
+				str_truncate(pending, 0);
+				pending_count = 0;
+			}
+			break;
+		default:
+			_exit(1);
+		}
+	}
+	_exit(pending_count == 0 ? 0 : 1);
+}
+
+static void
+test_lookup_callback(const struct dict_lookup_result *result,
+		     struct test_lookup *lookup)
+{
+	lookup->ret = result->ret;
+	lookup->value = result->value == NULL ? NULL :
+		i_strdup(result->value);
+}
+
+static struct dict *test_dict_init(bool async_support, pid_t *pid_r)
+{
+	struct dict *dict;
+	const char *error;
+	int fd;
+
+	(void)unlink(TEST_SOCKET_PATH);
+	fd = net_listen_unix(TEST_SOCKET_PATH, 1);
+	if (fd == -1)
+		i_fatal("net_listen_unix(%s) failed: %m", TEST_SOCKET_PATH);
+	if ((*pid_r = fork()) < 0)
+		i_fatal("fork() failed: %m");
+	if (*pid_r == 0) {
+		net_set_nonblock(fd, FALSE);
+		test_server_run(fd, async_support);
+	}
+	i_close_fd(&fd);
+
+	if (dict_init("proxy:"TEST_SOCKET_PATH":test", DICT_DATA_TYPE_STRING,
+		      "testuser", ".", &dict, &error) < 0)
+		i_fatal("dict_init() failed: %s", error);
+	return dict;
+}
+
+static void test_dict_deinit(struct dict **dict, pid_t pid)
+{
+	int status;
+
+	dict_deinit(dict);
+	test_assert(waitpid(pid, &status, 0) == pid);
+	test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	(void)unlink(TEST_SOCKET_PATH);
+}
+
+static void test_lookup_check(struct test_lookup *lookup, const char *value)
+{
+	test_assert(lookup->ret == 1);
+	test_assert(null_strcmp(lookup->value, value) == 0);
+	i_free_and_null(lookup->value);
+}
+
+static void test_dict_client_lookup_async(void)
+{
+	struct test_lookup lookups[5];
+	struct dict *dict;
+	const char *value;
+	pid_t pid;
+
+	test_begin("dict client async lookup");
+	dict = test_dict_init(TRUE, &pid);
+	memset(lookups, 0, sizeof(lookups));
+
+	/* the server's version isn't known before its first reply */
+	dict_lookup_async(dict, "priv/a", test_lookup_callback, &lookups[0]);
+	test_lookup_check(&lookups[0], "L:priv/a");
+
+	/* the replies come in reverse order */
+	dict_lookup_async(dict, "priv/b", test_lookup_callback, &lookups[1]);
+	dict_lookup_async(dict, "priv/c", test_lookup_callback, &lookups[2]);
+	test_assert(lookups[1].ret == 0 && lookups[2].ret == 0);
+	test_assert(dict_wait(dict) == 0);
+	test_lookup_check(&lookups[1], "K:priv/b");
+	test_lookup_check(&lookups[2], "K:priv/c");
+
+	/* sync lookups work between the async ones */
+	dict_lookup_async(dict, "priv/d", test_lookup_callback, &lookups[3]);
+	test_assert(dict_lookup(dict, pool_datastack_create(), "priv/missing",
+				&value) == 0);
+	dict_lookup_async(dict, "priv/e", test_lookup_callback, &lookups[4]);
+	test_assert(dict_wait(dict) == 0);
+	test_lookup_check(&lookups[3], "K:priv/d");
+	test_lookup_check(&lookups[4], "K:priv/e");
+
+	test_dict_deinit(&dict, pid);
+	test_end();
+}
+
+static void test_dict_client_lookup_async_old_server(void)
+{
+	struct test_lookup lookups[3];
+	struct dict *dict;
+	unsigned int i;
+	pid_t pid;
+
+	test_begin("dict client async lookup with old server");
+	dict = test_dict_init(FALSE, &pid);
+	memset(lookups, 0, sizeof(lookups));
+
+	/* the server doesn't support async lookups, so they're all done
+	   synchronously */
+	dict_lookup_async(dict, "priv/a", test_lookup_callback, &lookups[0]);
+	dict_lookup_async(dict, "priv/b", test_lookup_callback, &lookups[1]);
+	dict_lookup_async(dict, "priv/c", test_lookup_callback, &lookups[2]);
+	for (i = 0; i < N_ELEMENTS(lookups); i++)
+		test_assert(lookups[i].ret == 1);
+	test_assert(dict_wait(dict) == 0);
+	test_lookup_check(&lookups[0], "L:priv/a");
+	test_lookup_check(&lookups[1], "L:priv/b");
+	test_lookup_check(&lookups[2], "L:priv/c");
+
+	test_dict_deinit(&dict, pid);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_dict_client_lookup_async,
+		test_dict_client_lookup_async_old_server,
+		NULL
+	};
+	struct ioloop *ioloop;
+
+	test_init();
+	dict_driver_register(&dict_driver_client);
+	ioloop = io_loop_create();
+	test_run_funcs(test_functions);
+	io_loop_destroy(&ioloop);
+	dict_driver_unregister(&dict_driver_client);
+	return test_deinit();
+}
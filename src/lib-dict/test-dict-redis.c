@@ -0,0 +1,178 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "str.h"
+#include "net.h"
+#include "write-full.h"
+#include "dict-private.h"
+#include "test-common.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+static void test_server_reply(int fd, const char *reply)
+{
+	if (write_full(fd, reply, strlen(reply)) < 0)
+		i_fatal("write() failed: %m");
+}
+
+static void test_server_reply_value(string_t *reply, const char *prefix,
+				    const char *key)
+{
+	if (strstr(key, "missing") != NULL)
+		str_append(reply, "$-1\r\n");
+	else {
+		str_printfa(reply, "$%u\r\n%s%s\r\n",
+			    (unsigned int)(strlen(prefix) + strlen(key)),
+			    prefix, key);
+	}
+}
+
+static bool test_server_read_arg(struct istream *input, const char **arg_r)
+{
+	const char *line;
+
+	/* $<size> <arg> */
+	if ((line = i_stream_read_next_line(input)) == NULL || *line != '$' ||
+	    (line = i_stream_read_next_line(input)) == NULL)
+		return FALSE;
+	*arg_r = t_strdup(line);
+	return TRUE;
+}
+
+static void ATTR_NORETURN test_server_run(int listen_fd)
+{
+	struct istream *input;
+	string_t *reply;
+	const char *line, *cmd, *key;
+	unsigned int i, count;
+	int fd;
+
+	fd = accept(listen_fd, NULL, NULL);
+	if (fd < 0)
+		i_fatal("accept() failed: %m");
+	net_set_nonblock(fd, FALSE);
+	input = i_stream_create_fd(fd, (size_t)-1, FALSE);
+	reply = t_str_new(128);
+
+	/* only GET and MGET are expected. the values tell which one was
+	   used. */
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		if (*line != '*' || str_to_uint(line + 1, &count) < 0 ||
+		    count < 2 || !test_server_read_arg(input, &cmd))
+			_exit(1);
+		str_truncate(reply, 0);
+		if (strcmp(cmd, "MGET") == 0)
+			str_printfa(reply, "*%u\r\n", count - 1);
+		else if (strcmp(cmd, "GET") != 0 || count != 2)
+			_exit(1);
+		for (i = 1; i < count; i++) {
+			if (!test_server_read_arg(input, &key))
+				_exit(1);
+			test_server_reply_value(reply, count == 2 ?
+						"get:" : "mget:", key);
+		}
+		test_server_reply(fd, str_c(reply));
+	}
+	/* the client closed its only connection */
+	_exit(0);
+}
+
+static pid_t test_server_init(unsigned int *port_r)
+{
+	struct ip_addr ip;
+	pid_t pid;
+	int fd;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	*port_r = 0;
+	fd = net_listen(&ip, port_r, 1);
+	if (fd == -1)
+		i_fatal("net_listen() failed: %m");
+	if ((pid = fork()) < 0)
+		i_fatal("fork() failed: %m");
+	if (pid == 0) {
+		net_set_nonblock(fd, FALSE);
+		test_server_run(fd);
+	}
+	i_close_fd(&fd);
+	return pid;
+}
+
+static struct dict *test_dict_init(unsigned int port)
+{
+	struct dict *dict;
+	const char *error;
+
+	if (dict_init(t_strdup_printf("redis:host=127.0.0.1:port=%u:"
+				      "timeout_msecs=2000", port),
+		      DICT_DATA_TYPE_STRING, "testuser", ".",
+		      &dict, &error) < 0)
+		i_fatal("dict_init() failed: %s", error);
+	return dict;
+}
+
+static void test_dict_redis(void)
+{
+	static const char *keys[] = {
+		"shared/a", "shared/missing", "priv/b", NULL
+	};
+	const char *values[N_ELEMENTS(keys)-1], *value;
+	struct dict *dict;
+	unsigned int port;
+	int status;
+	pid_t pid;
+
+	test_begin("dict redis");
+	pid = test_server_init(&port);
+	dict = test_dict_init(port);
+
+	test_assert(dict_lookup(dict, pool_datastack_create(), "shared/a",
+				&value) == 1);
+	test_assert(null_strcmp(value, "get:a") == 0);
+	test_assert(dict_lookup(dict, pool_datastack_create(),
+				"priv/missing", &value) == 0);
+
+	/* multiple keys are looked up with a single MGET */
+	test_assert(dict_lookup_multi(dict, pool_datastack_create(),
+				      keys, values) == 0);
+	test_assert(null_strcmp(values[0], "mget:a") == 0);
+	test_assert(values[1] == NULL);
+	test_assert(null_strcmp(values[2], "mget:testuser/b") == 0);
+	dict_deinit(&dict);
+
+	/* the idle connection is reused. the server accepts only one
+	   connection, so a new one would time out. */
+	dict = test_dict_init(port);
+	test_assert(dict_lookup(dict, pool_datastack_create(), "shared/c",
+				&value) == 1);
+	test_assert(null_strcmp(value, "get:c") == 0);
+	dict_deinit(&dict);
+
+	/* the idle connection is closed */
+	dict_redis_idle_connections_deinit();
+	test_assert(waitpid(pid, &status, 0) == pid);
+	test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_dict_redis,
+		NULL
+	};
+	struct ioloop *ioloop;
+
+	test_init();
+	dict_driver_register(&dict_driver_redis);
+	ioloop = io_loop_create();
+	test_run_funcs(test_functions);
+	dict_driver_unregister(&dict_driver_redis);
+	io_loop_destroy(&ioloop);
+	return test_deinit();
+}
@@ -55,12 +55,28 @@ http_client_connection_count_pending(struct http_client_connection *conn)
 	return pending_count;
 }
 
+static bool
+http_client_connection_can_pipeline(struct http_client_connection *conn)
+{
+	struct http_client_request *const *reqs;
+	unsigned int count;
+
+	/* https://tools.ietf.org/html/rfc7230#section-6.3.2:
+
+	   A user agent SHOULD NOT pipeline requests after a non-idempotent
+	   method, until the final response status code for that method has
+	   been received. */
+	reqs = array_get(&conn->request_wait_list, &count);
+	return count == 0 || reqs[count-1]->idempotent;
+}
+
 bool http_client_connection_is_ready(struct http_client_connection *conn)
 {
 	return (conn->connected && !conn->output_locked &&
 		!conn->close_indicated && !conn->tunneling &&
 		http_client_connection_count_pending(conn) <
-			conn->client->set.max_pipelined_requests);
+			conn->client->set.max_pipelined_requests &&
+		http_client_connection_can_pipeline(conn));
 }
 
 bool http_client_connection_is_idle(struct http_client_connection *conn)
@@ -260,6 +276,7 @@ http_client_connection_continue_timeout(struct http_client_connection *conn)
 int http_client_connection_next_request(struct http_client_connection *conn)
 {
 	struct http_client_request *req = NULL;
+	struct http_client_stats stats;
 	const char *error;
 	bool have_pending_requests;
 
@@ -294,6 +311,16 @@ int http_client_connection_next_request(struct http_client_connection *conn)
 	array_append(&conn->request_wait_list, &req, 1);
 	http_client_request_ref(req);
 
+	memset(&stats, 0, sizeof(stats));
+	stats.requests_sent = 1;
+	stats.requests_reused = conn->requests_sent > 0 ? 1 : 0;
+	stats.requests_pipelined = have_pending_requests ? 1 : 0;
+	stats.queue_msecs = timeval_diff_msecs(&ioloop_timeval,
+					       &req->submit_time);
+	http_client_request_add_stats(req, &stats);
+	req->sent_time = ioloop_timeval;
+	conn->requests_sent++;
+
 	http_client_connection_debug(conn, "Claimed request %s",
 		http_client_request_label(req));
 
@@ -763,6 +790,7 @@ http_client_connection_start_tunnel(struct http_client_connection **_conn,
 static void 
 http_client_connection_ready(struct http_client_connection *conn)
 {
+	struct http_client_stats stats;
 	struct stat st;
 
 	/* connected */
@@ -774,6 +802,11 @@ http_client_connection_ready(struct http_client_connection *conn)
 
 	/* indicate connection success */
 	conn->connect_succeeded = TRUE;
+	memset(&stats, 0, sizeof(stats));
+	stats.connects = 1;
+	stats.connect_msecs = timeval_diff_msecs(&ioloop_timeval,
+						 &conn->connect_start_timestamp);
+	http_client_peer_add_stats(conn->peer, &stats);
 	http_client_peer_connection_success(conn->peer);
 
 	/* start raw log */
@@ -795,6 +828,7 @@ http_client_connection_ready(struct http_client_connection *conn)
 			http_client_request_ref(req);
 			req->conn = conn;
 			conn->tunneling = TRUE;
+			req->sent_time = ioloop_timeval;
 
 			memset(&response, 0, sizeof(response));
 			response.status = 200;
@@ -451,14 +451,14 @@ void http_client_peer_unlink_queue(struct http_client_peer *peer,
 }
 
 struct http_client_request *
-http_client_peer_claim_request(struct http_client_peer *peer, bool no_urgent)
+http_client_peer_claim_request(struct http_client_peer *peer, bool pipelined)
 {
 	struct http_client_queue *const *queue_idx;
 	struct http_client_request *req;
 
 	array_foreach(&peer->queues, queue_idx) {
 		if ((req=http_client_queue_claim_request
-			(*queue_idx, &peer->addr, no_urgent)) != NULL) {
+			(*queue_idx, &peer->addr, pipelined)) != NULL) {
 			req->peer = peer;
 			return req;
 		}
@@ -480,16 +480,31 @@ void http_client_peer_connection_success(struct http_client_peer *peer)
 	http_client_peer_trigger_request_handler(peer);
 }
 
+void http_client_peer_add_stats(struct http_client_peer *peer,
+				const struct http_client_stats *stats)
+{
+	struct http_client_queue *const *queue;
+
+	http_client_stats_add(&peer->client->stats, stats);
+	array_foreach(&peer->queues, queue)
+		http_client_stats_add(&(*queue)->host->stats, stats);
+}
+
 void http_client_peer_connection_failure(struct http_client_peer *peer,
 					 const char *reason)
 {
 	struct http_client_queue *const *queue;
+	struct http_client_stats stats;
 	unsigned int num_urgent;
 
 	i_assert(array_count(&peer->conns) > 0);
 
 	http_client_peer_debug(peer, "Failed to make connection");
 
+	memset(&stats, 0, sizeof(stats));
+	stats.connect_failures = 1;
+	http_client_peer_add_stats(peer, &stats);
+
 	peer->last_connect_failed = TRUE;
 	if (array_count(&peer->conns) > 1) {
 		/* if there are other connections attempting to connect, wait
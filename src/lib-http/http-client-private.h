@@ -71,6 +71,8 @@ struct http_client_request {
 	struct ostream *payload_output;
 
 	struct timeval release_time;
+	/* when the request was submitted and sent last time */
+	struct timeval submit_time, sent_time;
 
 	unsigned int attempts;
 	unsigned int redirects;
@@ -101,6 +103,7 @@ struct http_client_request {
 	unsigned int connect_tunnel:1;
 	unsigned int connect_direct:1;
 	unsigned int ssl_tunnel:1;
+	unsigned int idempotent:1;
 };
 
 struct http_client_connection {
@@ -128,6 +131,8 @@ struct http_client_connection {
 
 	/* requests that have been sent, waiting for response */
 	ARRAY_TYPE(http_client_request) request_wait_list;
+	/* number of requests sent over this connection */
+	unsigned int requests_sent;
 
 	unsigned int connected:1;           /* connection is connected */
 	unsigned int tunneling:1;          /* last sent request turns this
@@ -208,6 +213,8 @@ struct http_client_host {
 
 	/* active DNS lookup */
 	struct dns_lookup *dns_lookup;
+
+	struct http_client_stats stats;
 };
 
 struct http_client {
@@ -225,9 +232,13 @@ struct http_client {
 	HASH_TABLE_TYPE(http_client_peer) peers;
 	struct http_client_peer *peers_list;
 	unsigned int pending_requests;
+
+	struct http_client_stats stats;
 };
 
 int http_client_init_ssl_ctx(struct http_client *client, const char **error_r);
+void http_client_stats_add(struct http_client_stats *dest,
+			   const struct http_client_stats *src);
 
 void http_client_request_ref(struct http_client_request *req);
 void http_client_request_unref(struct http_client_request **_req);
@@ -235,6 +246,8 @@ int http_client_request_delay_from_response(struct http_client_request *req,
 	const struct http_response *response);
 enum http_response_payload_type
 http_client_request_get_payload_type(struct http_client_request *req);
+void http_client_request_add_stats(struct http_client_request *req,
+				   const struct http_client_stats *stats);
 int http_client_request_send(struct http_client_request *req,
 			    const char **error_r);
 int http_client_request_send_more(struct http_client_request *req,
@@ -291,9 +304,11 @@ void http_client_peer_unlink_queue(struct http_client_peer *peer,
 				struct http_client_queue *queue);
 struct http_client_request *
 	http_client_peer_claim_request(struct http_client_peer *peer,
-		bool no_urgent);
+		bool pipelined);
 void http_client_peer_trigger_request_handler(struct http_client_peer *peer);
 void http_client_peer_connection_success(struct http_client_peer *peer);
+void http_client_peer_add_stats(struct http_client_peer *peer,
+				const struct http_client_stats *stats);
 void http_client_peer_connection_failure(struct http_client_peer *peer,
 					 const char *reason);
 void http_client_peer_connection_lost(struct http_client_peer *peer);
@@ -315,7 +330,8 @@ http_client_queue_drop_request(struct http_client_queue *queue,
 	struct http_client_request *req);
 struct http_client_request *
 http_client_queue_claim_request(struct http_client_queue *queue,
-	const struct http_client_peer_addr *addr, bool no_urgent);
+	const struct http_client_peer_addr *addr, bool pipelined);
+unsigned int http_client_queue_count(struct http_client_queue *queue);
 unsigned int
 http_client_queue_requests_pending(struct http_client_queue *queue,
 	unsigned int *num_urgent_r);
@@ -416,7 +416,7 @@ void http_client_queue_submit_request(struct http_client_queue *queue,
 
 struct http_client_request *
 http_client_queue_claim_request(struct http_client_queue *queue,
-	const struct http_client_peer_addr *addr, bool no_urgent)
+	const struct http_client_peer_addr *addr, bool pipelined)
 {
 	struct http_client_request *const *requests;
 	struct http_client_request *req;
@@ -426,13 +426,20 @@ http_client_queue_claim_request(struct http_client_queue *queue,
 	if (count == 0)
 		return NULL;
 	i = 0;
-	if (requests[0]->urgent && no_urgent) {
+	if (requests[0]->urgent && pipelined) {
+		/* no urgent request can be second in line */
 		for (; requests[i]->urgent; i++) {
 			if (i == count)
 				return NULL;
 		}
 	}
 	req = requests[i];
+	if (pipelined && !req->idempotent) {
+		/* wait for an idle connection, so the request isn't sent
+		   twice if the connection is lost while it's in the
+		   pipeline. don't reorder the requests either. */
+		return NULL;
+	}
 	array_delete(&queue->request_queue, i, 1);
 
 	http_client_queue_debug(queue,
@@ -443,6 +450,12 @@ http_client_queue_claim_request(struct http_client_queue *queue,
 	return req;
 }
 
+unsigned int http_client_queue_count(struct http_client_queue *queue)
+{
+	return array_count(&queue->request_queue) +
+		array_count(&queue->delayed_request_queue);
+}
+
 unsigned int
 http_client_queue_requests_pending(struct http_client_queue *queue,
 	unsigned int *num_urgent_r)
@@ -5,10 +5,13 @@
 #include "str.h"
 #include "hash.h"
 #include "array.h"
+#include "ioloop.h"
 #include "istream.h"
 #include "ostream.h"
+#include "time-util.h"
 #include "http-url.h"
 #include "http-date.h"
+#include "http-request.h"
 #include "http-response-parser.h"
 #include "http-transfer.h"
 
@@ -64,6 +67,7 @@ http_client_request_new(struct http_client *client, const char *method,
 	req->refcount = 1;
 	req->client = client;
 	req->method = p_strdup(pool, method);
+	req->idempotent = http_request_method_is_idempotent(method);
 	req->callback = callback;
 	req->context = context;
 	req->date = (time_t)-1;
@@ -425,6 +429,7 @@ static void http_client_request_do_submit(struct http_client_request *req)
 void http_client_request_submit(struct http_client_request *req)
 {
 	req->client->pending_requests++;
+	req->submit_time = ioloop_timeval;
 
 	http_client_request_do_submit(req);
 	http_client_request_debug(req, "Submitted");
@@ -736,14 +741,31 @@ int http_client_request_send(struct http_client_request *req,
 	return ret;
 }
 
+void http_client_request_add_stats(struct http_client_request *req,
+				   const struct http_client_stats *stats)
+{
+	http_client_stats_add(&req->client->stats, stats);
+	if (req->host != NULL)
+		http_client_stats_add(&req->host->stats, stats);
+}
+
 bool http_client_request_callback(struct http_client_request *req,
 			     struct http_response *response)
 {
 	http_client_request_callback_t *callback = req->callback;
 	unsigned int orig_attempts = req->attempts;
+	struct http_client_stats stats;
 
 	req->state = HTTP_REQUEST_STATE_GOT_RESPONSE;
 
+	memset(&stats, 0, sizeof(stats));
+	stats.responses = 1;
+	stats.first_byte_msecs =
+		timeval_diff_msecs(&ioloop_timeval, &req->sent_time);
+	stats.response_msecs =
+		timeval_diff_msecs(&ioloop_timeval, &req->submit_time);
+	http_client_request_add_stats(req, &stats);
+
 	req->callback = NULL;
 	if (callback != NULL) {
 		callback(response, req->context);
@@ -766,11 +788,16 @@ http_client_request_send_error(struct http_client_request *req,
 			       unsigned int status, const char *error)
 {
 	http_client_request_callback_t *callback;
+	struct http_client_stats stats;
 
 	if (req->state >= HTTP_REQUEST_STATE_FINISHED)
 		return;
 	req->state = HTTP_REQUEST_STATE_ABORTED;
 
+	memset(&stats, 0, sizeof(stats));
+	stats.failures = 1;
+	http_client_request_add_stats(req, &stats);
+
 	callback = req->callback;
 	req->callback = NULL;
 	if (callback != NULL) {
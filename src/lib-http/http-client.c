@@ -228,6 +228,60 @@ unsigned int http_client_get_pending_request_count(struct http_client *client)
 	return client->pending_requests;
 }
 
+void http_client_stats_add(struct http_client_stats *dest,
+			   const struct http_client_stats *src)
+{
+	dest->requests_sent += src->requests_sent;
+	dest->requests_reused += src->requests_reused;
+	dest->requests_pipelined += src->requests_pipelined;
+	dest->responses += src->responses;
+	dest->failures += src->failures;
+	dest->connects += src->connects;
+	dest->connect_failures += src->connect_failures;
+	dest->connect_msecs += src->connect_msecs;
+	dest->queue_msecs += src->queue_msecs;
+	dest->first_byte_msecs += src->first_byte_msecs;
+	dest->response_msecs += src->response_msecs;
+}
+
+static unsigned int
+http_client_host_count_queued(struct http_client_host *host)
+{
+	struct http_client_queue *const *queue_idx;
+	unsigned int count = 0;
+
+	array_foreach(&host->queues, queue_idx)
+		count += http_client_queue_count(*queue_idx);
+	return count;
+}
+
+void http_client_get_stats(struct http_client *client,
+			   struct http_client_stats *stats_r)
+{
+	struct http_client_host *host;
+
+	*stats_r = client->stats;
+	stats_r->queued_requests = 0;
+	for (host = client->hosts_list; host != NULL; host = host->next)
+		stats_r->queued_requests += http_client_host_count_queued(host);
+}
+
+bool http_client_get_host_stats(struct http_client *client,
+				const char *host_name,
+				struct http_client_stats *stats_r)
+{
+	struct http_client_host *host;
+
+	host = hash_table_lookup(client->hosts, host_name);
+	if (host == NULL) {
+		memset(stats_r, 0, sizeof(*stats_r));
+		return FALSE;
+	}
+	*stats_r = host->stats;
+	stats_r->queued_requests = http_client_host_count_queued(host);
+	return TRUE;
+}
+
 int http_client_init_ssl_ctx(struct http_client *client, const char **error_r)
 {
 	struct ssl_iostream_settings ssl_set;
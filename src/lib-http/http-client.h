@@ -63,7 +63,9 @@ struct http_client_settings {
 	/* maximum number of parallel connections per peer (default = 1) */
 	unsigned int max_parallel_connections;
 
-	/* maximum number of pipelined requests per connection (default = 1) */
+	/* maximum number of pipelined requests per connection (default = 1).
+	   only idempotent requests are pipelined, and nothing is pipelined
+	   after a non-idempotent request until its response is received. */
 	unsigned int max_pipelined_requests;
 
 	/* don't automatically act upon redirect responses */
@@ -110,6 +112,33 @@ struct http_client_tunnel {
 	struct ostream *output;
 };
 
+struct http_client_stats {
+	/* number of requests currently waiting in queues for a connection */
+	unsigned int queued_requests;
+
+	/* number of requests sent to server (including retries), how many of
+	   them were sent over a connection that had already been used for
+	   earlier requests and how many were pipelined behind requests still
+	   waiting for a response */
+	unsigned int requests_sent, requests_reused, requests_pipelined;
+	/* number of requests that got a response / failed without one */
+	unsigned int responses, failures;
+	/* number of connections established / failed to be established */
+	unsigned int connects, connect_failures;
+
+	/* total time in milliseconds spent on establishing connections */
+	uint64_t connect_msecs;
+	/* total time in milliseconds requests spent waiting in the queue
+	   before they were sent */
+	uint64_t queue_msecs;
+	/* total time in milliseconds between sending requests and receiving
+	   their response headers (time-to-first-byte) */
+	uint64_t first_byte_msecs;
+	/* total time in milliseconds between submitting requests and
+	   receiving their response headers */
+	uint64_t response_msecs;
+};
+
 typedef void
 http_client_request_callback_t(const struct http_response *response,
 			       void *context);
@@ -214,4 +243,13 @@ void http_client_wait(struct http_client *client);
 /* Returns number of pending HTTP requests. */
 unsigned int http_client_get_pending_request_count(struct http_client *client);
 
+/* Get statistics of all the requests made by this client. */
+void http_client_get_stats(struct http_client *client,
+			   struct http_client_stats *stats_r);
+/* Get statistics of the requests made to the given host. Returns FALSE if
+   the client hasn't made any requests to it. */
+bool http_client_get_host_stats(struct http_client *client,
+				const char *host_name,
+				struct http_client_stats *stats_r);
+
 #endif
@@ -4,6 +4,20 @@
 
 #include "http-request.h"
 
+bool http_request_method_is_idempotent(const char *method)
+{
+	static const char *const idempotent_methods[] = {
+		"GET", "HEAD", "PUT", "DELETE", "OPTIONS", "TRACE"
+	};
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(idempotent_methods); i++) {
+		if (strcmp(method, idempotent_methods[i]) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
 bool http_request_has_connection_option(const struct http_request *req,
 	const char *option)
 {
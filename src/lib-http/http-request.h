@@ -76,6 +76,10 @@ http_request_header_get_fields(const struct http_request *req)
 	return http_header_get_fields(req->header);
 }
 
+/* Returns TRUE if the method is idempotent (RFC 7231, 4.2.2), i.e. sending
+   the request multiple times has the same effect as sending it once. */
+bool http_request_method_is_idempotent(const char *method);
+
 bool http_request_has_connection_option(const struct http_request *req,
 	const char *option);
 int http_request_get_payload_size(const struct http_request *req,
@@ -12,6 +12,7 @@
 #include "mail-cache-private.h"
 
 #include <unistd.h>
+#include <sys/time.h>
 
 #define MAIL_CACHE_MIN_HEADER_READ_SIZE 4096
 
@@ -321,6 +322,7 @@ static int
 mail_cache_map_with_read(struct mail_cache *cache, size_t offset, size_t size,
 			 const void **data_r)
 {
+	struct timeval start_time;
 	const void *hdr_data;
 	void *data;
 	ssize_t ret;
@@ -346,7 +348,10 @@ mail_cache_map_with_read(struct mail_cache *cache, size_t offset, size_t size,
 	}
 
 	data = buffer_append_space_unsafe(cache->read_buf, size);
+	(void)gettimeofday(&start_time, NULL);
 	ret = pread(cache->fd, data, size, offset);
+	mail_index_io_stats_add(MAIL_INDEX_IO_TYPE_CACHE, ret > 0 ? ret : 0,
+				&start_time);
 	if (ret < 0) {
 		if (errno != ESTALE)
 			mail_cache_set_syscall_error(cache, "read()");
@@ -371,6 +376,7 @@ int mail_cache_map(struct mail_cache *cache, size_t offset, size_t size,
 		   const void **data_r)
 {
 	struct stat st;
+	struct timeval start_time;
 	const void *data;
 	ssize_t ret;
 
@@ -399,7 +405,10 @@ int mail_cache_map(struct mail_cache *cache, size_t offset, size_t size,
 		return mail_cache_map_with_read(cache, offset, size, data_r);
 
 	if (cache->file_cache != NULL) {
+		(void)gettimeofday(&start_time, NULL);
 		ret = file_cache_read(cache->file_cache, offset, size);
+		mail_index_io_stats_add(MAIL_INDEX_IO_TYPE_CACHE,
+					ret > 0 ? ret : 0, &start_time);
 		if (ret < 0) {
                         /* In case of ESTALE we'll simply fail without error
                            messages. The caller will then just have to
@@ -447,7 +456,10 @@ int mail_cache_map(struct mail_cache *cache, size_t offset, size_t size,
 	cache->hdr = NULL;
 	cache->mmap_length = 0;
 
+	(void)gettimeofday(&start_time, NULL);
 	cache->mmap_base = mmap_ro_file(cache->fd, &cache->mmap_length);
+	/* mmap() itself doesn't read anything */
+	mail_index_io_stats_add(MAIL_INDEX_IO_TYPE_CACHE, 0, &start_time);
 	if (cache->mmap_base == MAP_FAILED) {
 		cache->mmap_base = NULL;
 		cache->mmap_length = 0;
@@ -582,6 +594,7 @@ void mail_cache_free(struct mail_cache **_cache)
 
 static int mail_cache_lock_file(struct mail_cache *cache, bool nonblock)
 {
+	struct timeval start_time;
 	unsigned int timeout_secs;
 	int ret;
 
@@ -605,9 +618,12 @@ static int mail_cache_lock_file(struct mail_cache *cache, bool nonblock)
 			nonblock ? DOTLOCK_CREATE_FLAG_NONBLOCK : 0;
 
 		i_assert(cache->dotlock == NULL);
+		(void)gettimeofday(&start_time, NULL);
 		ret = file_dotlock_create(&cache->dotlock_settings,
 					  cache->filepath, flags,
 					  &cache->dotlock);
+		mail_index_io_stats_add(MAIL_INDEX_IO_TYPE_LOCK_WAIT, 0,
+					&start_time);
 		if (ret < 0) {
 			mail_cache_set_syscall_error(cache,
 						     "file_dotlock_create()");
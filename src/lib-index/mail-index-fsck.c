@@ -415,6 +415,10 @@ mail_index_fsck_map(struct mail_index *index, struct mail_index_map *map)
 	}
 	hdr = map->hdr;
 
+	/* records that can't be read are zero-filled, which makes
+	   mail_index_fsck_records() drop them */
+	(void)mail_index_record_map_page_in_all(map->rec_map);
+
 	mail_index_fsck_header(index, map, &hdr);
 	mail_index_fsck_extensions(index, map, &hdr);
 	mail_index_fsck_records(index, map, &hdr);
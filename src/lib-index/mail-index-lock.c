@@ -21,19 +21,27 @@
 #include "nfs-workarounds.h"
 #include "mail-index-private.h"
 
+#include <sys/time.h>
+
 #define MAIL_INDEX_SHARED_LOCK_TIMEOUT 120
 
 int mail_index_lock_fd(struct mail_index *index, const char *path, int fd,
 		       int lock_type, unsigned int timeout_secs,
 		       struct file_lock **lock_r)
 {
+	struct timeval start_time;
+	int ret;
+
 	if (fd == -1) {
 		i_assert(MAIL_INDEX_IS_IN_MEMORY(index));
 		return 1;
 	}
 
-	return file_wait_lock(fd, path, lock_type, index->lock_method,
-			      timeout_secs, lock_r);
+	(void)gettimeofday(&start_time, NULL);
+	ret = file_wait_lock(fd, path, lock_type, index->lock_method,
+			     timeout_secs, lock_r);
+	mail_index_io_stats_add(MAIL_INDEX_IO_TYPE_LOCK_WAIT, 0, &start_time);
+	return ret;
 }
 
 void mail_index_flush_read_cache(struct mail_index *index, const char *path,
@@ -5,10 +5,13 @@
 #include "nfs-workarounds.h"
 #include "mmap-util.h"
 #include "read-full.h"
+#include "ostream.h"
 #include "mail-index-private.h"
 #include "mail-index-sync-private.h"
 #include "mail-transaction-log-private.h"
 
+#include <sys/time.h>
+
 static void mail_index_map_copy_hdr(struct mail_index_map *map,
 				    const struct mail_index_header *hdr)
 {
@@ -95,6 +98,326 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 	return 1;
 }
 
+struct mail_index_map_pages {
+	struct mail_index *index;
+	/* dup()ed index fd, or -1 after all pages have been read. The index
+	   file is always replaced by rename(), so this keeps pointing to the
+	   same file we read the header from. */
+	int fd;
+
+	uoff_t records_offset;
+	unsigned int record_size;
+	/* number of records that are read from the file. Records appended
+	   after them are in rec_map->buffer. */
+	unsigned int records_count;
+	unsigned int page_records;
+	unsigned int pages_left;
+
+	/* page => records. Allocated when the page is first accessed. */
+	ARRAY(void *) page_data;
+	/* bitmask of pages that have been successfully read */
+	buffer_t *paged_in;
+};
+
+static void
+mail_index_record_map_pages_init(struct mail_index_map *map,
+				 const struct mail_index_header *hdr,
+				 unsigned int records_count, int fd)
+{
+	struct mail_index_map_pages *pages;
+	unsigned int page_count;
+
+	i_assert(map->rec_map->pages == NULL);
+	i_assert(records_count > 0 && hdr->record_size > 0);
+
+	pages = i_new(struct mail_index_map_pages, 1);
+	pages->index = map->index;
+	pages->fd = fd;
+	pages->records_offset = hdr->header_size;
+	pages->record_size = hdr->record_size;
+	pages->records_count = records_count;
+	pages->page_records = MAIL_INDEX_MAP_PAGE_SIZE / hdr->record_size;
+	if (pages->page_records == 0)
+		pages->page_records = 1;
+	page_count = (records_count + pages->page_records - 1) /
+		pages->page_records;
+	pages->pages_left = page_count;
+	i_array_init(&pages->page_data, page_count);
+	array_idx_clear(&pages->page_data, page_count - 1);
+	pages->paged_in = buffer_create_dynamic(default_pool,
+						(page_count + 7) / 8);
+	buffer_append_zero(pages->paged_in, (page_count + 7) / 8);
+	map->rec_map->pages = pages;
+}
+
+void mail_index_record_map_pages_free(struct mail_index_record_map *rec_map)
+{
+	struct mail_index_map_pages *pages = rec_map->pages;
+	void **datap;
+
+	if (pages == NULL)
+		return;
+
+	rec_map->pages = NULL;
+	array_foreach_modifiable(&pages->page_data, datap)
+		i_free(*datap);
+	array_free(&pages->page_data);
+	if (pages->fd != -1) {
+		if (close(pages->fd) < 0)
+			mail_index_set_syscall_error(pages->index, "close()");
+	}
+	buffer_free(&pages->paged_in);
+	i_free(pages);
+}
+
+void mail_index_record_map_pages_clone(struct mail_index_record_map *dest,
+				       const struct mail_index_record_map *src)
+{
+	const struct mail_index_map_pages *src_pages = src->pages;
+	struct mail_index_map_pages *pages;
+	void *const *src_data, *data;
+	unsigned int i, count, size;
+
+	i_assert(dest->pages == NULL);
+
+	if (src_pages == NULL)
+		return;
+
+	pages = i_new(struct mail_index_map_pages, 1);
+	*pages = *src_pages;
+	if (src_pages->fd != -1) {
+		pages->fd = dup(src_pages->fd);
+		if (pages->fd == -1)
+			mail_index_set_syscall_error(src_pages->index, "dup()");
+	}
+
+	/* copy only the pages that have been accessed */
+	src_data = array_get(&src_pages->page_data, &count);
+	i_array_init(&pages->page_data, count);
+	array_idx_clear(&pages->page_data, count - 1);
+	for (i = 0; i < count; i++) {
+		if (src_data[i] == NULL)
+			continue;
+		size = I_MIN(pages->page_records,
+			     pages->records_count - i * pages->page_records) *
+			pages->record_size;
+		data = i_malloc(size);
+		memcpy(data, src_data[i], size);
+		array_idx_set(&pages->page_data, i, &data);
+	}
+	pages->paged_in = buffer_create_dynamic(default_pool,
+						src_pages->paged_in->used);
+	buffer_append_buf(pages->paged_in, src_pages->paged_in,
+			  0, (size_t)-1);
+	dest->pages = pages;
+}
+
+unsigned int
+mail_index_record_map_paged_count(const struct mail_index_record_map *rec_map)
+{
+	return rec_map->pages == NULL ? 0 : rec_map->pages->records_count;
+}
+
+static void
+mail_index_record_map_set_corrupted(struct mail_index_record_map *rec_map)
+{
+	struct mail_index *index = rec_map->pages->index;
+	struct mail_index_map *const *mapp;
+
+	/* the records we have can't be trusted anymore. this prevents
+	   syncing and writing the index until it's reopened and the file is
+	   read again. */
+	array_foreach(&rec_map->maps, mapp)
+		(*mapp)->hdr.flags |= MAIL_INDEX_HDR_FLAG_CORRUPTED;
+	if (index->map != NULL)
+		index->map->hdr.flags |= MAIL_INDEX_HDR_FLAG_CORRUPTED;
+}
+
+static bool
+mail_index_map_pages_is_read(const struct mail_index_map_pages *pages,
+			     unsigned int page)
+{
+	const unsigned char *bits = pages->paged_in->data;
+
+	return (bits[page / 8] & (1 << (page % 8))) != 0;
+}
+
+static size_t
+mail_index_map_pages_get_size(const struct mail_index_map_pages *pages,
+			      unsigned int page)
+{
+	unsigned int first_idx = page * pages->page_records;
+
+	return (size_t)I_MIN(pages->page_records,
+			     pages->records_count - first_idx) *
+		pages->record_size;
+}
+
+static int
+mail_index_map_pages_pread(struct mail_index_map_pages *pages,
+			   unsigned int page, void *data, size_t size)
+{
+	struct timeval start_time;
+	ssize_t ret;
+
+	(void)gettimeofday(&start_time, NULL);
+	ret = pread_full(pages->fd, data, size, pages->records_offset +
+			 (uoff_t)page * pages->page_records *
+			 pages->record_size);
+	mail_index_io_stats_add(MAIL_INDEX_IO_TYPE_INDEX, ret > 0 ? size : 0,
+				&start_time);
+	if (ret <= 0) {
+		if (ret < 0) {
+			mail_index_set_syscall_error(pages->index,
+						     "pread_full()");
+		} else {
+			mail_index_set_error(pages->index,
+				"Corrupted index file %s: "
+				"File shrank while reading",
+				pages->index->filepath);
+		}
+		return -1;
+	}
+	return 0;
+}
+
+static int
+mail_index_record_map_read_page(struct mail_index_map_pages *pages,
+				unsigned int page)
+{
+	void **datap;
+	unsigned char *bits;
+	size_t size;
+
+	size = mail_index_map_pages_get_size(pages, page);
+	datap = array_idx_modifiable(&pages->page_data, page);
+	if (*datap == NULL)
+		*datap = i_malloc(size);
+	if (mail_index_map_pages_pread(pages, page, *datap, size) < 0) {
+		/* don't leave a partially read page behind. it's read again
+		   the next time it's accessed. */
+		memset(*datap, 0, size);
+		return -1;
+	}
+
+	bits = buffer_get_modifiable_data(pages->paged_in, NULL);
+	bits[page / 8] |= 1 << (page % 8);
+	if (--pages->pages_left == 0) {
+		/* everything is in memory, we don't need the file anymore */
+		if (close(pages->fd) < 0)
+			mail_index_set_syscall_error(pages->index, "close()");
+		pages->fd = -1;
+	}
+	return 0;
+}
+
+void *mail_index_record_map_get_paged(struct mail_index_record_map *rec_map,
+				      unsigned int idx)
+{
+	struct mail_index_map_pages *pages = rec_map->pages;
+	void *const *datap;
+	unsigned int page;
+
+	if (idx >= pages->records_count) {
+		/* appended after the file was read */
+		return PTR_OFFSET(rec_map->records,
+				  (idx - pages->records_count) *
+				  pages->record_size);
+	}
+
+	page = idx / pages->page_records;
+	if (!mail_index_map_pages_is_read(pages, page)) {
+		if (mail_index_record_map_read_page(pages, page) < 0)
+			mail_index_record_map_set_corrupted(rec_map);
+	}
+	datap = array_idx(&pages->page_data, page);
+	return PTR_OFFSET(*datap,
+			  (idx % pages->page_records) * pages->record_size);
+}
+
+int mail_index_record_map_page_in_all(struct mail_index_record_map *rec_map)
+{
+	struct mail_index_map_pages *pages = rec_map->pages;
+	buffer_t *buffer;
+	void *const *datap;
+	unsigned int page, page_count;
+	int ret = 0;
+
+	if (pages == NULL)
+		return 0;
+
+	buffer = buffer_create_dynamic(default_pool,
+				       rec_map->records_count *
+				       pages->record_size);
+	datap = array_get(&pages->page_data, &page_count);
+	for (page = 0; page < page_count; page++) {
+		if (!mail_index_map_pages_is_read(pages, page)) {
+			if (mail_index_record_map_read_page(pages, page) < 0)
+				ret = -1;
+		}
+		buffer_append(buffer, datap[page],
+			      I_MIN(pages->page_records, pages->records_count -
+				    page * pages->page_records) *
+			      pages->record_size);
+	}
+	buffer_append_buf(buffer, rec_map->buffer, 0, (size_t)-1);
+
+	if (ret < 0)
+		mail_index_record_map_set_corrupted(rec_map);
+	buffer_free(&rec_map->buffer);
+	rec_map->buffer = buffer;
+	rec_map->records = buffer_get_modifiable_data(buffer, NULL);
+	mail_index_record_map_pages_free(rec_map);
+	return ret;
+}
+
+int mail_index_record_map_write(struct mail_index_record_map *rec_map,
+				unsigned int record_size,
+				struct ostream *output)
+{
+	struct mail_index_map_pages *pages = rec_map->pages;
+	void *const *datap;
+	buffer_t *buf;
+	unsigned int page, page_count;
+	size_t size;
+	int ret = 0;
+
+	if (pages == NULL) {
+		o_stream_nsend(output, rec_map->records,
+			       rec_map->records_count * record_size);
+		return 0;
+	}
+	i_assert(pages->record_size == record_size);
+	i_assert(rec_map->records_count >= pages->records_count);
+
+	/* the pages that haven't been read yet are copied from the file
+	   without keeping them. they aren't paged in, since the map may be
+	   shared with views and large indexes would be read fully. */
+	buf = buffer_create_dynamic(default_pool, MAIL_INDEX_MAP_PAGE_SIZE);
+	datap = array_get(&pages->page_data, &page_count);
+	for (page = 0; page < page_count && ret == 0; page++) {
+		size = mail_index_map_pages_get_size(pages, page);
+		if (mail_index_map_pages_is_read(pages, page)) {
+			o_stream_nsend(output, datap[page], size);
+			continue;
+		}
+		buffer_set_used_size(buf, 0);
+		if (mail_index_map_pages_pread(pages, page,
+				buffer_append_space_unsafe(buf, size),
+				size) < 0) {
+			mail_index_record_map_set_corrupted(rec_map);
+			ret = -1;
+		} else {
+			o_stream_nsend(output, buf->data, size);
+		}
+	}
+	buffer_free(&buf);
+	o_stream_nsend(output, rec_map->records,
+		       (rec_map->records_count - pages->records_count) *
+		       record_size);
+	return ret;
+}
+
 static int mail_index_read_header(struct mail_index *index,
 				  void *buf, size_t buf_size, size_t *pos_r)
 {
@@ -120,8 +443,9 @@ static int mail_index_read_header(struct mail_index *index,
 }
 
 static int
-mail_index_try_read_map(struct mail_index_map *map,
-			uoff_t file_size, bool *retry_r, bool try_retry)
+mail_index_try_read_map(struct mail_index_map *map, uoff_t file_size,
+			bool paged, uoff_t *read_bytes, bool *retry_r,
+			bool try_retry)
 {
 	struct mail_index *index = map->index;
 	const struct mail_index_header *hdr;
@@ -131,11 +455,13 @@ mail_index_try_read_map(struct mail_index_map *map,
 	ssize_t ret;
 	size_t pos, records_size, initial_buf_pos = 0;
 	unsigned int records_count = 0, extra;
+	int paged_fd = -1;
 
 	i_assert(map->rec_map->mmap_base == NULL);
 
 	*retry_r = FALSE;
 	ret = mail_index_read_header(index, read_buf, sizeof(read_buf), &pos);
+	*read_bytes += pos;
 	buf = read_buf; hdr = buf;
 
 	if (pos > (ssize_t)offsetof(struct mail_index_header, major_version) &&
@@ -166,6 +492,8 @@ mail_index_try_read_map(struct mail_index_map *map,
 							  pos);
 			ret = pread_full(index->fd, data,
 					 hdr->header_size - pos, pos);
+			if (ret > 0)
+				*read_bytes += hdr->header_size - pos;
 		}
 	}
 
@@ -185,16 +513,30 @@ mail_index_try_read_map(struct mail_index_map *map,
 				index->filepath, hdr->messages_count,
 				records_count);
 		}
+		if (records_size == 0)
+			paged = FALSE;
+		else if (paged) {
+			paged_fd = dup(index->fd);
+			if (paged_fd == -1) {
+				/* just read everything now */
+				mail_index_set_syscall_error(index, "dup()");
+				paged = FALSE;
+			}
+		}
 
 		if (map->rec_map->buffer == NULL) {
 			map->rec_map->buffer =
 				buffer_create_dynamic(default_pool,
+						      paged ? 1024 :
 						      records_size);
 		}
 
 		/* @UNSAFE */
 		buffer_set_used_size(map->rec_map->buffer, 0);
-		if (initial_buf_pos <= hdr->header_size)
+		if (paged) {
+			/* the records are read when they're accessed */
+			extra = records_size;
+		} else if (initial_buf_pos <= hdr->header_size)
 			extra = 0;
 		else {
 			extra = initial_buf_pos - hdr->header_size;
@@ -207,6 +549,8 @@ mail_index_try_read_map(struct mail_index_map *map,
 							  records_size - extra);
 			ret = pread_full(index->fd, data, records_size - extra,
 					 hdr->header_size + extra);
+			if (ret > 0)
+				*read_bytes += records_size - extra;
 		}
 	}
 
@@ -229,13 +573,18 @@ mail_index_try_read_map(struct mail_index_map *map,
 	map->rec_map->records =
 		buffer_get_modifiable_data(map->rec_map->buffer, NULL);
 	map->rec_map->records_count = records_count;
+	if (paged) {
+		mail_index_record_map_pages_init(map, hdr, records_count,
+						 paged_fd);
+	}
 
 	mail_index_map_copy_hdr(map, hdr);
 	map->hdr_base = map->hdr_copy_buf->data;
 	return 1;
 }
 
-static int mail_index_read_map(struct mail_index_map *map, uoff_t file_size)
+static int mail_index_read_map(struct mail_index_map *map, uoff_t file_size,
+			       bool paged, uoff_t *read_bytes)
 {
 	struct mail_index *index = map->index;
 	mail_index_sync_lost_handler_t *const *handlerp;
@@ -255,8 +604,9 @@ static int mail_index_read_map(struct mail_index_map *map, uoff_t file_size)
 			ret = 0;
 			retry = try_retry;
 		} else {
-			ret = mail_index_try_read_map(map, file_size,
-						      &retry, try_retry);
+			ret = mail_index_try_read_map(map, file_size, paged,
+						      read_bytes, &retry,
+						      try_retry);
 		}
 		if (ret != 0 || !retry)
 			break;
@@ -293,8 +643,9 @@ static int mail_index_map_latest_file(struct mail_index *index)
 {
 	struct mail_index_map *old_map, *new_map;
 	struct stat st;
-	uoff_t file_size;
-	bool use_mmap, unusable = FALSE;
+	struct timeval start_time;
+	uoff_t file_size, read_bytes = 0;
+	bool use_mmap, use_paged, unusable = FALSE;
 	int ret, try;
 
 	ret = mail_index_reopen_if_changed(index);
@@ -324,13 +675,25 @@ static int mail_index_map_latest_file(struct mail_index *index)
 	   mmap isn't disabled don't use it unless the file is large enough */
 	use_mmap = (index->flags & MAIL_INDEX_OPEN_FLAG_MMAP_DISABLE) == 0 &&
 		file_size != (uoff_t)-1 && file_size > MAIL_INDEX_MMAP_MIN_SIZE;
+	/* with mmap disabled read only the header of large index files and
+	   the records when they're needed. NFS may give ESTALE for the old
+	   file after it has been replaced, so there read everything now. */
+	use_paged = !use_mmap &&
+		(index->flags & MAIL_INDEX_OPEN_FLAG_NFS_FLUSH) == 0 &&
+		file_size != (uoff_t)-1 &&
+		file_size > MAIL_INDEX_MAP_PAGED_MIN_SIZE;
 
 	new_map = mail_index_map_alloc(index);
+	(void)gettimeofday(&start_time, NULL);
 	if (use_mmap) {
+		/* nothing is read yet, so count only the operation */
 		ret = mail_index_mmap(new_map, file_size);
 	} else {
-		ret = mail_index_read_map(new_map, file_size);
+		ret = mail_index_read_map(new_map, file_size, use_paged,
+					  &read_bytes);
 	}
+	mail_index_io_stats_add(MAIL_INDEX_IO_TYPE_INDEX, read_bytes,
+				&start_time);
 	if (ret == 0) {
 		/* the index files are unusable */
 		unusable = TRUE;
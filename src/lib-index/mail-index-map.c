@@ -275,6 +275,7 @@ static void mail_index_record_map_free(struct mail_index_map *map,
 			mail_index_set_syscall_error(map->index, "munmap()");
 		rec_map->mmap_base = NULL;
 	}
+	mail_index_record_map_pages_free(rec_map);
 	array_free(&rec_map->maps);
 	if (rec_map->modseq != NULL)
 		mail_index_map_modseq_free(&rec_map->modseq);
@@ -326,12 +327,14 @@ static void mail_index_map_copy_records(struct mail_index_record_map *dest,
 {
 	size_t size;
 
-	size = src->records_count * record_size;
+	size = (src->records_count - mail_index_record_map_paged_count(src)) *
+		record_size;
 	dest->buffer = buffer_create_dynamic(default_pool, I_MIN(size, 1024));
 	buffer_append(dest->buffer, src->records, size);
 
 	dest->records = buffer_get_modifiable_data(dest->buffer, NULL);
 	dest->records_count = src->records_count;
+	mail_index_record_map_pages_clone(dest, src);
 }
 
 static void mail_index_map_copy_header(struct mail_index_map *dest,
@@ -440,6 +443,9 @@ void mail_index_record_map_move_to_private(struct mail_index_map *map)
 	}
 
 	if (new_map->records_count != map->hdr.messages_count) {
+		if (map->hdr.messages_count <
+		    mail_index_record_map_paged_count(new_map))
+			(void)mail_index_record_map_page_in_all(new_map);
 		new_map->records_count = map->hdr.messages_count;
 		if (new_map->records_count == 0)
 			new_map->last_appended_uid = 0;
@@ -447,8 +453,10 @@ void mail_index_record_map_move_to_private(struct mail_index_map *map)
 			rec = MAIL_INDEX_MAP_IDX(map, new_map->records_count-1);
 			new_map->last_appended_uid = rec->uid;
 		}
-		buffer_set_used_size(new_map->buffer, new_map->records_count *
-				     map->hdr.record_size);
+		buffer_set_used_size(new_map->buffer,
+			(new_map->records_count -
+			 mail_index_record_map_paged_count(new_map)) *
+			map->hdr.record_size);
 	}
 }
 
@@ -499,14 +507,11 @@ static uint32_t mail_index_bsearch_uid(struct mail_index_map *map,
 				       uint32_t uid, uint32_t left_idx,
 				       int nearest_side)
 {
-	const struct mail_index_record *rec_base, *rec;
-	uint32_t idx, right_idx, record_size;
+	const struct mail_index_record *rec;
+	uint32_t idx, right_idx;
 
 	i_assert(map->hdr.messages_count <= map->rec_map->records_count);
 
-	rec_base = map->rec_map->records;
-	record_size = map->hdr.record_size;
-
 	idx = left_idx;
 	right_idx = I_MIN(map->hdr.messages_count, uid);
 
@@ -514,7 +519,7 @@ static uint32_t mail_index_bsearch_uid(struct mail_index_map *map,
 	while (left_idx < right_idx) {
 		idx = (left_idx + right_idx) / 2;
 
-                rec = CONST_PTR_OFFSET(rec_base, idx * record_size);
+                rec = MAIL_INDEX_MAP_IDX(map, idx);
 		if (rec->uid < uid)
 			left_idx = idx+1;
 		else if (rec->uid > uid)
@@ -524,7 +529,7 @@ static uint32_t mail_index_bsearch_uid(struct mail_index_map *map,
 	}
 	i_assert(idx < map->hdr.messages_count);
 
-	rec = CONST_PTR_OFFSET(rec_base, idx * record_size);
+	rec = MAIL_INDEX_MAP_IDX(map, idx);
 	if (rec->uid != uid) {
 		if (nearest_side > 0) {
 			/* we want uid or larger */
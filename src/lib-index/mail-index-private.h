@@ -12,9 +12,15 @@
 struct mail_transaction_header;
 struct mail_transaction_log_view;
 struct mail_index_sync_map_ctx;
+struct mail_index_map_pages;
 
 /* How large index files to mmap() instead of reading to memory. */
 #define MAIL_INDEX_MMAP_MIN_SIZE (1024*64)
+/* With mmap disabled, index files larger than this have only their header
+   read at open. The records are read lazily in MAIL_INDEX_MAP_PAGE_SIZE
+   chunks when they're first accessed. */
+#define MAIL_INDEX_MAP_PAGED_MIN_SIZE (1024*256)
+#define MAIL_INDEX_MAP_PAGE_SIZE (1024*32)
 /* How many times to retry opening index files if read/fstat returns ESTALE.
    This happens with NFS when the file has been deleted (ie. index file was
    rewritten by another computer than us). */
@@ -36,7 +42,10 @@ struct mail_index_sync_map_ctx;
 
 #define MAIL_INDEX_MAP_IDX(map, idx) \
 	((struct mail_index_record *) \
-	 PTR_OFFSET((map)->rec_map->records, (idx) * (map)->hdr.record_size))
+	 ((map)->rec_map->pages == NULL ? \
+	  PTR_OFFSET((map)->rec_map->records, \
+		     (idx) * (map)->hdr.record_size) : \
+	  mail_index_record_map_get_paged((map)->rec_map, idx)))
 
 #define MAIL_TRANSACTION_FLAG_UPDATE_IS_INTERNAL(u) \
 	((((u)->add_flags | (u)->remove_flags) & MAIL_INDEX_FLAGS_MASK) == 0 && \
@@ -124,6 +133,11 @@ struct mail_index_record_map {
 
 	void *records; /* struct mail_index_record[] */
 	unsigned int records_count;
+	/* non-NULL if the records read from the index file are kept in
+	   separately read pages. buffer/records then contains only the
+	   records appended after them. Use MAIL_INDEX_MAP_IDX() or
+	   mail_index_record_map_page_in_all() before accessing records. */
+	struct mail_index_map_pages *pages;
 
 	struct mail_index_map_modseq *modseq;
 	uint32_t last_appended_uid;
@@ -290,6 +304,32 @@ struct mail_index_map *mail_index_map_clone(const struct mail_index_map *map);
 void mail_index_record_map_move_to_private(struct mail_index_map *map);
 /* Move a mmaped map to memory. */
 void mail_index_map_move_to_memory(struct mail_index_map *map);
+/* Return record idx from a paged map, reading its page if necessary. If the
+   read fails, the returned record is zero-filled and the index is marked
+   corrupted. */
+void *mail_index_record_map_get_paged(struct mail_index_record_map *rec_map,
+				      unsigned int idx);
+/* Read all the remaining records from a paged map into rec_map->records.
+   This must be done before records are moved around or accessed directly
+   via rec_map->records. The old record memory is freed, so this must be
+   called only for private maps. Returns -1 if some records couldn't be read.
+   They're zero-filled and the index is marked corrupted. */
+int mail_index_record_map_page_in_all(struct mail_index_record_map *rec_map);
+/* Write all the records to output. The records that haven't been paged in
+   are copied from the file without changing the map. Returns -1 if some
+   records couldn't be read. The index is then marked corrupted. */
+int mail_index_record_map_write(struct mail_index_record_map *rec_map,
+				unsigned int record_size,
+				struct ostream *output);
+/* Returns the number of records in the paged part of the map. The rest of
+   the records are in rec_map->buffer. */
+unsigned int
+mail_index_record_map_paged_count(const struct mail_index_record_map *rec_map);
+/* Copy paged map state from src to dest, which must have a copy of
+   src's non-paged records. */
+void mail_index_record_map_pages_clone(struct mail_index_record_map *dest,
+				       const struct mail_index_record_map *src);
+void mail_index_record_map_pages_free(struct mail_index_record_map *rec_map);
 void mail_index_fchown(struct mail_index *index, int fd, const char *path);
 
 bool mail_index_map_lookup_ext(struct mail_index_map *map, const char *name,
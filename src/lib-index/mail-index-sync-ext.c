@@ -215,7 +215,9 @@ static void sync_ext_reorder(struct mail_index_map *map, uint32_t ext_map_idx,
 	}
 	new_record_size = offset;
 
-	/* copy the records to new buffer */
+	/* copy the records to new buffer. if paging them in fails, the index
+	   is marked corrupted. */
+	(void)mail_index_record_map_page_in_all(map->rec_map);
 	new_buffer_size = map->rec_map->records_count * new_record_size;
 	new_buffer = buffer_create_dynamic(default_pool, new_buffer_size);
 	src = map->rec_map->records;
@@ -254,6 +254,9 @@ sync_expunge(struct mail_index_sync_map_ctx *ctx, uint32_t uid1, uint32_t uid2)
 						     0, FALSE);
 	}
 
+	/* the records move around, so they can't be paged anymore. if this
+	   fails the index is marked corrupted. */
+	(void)mail_index_record_map_page_in_all(map->rec_map);
 	/* @UNSAFE */
 	memmove(MAIL_INDEX_MAP_IDX(map, seq1-1),
 		MAIL_INDEX_MAP_IDX(map, seq2),
@@ -270,7 +273,9 @@ static void *sync_append_record(struct mail_index_map *map)
 	size_t append_pos;
 	void *ret;
 
-	append_pos = map->rec_map->records_count * map->hdr.record_size;
+	append_pos = (map->rec_map->records_count -
+		      mail_index_record_map_paged_count(map->rec_map)) *
+		map->hdr.record_size;
 	ret = buffer_get_space_unsafe(map->rec_map->buffer, append_pos,
 				      map->hdr.record_size);
 	map->rec_map->records =
@@ -79,10 +79,11 @@ static int mail_index_recreate(struct mail_index *index)
 	o_stream_nsend(output, &map->hdr, base_size);
 	o_stream_nsend(output, CONST_PTR_OFFSET(map->hdr_base, base_size),
 		       map->hdr.header_size - base_size);
-	o_stream_nsend(output, map->rec_map->records,
-		       map->rec_map->records_count * map->hdr.record_size);
-	o_stream_nflush(output);
-	if (o_stream_nfinish(output) < 0) {
+	if (mail_index_record_map_write(map->rec_map, map->hdr.record_size,
+					output) < 0) {
+		o_stream_ignore_last_errors(output);
+		ret = -1;
+	} else if (o_stream_nfinish(output) < 0) {
 		mail_index_file_set_syscall_error(index, path, "write()");
 		ret = -1;
 	}
@@ -129,9 +130,17 @@ void mail_index_write(struct mail_index *index, bool want_rotate)
 	if (index->readonly)
 		return;
 
+	if ((map->hdr.flags & MAIL_INDEX_HDR_FLAG_CORRUPTED) != 0) {
+		/* don't write records that couldn't be read. the index gets
+		   reopened and read again. */
+		return;
+	}
+
 	if (!MAIL_INDEX_IS_IN_MEMORY(index)) {
 		if (mail_index_recreate(index) < 0) {
-			(void)mail_index_move_to_memory(index);
+			if ((map->hdr.flags &
+			     MAIL_INDEX_HDR_FLAG_CORRUPTED) == 0)
+				(void)mail_index_move_to_memory(index);
 			return;
 		}
 	}
@@ -7,6 +7,7 @@
 #include "eacces-error.h"
 #include "hash.h"
 #include "str-sanitize.h"
+#include "time-util.h"
 #include "mmap-util.h"
 #include "nfs-workarounds.h"
 #include "read-full.h"
@@ -25,6 +26,7 @@
 #include <sys/stat.h>
 
 struct mail_index_module_register mail_index_module_register = { 0 };
+struct mail_index_io_stat mail_index_io_stats[MAIL_INDEX_IO_TYPE_COUNT];
 
 struct mail_index *mail_index_alloc(const char *dir, const char *prefix)
 {
@@ -110,6 +112,11 @@ void mail_index_set_lock_method(struct mail_index *index,
 	index->max_lock_timeout_secs = max_timeout_secs;
 }
 
+void mail_index_set_readonly(struct mail_index *index)
+{
+	index->readonly = TRUE;
+}
+
 void mail_index_set_ext_init_data(struct mail_index *index, uint32_t ext_id,
 				  const void *data, size_t size)
 {
@@ -924,3 +931,20 @@ void mail_index_reset_error(struct mail_index *index)
 	index->nodiskspace = FALSE;
         index->index_lock_timeout = FALSE;
 }
+
+void mail_index_io_stats_add(enum mail_index_io_type type, uoff_t bytes,
+			     const struct timeval *start_time)
+{
+	struct mail_index_io_stat *stat = &mail_index_io_stats[type];
+	struct timeval now;
+	long long usecs;
+
+	i_assert(type < MAIL_INDEX_IO_TYPE_COUNT);
+
+	(void)gettimeofday(&now, NULL);
+	usecs = timeval_diff_usecs(&now, start_time);
+	stat->count++;
+	stat->bytes += bytes;
+	if (usecs > 0)
+		stat->usecs += usecs;
+}
@@ -30,7 +30,12 @@ enum mail_index_open_flags {
 	MAIL_INDEX_OPEN_FLAG_NEVER_IN_MEMORY	= 0x200,
 	/* We're only going to save new messages to the index.
 	   Avoid unnecessary reads. */
-	MAIL_INDEX_OPEN_FLAG_SAVEONLY		= 0x400
+	MAIL_INDEX_OPEN_FLAG_SAVEONLY		= 0x400,
+	/* fdatasync() transaction log appends only after the log lock has
+	   been released. This allows other processes to append to the log
+	   while we're waiting for the disk, and the filesystem to flush
+	   multiple concurrent commits with a single journal commit. */
+	MAIL_INDEX_OPEN_FLAG_GROUP_COMMIT	= 0x800
 };
 
 enum mail_index_header_compat_flags {
@@ -232,6 +237,9 @@ void mail_index_set_permissions(struct mail_index *index,
 void mail_index_set_lock_method(struct mail_index *index,
 				enum file_lock_method lock_method,
 				unsigned int max_timeout_secs);
+/* Don't write anything to the already opened index anymore. This includes
+   the transaction log and cache files, so the index can't be synced. */
+void mail_index_set_readonly(struct mail_index *index);
 /* When creating a new index file or reseting an existing one, add the given
    extension header data immediately to it. */
 void mail_index_set_ext_init_data(struct mail_index *index, uint32_t ext_id,
@@ -616,4 +624,35 @@ void mail_index_update_ext(struct mail_index_transaction *t, uint32_t seq,
 int mail_index_atomic_inc_ext(struct mail_index_transaction *t,
 			      uint32_t seq, uint32_t ext_id, int diff);
 
+/* The bytes are what was actually read(). mmap()s are counted as operations
+   without bytes. */
+enum mail_index_io_type {
+	/* dovecot.index reads/mmaps */
+	MAIL_INDEX_IO_TYPE_INDEX,
+	/* dovecot.index.log reads/mmaps */
+	MAIL_INDEX_IO_TYPE_LOG,
+	/* dovecot.index.cache reads/mmaps */
+	MAIL_INDEX_IO_TYPE_CACHE,
+	/* storage backends' own index files, e.g. dovecot-uidlist */
+	MAIL_INDEX_IO_TYPE_BACKEND,
+	/* waiting for index or dotlocks (bytes are always 0) */
+	MAIL_INDEX_IO_TYPE_LOCK_WAIT,
+
+	MAIL_INDEX_IO_TYPE_COUNT
+};
+
+struct mail_index_io_stat {
+	unsigned long count;
+	unsigned long long bytes;
+	unsigned long long usecs;
+};
+
+/* Process-wide I/O statistics. They're never reset, so users (e.g. the stats
+   plugin) need to look at how they've changed. */
+extern struct mail_index_io_stat mail_index_io_stats[MAIL_INDEX_IO_TYPE_COUNT];
+
+/* Add an I/O operation that was started at start_time and is now finished. */
+void mail_index_io_stats_add(enum mail_index_io_type type, uoff_t bytes,
+			     const struct timeval *start_time);
+
 #endif
@@ -90,7 +90,12 @@ static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx)
 	if ((ctx->want_fsync &&
 	     file->log->index->fsync_mode != FSYNC_MODE_NEVER) ||
 	    file->log->index->fsync_mode == FSYNC_MODE_ALWAYS) {
-		if (fdatasync(file->fd) < 0) {
+		if ((file->log->index->flags &
+		     MAIL_INDEX_OPEN_FLAG_GROUP_COMMIT) != 0 &&
+		    !file->log->index->log_sync_locked) {
+			/* the log gets unlocked right after this write */
+			ctx->fsync_after_unlock = TRUE;
+		} else if (fdatasync(file->fd) < 0) {
 			mail_index_file_set_syscall_error(ctx->log->index,
 							  file->filepath,
 							  "fdatasync()");
@@ -222,17 +227,37 @@ int mail_transaction_log_append_begin(struct mail_index *index,
 	return 0;
 }
 
+static int
+mail_transaction_log_append_fsync(struct mail_transaction_log_append_ctx *ctx,
+				  struct mail_transaction_log_file *file)
+{
+	/* the data was already written while the log was locked, and it may
+	   already have been read by others. we can't truncate it away
+	   anymore, so just report the failure. */
+	if (fdatasync(file->fd) < 0) {
+		mail_index_file_set_syscall_error(ctx->log->index,
+						  file->filepath,
+						  "fdatasync()");
+		return -1;
+	}
+	return 0;
+}
+
 int mail_transaction_log_append_commit(struct mail_transaction_log_append_ctx **_ctx)
 {
 	struct mail_transaction_log_append_ctx *ctx = *_ctx;
 	struct mail_index *index = ctx->log->index;
+	struct mail_transaction_log_file *file = index->log->head;
 	int ret = 0;
 
 	*_ctx = NULL;
 
 	ret = mail_transaction_log_append_locked(ctx);
 	if (!index->log_sync_locked)
-		mail_transaction_log_file_unlock(index->log->head);
+		mail_transaction_log_file_unlock(file);
+	if (ret == 0 && ctx->fsync_after_unlock &&
+	    !MAIL_TRANSACTION_LOG_FILE_IN_MEMORY(file))
+		ret = mail_transaction_log_append_fsync(ctx, file);
 
 	buffer_free(&ctx->output);
 	i_free(ctx);
@@ -295,14 +295,18 @@ static int
 mail_transaction_log_file_dotlock(struct mail_transaction_log_file *file)
 {
 	struct dotlock_settings dotlock_set;
+	struct timeval start_time;
 	int ret;
 
 	if (file->log->dotlock_count > 0)
 		ret = 1;
 	else {
 		mail_transaction_log_get_dotlock_set(file->log, &dotlock_set);
+		(void)gettimeofday(&start_time, NULL);
 		ret = file_dotlock_create(&dotlock_set, file->filepath, 0,
 					  &file->log->dotlock);
+		mail_index_io_stats_add(MAIL_INDEX_IO_TYPE_LOCK_WAIT, 0,
+					&start_time);
 	}
 	if (ret > 0) {
 		file->log->dotlock_count++;
@@ -423,6 +427,7 @@ void mail_transaction_log_file_unlock(struct mail_transaction_log_file *file)
 static ssize_t
 mail_transaction_log_file_read_header(struct mail_transaction_log_file *file)
 {
+	struct timeval start_time;
 	void *dest;
 	size_t pos, dest_size;
 	ssize_t ret;
@@ -446,6 +451,7 @@ mail_transaction_log_file_read_header(struct mail_transaction_log_file *file)
 
 	/* it's not necessarily an error to read less than wanted header size,
 	   since older versions of the log format used smaller headers. */
+	(void)gettimeofday(&start_time, NULL);
         pos = 0;
 	do {
 		ret = pread(file->fd, PTR_OFFSET(dest, pos),
@@ -453,6 +459,7 @@ mail_transaction_log_file_read_header(struct mail_transaction_log_file *file)
 		if (ret > 0)
 			pos += ret;
 	} while (ret > 0 && pos < dest_size);
+	mail_index_io_stats_add(MAIL_INDEX_IO_TYPE_LOG, pos, &start_time);
 
 	if (file->buffer != NULL) {
 		buffer_set_used_size(file->buffer, pos);
@@ -1427,6 +1434,7 @@ static int
 mail_transaction_log_file_insert_read(struct mail_transaction_log_file *file,
 				      uoff_t offset)
 {
+	struct timeval start_time;
 	void *data;
 	size_t size;
 	ssize_t ret;
@@ -1435,7 +1443,10 @@ mail_transaction_log_file_insert_read(struct mail_transaction_log_file *file,
 	buffer_copy(file->buffer, size, file->buffer, 0, (size_t)-1);
 
 	data = buffer_get_space_unsafe(file->buffer, 0, size);
+	(void)gettimeofday(&start_time, NULL);
 	ret = pread_full(file->fd, data, size, offset);
+	mail_index_io_stats_add(MAIL_INDEX_IO_TYPE_LOG, ret > 0 ? size : 0,
+				&start_time);
 	if (ret > 0) {
 		/* success */
 		file->buffer_offset -= size;
@@ -1461,13 +1472,16 @@ mail_transaction_log_file_insert_read(struct mail_transaction_log_file *file,
 static int
 mail_transaction_log_file_read_more(struct mail_transaction_log_file *file)
 {
+	struct timeval start_time;
 	void *data;
 	size_t size;
-	uint32_t read_offset;
+	uint32_t read_offset, start_offset;
 	ssize_t ret;
 
 	read_offset = file->buffer_offset + buffer_get_used_size(file->buffer);
+	start_offset = read_offset;
 
+	(void)gettimeofday(&start_time, NULL);
 	do {
 		data = buffer_append_space_unsafe(file->buffer, LOG_PREFETCH);
 		ret = pread(file->fd, data, LOG_PREFETCH, read_offset);
@@ -1477,6 +1491,8 @@ mail_transaction_log_file_read_more(struct mail_transaction_log_file *file)
 		size = read_offset - file->buffer_offset;
 		buffer_set_used_size(file->buffer, size);
 	} while (ret > 0 || (ret < 0 && errno == EINTR));
+	mail_index_io_stats_add(MAIL_INDEX_IO_TYPE_LOG,
+				read_offset - start_offset, &start_time);
 
 	file->last_size = read_offset;
 
@@ -1587,13 +1603,18 @@ log_file_map_check_offsets(struct mail_transaction_log_file *file,
 static int
 mail_transaction_log_file_mmap(struct mail_transaction_log_file *file)
 {
+	struct timeval start_time;
+
 	if (file->buffer != NULL) {
 		/* in case we just switched to mmaping */
 		buffer_free(&file->buffer);
 	}
 	file->mmap_size = file->last_size;
+	(void)gettimeofday(&start_time, NULL);
 	file->mmap_base = mmap(NULL, file->mmap_size, PROT_READ, MAP_SHARED,
 			       file->fd, 0);
+	/* mmap() itself doesn't read anything */
+	mail_index_io_stats_add(MAIL_INDEX_IO_TYPE_LOG, 0, &start_time);
 	if (file->mmap_base == MAP_FAILED) {
 		file->mmap_base = NULL;
 		file->mmap_size = 0;
@@ -179,6 +179,8 @@ struct mail_transaction_log_append_ctx {
 	unsigned int append_sync_offset:1;
 	unsigned int sync_includes_this:1;
 	unsigned int want_fsync:1;
+	/* fdatasync() is done after the log has been unlocked */
+	unsigned int fsync_after_unlock:1;
 };
 
 #define LOG_IS_BEFORE(seq1, offset1, seq2, offset2) \
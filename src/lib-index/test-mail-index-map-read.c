@@ -0,0 +1,276 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "ioloop.h"
+#include "unlink-directory.h"
+#include "mail-index-private.h"
+#include "mail-transaction-log.h"
+#include "test-common.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TEST_INDEX_DIR ".test-mail-index-map-read"
+#define TEST_INDEX_PATH TEST_INDEX_DIR"/test.index"
+/* enough records to make the index file larger than
+   MAIL_INDEX_MAP_PAGED_MIN_SIZE */
+#define TEST_RECORDS_COUNT 50000
+
+static unsigned int test_error_count;
+static failure_callback_t *test_orig_error_handler;
+
+static void ATTR_FORMAT(2, 0)
+test_count_error_handler(const struct failure_context *ctx ATTR_UNUSED,
+			 const char *format ATTR_UNUSED,
+			 va_list args ATTR_UNUSED)
+{
+	test_error_count++;
+}
+
+static void test_expect_errors_begin(void)
+{
+	failure_callback_t *fatal, *info, *debug;
+
+	i_get_failure_handlers(&fatal, &test_orig_error_handler, &info, &debug);
+	i_set_error_handler(test_count_error_handler);
+	test_error_count = 0;
+}
+
+static void test_expect_errors_end(void)
+{
+	i_set_error_handler(test_orig_error_handler);
+}
+
+static struct mail_index *test_index_open(void)
+{
+	struct mail_index *index;
+
+	index = mail_index_alloc(TEST_INDEX_DIR, "test.index");
+	test_assert(mail_index_open_or_create(index,
+			MAIL_INDEX_OPEN_FLAG_CREATE |
+			MAIL_INDEX_OPEN_FLAG_MMAP_DISABLE) == 0);
+	return index;
+}
+
+static void test_index_close(struct mail_index **index)
+{
+	mail_index_close(*index);
+	mail_index_free(index);
+}
+
+static void test_index_append(struct mail_index *index,
+			      uint32_t first_uid, uint32_t last_uid)
+{
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t uid, seq, uid_validity = 1;
+
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &view,
+					  &trans, 0) == 1);
+	if (first_uid == 1) {
+		mail_index_update_header(trans,
+			offsetof(struct mail_index_header, uid_validity),
+			&uid_validity, sizeof(uid_validity), TRUE);
+	}
+	for (uid = first_uid; uid <= last_uid; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+}
+
+static void test_index_create(void)
+{
+	struct mail_index *index;
+	struct stat st;
+	uint32_t log_seq;
+	uoff_t log_offset;
+
+	(void)unlink_directory(TEST_INDEX_DIR, TRUE);
+	if (mkdir(TEST_INDEX_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_INDEX_DIR);
+
+	index = test_index_open();
+	test_index_append(index, 1, TEST_RECORDS_COUNT);
+	/* a new index isn't written on the first sync */
+	test_assert(mail_transaction_log_sync_lock(index->log, &log_seq,
+						   &log_offset) == 0);
+	mail_index_write(index, FALSE);
+	mail_transaction_log_sync_unlock(index->log);
+	test_index_close(&index);
+
+	test_assert(stat(TEST_INDEX_PATH, &st) == 0 &&
+		    st.st_size > MAIL_INDEX_MAP_PAGED_MIN_SIZE);
+}
+
+static bool test_index_uids_ok(struct mail_index_view *view,
+			       uint32_t first_seq, uint32_t last_seq)
+{
+	uint32_t seq, uid;
+
+	for (seq = first_seq; seq <= last_seq; seq++) {
+		mail_index_lookup_uid(view, seq, &uid);
+		if (uid != seq)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void test_mail_index_map_paged_read(void)
+{
+	struct ioloop *ioloop;
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_transaction *trans;
+	uint32_t seq, count;
+
+	test_begin("mail index map paged read");
+	/* index ID is taken from ioloop_time */
+	ioloop = io_loop_create();
+	test_index_create();
+
+	index = test_index_open();
+	test_assert(index->map->rec_map->pages != NULL);
+	test_assert(mail_index_record_map_paged_count(index->map->rec_map) ==
+		    TEST_RECORDS_COUNT);
+	/* nothing is read until it's accessed */
+	test_assert(index->map->rec_map->buffer->used == 0);
+
+	view = mail_index_view_open(index);
+	test_assert(mail_index_lookup_seq(view, TEST_RECORDS_COUNT/2, &seq) &&
+		    seq == TEST_RECORDS_COUNT/2);
+	test_assert(test_index_uids_ok(view, 1, TEST_RECORDS_COUNT));
+	mail_index_view_close(&view);
+
+	/* appends go after the paged records */
+	test_index_append(index, TEST_RECORDS_COUNT+1, TEST_RECORDS_COUNT+10);
+	view = mail_index_view_open(index);
+	count = mail_index_view_get_messages_count(view);
+	test_assert(count == TEST_RECORDS_COUNT+10);
+	test_assert(test_index_uids_ok(view, 1, count));
+	mail_index_view_close(&view);
+
+	/* expunging moves the records around, so they're all paged in */
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &view,
+					  &trans, 0) == 1);
+	mail_index_expunge(trans, count);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+	test_assert(index->map->rec_map->pages == NULL);
+	view = mail_index_view_open(index);
+	count = mail_index_view_get_messages_count(view);
+	test_assert(count == TEST_RECORDS_COUNT+9);
+	test_assert(test_index_uids_ok(view, 1, count));
+	mail_index_view_close(&view);
+
+	test_index_close(&index);
+	io_loop_destroy(&ioloop);
+	(void)unlink_directory(TEST_INDEX_DIR, TRUE);
+	test_end();
+}
+
+static void test_mail_index_map_paged_write(void)
+{
+	struct ioloop *ioloop;
+	struct mail_index *index;
+	struct mail_index_view *view;
+	const struct mail_index_record *rec;
+	uint32_t log_seq, count;
+	uoff_t log_offset;
+
+	test_begin("mail index map paged write");
+	/* index ID is taken from ioloop_time */
+	ioloop = io_loop_create();
+	test_index_create();
+
+	index = test_index_open();
+	view = mail_index_view_open(index);
+	rec = mail_index_lookup(view, 1);
+	test_assert(rec->uid == 1);
+	test_index_append(index, TEST_RECORDS_COUNT+1, TEST_RECORDS_COUNT+10);
+
+	/* the view still uses the same map, so its records must stay where
+	   they are. the unread pages are written without paging them in. */
+	test_assert(mail_transaction_log_sync_lock(index->log, &log_seq,
+						   &log_offset) == 0);
+	mail_index_write(index, FALSE);
+	mail_transaction_log_sync_unlock(index->log);
+	test_assert(index->map->rec_map->pages != NULL);
+	test_assert(rec->uid == 1);
+	mail_index_view_close(&view);
+	test_index_close(&index);
+
+	index = test_index_open();
+	view = mail_index_view_open(index);
+	count = mail_index_view_get_messages_count(view);
+	test_assert(count == TEST_RECORDS_COUNT+10);
+	test_assert(test_index_uids_ok(view, 1, count));
+	mail_index_view_close(&view);
+	test_index_close(&index);
+
+	io_loop_destroy(&ioloop);
+	(void)unlink_directory(TEST_INDEX_DIR, TRUE);
+	test_end();
+}
+
+static void test_mail_index_map_paged_read_error(void)
+{
+	struct ioloop *ioloop;
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_transaction *trans;
+	uint32_t uid;
+	int ret;
+
+	test_begin("mail index map paged read error");
+	/* index ID is taken from ioloop_time */
+	ioloop = io_loop_create();
+	test_index_create();
+
+	index = test_index_open();
+	test_assert(index->map->rec_map->pages != NULL);
+	view = mail_index_view_open(index);
+	mail_index_lookup_uid(view, 1, &uid);
+	test_assert(uid == 1);
+
+	/* only the first records can be read anymore */
+	test_assert(truncate(TEST_INDEX_PATH,
+			     index->map->hdr.header_size + 1024) == 0);
+	test_expect_errors_begin();
+	mail_index_lookup_uid(view, TEST_RECORDS_COUNT/2, &uid);
+	test_assert(uid == 0);
+	test_assert(test_error_count == 1);
+	/* the read is retried the next time */
+	mail_index_lookup_uid(view, TEST_RECORDS_COUNT/2, &uid);
+	test_assert(test_error_count == 2);
+	test_expect_errors_end();
+	/* the already read records are still fine */
+	mail_index_lookup_uid(view, 1, &uid);
+	test_assert(uid == 1);
+	mail_index_view_close(&view);
+
+	/* the index needs to be reopened before it can be synced */
+	test_assert((index->map->hdr.flags &
+		     MAIL_INDEX_HDR_FLAG_CORRUPTED) != 0);
+	ret = mail_index_sync_begin(index, &sync_ctx, &view, &trans, 0);
+	test_assert(ret < 0);
+	if (ret > 0)
+		mail_index_sync_rollback(&sync_ctx);
+
+	test_index_close(&index);
+	io_loop_destroy(&ioloop);
+	(void)unlink_directory(TEST_INDEX_DIR, TRUE);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_mail_index_map_paged_read,
+		test_mail_index_map_paged_write,
+		test_mail_index_map_paged_read_error,
+		NULL
+	};
+	return test_run(test_functions);
+}
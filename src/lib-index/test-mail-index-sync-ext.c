@@ -27,6 +27,9 @@ int mail_index_map_ext_hdr_check(const struct mail_index_header *hdr ATTR_UNUSED
 				 const char *name ATTR_UNUSED,
 				 const char **error_r ATTR_UNUSED) { return -1; }
 void mail_index_modseq_hdr_update(struct mail_index_modseq_sync *ctx ATTR_UNUSED) {}
+void *mail_index_record_map_get_paged(struct mail_index_record_map *rec_map ATTR_UNUSED,
+				      unsigned int idx ATTR_UNUSED) { i_unreached(); }
+int mail_index_record_map_page_in_all(struct mail_index_record_map *rec_map ATTR_UNUSED) { return 0; }
 bool mail_index_lookup_seq(struct mail_index_view *view ATTR_UNUSED,
 			   uint32_t uid, uint32_t *seq_r) {
 	*seq_r = uid;
@@ -190,13 +190,16 @@ int message_parse_header_next(struct message_header_parser_ctx *ctx,
 		}
 
 		/* find '\n' */
-		for (; i < parse_size; i++) {
-			if (msg[i] <= '\n') {
-				if (msg[i] == '\n')
-					break;
-				if (msg[i] == '\0')
-					ctx->has_nuls = TRUE;
-			}
+		if (i < parse_size) {
+			const unsigned char *lf =
+				memchr(msg + i, '\n', parse_size - i);
+			size_t line_end = lf == NULL ? parse_size :
+				(size_t)(lf - msg);
+
+			if (!ctx->has_nuls &&
+			    memchr(msg + i, '\0', line_end - i) != NULL)
+				ctx->has_nuls = TRUE;
+			i = line_end;
 		}
 
 		if (i < parse_size && i+1 == size && ret == -2) {
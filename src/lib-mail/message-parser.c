@@ -247,6 +247,28 @@ boundary_line_find(struct message_parser_ctx *ctx,
 	return 1;
 }
 
+static const unsigned char *
+boundary_lf_find(const unsigned char *cur, const unsigned char *end)
+{
+	const unsigned char *p;
+
+	/* return the first LF that is followed by "--" or by less than two
+	   bytes. other lines can't be boundaries. looking for '-' with
+	   memchr() skips them much faster than going through each line,
+	   especially with base64 data that never contains '-'. */
+	for (p = cur + 1; p + 1 < end; p++) {
+		if ((p = memchr(p, '-', (end - 1) - p)) == NULL)
+			break;
+		if (p[-1] == '\n' && p[1] == '-')
+			return p - 1;
+	}
+	if (end - cur >= 2 && end[-2] == '\n')
+		return end - 2;
+	if (end - cur >= 1 && end[-1] == '\n')
+		return end - 1;
+	return NULL;
+}
+
 static int parse_next_mime_header_init(struct message_parser_ctx *ctx,
 				       struct message_block *block_r)
 {
@@ -348,7 +370,7 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 				       struct message_block *block_r)
 {
 	struct message_boundary *boundary = NULL;
-	const unsigned char *data, *cur, *next, *end;
+	const unsigned char *data, *cur, *next, *end, *last_lf;
 	size_t boundary_start;
 	int ret;
 	bool full;
@@ -374,7 +396,7 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 	/* skip to beginning of the next line. the first line was
 	   handled already. */
 	cur = data; end = data + block_r->size;
-	while ((next = memchr(cur, '\n', end - cur)) != NULL) {
+	while ((next = boundary_lf_find(cur, end)) != NULL) {
 		cur = next + 1;
 
 		boundary_start = next - data;
@@ -396,6 +418,19 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 		}
 	}
 
+	if (next == NULL) {
+		/* leave the last line to buffer */
+		for (last_lf = end; last_lf > cur; last_lf--) {
+			if (last_lf[-1] == '\n')
+				break;
+		}
+		if (last_lf > cur) {
+			boundary_start = (last_lf - 1) - data;
+			if (last_lf - 1 > data && last_lf[-2] == '\r')
+				boundary_start--;
+		}
+	}
+
 	if (next != NULL) {
 		/* found / need more data */
 		i_assert(ret >= 0);
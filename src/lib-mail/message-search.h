@@ -15,6 +15,14 @@ struct message_search_context *
 message_search_init(const char *normalized_key_utf8,
 		    normalizer_func_t *normalizer,
 		    enum message_search_flags flags);
+/* Like message_search_init(), but search all the keys with a single pass.
+   message_search_more*() and message_search_msg() report a match only after
+   all the keys have been found. Use message_search_key_found() to check
+   which of them were found. */
+struct message_search_context *
+message_search_init_multi(const char *const *normalized_keys_utf8,
+			  normalizer_func_t *normalizer,
+			  enum message_search_flags flags);
 void message_search_deinit(struct message_search_context **ctx);
 
 /* Returns TRUE if key is found from input buffer, FALSE if not. */
@@ -24,6 +32,11 @@ bool message_search_more(struct message_search_context *ctx,
 bool message_search_more_decoded(struct message_search_context *ctx,
 				 struct message_block *block);
 void message_search_reset(struct message_search_context *ctx);
+/* Returns TRUE if the key with the given index has been found since the
+   last message_search_msg() or message_search_reset_found(). */
+bool message_search_key_found(struct message_search_context *ctx,
+			      unsigned int key_idx);
+void message_search_reset_found(struct message_search_context *ctx);
 /* Search a full message. Returns 1 if match was found, 0 if not,
    -1 if error (if stream_error == 0, the parts contained broken data) */
 int message_search_msg(struct message_search_context *ctx,
@@ -128,10 +128,70 @@ static void test_message_parser_small_blocks(void)
 	test_end();
 }
 
+static void test_message_parser_dash_lines(void)
+{
+	static const char input_msg[] =
+"Content-Type: multipart/mixed; boundary=\"a\"\r\n"
+"MIME-Version: 1.0\r\n"
+"\r\n"
+"-\r\n"
+"--\r\n"
+"--b\r\n"
+"--a\r\n"
+"Content-Type: text/plain\r\n"
+"\r\n"
+"---a\r\n"
+"- -a\r\n"
+"--ax\r\n"
+"\r\n"
+"--a--\r\n"
+"-\r\n";
+	struct message_parser_ctx *parser;
+	struct istream *input;
+	struct message_part *parts, *part;
+	struct message_block block;
+	unsigned int i, input_len = sizeof(input_msg)-1;
+	pool_t pool;
+	int ret;
+
+	test_begin("message parser dash lines");
+	pool = pool_alloconly_create("message parser", 10240);
+	input = test_istream_create(input_msg);
+	test_istream_set_allow_eof(input, FALSE);
+
+	parser = message_parser_init(pool, input, 0, 0);
+	for (i = 1; i <= input_len+1; i++) {
+		test_istream_set_size(input, i);
+		if (i > input_len)
+			test_istream_set_allow_eof(input, TRUE);
+		while ((ret = message_parser_parse_next_block(parser,
+							      &block)) > 0) ;
+	}
+	test_assert(ret < 0);
+	test_assert(message_parser_deinit(&parser, &parts) == 0);
+
+	test_assert(parts->header_size.physical_size == 66);
+	test_assert(parts->body_size.physical_size == 75);
+	test_assert(parts->body_size.lines == 12);
+	part = parts->children;
+	test_assert(part->physical_pos == 83);
+	test_assert(part->header_size.physical_size == 28);
+	test_assert(part->body_size.physical_size == 10);
+	test_assert(part->body_size.lines == 1);
+	part = part->next;
+	test_assert(part->physical_pos == 129);
+	test_assert(part->next == NULL);
+
+	i_stream_unref(&input);
+	pool_unref(&pool);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*test_functions[])(void) = {
 		test_message_parser_small_blocks,
+		test_message_parser_dash_lines,
 		NULL
 	};
 	return test_run(test_functions);
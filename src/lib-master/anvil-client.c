@@ -3,6 +3,9 @@
 #include "lib.h"
 #include "ioloop.h"
 #include "net.h"
+#include "fd-set-nonblock.h"
+#include "fdpass.h"
+#include "write-full.h"
 #include "istream.h"
 #include "ostream.h"
 #include "array.h"
@@ -146,6 +149,36 @@ int anvil_client_connect(struct anvil_client *client, bool retry)
 	return 0;
 }
 
+int anvil_client_get_connect_limit_shm_fd(struct anvil_client *client)
+{
+	const char *cmd = ANVIL_HANDSHAKE"CONNECT-LIMIT-SHM\n";
+	int fd, shm_fd = -1;
+	ssize_t ret;
+	char c;
+
+	fd = net_connect_unix(client->path);
+	if (fd == -1) {
+		i_error("net_connect_unix(%s) failed: %m", client->path);
+		return -1;
+	}
+	fd_set_nonblock(fd, FALSE);
+	if (write_full(fd, cmd, strlen(cmd)) < 0) {
+		i_error("write(%s) failed: %m", client->path);
+		net_disconnect(fd);
+		return -1;
+	}
+	ret = fd_read(fd, &c, 1, &shm_fd);
+	if (ret < 0)
+		i_error("fd_read(%s) failed: %m", client->path);
+	else if (ret > 0 && c != '+' && shm_fd != -1) {
+		/* shouldn't happen */
+		i_close_fd(&shm_fd);
+	}
+	/* ret == 0 is an older anvil that doesn't support the command */
+	net_disconnect(fd);
+	return shm_fd;
+}
+
 static void anvil_client_cancel_queries(struct anvil_client *client)
 {
 	const struct anvil_query *queries, *query;
@@ -19,6 +19,11 @@ void anvil_client_deinit(struct anvil_client **client);
 /* Connect to anvil. If retry=TRUE, try connecting for a while */
 int anvil_client_connect(struct anvil_client *client, bool retry);
 
+/* Get an fd to anvil's shared memory table of connect-limit counts, which
+   can be opened with connect_limit_shm_open(). This is done synchronously
+   via a separate connection. Returns -1 if it's not available. */
+int anvil_client_get_connect_limit_shm_fd(struct anvil_client *client);
+
 /* Send a query to anvil, expect a one line reply. */
 void anvil_client_query(struct anvil_client *client, const char *query,
 			anvil_callback_t *callback, void *context);
@@ -0,0 +1,380 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#define _GNU_SOURCE /* for memfd_create() */
+
+#include "lib.h"
+#include "crc32.h"
+#include "hash.h"
+#include "connect-limit-shm.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/* the fd is given to login processes, so it can be used only if they can be
+   prevented from writing to it */
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS) && \
+	defined(F_SEAL_FUTURE_WRITE) && defined(__GNUC__)
+#  define HAVE_CONNECT_LIMIT_SHM
+#  define connect_limit_shm_barrier() __sync_synchronize()
+#else
+#  define connect_limit_shm_barrier()
+#endif
+
+#define CONNECT_LIMIT_SHM_VERSION 1
+/* Give up reading and fall back to asking anvil after this many times of
+   seeing the table being modified. */
+#define CONNECT_LIMIT_SHM_LOOKUP_RETRIES 16
+/* Rebuild the table when this many percents of its entries are used. */
+#define CONNECT_LIMIT_SHM_MAX_USED_PERCENTAGE 75
+
+struct connect_limit_shm_header {
+	uint32_t version;
+	uint32_t entries_count;
+	/* Odd while anvil is modifying the entries */
+	uint32_t seq;
+	uint32_t disabled;
+};
+
+struct connect_limit_shm_entry {
+	/* hash1=0 if the entry has never been used. count=0 if the ident has
+	   been removed, but the entry is still kept for the probe chains. */
+	uint32_t hash1, hash2;
+	uint32_t count;
+	uint32_t unused;
+};
+
+struct connect_limit_shm {
+	int fd;
+	void *mmap_base;
+	size_t mmap_size;
+
+	volatile struct connect_limit_shm_header *hdr;
+	volatile struct connect_limit_shm_entry *entries;
+	unsigned int mask;
+
+	/* writer only: number of entries with hash1 != 0 (used) and
+	   additionally count != 0 (live) */
+	unsigned int used_count, live_count;
+};
+
+static void
+connect_limit_shm_hash(const char *ident, uint32_t *hash1_r, uint32_t *hash2_r)
+{
+	*hash1_r = str_hash(ident);
+	if (*hash1_r == 0)
+		*hash1_r = 1;
+	*hash2_r = crc32_str(ident);
+}
+
+static struct connect_limit_shm *
+connect_limit_shm_alloc(int fd, void *mmap_base, size_t mmap_size)
+{
+	struct connect_limit_shm *shm;
+
+	shm = i_new(struct connect_limit_shm, 1);
+	shm->fd = fd;
+	shm->mmap_base = mmap_base;
+	shm->mmap_size = mmap_size;
+	shm->hdr = mmap_base;
+	shm->entries = PTR_OFFSET(mmap_base,
+				  sizeof(struct connect_limit_shm_header));
+	shm->mask = shm->hdr->entries_count - 1;
+	return shm;
+}
+
+#ifdef HAVE_CONNECT_LIMIT_SHM
+static int connect_limit_shm_seal(int fd)
+{
+	/* processes that receive the fd mustn't be able to resize the
+	   table under anvil or get write access to it */
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+		  F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0) {
+		/* EINVAL = the kernel is too old for F_SEAL_FUTURE_WRITE.
+		   the table isn't shared then, login processes ask anvil. */
+		if (errno != EINVAL)
+			i_error("fcntl(connect limit shm, F_ADD_SEALS) failed: %m");
+		return -1;
+	}
+	return 0;
+}
+
+struct connect_limit_shm *connect_limit_shm_create(unsigned int entries)
+{
+	struct connect_limit_shm_header *hdr;
+	unsigned int entries_count = 1;
+	size_t size;
+	void *base;
+	int fd;
+
+	while (entries_count < entries)
+		entries_count <<= 1;
+	size = sizeof(struct connect_limit_shm_header) +
+		entries_count * sizeof(struct connect_limit_shm_entry);
+
+	fd = memfd_create("anvil-connect-limit",
+			  MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1) {
+		i_error("memfd_create(connect limit shm) failed: %m");
+		return NULL;
+	}
+	if (ftruncate(fd, size) < 0) {
+		i_error("ftruncate(connect limit shm) failed: %m");
+		i_close_fd(&fd);
+		return NULL;
+	}
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		i_error("mmap(connect limit shm) failed: %m");
+		i_close_fd(&fd);
+		return NULL;
+	}
+	if (connect_limit_shm_seal(fd) < 0) {
+		if (munmap(base, size) < 0)
+			i_error("munmap(connect limit shm) failed: %m");
+		i_close_fd(&fd);
+		return NULL;
+	}
+
+	hdr = base;
+	hdr->version = CONNECT_LIMIT_SHM_VERSION;
+	hdr->entries_count = entries_count;
+	return connect_limit_shm_alloc(fd, base, size);
+}
+
+struct connect_limit_shm *connect_limit_shm_open(int fd)
+{
+	const struct connect_limit_shm_header *hdr;
+	struct stat st;
+	void *base;
+
+	if (fstat(fd, &st) < 0) {
+		i_error("fstat(connect limit shm) failed: %m");
+		i_close_fd(&fd);
+		return NULL;
+	}
+	if ((uoff_t)st.st_size < sizeof(*hdr)) {
+		i_error("connect limit shm: File too small");
+		i_close_fd(&fd);
+		return NULL;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	i_close_fd(&fd);
+	if (base == MAP_FAILED) {
+		i_error("mmap(connect limit shm) failed: %m");
+		return NULL;
+	}
+
+	hdr = base;
+	if (hdr->version != CONNECT_LIMIT_SHM_VERSION ||
+	    hdr->entries_count == 0 ||
+	    (hdr->entries_count & (hdr->entries_count - 1)) != 0 ||
+	    (uoff_t)st.st_size != sizeof(*hdr) + hdr->entries_count *
+	    sizeof(struct connect_limit_shm_entry)) {
+		i_error("connect limit shm: Unsupported version or "
+			"corrupted header");
+		if (munmap(base, st.st_size) < 0)
+			i_error("munmap(connect limit shm) failed: %m");
+		return NULL;
+	}
+	return connect_limit_shm_alloc(-1, base, st.st_size);
+}
+#else
+struct connect_limit_shm *
+connect_limit_shm_create(unsigned int entries ATTR_UNUSED)
+{
+	return NULL;
+}
+
+struct connect_limit_shm *connect_limit_shm_open(int fd)
+{
+	i_close_fd(&fd);
+	return NULL;
+}
+#endif
+
+void connect_limit_shm_free(struct connect_limit_shm **_shm)
+{
+	struct connect_limit_shm *shm = *_shm;
+
+	*_shm = NULL;
+	if (munmap(shm->mmap_base, shm->mmap_size) < 0)
+		i_error("munmap(connect limit shm) failed: %m");
+	if (shm->fd != -1)
+		i_close_fd(&shm->fd);
+	i_free(shm);
+}
+
+int connect_limit_shm_get_fd(struct connect_limit_shm *shm)
+{
+	return shm->fd;
+}
+
+static void connect_limit_shm_write_begin(struct connect_limit_shm *shm)
+{
+	shm->hdr->seq++;
+	connect_limit_shm_barrier();
+}
+
+static void connect_limit_shm_write_end(struct connect_limit_shm *shm)
+{
+	connect_limit_shm_barrier();
+	shm->hdr->seq++;
+}
+
+static volatile struct connect_limit_shm_entry *
+connect_limit_shm_find(struct connect_limit_shm *shm,
+		       uint32_t hash1, uint32_t hash2, bool *found_r)
+{
+	volatile struct connect_limit_shm_entry *entry, *first_free = NULL;
+	unsigned int i, idx = hash1 & shm->mask;
+
+	*found_r = FALSE;
+	for (i = 0; i <= shm->mask; i++, idx = (idx + 1) & shm->mask) {
+		entry = &shm->entries[idx];
+		if (entry->hash1 == 0)
+			return first_free != NULL ? first_free : entry;
+		if (entry->hash1 == hash1 && entry->hash2 == hash2) {
+			*found_r = TRUE;
+			return entry;
+		}
+		if (entry->count == 0 && first_free == NULL)
+			first_free = entry;
+	}
+	return first_free;
+}
+
+static void connect_limit_shm_rebuild(struct connect_limit_shm *shm)
+{
+	struct connect_limit_shm_entry *live;
+	volatile struct connect_limit_shm_entry *entry;
+	unsigned int i, n, idx, count = shm->mask + 1;
+
+	/* drop the removed entries, which are only lengthening the probe
+	   chains by now */
+	live = i_new(struct connect_limit_shm_entry, shm->live_count);
+	for (i = n = 0; i < count; i++) {
+		if (shm->entries[i].hash1 != 0 && shm->entries[i].count != 0) {
+			i_assert(n < shm->live_count);
+			live[n].hash1 = shm->entries[i].hash1;
+			live[n].hash2 = shm->entries[i].hash2;
+			live[n].count = shm->entries[i].count;
+			n++;
+		}
+	}
+	i_assert(n == shm->live_count);
+
+	connect_limit_shm_write_begin(shm);
+	for (i = 0; i < count; i++) {
+		shm->entries[i].hash1 = 0;
+		shm->entries[i].count = 0;
+	}
+	for (i = 0; i < n; i++) {
+		idx = live[i].hash1 & shm->mask;
+		while (shm->entries[idx].hash1 != 0)
+			idx = (idx + 1) & shm->mask;
+		entry = &shm->entries[idx];
+		entry->hash1 = live[i].hash1;
+		entry->hash2 = live[i].hash2;
+		entry->count = live[i].count;
+	}
+	shm->used_count = n;
+	connect_limit_shm_write_end(shm);
+	i_free(live);
+}
+
+static bool connect_limit_shm_is_full(struct connect_limit_shm *shm,
+				      unsigned int used_count)
+{
+	return used_count * 100ULL >=
+		(shm->mask + 1ULL) * CONNECT_LIMIT_SHM_MAX_USED_PERCENTAGE;
+}
+
+int connect_limit_shm_update(struct connect_limit_shm *shm,
+			     const char *ident, unsigned int count)
+{
+	volatile struct connect_limit_shm_entry *entry;
+	uint32_t hash1, hash2;
+	unsigned int old_count;
+	bool found;
+
+	if (shm->hdr->disabled != 0)
+		return 0;
+
+	connect_limit_shm_hash(ident, &hash1, &hash2);
+	entry = connect_limit_shm_find(shm, hash1, hash2, &found);
+	if (!found && count == 0)
+		return 0;
+	if (!found && entry->hash1 == 0 &&
+	    connect_limit_shm_is_full(shm, shm->used_count + 1)) {
+		if (connect_limit_shm_is_full(shm, shm->live_count + 1)) {
+			connect_limit_shm_disable(shm);
+			return -1;
+		}
+		connect_limit_shm_rebuild(shm);
+		entry = connect_limit_shm_find(shm, hash1, hash2, &found);
+		i_assert(!found);
+	}
+	old_count = found ? entry->count : 0;
+
+	connect_limit_shm_write_begin(shm);
+	if (!found) {
+		if (entry->hash1 == 0)
+			shm->used_count++;
+		entry->hash1 = hash1;
+		entry->hash2 = hash2;
+	}
+	entry->count = count;
+	connect_limit_shm_write_end(shm);
+
+	if (old_count == 0 && count != 0)
+		shm->live_count++;
+	else if (old_count != 0 && count == 0)
+		shm->live_count--;
+	return 0;
+}
+
+void connect_limit_shm_disable(struct connect_limit_shm *shm)
+{
+	connect_limit_shm_write_begin(shm);
+	shm->hdr->disabled = 1;
+	connect_limit_shm_write_end(shm);
+}
+
+bool connect_limit_shm_lookup(struct connect_limit_shm *shm,
+			      const char *ident, unsigned int *count_r)
+{
+	volatile const struct connect_limit_shm_entry *entry;
+	uint32_t hash1, hash2, seq, entry_hash1;
+	unsigned int i, idx, retry, count;
+
+	connect_limit_shm_hash(ident, &hash1, &hash2);
+	for (retry = 0; retry < CONNECT_LIMIT_SHM_LOOKUP_RETRIES; retry++) {
+		seq = shm->hdr->seq;
+		connect_limit_shm_barrier();
+		if (shm->hdr->disabled != 0)
+			return FALSE;
+		if ((seq & 1) != 0)
+			continue;
+
+		count = 0;
+		idx = hash1 & shm->mask;
+		for (i = 0; i <= shm->mask; i++, idx = (idx + 1) & shm->mask) {
+			entry = &shm->entries[idx];
+			entry_hash1 = entry->hash1;
+			if (entry_hash1 == 0)
+				break;
+			if (entry_hash1 == hash1 && entry->hash2 == hash2) {
+				count = entry->count;
+				break;
+			}
+		}
+		connect_limit_shm_barrier();
+		if (shm->hdr->seq == seq) {
+			*count_r = count;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
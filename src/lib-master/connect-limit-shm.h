@@ -0,0 +1,33 @@
+#ifndef CONNECT_LIMIT_SHM_H
+#define CONNECT_LIMIT_SHM_H
+
+/* Shared memory table of anvil's connect-limit ident => count. Anvil is the
+   only writer, login processes map it read-only and look up the counts
+   without asking anvil. Idents are stored only as two 32bit hashes. */
+
+/* Create a new table with space for the given number of entries (rounded
+   up to a power of 2). Returns NULL if shared memory isn't available or
+   it can't be sealed against writes by the processes receiving the fd. */
+struct connect_limit_shm *connect_limit_shm_create(unsigned int entries);
+/* Map an fd received from anvil read-only. The fd is closed.
+   Returns NULL on failure. */
+struct connect_limit_shm *connect_limit_shm_open(int fd);
+void connect_limit_shm_free(struct connect_limit_shm **shm);
+
+/* Returns the fd that can be sent to other processes. */
+int connect_limit_shm_get_fd(struct connect_limit_shm *shm);
+
+/* Set ident's connection count. count=0 removes it. Returns -1 if the table
+   became full and was disabled, 0 otherwise. */
+int connect_limit_shm_update(struct connect_limit_shm *shm,
+			     const char *ident, unsigned int count);
+/* Mark the table unusable, so readers fall back to asking anvil. */
+void connect_limit_shm_disable(struct connect_limit_shm *shm);
+
+/* Look up ident's connection count. Returns FALSE if it couldn't be looked
+   up reliably (table is disabled or being modified too much), in which
+   case the caller should ask anvil. */
+bool connect_limit_shm_lookup(struct connect_limit_shm *shm,
+			      const char *ident, unsigned int *count_r);
+
+#endif
@@ -0,0 +1,95 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "test-common.h"
+#include "connect-limit-shm.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define TEST_IDENT_COUNT 32
+
+static void test_connect_limit_shm_random(void)
+{
+	struct connect_limit_shm *wshm, *rshm;
+	unsigned int counts[TEST_IDENT_COUNT];
+	unsigned int i, n, idx, count;
+	const char *ident;
+	int fd;
+
+	test_begin("connect limit shm random");
+	wshm = connect_limit_shm_create(64);
+	if (wshm == NULL) {
+		/* not supported by this OS */
+		test_end();
+		return;
+	}
+	fd = dup(connect_limit_shm_get_fd(wshm));
+	test_assert(fd != -1);
+	/* the receivers of the fd can't get write access to the table */
+	test_assert(mmap(NULL, 1, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 fd, 0) == MAP_FAILED);
+	rshm = connect_limit_shm_open(fd);
+	test_assert(rshm != NULL);
+
+	/* the table needs to be rebuilt many times to get rid of the
+	   removed entries */
+	memset(counts, 0, sizeof(counts));
+	for (n = 0; n < 10000; n++) {
+		idx = rand() % TEST_IDENT_COUNT;
+		ident = t_strdup_printf("imap/127.0.0.%u/user%u", idx, idx);
+		if (counts[idx] > 0 && rand() % 2 == 0)
+			counts[idx]--;
+		else
+			counts[idx]++;
+		test_assert(connect_limit_shm_update(wshm, ident,
+						     counts[idx]) == 0);
+
+		for (i = 0; i < TEST_IDENT_COUNT; i++) {
+			ident = t_strdup_printf("imap/127.0.0.%u/user%u", i, i);
+			test_assert(connect_limit_shm_lookup(rshm, ident, &count) &&
+				    count == counts[i]);
+		}
+	}
+	test_assert(connect_limit_shm_lookup(rshm, "nonexistent", &count) &&
+		    count == 0);
+
+	connect_limit_shm_free(&rshm);
+	connect_limit_shm_free(&wshm);
+	test_end();
+}
+
+static void test_connect_limit_shm_full(void)
+{
+	struct connect_limit_shm *shm;
+	unsigned int i, count;
+
+	test_begin("connect limit shm full");
+	shm = connect_limit_shm_create(16);
+	if (shm == NULL) {
+		test_end();
+		return;
+	}
+	/* 75% of the table can be used */
+	for (i = 0; i < 11; i++)
+		test_assert(connect_limit_shm_update(shm, dec2str(i), i + 1) == 0);
+	for (i = 0; i < 11; i++) {
+		test_assert(connect_limit_shm_lookup(shm, dec2str(i), &count) &&
+			    count == i + 1);
+	}
+	test_assert(connect_limit_shm_update(shm, "full", 1) < 0);
+	test_assert(!connect_limit_shm_lookup(shm, "0", &count));
+	connect_limit_shm_free(&shm);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_connect_limit_shm_random,
+		test_connect_limit_shm_full,
+		NULL
+	};
+	return test_run(test_functions);
+}
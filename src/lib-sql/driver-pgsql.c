@@ -3,12 +3,20 @@
 #include "lib.h"
 #include "array.h"
 #include "ioloop.h"
+#include "str.h"
 #include "sql-api-private.h"
 
 #ifdef BUILD_PGSQL
 #include <stdlib.h>
 #include <libpq-fe.h>
 
+struct pgsql_prepared {
+	char *query;
+	unsigned int id;
+	/* PREPARE has succeeded in this connection */
+	bool ready;
+};
+
 struct pgsql_db {
 	struct sql_db api;
 
@@ -27,6 +35,10 @@ struct pgsql_db {
 
 	char *error;
 
+	/* prepared statement cache, the most recently used last */
+	ARRAY(struct pgsql_prepared) prepared;
+	unsigned int prepared_id_counter;
+
 	unsigned int fatal_error:1;
 };
 
@@ -50,7 +62,18 @@ struct pgsql_result {
 	sql_query_callback_t *callback;
 	void *context;
 
+	/* statement parameters */
+	const char **stmt_args;
+	unsigned int stmt_args_count;
+	/* ID of the prepared statement to execute */
+	unsigned int stmt_id;
+
 	unsigned int timeout:1;
+	/* waiting for PREPARE/DEALLOCATE to finish before executing the
+	   prepared statement */
+	unsigned int preparing:1;
+	/* the first result of PREPARE/DEALLOCATE has been read */
+	unsigned int prepare_replied:1;
 };
 
 struct pgsql_transaction_context {
@@ -72,6 +95,7 @@ extern const struct sql_db driver_pgsql_db;
 extern const struct sql_result driver_pgsql_result;
 
 static void result_finish(struct pgsql_result *result);
+static void get_prepare_result(struct pgsql_result *result);
 
 static const char *pgsql_prefix(struct pgsql_db *db)
 {
@@ -100,10 +124,50 @@ static void driver_pgsql_stop_io(struct pgsql_db *db)
 	}
 }
 
+static void driver_pgsql_prepared_clear(struct pgsql_db *db)
+{
+	struct pgsql_prepared *prepared;
+
+	array_foreach_modifiable(&db->prepared, prepared)
+		i_free(prepared->query);
+	array_clear(&db->prepared);
+}
+
+static struct pgsql_prepared *
+driver_pgsql_prepared_find(struct pgsql_db *db, unsigned int id,
+			   unsigned int *idx_r)
+{
+	struct pgsql_prepared *prepared;
+	unsigned int i, count;
+
+	prepared = array_get_modifiable(&db->prepared, &count);
+	for (i = 0; i < count; i++) {
+		if (prepared[i].id == id) {
+			*idx_r = i;
+			return &prepared[i];
+		}
+	}
+	return NULL;
+}
+
+static void driver_pgsql_prepared_drop(struct pgsql_db *db, unsigned int id)
+{
+	struct pgsql_prepared *prepared;
+	unsigned int idx;
+
+	prepared = driver_pgsql_prepared_find(db, id, &idx);
+	if (prepared != NULL) {
+		i_free(prepared->query);
+		array_delete(&db->prepared, idx, 1);
+	}
+}
+
 static void driver_pgsql_close(struct pgsql_db *db)
 {
 	db->io_dir = 0;
 	db->fatal_error = FALSE;
+	/* prepared statements exist only within the session */
+	driver_pgsql_prepared_clear(db);
 
 	driver_pgsql_stop_io(db);
 
@@ -238,6 +302,7 @@ static struct sql_db *driver_pgsql_init_v(const char *connect_string)
 	db = i_new(struct pgsql_db, 1);
 	db->connect_string = i_strdup(connect_string);
 	db->api = driver_pgsql_db;
+	i_array_init(&db->prepared, 8);
 
 	T_BEGIN {
 		const char *const *arg = t_strsplit(connect_string, " ");
@@ -262,6 +327,7 @@ static void driver_pgsql_deinit_v(struct sql_db *_db)
 	i_free(db->host);
 	i_free(db->error);
 	i_free(db->connect_string);
+	array_free(&db->prepared);
 	array_free(&_db->module_contexts);
 	i_free(db);
 }
@@ -346,6 +412,7 @@ static void driver_pgsql_result_free(struct sql_result *_result)
 
 	i_free(result->fields);
 	i_free(result->values);
+	i_free(result->stmt_args);
 	i_free(result);
 }
 
@@ -357,6 +424,13 @@ static void result_finish(struct pgsql_result *result)
 	i_assert(db->io == NULL);
 	timeout_remove(&result->to);
 
+	if (result->preparing) {
+		/* PREPARE failed or timed out. the server may still have
+		   the statement, so the next PREPARE gets a new name. */
+		driver_pgsql_prepared_drop(db, result->stmt_id);
+		result->preparing = FALSE;
+	}
+
 	/* if connection to server was lost, we don't yet see that the
 	   connection is bad. we only see the fatal error, so assume it also
 	   means disconnection. */
@@ -401,6 +475,10 @@ static void get_result(struct pgsql_result *result)
 		return;
 	}
 
+	if (result->preparing) {
+		get_prepare_result(result);
+		return;
+	}
 	result->pgres = PQgetResult(db->pg);
 	result_finish(result);
 }
@@ -439,10 +517,9 @@ static void query_timeout(struct pgsql_result *result)
 	result_finish(result);
 }
 
-static void do_query(struct pgsql_result *result, const char *query)
+static void do_query_begin(struct pgsql_result *result)
 {
         struct pgsql_db *db = (struct pgsql_db *)result->api.db;
-	int ret;
 
 	i_assert(SQL_DB_IS_READY(&db->api));
 	i_assert(db->cur_result == NULL);
@@ -452,9 +529,14 @@ static void do_query(struct pgsql_result *result, const char *query)
 	db->cur_result = result;
 	result->to = timeout_add(SQL_QUERY_TIMEOUT_SECS * 1000,
 				 query_timeout, result);
+}
 
-	if (!PQsendQuery(db->pg, query) ||
-	    (ret = PQflush(db->pg)) < 0) {
+static void do_query_sent(struct pgsql_result *result, bool sent)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	int ret;
+
+	if (!sent || (ret = PQflush(db->pg)) < 0) {
 		/* failed to send query */
 		result_finish(result);
 		return;
@@ -470,6 +552,14 @@ static void do_query(struct pgsql_result *result, const char *query)
 	}
 }
 
+static void do_query(struct pgsql_result *result, const char *query)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+
+	do_query_begin(result);
+	do_query_sent(result, PQsendQuery(db->pg, query) != 0);
+}
+
 static const char *
 driver_pgsql_escape_string(struct sql_db *_db, const char *string)
 {
@@ -531,6 +621,159 @@ static void driver_pgsql_query(struct sql_db *db, const char *query,
 	do_query(result, query);
 }
 
+static const char *driver_pgsql_statement_convert(const char *query_template)
+{
+	string_t *query = t_str_new(128);
+	unsigned int arg_idx = 0;
+	const char *p, *param;
+
+	/* replace '?' with $1, $2, .. */
+	p = query_template;
+	while ((param = sql_statement_template_next_param(p)) != NULL) {
+		str_append_n(query, p, param - p);
+		str_printfa(query, "$%u", ++arg_idx);
+		p = param + 1;
+	}
+	str_append(query, p);
+	return str_c(query);
+}
+
+static struct pgsql_prepared *
+driver_pgsql_prepared_get(struct pgsql_db *db, const char *query_template,
+			  unsigned int *evicted_id_r)
+{
+	struct pgsql_prepared *prepared, new_prepared;
+	unsigned int i, count;
+
+	*evicted_id_r = 0;
+	prepared = array_get_modifiable(&db->prepared, &count);
+	for (i = count; i > 0; i--) {
+		if (strcmp(prepared[i-1].query, query_template) == 0) {
+			new_prepared = prepared[i-1];
+			array_delete(&db->prepared, i-1, 1);
+			array_append(&db->prepared, &new_prepared, 1);
+			return array_idx_modifiable(&db->prepared, count-1);
+		}
+	}
+
+	if (count >= SQL_STATEMENT_CACHE_SIZE) {
+		/* drop the least recently used statement */
+		if (prepared[0].ready)
+			*evicted_id_r = prepared[0].id;
+		i_free(prepared[0].query);
+		array_delete(&db->prepared, 0, 1);
+	}
+
+	memset(&new_prepared, 0, sizeof(new_prepared));
+	new_prepared.query = i_strdup(query_template);
+	new_prepared.id = ++db->prepared_id_counter;
+	array_append(&db->prepared, &new_prepared, 1);
+	return array_idx_modifiable(&db->prepared,
+				    array_count(&db->prepared)-1);
+}
+
+static bool driver_pgsql_send_prepared(struct pgsql_result *result)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	const char *name;
+
+	name = t_strdup_printf("dovecot_stmt_%u", result->stmt_id);
+	return PQsendQueryPrepared(db->pg, name, result->stmt_args_count,
+				   result->stmt_args, NULL, NULL, 0) != 0;
+}
+
+static void get_prepare_result(struct pgsql_result *result)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	struct pgsql_prepared *prepared;
+	PGresult *pgres;
+	unsigned int idx;
+
+	/* read all the results of the PREPARE/DEALLOCATE query. only the
+	   first one is PREPARE's. a failed DEALLOCATE of an evicted
+	   statement is ignored, since its name isn't used again. */
+	while ((pgres = PQgetResult(db->pg)) != NULL) {
+		if (!result->prepare_replied) {
+			result->prepare_replied = TRUE;
+			if (PQresultStatus(pgres) != PGRES_COMMAND_OK)
+				result->pgres = pgres;
+			else
+				PQclear(pgres);
+		} else {
+			PQclear(pgres);
+		}
+		if (PQisBusy(db->pg)) {
+			db->io = io_add(PQsocket(db->pg), IO_READ,
+					get_result, result);
+			db->io_dir = IO_READ;
+			return;
+		}
+	}
+	if (result->pgres != NULL) {
+		/* failed, return the error as the query's result */
+		result_finish(result);
+		return;
+	}
+	result->preparing = FALSE;
+	prepared = driver_pgsql_prepared_find(db, result->stmt_id, &idx);
+	if (prepared != NULL)
+		prepared->ready = TRUE;
+	do_query_sent(result, driver_pgsql_send_prepared(result));
+}
+
+static void
+driver_pgsql_statement_query(struct sql_statement *stmt,
+			     sql_query_callback_t *callback, void *context)
+{
+	struct pgsql_db *db = (struct pgsql_db *)stmt->db;
+	struct pgsql_result *result;
+	struct pgsql_prepared *prepared;
+	const char *const *args, **args_z, *query;
+	unsigned int evicted_id;
+	string_t *str;
+	bool sent;
+
+	result = i_new(struct pgsql_result, 1);
+	result->api = driver_pgsql_result;
+	result->api.db = stmt->db;
+	result->api.refcount = 1;
+	result->callback = callback;
+	result->context = context;
+
+	args = sql_statement_get_args(stmt, &result->stmt_args_count);
+	args_z = t_new(const char *, result->stmt_args_count + 1);
+	memcpy(args_z, args, sizeof(*args) * result->stmt_args_count);
+	result->stmt_args = p_strarray_dup(default_pool, args_z);
+
+	do_query_begin(result);
+	query = driver_pgsql_statement_convert(stmt->query_template);
+	if (!stmt->prepared) {
+		sent = PQsendQueryParams(db->pg, query,
+					 result->stmt_args_count, NULL,
+					 result->stmt_args, NULL, NULL, 0) != 0;
+	} else {
+		prepared = driver_pgsql_prepared_get(db, stmt->query_template,
+						     &evicted_id);
+		result->stmt_id = prepared->id;
+		if (prepared->ready)
+			sent = driver_pgsql_send_prepared(result);
+		else {
+			/* DEALLOCATE goes last, so that its failure can't
+			   prevent the PREPARE */
+			str = t_str_new(128);
+			str_printfa(str, "PREPARE dovecot_stmt_%u AS %s",
+				    prepared->id, query);
+			if (evicted_id != 0) {
+				str_printfa(str, ";DEALLOCATE dovecot_stmt_%u",
+					    evicted_id);
+			}
+			result->preparing = TRUE;
+			sent = PQsendQuery(db->pg, str_c(str)) != 0;
+		}
+	}
+	do_query_sent(result, sent);
+}
+
 static void pgsql_query_s_callback(struct sql_result *result, void *context)
 {
         struct pgsql_db *db = context;
@@ -575,7 +818,8 @@ static void driver_pgsql_sync_deinit(struct pgsql_db *db)
 }
 
 static struct sql_result *
-driver_pgsql_sync_query(struct pgsql_db *db, const char *query)
+driver_pgsql_sync_run(struct pgsql_db *db, const char *query,
+		      struct sql_statement *stmt)
 {
 	struct sql_result *result;
 
@@ -592,7 +836,10 @@ driver_pgsql_sync_query(struct pgsql_db *db, const char *query)
 		break;
 	}
 
-	driver_pgsql_query(&db->api, query, pgsql_query_s_callback, db);
+	if (stmt != NULL)
+		driver_pgsql_statement_query(stmt, pgsql_query_s_callback, db);
+	else
+		driver_pgsql_query(&db->api, query, pgsql_query_s_callback, db);
 	if (db->sync_result == NULL)
 		io_loop_run(db->ioloop);
 
@@ -612,6 +859,12 @@ driver_pgsql_sync_query(struct pgsql_db *db, const char *query)
 	return result;
 }
 
+static struct sql_result *
+driver_pgsql_sync_query(struct pgsql_db *db, const char *query)
+{
+	return driver_pgsql_sync_run(db, query, NULL);
+}
+
 static struct sql_result *
 driver_pgsql_query_s(struct sql_db *_db, const char *query)
 {
@@ -624,6 +877,18 @@ driver_pgsql_query_s(struct sql_db *_db, const char *query)
 	return result;
 }
 
+static struct sql_result *
+driver_pgsql_statement_query_s(struct sql_statement *stmt)
+{
+	struct pgsql_db *db = (struct pgsql_db *)stmt->db;
+	struct sql_result *result;
+
+	driver_pgsql_sync_init(db);
+	result = driver_pgsql_sync_run(db, NULL, stmt);
+	driver_pgsql_sync_deinit(db);
+	return result;
+}
+
 static int driver_pgsql_result_next_row(struct sql_result *_result)
 {
 	struct pgsql_result *result = (struct pgsql_result *)_result;
@@ -1066,7 +1331,10 @@ const struct sql_db driver_pgsql_db = {
 		driver_pgsql_transaction_commit_s,
 		driver_pgsql_transaction_rollback,
 
-		driver_pgsql_update
+		driver_pgsql_update,
+
+		driver_pgsql_statement_query,
+		driver_pgsql_statement_query_s
 	}
 };
 
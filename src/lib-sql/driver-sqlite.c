@@ -3,39 +3,138 @@
 #include "lib.h"
 #include "array.h"
 #include "str.h"
+#include "llist.h"
+#include "ioloop.h"
+#include "fd-set-nonblock.h"
+#include "fd-close-on-exec.h"
 #include "sql-api-private.h"
 
 #ifdef BUILD_SQLITE
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
 #include <sqlite3.h>
 
 /* retry time if db is busy (in ms) */
 static const int sqlite_busy_timeout = 1000;
 
+struct sqlite_prepared {
+	char *query;
+	sqlite3_stmt *stmt;
+
+	/* a result is using the stmt */
+	unsigned int in_use:1;
+	/* removed from the cache while in use, free when the result is */
+	unsigned int orphan:1;
+};
+
+enum sqlite_request_type {
+	SQLITE_REQUEST_QUERY,
+	SQLITE_REQUEST_COMMIT
+};
+
+struct sqlite_value {
+	/* NULL for SQL NULLs, otherwise NUL-terminated */
+	const char *data;
+	size_t size;
+};
+
+/* A query or a commit that is run by the I/O thread. Between being queued
+   and being moved to the done list the request belongs to the I/O thread,
+   so the ioloop thread must not touch it. */
+struct sqlite_request {
+	struct sqlite_request *prev, *next;
+
+	pool_t pool;
+	enum sqlite_request_type type;
+
+	/* SQLITE_REQUEST_QUERY */
+	const char *query;
+	const char *const *args;
+	unsigned int args_count;
+	sql_query_callback_t *callback;
+	void *context;
+
+	/* SQLITE_REQUEST_COMMIT */
+	struct sqlite_transaction_context *trans;
+	sql_commit_callback_t *commit_callback;
+	unsigned int *affected_rows;
+
+	/* filled by the I/O thread */
+	int rc;
+	const char *error;
+	unsigned int cols, rows;
+	const char **col_names;
+	ARRAY(struct sqlite_value) values;
+};
+
 struct sqlite_db {
 	struct sql_db api;
 
 	pool_t pool;
 	const char *dbfile;
 	sqlite3 *sqlite;
+	/* prepared statement cache, the most recently used last */
+	ARRAY(struct sqlite_prepared *) prepared;
 	unsigned int connected:1;
 	int rc;
+
+	/* Asynchronous queries and commits are run by the I/O thread, so
+	   a slow disk or a locked database doesn't block the ioloop. The
+	   thread uses the same connection, which is opened in serialized
+	   mode. The synchronous APIs first wait for the thread's queue to
+	   become empty, so they see everything queued before them. The
+	   thread may use only the sqlite library and malloc-backed pools:
+	   no data stack, logging or ioloop. */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* signalled when the queue becomes empty and the thread idle */
+	pthread_cond_t idle_cond;
+	/* protected by the lock: */
+	struct sqlite_request *queue_head, *queue_tail;
+	struct sqlite_request *done_head, *done_tail;
+	unsigned int thread_stop:1;
+	unsigned int thread_busy:1;
+
+	/* the I/O thread writes to notify_fd[1] when requests are done */
+	int notify_fd[2];
+	struct io *io_notify;
+	unsigned int pending_count;
+	unsigned int thread_started:1;
+	unsigned int thread_failed:1;
 };
 
 struct sqlite_result {
 	struct sql_result api;
 	sqlite3_stmt *stmt;
+	/* if non-NULL, stmt is owned by this cache entry */
+	struct sqlite_prepared *prepared;
 	unsigned int cols;
 	const char **row;
 };
 
+struct sqlite_async_result {
+	struct sql_result api;
+	struct sqlite_request *request;
+
+	const struct sqlite_value *cur_row;
+	unsigned int next_row_idx;
+	const char **row;
+};
+
 struct sqlite_transaction_context {
 	struct sql_transaction_context ctx;
-	unsigned int failed:1;
+	pool_t query_pool;
 };
 
 extern const struct sql_db driver_sqlite_db;
 extern const struct sql_result driver_sqlite_result;
 extern const struct sql_result driver_sqlite_error_result;
+extern const struct sql_result driver_sqlite_async_result;
+
+static void driver_sqlite_thread_stop(struct sqlite_db *db);
+static void driver_sqlite_wait_idle(struct sqlite_db *db);
 
 static int driver_sqlite_connect(struct sql_db *_db)
 {
@@ -44,7 +143,10 @@ static int driver_sqlite_connect(struct sql_db *_db)
 	if (db->connected)
 		return 1;
 
-	db->rc = sqlite3_open(db->dbfile, &db->sqlite);
+	/* the I/O thread uses the same connection */
+	db->rc = sqlite3_open_v2(db->dbfile, &db->sqlite,
+				 SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+				 SQLITE_OPEN_FULLMUTEX, NULL);
 	
 	if (db->rc == SQLITE_OK) {
 		db->connected = TRUE;
@@ -59,12 +161,38 @@ static int driver_sqlite_connect(struct sql_db *_db)
 	}
 }
 
+static void sqlite_prepared_free(struct sqlite_prepared **_prepared)
+{
+	struct sqlite_prepared *prepared = *_prepared;
+
+	*_prepared = NULL;
+	(void)sqlite3_finalize(prepared->stmt);
+	i_free(prepared->query);
+	i_free(prepared);
+}
+
+static void driver_sqlite_prepared_free_all(struct sqlite_db *db)
+{
+	struct sqlite_prepared **preparedp;
+
+	array_foreach_modifiable(&db->prepared, preparedp) {
+		if ((*preparedp)->in_use)
+			(*preparedp)->orphan = TRUE;
+		else
+			sqlite_prepared_free(preparedp);
+	}
+	array_clear(&db->prepared);
+}
+
 static void driver_sqlite_disconnect(struct sql_db *_db)
 {
  	struct sqlite_db *db = (struct sqlite_db *)_db;
 
+	driver_sqlite_wait_idle(db);
+	driver_sqlite_prepared_free_all(db);
 	sqlite3_close(db->sqlite);
 	db->sqlite = NULL;
+	db->connected = FALSE;
 }
 
 static struct sql_db *driver_sqlite_init_v(const char *connect_string)
@@ -80,6 +208,7 @@ static struct sql_db *driver_sqlite_init_v(const char *connect_string)
 	db->api = driver_sqlite_db;
 	db->dbfile = p_strdup(db->pool, connect_string);
 	db->connected = FALSE;
+	i_array_init(&db->prepared, 8);
 
 	return &db->api;
 }
@@ -91,6 +220,9 @@ static void driver_sqlite_deinit_v(struct sql_db *_db)
 	_db->no_reconnect = TRUE;
 	sql_db_set_state(&db->api, SQL_DB_STATE_DISCONNECTED);
 
+	driver_sqlite_thread_stop(db);
+	driver_sqlite_prepared_free_all(db);
+	array_free(&db->prepared);
 	sqlite3_close(db->sqlite);
 	array_free(&_db->module_contexts);
 	pool_unref(&db->pool);
@@ -130,6 +262,7 @@ static void driver_sqlite_exec(struct sql_db *_db, const char *query)
 {
 	struct sqlite_db *db = (struct sqlite_db *)_db;
 
+	driver_sqlite_wait_idle(db);
 	if (driver_sqlite_connect(_db) < 0)
 		return;
 
@@ -140,18 +273,366 @@ static void driver_sqlite_exec(struct sql_db *_db, const char *query)
 	}
 }
 
-static void driver_sqlite_query(struct sql_db *db, const char *query,
+static int
+driver_sqlite_run_transaction(sqlite3 *sqlite, struct sql_transaction_query *head,
+			      unsigned int *affected_rows, pool_t pool,
+			      const char **error_r)
+{
+	struct sql_transaction_query *query;
+	unsigned int i;
+	int rc;
+
+	rc = sqlite3_exec(sqlite, "BEGIN TRANSACTION", NULL, NULL, NULL);
+	for (query = head, i = 0; query != NULL && rc == SQLITE_OK;
+	     query = query->next, i++) {
+		rc = sqlite3_exec(sqlite, query->query, NULL, NULL, NULL);
+		affected_rows[i] = sqlite3_changes(sqlite);
+	}
+	if (rc == SQLITE_OK)
+		rc = sqlite3_exec(sqlite, "COMMIT", NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		*error_r = p_strdup(pool, sqlite3_errmsg(sqlite));
+		(void)sqlite3_exec(sqlite, "ROLLBACK", NULL, NULL, NULL);
+	}
+	return rc;
+}
+
+static void
+driver_sqlite_transaction_set_affected(struct sql_transaction_query *head,
+				       const unsigned int *affected_rows)
+{
+	struct sql_transaction_query *query;
+	unsigned int i;
+
+	for (query = head, i = 0; query != NULL; query = query->next, i++) {
+		if (query->affected_rows != NULL)
+			*query->affected_rows = affected_rows[i];
+	}
+}
+
+static void
+driver_sqlite_request_query(sqlite3 *sqlite, struct sqlite_request *request)
+{
+	struct sqlite_value *value;
+	sqlite3_stmt *stmt;
+	const unsigned char *data;
+	unsigned int i;
+	int rc;
+
+	rc = sqlite3_prepare_v2(sqlite, request->query, -1, &stmt, NULL);
+	for (i = 0; i < request->args_count && rc == SQLITE_OK; i++) {
+		rc = sqlite3_bind_text(stmt, i+1, request->args[i], -1,
+				       SQLITE_STATIC);
+	}
+	if (rc == SQLITE_OK) {
+		request->cols = sqlite3_column_count(stmt);
+		request->col_names =
+			p_new(request->pool, const char *, request->cols + 1);
+		for (i = 0; i < request->cols; i++) {
+			request->col_names[i] = p_strdup(request->pool,
+				sqlite3_column_name(stmt, i));
+		}
+		p_array_init(&request->values, request->pool,
+			     request->cols * 8 + 1);
+
+		/* read the whole result, so the ioloop never needs to
+		   access the connection */
+		while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+			for (i = 0; i < request->cols; i++) {
+				value = array_append_space(&request->values);
+				data = sqlite3_column_text(stmt, i);
+				if (data == NULL)
+					continue;
+				value->size = sqlite3_column_bytes(stmt, i);
+				value->data = p_malloc(request->pool,
+						       value->size + 1);
+				memcpy((char *)value->data, data, value->size);
+			}
+			request->rows++;
+		}
+		if (rc == SQLITE_DONE)
+			rc = SQLITE_OK;
+	}
+	if (rc != SQLITE_OK)
+		request->error = p_strdup(request->pool, sqlite3_errmsg(sqlite));
+	request->rc = rc;
+	(void)sqlite3_finalize(stmt);
+}
+
+static void
+driver_sqlite_request_run(struct sqlite_db *db, struct sqlite_request *request)
+{
+	sqlite3_mutex *mutex = sqlite3_db_mutex(db->sqlite);
+
+	/* keep the ioloop thread's calls from interleaving with the
+	   request, so e.g. a transaction is seen only after its COMMIT */
+	sqlite3_mutex_enter(mutex);
+	switch (request->type) {
+	case SQLITE_REQUEST_QUERY:
+		driver_sqlite_request_query(db->sqlite, request);
+		break;
+	case SQLITE_REQUEST_COMMIT:
+		request->rc = driver_sqlite_run_transaction(db->sqlite,
+				request->trans->ctx.head, request->affected_rows,
+				request->pool, &request->error);
+		break;
+	}
+	sqlite3_mutex_leave(mutex);
+}
+
+static void *driver_sqlite_thread(void *context)
+{
+	struct sqlite_db *db = context;
+	struct sqlite_request *request;
+
+	pthread_mutex_lock(&db->lock);
+	for (;;) {
+		while (db->queue_head == NULL && !db->thread_stop)
+			pthread_cond_wait(&db->cond, &db->lock);
+		/* finish all the queued requests before stopping */
+		if ((request = db->queue_head) == NULL)
+			break;
+		DLLIST2_REMOVE(&db->queue_head, &db->queue_tail, request);
+		db->thread_busy = TRUE;
+		pthread_mutex_unlock(&db->lock);
+
+		driver_sqlite_request_run(db, request);
+
+		pthread_mutex_lock(&db->lock);
+		db->thread_busy = FALSE;
+		if (db->queue_head == NULL)
+			pthread_cond_broadcast(&db->idle_cond);
+		DLLIST2_APPEND(&db->done_head, &db->done_tail, request);
+		if (write(db->notify_fd[1], "", 1) < 0) {
+			/* EAGAIN: the ioloop hasn't read the earlier
+			   notifications yet, it'll see this request too */
+		}
+	}
+	pthread_mutex_unlock(&db->lock);
+	return NULL;
+}
+
+static void
+driver_sqlite_request_finish(struct sqlite_db *db,
+			     struct sqlite_request *request)
+{
+	struct sqlite_async_result *result;
+	struct sqlite_transaction_context *ctx;
+
+	switch (request->type) {
+	case SQLITE_REQUEST_QUERY:
+		result = i_new(struct sqlite_async_result, 1);
+		result->api = driver_sqlite_async_result;
+		result->api.db = &db->api;
+		result->api.refcount = 1;
+		result->request = request;
+
+		result->api.callback = TRUE;
+		request->callback(&result->api, request->context);
+		result->api.callback = FALSE;
+		sql_result_unref(&result->api);
+		break;
+	case SQLITE_REQUEST_COMMIT:
+		ctx = request->trans;
+		if (request->rc == SQLITE_OK) {
+			driver_sqlite_transaction_set_affected(ctx->ctx.head,
+							request->affected_rows);
+			request->commit_callback(NULL, request->context);
+		} else {
+			request->commit_callback(request->error,
+						 request->context);
+		}
+		pool_unref(&ctx->query_pool);
+		i_free(ctx);
+		pool_unref(&request->pool);
+		break;
+	}
+}
+
+static void driver_sqlite_notify(struct sqlite_db *db)
+{
+	struct sqlite_request *request, *next;
+	char buf[64];
+	ssize_t ret;
+
+	while ((ret = read(db->notify_fd[0], buf, sizeof(buf))) > 0) ;
+	if (ret < 0 && errno != EAGAIN)
+		i_error("sqlite: read(notify pipe) failed: %m");
+
+	pthread_mutex_lock(&db->lock);
+	request = db->done_head;
+	db->done_head = db->done_tail = NULL;
+	pthread_mutex_unlock(&db->lock);
+
+	for (; request != NULL; request = next) {
+		next = request->next;
+		i_assert(db->pending_count > 0);
+		db->pending_count--;
+		driver_sqlite_request_finish(db, request);
+	}
+	if (db->pending_count == 0 && db->io_notify != NULL)
+		io_remove(&db->io_notify);
+}
+
+static int driver_sqlite_thread_start(struct sqlite_db *db)
+{
+	sigset_t sigset, old_sigset;
+	int ret;
+
+	if (sqlite3_threadsafe() == 0) {
+		i_warning("sqlite: Library isn't thread-safe, "
+			  "queries will block");
+		return -1;
+	}
+	if (pipe(db->notify_fd) < 0) {
+		i_error("sqlite: pipe() failed: %m");
+		return -1;
+	}
+	fd_set_nonblock(db->notify_fd[0], TRUE);
+	fd_set_nonblock(db->notify_fd[1], TRUE);
+	fd_close_on_exec(db->notify_fd[0], TRUE);
+	fd_close_on_exec(db->notify_fd[1], TRUE);
+	pthread_mutex_init(&db->lock, NULL);
+	pthread_cond_init(&db->cond, NULL);
+	pthread_cond_init(&db->idle_cond, NULL);
+
+	/* signals are handled only by the ioloop thread */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_SETMASK, &sigset, &old_sigset);
+	ret = pthread_create(&db->thread, NULL, driver_sqlite_thread, db);
+	pthread_sigmask(SIG_SETMASK, &old_sigset, NULL);
+	if (ret != 0) {
+		errno = ret;
+		i_error("sqlite: pthread_create() failed: %m");
+		pthread_cond_destroy(&db->idle_cond);
+		pthread_cond_destroy(&db->cond);
+		pthread_mutex_destroy(&db->lock);
+		i_close_fd(&db->notify_fd[0]);
+		i_close_fd(&db->notify_fd[1]);
+		return -1;
+	}
+	db->thread_started = TRUE;
+	return 0;
+}
+
+static void driver_sqlite_thread_stop(struct sqlite_db *db)
+{
+	if (!db->thread_started) {
+		db->thread_stop = TRUE;
+		return;
+	}
+
+	pthread_mutex_lock(&db->lock);
+	db->thread_stop = TRUE;
+	pthread_cond_signal(&db->cond);
+	pthread_mutex_unlock(&db->lock);
+	(void)pthread_join(db->thread, NULL);
+	db->thread_started = FALSE;
+
+	/* the queued requests were finished, call their callbacks. any new
+	   queries they send are run synchronously. */
+	driver_sqlite_notify(db);
+	i_assert(db->pending_count == 0);
+
+	pthread_cond_destroy(&db->idle_cond);
+	pthread_cond_destroy(&db->cond);
+	pthread_mutex_destroy(&db->lock);
+	i_close_fd(&db->notify_fd[0]);
+	i_close_fd(&db->notify_fd[1]);
+}
+
+static bool driver_sqlite_async_available(struct sqlite_db *db)
+{
+	if (current_ioloop == NULL || db->thread_stop)
+		return FALSE;
+	if (db->thread_started)
+		return TRUE;
+	if (db->thread_failed)
+		return FALSE;
+
+	/* the I/O thread uses the connection, so it must be open first.
+	   if it can't be opened, the synchronous code returns the error. */
+	if (driver_sqlite_connect(&db->api) < 0)
+		return FALSE;
+	if (driver_sqlite_thread_start(db) < 0) {
+		db->thread_failed = TRUE;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void driver_sqlite_wait_idle(struct sqlite_db *db)
+{
+	if (!db->thread_started)
+		return;
+
+	pthread_mutex_lock(&db->lock);
+	while (db->queue_head != NULL || db->thread_busy)
+		pthread_cond_wait(&db->idle_cond, &db->lock);
+	pthread_mutex_unlock(&db->lock);
+}
+
+static struct sqlite_request *
+driver_sqlite_request_new(enum sqlite_request_type type)
+{
+	struct sqlite_request *request;
+	pool_t pool;
+
+	pool = pool_alloconly_create("sqlite request", 1024);
+	request = p_new(pool, struct sqlite_request, 1);
+	request->pool = pool;
+	request->type = type;
+	return request;
+}
+
+static void
+driver_sqlite_request_queue(struct sqlite_db *db,
+			    struct sqlite_request *request)
+{
+	if (db->io_notify == NULL) {
+		db->io_notify = io_add(db->notify_fd[0], IO_READ,
+				       driver_sqlite_notify, db);
+	}
+	db->pending_count++;
+
+	pthread_mutex_lock(&db->lock);
+	DLLIST2_APPEND(&db->queue_head, &db->queue_tail, request);
+	pthread_cond_signal(&db->cond);
+	pthread_mutex_unlock(&db->lock);
+}
+
+static void driver_sqlite_query(struct sql_db *_db, const char *query,
 				sql_query_callback_t *callback, void *context)
 {
+	struct sqlite_db *db = (struct sqlite_db *)_db;
+	struct sqlite_request *request;
 	struct sql_result *result;
 
-	result = sql_query_s(db, query);
+	if (driver_sqlite_async_available(db)) {
+		request = driver_sqlite_request_new(SQLITE_REQUEST_QUERY);
+		request->query = p_strdup(request->pool, query);
+		request->callback = callback;
+		request->context = context;
+		driver_sqlite_request_queue(db, request);
+		return;
+	}
+
+	result = sql_query_s(_db, query);
 	result->callback = TRUE;
 	callback(result, context);
 	result->callback = FALSE;
 	sql_result_unref(result);
 }
 
+static void driver_sqlite_result_init(struct sqlite_result *result)
+{
+	result->api = driver_sqlite_result;
+	result->cols = sqlite3_column_count(result->stmt);
+	/* e.g. INSERT statements return no columns */
+	if (result->cols > 0)
+		result->row = i_new(const char *, result->cols);
+}
+
 static struct sql_result *
 driver_sqlite_query_s(struct sql_db *_db, const char *query)
 {
@@ -159,6 +640,7 @@ driver_sqlite_query_s(struct sql_db *_db, const char *query)
 	struct sqlite_result *result;
 	int rc;
 
+	driver_sqlite_wait_idle(db);
 	result = i_new(struct sqlite_result, 1);
 
 	if (driver_sqlite_connect(_db) < 0) {
@@ -167,11 +649,9 @@ driver_sqlite_query_s(struct sql_db *_db, const char *query)
 		result->cols = 0;
 	} else {
 		rc = sqlite3_prepare(db->sqlite, query, -1, &result->stmt, NULL);
-		if (rc == SQLITE_OK) {
-			result->api = driver_sqlite_result;
-			result->cols = sqlite3_column_count(result->stmt);
-			result->row = i_new(const char *, result->cols);
-		} else {
+		if (rc == SQLITE_OK)
+			driver_sqlite_result_init(result);
+		else {
 			result->api = driver_sqlite_error_result;
 			result->stmt = NULL;
 			result->cols = 0;
@@ -192,7 +672,17 @@ static void driver_sqlite_result_free(struct sql_result *_result)
 	if (_result->callback)
 		return;
 
-	if (result->stmt != NULL) {
+	if (result->prepared != NULL) {
+		/* keep the statement cached for the next query */
+		if (result->prepared->orphan)
+			sqlite_prepared_free(&result->prepared);
+		else {
+			(void)sqlite3_reset(result->stmt);
+			(void)sqlite3_clear_bindings(result->stmt);
+			result->prepared->in_use = FALSE;
+		}
+		i_free(result->row);
+	} else if (result->stmt != NULL) {
 		if ((rc = sqlite3_finalize(result->stmt)) != SQLITE_OK) {
 			i_warning("sqlite: finalize failed: %s (%d)",
 				  sqlite3_errmsg(db->sqlite), rc);
@@ -302,19 +792,262 @@ static const char *driver_sqlite_result_get_error(struct sql_result *_result)
 	return sqlite3_errmsg(db->sqlite);
 }
 
+static void driver_sqlite_async_result_free(struct sql_result *_result)
+{
+	struct sqlite_async_result *result =
+		(struct sqlite_async_result *)_result;
+
+	if (_result->callback)
+		return;
+
+	pool_unref(&result->request->pool);
+	i_free(result);
+}
+
+static int driver_sqlite_async_result_next_row(struct sql_result *_result)
+{
+	struct sqlite_async_result *result =
+		(struct sqlite_async_result *)_result;
+	struct sqlite_request *request = result->request;
+
+	if (request->rc != SQLITE_OK)
+		return -1;
+	if (result->next_row_idx >= request->rows)
+		return 0;
+
+	result->cur_row = array_idx(&request->values,
+				    result->next_row_idx * request->cols);
+	result->next_row_idx++;
+	return 1;
+}
+
+static unsigned int
+driver_sqlite_async_result_get_fields_count(struct sql_result *_result)
+{
+	struct sqlite_async_result *result =
+		(struct sqlite_async_result *)_result;
+
+	return result->request->cols;
+}
+
+static const char *
+driver_sqlite_async_result_get_field_name(struct sql_result *_result,
+					  unsigned int idx)
+{
+	struct sqlite_async_result *result =
+		(struct sqlite_async_result *)_result;
+
+	i_assert(idx < result->request->cols);
+	return result->request->col_names[idx];
+}
+
+static int driver_sqlite_async_result_find_field(struct sql_result *_result,
+						 const char *field_name)
+{
+	struct sqlite_async_result *result =
+		(struct sqlite_async_result *)_result;
+	unsigned int i;
+
+	for (i = 0; i < result->request->cols; i++) {
+		if (strcmp(result->request->col_names[i], field_name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static const char *
+driver_sqlite_async_result_get_field_value(struct sql_result *_result,
+					   unsigned int idx)
+{
+	struct sqlite_async_result *result =
+		(struct sqlite_async_result *)_result;
+
+	i_assert(idx < result->request->cols);
+	return result->cur_row[idx].data;
+}
+
+static const unsigned char *
+driver_sqlite_async_result_get_field_value_binary(struct sql_result *_result,
+						  unsigned int idx,
+						  size_t *size_r)
+{
+	struct sqlite_async_result *result =
+		(struct sqlite_async_result *)_result;
+
+	i_assert(idx < result->request->cols);
+	*size_r = result->cur_row[idx].size;
+	return (const unsigned char *)result->cur_row[idx].data;
+}
+
+static const char *
+driver_sqlite_async_result_find_field_value(struct sql_result *result,
+					    const char *field_name)
+{
+	int idx;
+
+	idx = driver_sqlite_async_result_find_field(result, field_name);
+	if (idx < 0)
+		return NULL;
+	return driver_sqlite_async_result_get_field_value(result, idx);
+}
+
+static const char *const *
+driver_sqlite_async_result_get_values(struct sql_result *_result)
+{
+	struct sqlite_async_result *result =
+		(struct sqlite_async_result *)_result;
+	struct sqlite_request *request = result->request;
+	unsigned int i;
+
+	if (result->row == NULL)
+		result->row = p_new(request->pool, const char *, request->cols + 1);
+	for (i = 0; i < request->cols; i++)
+		result->row[i] = result->cur_row[i].data;
+	return result->row;
+}
+
+static const char *
+driver_sqlite_async_result_get_error(struct sql_result *_result)
+{
+	struct sqlite_async_result *result =
+		(struct sqlite_async_result *)_result;
+
+	return result->request->error != NULL ?
+		result->request->error : "not an error";
+}
+
+static struct sqlite_prepared *
+driver_sqlite_prepared_get(struct sqlite_db *db, const char *query)
+{
+	struct sqlite_prepared *const *prepared, *new_prepared;
+	unsigned int i, count;
+	sqlite3_stmt *stmt;
+
+	prepared = array_get(&db->prepared, &count);
+	for (i = count; i > 0; i--) {
+		if (strcmp(prepared[i-1]->query, query) != 0)
+			continue;
+
+		new_prepared = prepared[i-1];
+		if (new_prepared->in_use) {
+			/* an earlier result is still using it */
+			return NULL;
+		}
+		array_delete(&db->prepared, i-1, 1);
+		array_append(&db->prepared, &new_prepared, 1);
+		return new_prepared;
+	}
+
+	if (count >= SQL_STATEMENT_CACHE_SIZE) {
+		/* drop the least recently used statement */
+		for (i = 0; i < count; i++) {
+			if (!prepared[i]->in_use)
+				break;
+		}
+		if (i == count)
+			return NULL;
+		new_prepared = prepared[i];
+		array_delete(&db->prepared, i, 1);
+		sqlite_prepared_free(&new_prepared);
+	}
+
+	if (sqlite3_prepare_v2(db->sqlite, query, -1, &stmt, NULL) != SQLITE_OK)
+		return NULL;
+	new_prepared = i_new(struct sqlite_prepared, 1);
+	new_prepared->query = i_strdup(query);
+	new_prepared->stmt = stmt;
+	array_append(&db->prepared, &new_prepared, 1);
+	return new_prepared;
+}
+
+static struct sql_result *
+driver_sqlite_statement_query_s(struct sql_statement *stmt)
+{
+	struct sqlite_db *db = (struct sqlite_db *)stmt->db;
+	struct sqlite_result *result;
+	const char *const *args;
+	unsigned int i, count;
+	int rc = SQLITE_OK;
+
+	driver_sqlite_wait_idle(db);
+	result = i_new(struct sqlite_result, 1);
+	if (driver_sqlite_connect(stmt->db) < 0)
+		rc = SQLITE_CANTOPEN;
+	else {
+		if (stmt->prepared) {
+			result->prepared = driver_sqlite_prepared_get(db,
+							stmt->query_template);
+		}
+		if (result->prepared != NULL) {
+			result->prepared->in_use = TRUE;
+			result->stmt = result->prepared->stmt;
+		} else {
+			rc = sqlite3_prepare_v2(db->sqlite,
+						stmt->query_template, -1,
+						&result->stmt, NULL);
+		}
+	}
+
+	args = sql_statement_get_args(stmt, &count);
+	for (i = 0; i < count && rc == SQLITE_OK; i++) {
+		rc = sqlite3_bind_text(result->stmt, i+1, args[i], -1,
+				       SQLITE_TRANSIENT);
+	}
+	if (rc == SQLITE_OK)
+		driver_sqlite_result_init(result);
+	else {
+		/* the error result frees the stmt */
+		result->api = driver_sqlite_error_result;
+		i_assert(result->row == NULL);
+	}
+	result->api.db = stmt->db;
+	result->api.refcount = 1;
+	return &result->api;
+}
+
+static void
+driver_sqlite_statement_query(struct sql_statement *stmt,
+			      sql_query_callback_t *callback, void *context)
+{
+	struct sqlite_db *db = (struct sqlite_db *)stmt->db;
+	struct sqlite_request *request;
+	struct sql_result *result;
+	const char *const *args;
+	const char **request_args;
+	unsigned int i, count;
+
+	if (driver_sqlite_async_available(db)) {
+		request = driver_sqlite_request_new(SQLITE_REQUEST_QUERY);
+		request->query = p_strdup(request->pool, stmt->query_template);
+		args = sql_statement_get_args(stmt, &count);
+		request_args = p_new(request->pool, const char *, count + 1);
+		for (i = 0; i < count; i++)
+			request_args[i] = p_strdup(request->pool, args[i]);
+		request->args = request_args;
+		request->args_count = count;
+		request->callback = callback;
+		request->context = context;
+		driver_sqlite_request_queue(db, request);
+		return;
+	}
+
+	result = driver_sqlite_statement_query_s(stmt);
+	result->callback = TRUE;
+	callback(result, context);
+	result->callback = FALSE;
+	sql_result_unref(result);
+}
+
 static struct sql_transaction_context *
 driver_sqlite_transaction_begin(struct sql_db *_db)
 {
 	struct sqlite_transaction_context *ctx;
-	struct sqlite_db *db = (struct sqlite_db *)_db;
 
 	ctx = i_new(struct sqlite_transaction_context, 1);
 	ctx->ctx.db = _db;
-
-	sql_exec(_db, "BEGIN TRANSACTION");
-	if (db->rc != SQLITE_OK)
-		ctx->failed = TRUE;
-
+	/* the updates are run only when committing, so that the commit can
+	   be done by the I/O thread */
+	ctx->query_pool = pool_alloconly_create("sqlite transaction", 1024);
 	return &ctx->ctx;
 }
 
@@ -324,54 +1057,75 @@ driver_sqlite_transaction_rollback(struct sql_transaction_context *_ctx)
 	struct sqlite_transaction_context *ctx =
 		(struct sqlite_transaction_context *)_ctx;
 
-	sql_exec(_ctx->db, "ROLLBACK");
+	pool_unref(&ctx->query_pool);
 	i_free(ctx);
 }
 
-static void
-driver_sqlite_transaction_commit(struct sql_transaction_context *_ctx,
-				 sql_commit_callback_t *callback, void *context)
+static int
+driver_sqlite_transaction_commit_s(struct sql_transaction_context *_ctx,
+				   const char **error_r)
 {
-	struct sqlite_transaction_context *ctx =
-		(struct sqlite_transaction_context *)_ctx;
-	struct sqlite_db *db = (struct sqlite_db *)ctx->ctx.db;
-	const char *errmsg;
-
-	if (!ctx->failed) {
-		sql_exec(_ctx->db, "COMMIT");
-		if (db->rc != SQLITE_OK)
-			ctx->failed = TRUE;
-	}
-
-	if (ctx->failed) {
-		errmsg = sqlite3_errmsg(db->sqlite);
-		callback(errmsg, context);
-                /* also does i_free(ctx) */
-		driver_sqlite_transaction_rollback(_ctx);
+	struct sqlite_db *db = (struct sqlite_db *)_ctx->db;
+	struct sql_transaction_query *query;
+	unsigned int *affected_rows, count = 0;
+	int ret = 0;
+
+	for (query = _ctx->head; query != NULL; query = query->next)
+		count++;
+
+	driver_sqlite_wait_idle(db);
+	if (count == 0)
+		;
+	else if (driver_sqlite_connect(_ctx->db) < 0) {
+		*error_r = SQL_ERRSTR_NOT_CONNECTED;
+		ret = -1;
 	} else {
-		callback(NULL, context);
-		i_free(ctx);
+		affected_rows = t_new(unsigned int, count);
+		db->rc = driver_sqlite_run_transaction(db->sqlite, _ctx->head,
+						       affected_rows,
+						       pool_datastack_create(),
+						       error_r);
+		if (db->rc != SQLITE_OK)
+			ret = -1;
+		else {
+			driver_sqlite_transaction_set_affected(_ctx->head,
+							       affected_rows);
+		}
 	}
+	driver_sqlite_transaction_rollback(_ctx);
+	return ret;
 }
 
-static int
-driver_sqlite_transaction_commit_s(struct sql_transaction_context *_ctx,
-				   const char **error_r)
+static void
+driver_sqlite_transaction_commit(struct sql_transaction_context *_ctx,
+				 sql_commit_callback_t *callback, void *context)
 {
 	struct sqlite_transaction_context *ctx =
 		(struct sqlite_transaction_context *)_ctx;
-	struct sqlite_db *db = (struct sqlite_db *) ctx->ctx.db;
-
-	if (ctx->failed) {
-                /* also does i_free(ctx) */
-		driver_sqlite_transaction_rollback(_ctx);
-		return -1;
+	struct sqlite_db *db = (struct sqlite_db *)_ctx->db;
+	struct sql_transaction_query *query;
+	struct sqlite_request *request;
+	const char *error;
+	unsigned int count = 0;
+
+	for (query = _ctx->head; query != NULL; query = query->next)
+		count++;
+
+	if (count > 0 && driver_sqlite_async_available(db)) {
+		request = driver_sqlite_request_new(SQLITE_REQUEST_COMMIT);
+		request->trans = ctx;
+		request->affected_rows =
+			p_new(request->pool, unsigned int, count);
+		request->commit_callback = callback;
+		request->context = context;
+		driver_sqlite_request_queue(db, request);
+		return;
 	}
 
-	sql_exec(_ctx->db, "COMMIT");
-	*error_r = sqlite3_errmsg(db->sqlite);
-	i_free(ctx);
-	return 0;
+	if (driver_sqlite_transaction_commit_s(_ctx, &error) < 0)
+		callback(error, context);
+	else
+		callback(NULL, context);
 }
 
 static void
@@ -380,16 +1134,8 @@ driver_sqlite_update(struct sql_transaction_context *_ctx, const char *query,
 {
 	struct sqlite_transaction_context *ctx =
 		(struct sqlite_transaction_context *)_ctx;
-	struct sqlite_db *db = (struct sqlite_db *)ctx->ctx.db;
-
-	if (ctx->failed)
-		return;
 
-	sql_exec(_ctx->db, query);
-	if (db->rc != SQLITE_OK)
-		ctx->failed = TRUE;
-	else if (affected_rows != NULL)
-		*affected_rows = sqlite3_changes(db->sqlite);
+	sql_transaction_add_query(_ctx, ctx->query_pool, query, affected_rows);
 }
 
 const struct sql_db driver_sqlite_db = {
@@ -410,7 +1156,10 @@ const struct sql_db driver_sqlite_db = {
 		driver_sqlite_transaction_commit,
 		driver_sqlite_transaction_commit_s,
 		driver_sqlite_transaction_rollback,
-		driver_sqlite_update
+		driver_sqlite_update,
+
+		driver_sqlite_statement_query,
+		driver_sqlite_statement_query_s
 	}
 };
 
@@ -444,6 +1193,21 @@ const struct sql_result driver_sqlite_error_result = {
 	}
 };
 
+const struct sql_result driver_sqlite_async_result = {
+	.v = {
+		driver_sqlite_async_result_free,
+		driver_sqlite_async_result_next_row,
+		driver_sqlite_async_result_get_fields_count,
+		driver_sqlite_async_result_get_field_name,
+		driver_sqlite_async_result_find_field,
+		driver_sqlite_async_result_get_field_value,
+		driver_sqlite_async_result_get_field_value_binary,
+		driver_sqlite_async_result_find_field_value,
+		driver_sqlite_async_result_get_values,
+		driver_sqlite_async_result_get_error
+	}
+};
+
 const char *driver_sqlite_version = DOVECOT_ABI_VERSION;
 
 void driver_sqlite_init(void);
@@ -51,6 +51,9 @@ struct sqlpool_request {
 
 	/* requests are a) queries */
 	char *query;
+	/* statement parameters, or NULL if query isn't a statement template */
+	const char **args;
+	bool prepared;
 	sql_query_callback_t *callback;
 	void *context;
 
@@ -101,6 +104,7 @@ sqlpool_request_free(struct sqlpool_request **_request)
 
 	i_assert(request->prev == NULL && request->next == NULL);
 	i_free(request->query);
+	i_free(request->args);
 	i_free(request);
 }
 
@@ -147,6 +151,37 @@ sqlpool_request_handle_transaction(struct sql_db *conndb,
 			       driver_sqlpool_commit_callback, trans);
 }
 
+static struct sql_statement *
+sqlpool_statement_init(struct sql_db *conndb, const char *query_template,
+		       const char *const *args, bool prepared)
+{
+	struct sql_statement *stmt;
+	unsigned int i;
+
+	stmt = sql_statement_init(conndb, query_template);
+	stmt->prepared = prepared;
+	for (i = 0; args[i] != NULL; i++)
+		sql_statement_bind_str(stmt, i, args[i]);
+	return stmt;
+}
+
+static void
+sqlpool_request_send_query(struct sqlpool_request *request,
+			   struct sql_db *conndb)
+{
+	struct sql_statement *stmt;
+
+	if (request->args == NULL) {
+		sql_query(conndb, request->query,
+			  driver_sqlpool_query_callback, request);
+	} else {
+		stmt = sqlpool_statement_init(conndb, request->query,
+					      request->args, request->prepared);
+		sql_statement_query(&stmt, driver_sqlpool_query_callback,
+				    request);
+	}
+}
+
 static void
 sqlpool_request_send_next(struct sqlpool_db *db, struct sql_db *conndb)
 {
@@ -159,10 +194,9 @@ sqlpool_request_send_next(struct sqlpool_db *db, struct sql_db *conndb)
 	DLLIST2_REMOVE(&db->requests_head, &db->requests_tail, request);
 	timeout_reset(db->request_to);
 
-	if (request->query != NULL) {
-		sql_query(conndb, request->query,
-			  driver_sqlpool_query_callback, request);
-	} else if (request->trans != NULL) {
+	if (request->query != NULL)
+		sqlpool_request_send_query(request, conndb);
+	else if (request->trans != NULL) {
 		sqlpool_request_handle_transaction(conndb, request->trans);
 	} else {
 		i_unreached();
@@ -639,25 +673,31 @@ driver_sqlpool_query_callback(struct sql_result *result,
 	}
 }
 
+static void
+driver_sqlpool_send_request(struct sqlpool_db *db,
+			    struct sqlpool_request *request)
+{
+	const struct sqlpool_connection *conn;
+
+	if (!driver_sqlpool_get_connection(db, UINT_MAX, &conn))
+		driver_sqlpool_append_request(db, request);
+	else {
+		request->host_idx = conn->host_idx;
+		sqlpool_request_send_query(request, conn->db);
+	}
+}
+
 static void ATTR_NULL(3, 4)
 driver_sqlpool_query(struct sql_db *_db, const char *query,
 		     sql_query_callback_t *callback, void *context)
 {
         struct sqlpool_db *db = (struct sqlpool_db *)_db;
 	struct sqlpool_request *request;
-	const struct sqlpool_connection *conn;
 
 	request = sqlpool_request_new(db, query);
 	request->callback = callback;
 	request->context = context;
-
-	if (!driver_sqlpool_get_connection(db, UINT_MAX, &conn))
-		driver_sqlpool_append_request(db, request);
-	else {
-		request->host_idx = conn->host_idx;
-		sql_query(conn->db, query, driver_sqlpool_query_callback,
-			  request);
-	}
+	driver_sqlpool_send_request(db, request);
 }
 
 static void driver_sqlpool_exec(struct sql_db *_db, const char *query)
@@ -688,6 +728,67 @@ driver_sqlpool_query_s(struct sql_db *_db, const char *query)
 	return result;
 }
 
+static const char *const *
+sqlpool_statement_get_args(struct sql_statement *stmt)
+{
+	const char *const *args, **args_z;
+	unsigned int count;
+
+	args = sql_statement_get_args(stmt, &count);
+	args_z = t_new(const char *, count + 1);
+	memcpy(args_z, args, sizeof(*args) * count);
+	return args_z;
+}
+
+static void
+driver_sqlpool_statement_query(struct sql_statement *stmt,
+			       sql_query_callback_t *callback, void *context)
+{
+        struct sqlpool_db *db = (struct sqlpool_db *)stmt->db;
+	struct sqlpool_request *request;
+
+	request = sqlpool_request_new(db, stmt->query_template);
+	T_BEGIN {
+		request->args = p_strarray_dup(default_pool,
+					sqlpool_statement_get_args(stmt));
+	} T_END;
+	request->prepared = stmt->prepared;
+	request->callback = callback;
+	request->context = context;
+	driver_sqlpool_send_request(db, request);
+}
+
+static struct sql_result *
+driver_sqlpool_statement_query_s(struct sql_statement *stmt)
+{
+        struct sqlpool_db *db = (struct sqlpool_db *)stmt->db;
+	const struct sqlpool_connection *conn;
+	struct sql_statement *conn_stmt;
+	struct sql_result *result;
+	const char *const *args;
+
+	if (!driver_sqlpool_get_sync_connection(db, &conn)) {
+		sql_not_connected_result.refcount++;
+		return &sql_not_connected_result;
+	}
+
+	args = sqlpool_statement_get_args(stmt);
+	conn_stmt = sqlpool_statement_init(conn->db, stmt->query_template,
+					   args, stmt->prepared);
+	result = sql_statement_query_s(&conn_stmt);
+	if (result->failed_try_retry) {
+		if (!driver_sqlpool_get_sync_connection(db, &conn))
+			return result;
+
+		sql_result_unref(result);
+		conn_stmt = sqlpool_statement_init(conn->db,
+						   stmt->query_template,
+						   args, stmt->prepared);
+		result = sql_statement_query_s(&conn_stmt);
+	}
+	return result;
+}
+
 static struct sql_transaction_context *
 driver_sqlpool_transaction_begin(struct sql_db *_db)
 {
@@ -808,6 +909,9 @@ struct sql_db driver_sqlpool_db = {
 		driver_sqlpool_transaction_commit_s,
 		driver_sqlpool_transaction_rollback,
 
-		driver_sqlpool_update
+		driver_sqlpool_update,
+
+		driver_sqlpool_statement_query,
+		driver_sqlpool_statement_query_s
 	}
 };
@@ -30,6 +30,8 @@ enum sql_db_state {
 #define SQL_QUERY_TIMEOUT_SECS 60
 /* Default max. number of connections to create per host */
 #define SQL_DEFAULT_CONNECTION_LIMIT 5
+/* Max. number of prepared statements to cache per connection */
+#define SQL_STATEMENT_CACHE_SIZE 32
 
 #define SQL_DB_IS_READY(db) \
 	((db)->state == SQL_DB_STATE_IDLE)
@@ -76,6 +78,12 @@ struct sql_db_vfuncs {
 
 	void (*update)(struct sql_transaction_context *ctx, const char *query,
 		       unsigned int *affected_rows);
+
+	/* optional: execute statements with native parameter binding.
+	   the statement is freed by the caller after these return. */
+	void (*statement_query)(struct sql_statement *stmt,
+				sql_query_callback_t *callback, void *context);
+	struct sql_result *(*statement_query_s)(struct sql_statement *stmt);
 };
 
 struct sql_db {
@@ -145,6 +153,24 @@ struct sql_result {
 	unsigned int callback:1;
 };
 
+struct sql_prepared_statement {
+	struct sql_db *db;
+	char *query_template;
+};
+
+struct sql_statement {
+	struct sql_db *db;
+	pool_t pool;
+
+	const char *query_template;
+	/* bound parameters, NULL if not bound */
+	ARRAY_TYPE(const_string) args;
+
+	/* the template comes from a prepared statement, so it's going to be
+	   executed again. drivers may cache it. */
+	unsigned int prepared:1;
+};
+
 struct sql_transaction_context {
 	struct sql_db *db;
 
@@ -162,6 +188,16 @@ driver_sqlpool_init(const char *connect_string, const struct sql_db *driver);
 
 void sql_db_set_state(struct sql_db *db, enum sql_db_state state);
 
+/* Returns the next '?' parameter in the query template starting from p, or
+   NULL if there are no more. '?' inside '' or "" quoted strings and
+   backslash-escaped characters are skipped. */
+const char *sql_statement_template_next_param(const char *p);
+/* Returns the statement's query with the parameters escaped and expanded. */
+const char *sql_statement_get_query(struct sql_statement *stmt);
+/* Returns the statement's parameters. There's one for each '?'. */
+const char *const *sql_statement_get_args(struct sql_statement *stmt,
+					  unsigned int *count_r);
+
 void sql_transaction_add_query(struct sql_transaction_context *ctx, pool_t pool,
 			       const char *query, unsigned int *affected_rows);
 
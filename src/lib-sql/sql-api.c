@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "ioloop.h"
+#include "str.h"
 #include "sql-api-private.h"
 
 #include <stdlib.h>
@@ -143,6 +144,160 @@ struct sql_result *sql_query_s(struct sql_db *db, const char *query)
 	return db->v.query_s(db, query);
 }
 
+struct sql_statement *
+sql_statement_init(struct sql_db *db, const char *query_template)
+{
+	struct sql_statement *stmt;
+	pool_t pool;
+
+	pool = pool_alloconly_create("sql statement", 1024);
+	stmt = p_new(pool, struct sql_statement, 1);
+	stmt->db = db;
+	stmt->pool = pool;
+	stmt->query_template = p_strdup(pool, query_template);
+	p_array_init(&stmt->args, pool, 8);
+	return stmt;
+}
+
+void sql_statement_abort(struct sql_statement **_stmt)
+{
+	struct sql_statement *stmt = *_stmt;
+
+	*_stmt = NULL;
+	pool_unref(&stmt->pool);
+}
+
+void sql_statement_bind_str(struct sql_statement *stmt,
+			    unsigned int column_idx, const char *value)
+{
+	value = p_strdup(stmt->pool, value);
+	array_idx_set(&stmt->args, column_idx, &value);
+}
+
+void sql_statement_bind_int64(struct sql_statement *stmt,
+			      unsigned int column_idx, int64_t value)
+{
+	const char *value_str;
+
+	value_str = p_strdup_printf(stmt->pool, "%lld", (long long)value);
+	array_idx_set(&stmt->args, column_idx, &value_str);
+}
+
+const char *const *sql_statement_get_args(struct sql_statement *stmt,
+					  unsigned int *count_r)
+{
+	const char *const *args;
+	unsigned int i;
+
+	args = array_get(&stmt->args, count_r);
+	for (i = 0; i < *count_r; i++) {
+		if (args[i] == NULL)
+			i_panic("sql statement: Parameter %u not bound: %s",
+				i, stmt->query_template);
+	}
+	return args;
+}
+
+const char *sql_statement_template_next_param(const char *p)
+{
+	char quote = '\0';
+
+	for (; *p != '\0'; p++) {
+		if (*p == '\\' && p[1] != '\0')
+			p++;
+		else if (quote != '\0') {
+			if (*p == quote)
+				quote = '\0';
+		} else if (*p == '\'' || *p == '"')
+			quote = *p;
+		else if (*p == '?')
+			return p;
+	}
+	return NULL;
+}
+
+const char *sql_statement_get_query(struct sql_statement *stmt)
+{
+	string_t *query = t_str_new(128);
+	const char *const *args, *p, *param;
+	unsigned int arg_idx = 0, count;
+
+	args = sql_statement_get_args(stmt, &count);
+	p = stmt->query_template;
+	while ((param = sql_statement_template_next_param(p)) != NULL) {
+		i_assert(arg_idx < count);
+		str_append_n(query, p, param - p);
+		str_printfa(query, "'%s'", sql_escape_string(stmt->db,
+							args[arg_idx++]));
+		p = param + 1;
+	}
+	str_append(query, p);
+	i_assert(arg_idx == count);
+	return str_c(query);
+}
+
+#undef sql_statement_query
+void sql_statement_query(struct sql_statement **_stmt,
+			 sql_query_callback_t *callback, void *context)
+{
+	struct sql_statement *stmt = *_stmt;
+
+	*_stmt = NULL;
+	if (stmt->db->v.statement_query != NULL)
+		stmt->db->v.statement_query(stmt, callback, context);
+	else T_BEGIN {
+		stmt->db->v.query(stmt->db, sql_statement_get_query(stmt),
+				  callback, context);
+	} T_END;
+	pool_unref(&stmt->pool);
+}
+
+struct sql_result *sql_statement_query_s(struct sql_statement **_stmt)
+{
+	struct sql_statement *stmt = *_stmt;
+	struct sql_result *result;
+
+	*_stmt = NULL;
+	if (stmt->db->v.statement_query_s != NULL)
+		result = stmt->db->v.statement_query_s(stmt);
+	else T_BEGIN {
+		result = stmt->db->v.query_s(stmt->db,
+					     sql_statement_get_query(stmt));
+	} T_END;
+	pool_unref(&stmt->pool);
+	return result;
+}
+
+struct sql_prepared_statement *
+sql_prepared_statement_init(struct sql_db *db, const char *query_template)
+{
+	struct sql_prepared_statement *prep_stmt;
+
+	prep_stmt = i_new(struct sql_prepared_statement, 1);
+	prep_stmt->db = db;
+	prep_stmt->query_template = i_strdup(query_template);
+	return prep_stmt;
+}
+
+void sql_prepared_statement_deinit(struct sql_prepared_statement **_prep_stmt)
+{
+	struct sql_prepared_statement *prep_stmt = *_prep_stmt;
+
+	*_prep_stmt = NULL;
+	i_free(prep_stmt->query_template);
+	i_free(prep_stmt);
+}
+
+struct sql_statement *
+sql_statement_init_prepared(struct sql_prepared_statement *prep_stmt)
+{
+	struct sql_statement *stmt;
+
+	stmt = sql_statement_init(prep_stmt->db, prep_stmt->query_template);
+	stmt->prepared = TRUE;
+	return stmt;
+}
+
 void sql_result_ref(struct sql_result *result)
 {
 	result->refcount++;
@@ -378,6 +533,18 @@ void sql_update_get_rows(struct sql_transaction_context *ctx, const char *query,
 	ctx->db->v.update(ctx, query, affected_rows);
 }
 
+void sql_update_stmt(struct sql_transaction_context *ctx,
+		     struct sql_statement **_stmt)
+{
+	struct sql_statement *stmt = *_stmt;
+
+	*_stmt = NULL;
+	T_BEGIN {
+		ctx->db->v.update(ctx, sql_statement_get_query(stmt), NULL);
+	} T_END;
+	pool_unref(&stmt->pool);
+}
+
 void sql_db_set_state(struct sql_db *db, enum sql_db_state state)
 {
 	enum sql_db_state old_state = db->state;
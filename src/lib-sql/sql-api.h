@@ -40,6 +40,8 @@ struct sql_field_def {
 
 struct sql_db;
 struct sql_result;
+struct sql_statement;
+struct sql_prepared_statement;
 
 typedef void sql_query_callback_t(struct sql_result *result, void *context);
 typedef void sql_commit_callback_t(const char *error, void *context);
@@ -86,6 +88,45 @@ void sql_query(struct sql_db *db, const char *query,
 /* Execute blocking SQL query and return result. */
 struct sql_result *sql_query_s(struct sql_db *db, const char *query);
 
+/* Create a statement from a query template, where each '?' is replaced by
+   a parameter bound with sql_statement_bind_*(). The parameters don't need
+   to be escaped. '?' inside '' or "" quoted strings and after a backslash
+   isn't a parameter. The template is scanned the same way for all drivers,
+   so a backslash is always treated as an escape character, even inside
+   PostgreSQL's standard conforming strings. Avoid ending such a literal
+   with a backslash. */
+struct sql_statement *
+sql_statement_init(struct sql_db *db, const char *query_template);
+/* Abort a statement without executing it. */
+void sql_statement_abort(struct sql_statement **stmt);
+/* Bind a parameter. column_idx is the 0-based index of the '?' in the
+   template. */
+void sql_statement_bind_str(struct sql_statement *stmt,
+			    unsigned int column_idx, const char *value);
+void sql_statement_bind_int64(struct sql_statement *stmt,
+			      unsigned int column_idx, int64_t value);
+/* Execute the statement and free it. The callback works the same way as
+   with sql_query(). */
+void sql_statement_query(struct sql_statement **stmt,
+			 sql_query_callback_t *callback, void *context);
+#define sql_statement_query(stmt, callback, context) \
+	sql_statement_query(stmt + \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			struct sql_result *, typeof(context))), \
+		(sql_query_callback_t *)callback, context)
+/* Execute the statement, free it and return the result. */
+struct sql_result *sql_statement_query_s(struct sql_statement **stmt);
+
+/* Prepared statements are templates that are executed repeatedly. Drivers
+   that support it prepare the template once per connection and cache it.
+   The others expand the parameters into the query with escaping. */
+struct sql_prepared_statement *
+sql_prepared_statement_init(struct sql_db *db, const char *query_template);
+void sql_prepared_statement_deinit(struct sql_prepared_statement **prep_stmt);
+/* Create a new statement for executing the prepared statement. */
+struct sql_statement *
+sql_statement_init_prepared(struct sql_prepared_statement *prep_stmt);
+
 void sql_result_setup_fetch(struct sql_result *result,
 			    const struct sql_field_def *fields,
 			    void *dest, size_t dest_size);
@@ -143,5 +184,8 @@ void sql_update(struct sql_transaction_context *ctx, const char *query);
    commit callback is called. */
 void sql_update_get_rows(struct sql_transaction_context *ctx, const char *query,
 			 unsigned int *affected_rows);
+/* Execute the statement in given transaction and free it. */
+void sql_update_stmt(struct sql_transaction_context *ctx,
+		     struct sql_statement **stmt);
 
 #endif
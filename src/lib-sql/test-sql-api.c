@@ -0,0 +1,288 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "sql-api-private.h"
+#include "test-common.h"
+
+#include <unistd.h>
+
+#define TEST_DB_PATH ".test-sql-api.db"
+
+static const char *
+test_escape_string(struct sql_db *db ATTR_UNUSED, const char *string)
+{
+	return t_strarray_join(t_strsplit(string, "'"), "''");
+}
+
+static struct sql_db test_db = {
+	.name = "test",
+	.v = {
+		.escape_string = test_escape_string
+	}
+};
+
+static void test_sql_statement_get_query(void)
+{
+	struct sql_statement *stmt;
+
+	test_begin("sql statement query expansion");
+	stmt = sql_statement_init(&test_db,
+		"SELECT a FROM t WHERE b = ? AND c = '?' AND d = ?");
+	/* parameters can be bound in any order */
+	sql_statement_bind_int64(stmt, 1, -5);
+	sql_statement_bind_str(stmt, 0, "it's ?");
+	test_assert(strcmp(sql_statement_get_query(stmt),
+		"SELECT a FROM t WHERE b = 'it''s ?' "
+		"AND c = '?' AND d = '-5'") == 0);
+	sql_statement_abort(&stmt);
+
+	/* '?' isn't a parameter inside "" or after a backslash */
+	stmt = sql_statement_init(&test_db,
+		"SELECT \"?\" FROM t WHERE b = 'x\\'?' AND c = \\? AND d = ?");
+	sql_statement_bind_str(stmt, 0, "a");
+	test_assert(strcmp(sql_statement_get_query(stmt),
+		"SELECT \"?\" FROM t WHERE b = 'x\\'?' "
+		"AND c = \\? AND d = 'a'") == 0);
+	sql_statement_abort(&stmt);
+	test_end();
+}
+
+#ifdef BUILD_SQLITE
+extern const struct sql_db driver_sqlite_db;
+
+static void test_sql_insert(struct sql_db *db, const char *key,
+			    const char *value)
+{
+	struct sql_transaction_context *trans;
+	struct sql_statement *stmt;
+	const char *error;
+
+	trans = sql_transaction_begin(db);
+	stmt = sql_statement_init(db, "INSERT INTO t (key, value) VALUES (?, ?)");
+	sql_statement_bind_str(stmt, 0, key);
+	sql_statement_bind_str(stmt, 1, value);
+	sql_update_stmt(trans, &stmt);
+	test_assert(sql_transaction_commit_s(&trans, &error) == 0);
+}
+
+static const char *test_sql_result_value(struct sql_result *result)
+{
+	const char *value;
+
+	if (sql_result_next_row(result) <= 0)
+		return NULL;
+	value = t_strdup(sql_result_get_field_value(result, 0));
+	test_assert(sql_result_next_row(result) == 0);
+	return value;
+}
+
+static const char *
+test_sql_prepared_lookup(struct sql_prepared_statement *prep_stmt,
+			 const char *key)
+{
+	struct sql_statement *stmt;
+	struct sql_result *result;
+	const char *value;
+
+	stmt = sql_statement_init_prepared(prep_stmt);
+	sql_statement_bind_str(stmt, 0, key);
+	result = sql_statement_query_s(&stmt);
+	value = test_sql_result_value(result);
+	sql_result_unref(result);
+	return value;
+}
+
+static void test_sql_lookup_callback(struct sql_result *result,
+				     const char **value_r)
+{
+	*value_r = test_sql_result_value(result);
+	io_loop_stop(current_ioloop);
+}
+
+static struct sql_db *test_sqlite_init(void)
+{
+	struct sql_db *db;
+
+	(void)unlink(TEST_DB_PATH);
+	db = sql_init("sqlite", TEST_DB_PATH);
+	sql_exec(db, "CREATE TABLE t (key TEXT, value TEXT)");
+	return db;
+}
+
+static void test_sqlite_deinit(struct sql_db **db)
+{
+	sql_deinit(db);
+	(void)unlink(TEST_DB_PATH);
+}
+
+static void test_sql_statement_sqlite(void)
+{
+	struct sql_db *db;
+	struct sql_statement *stmt;
+	struct sql_result *result;
+	const char *value = NULL;
+
+	test_begin("sql statement sqlite");
+	db = test_sqlite_init();
+	test_sql_insert(db, "it's", "quoted ? '?'");
+	test_sql_insert(db, "plain", "value");
+
+	/* the parameters aren't interpreted as SQL */
+	stmt = sql_statement_init(db, "SELECT value FROM t WHERE key = ?");
+	sql_statement_bind_str(stmt, 0, "it's");
+	result = sql_statement_query_s(&stmt);
+	test_assert(null_strcmp(test_sql_result_value(result),
+				"quoted ? '?'") == 0);
+	sql_result_unref(result);
+
+	stmt = sql_statement_init(db, "SELECT value FROM t WHERE key = ?");
+	sql_statement_bind_str(stmt, 0, "' OR ''='");
+	result = sql_statement_query_s(&stmt);
+	test_assert(test_sql_result_value(result) == NULL);
+	sql_result_unref(result);
+
+	stmt = sql_statement_init(db, "SELECT COUNT(*) FROM t WHERE key <> ?");
+	sql_statement_bind_int64(stmt, 0, 1);
+	sql_statement_query(&stmt, test_sql_lookup_callback, &value);
+	io_loop_run(current_ioloop);
+	test_assert(null_strcmp(value, "2") == 0);
+
+	test_sqlite_deinit(&db);
+	test_end();
+}
+
+static void test_sql_prepared_statement_sqlite(void)
+{
+	struct sql_prepared_statement *prep_stmts[SQL_STATEMENT_CACHE_SIZE+1];
+	struct sql_statement *stmt1, *stmt2;
+	struct sql_result *result1, *result2;
+	struct sql_db *db;
+	unsigned int i, j;
+
+	test_begin("sql prepared statement sqlite");
+	db = test_sqlite_init();
+	test_sql_insert(db, "a", "value a");
+	test_sql_insert(db, "b", "value b");
+
+	/* more statements than are cached. running them in the same
+	   order evicts each one before it's used again. */
+	for (i = 0; i < N_ELEMENTS(prep_stmts); i++) {
+		prep_stmts[i] = sql_prepared_statement_init(db, t_strdup_printf(
+			"SELECT value FROM t WHERE key = ? AND %u = %u", i, i));
+	}
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < N_ELEMENTS(prep_stmts); i++) {
+			test_assert(null_strcmp(test_sql_prepared_lookup(
+				prep_stmts[i], i % 2 == 0 ? "a" : "b"),
+				i % 2 == 0 ? "value a" : "value b") == 0);
+		}
+	}
+
+	/* the cached statement is still in use by the first result */
+	stmt1 = sql_statement_init_prepared(prep_stmts[0]);
+	sql_statement_bind_str(stmt1, 0, "a");
+	result1 = sql_statement_query_s(&stmt1);
+	stmt2 = sql_statement_init_prepared(prep_stmts[0]);
+	sql_statement_bind_str(stmt2, 0, "b");
+	result2 = sql_statement_query_s(&stmt2);
+	test_assert(null_strcmp(test_sql_result_value(result2),
+				"value b") == 0);
+	test_assert(null_strcmp(test_sql_result_value(result1),
+				"value a") == 0);
+	sql_result_unref(result1);
+	sql_result_unref(result2);
+
+	for (i = 0; i < N_ELEMENTS(prep_stmts); i++)
+		sql_prepared_statement_deinit(&prep_stmts[i]);
+	test_sqlite_deinit(&db);
+	test_end();
+}
+
+static void test_sql_commit_callback(const char *error,
+				     unsigned int *commit_count)
+{
+	test_assert(error == NULL);
+	(*commit_count)++;
+}
+
+static void test_sql_insert_async(struct sql_db *db, unsigned int i,
+				  unsigned int *commit_count)
+{
+	struct sql_transaction_context *trans;
+	struct sql_statement *stmt;
+
+	trans = sql_transaction_begin(db);
+	stmt = sql_statement_init(db, "INSERT INTO t (key, value) VALUES (?, ?)");
+	sql_statement_bind_int64(stmt, 0, i);
+	sql_statement_bind_str(stmt, 1, "value");
+	sql_update_stmt(trans, &stmt);
+	sql_transaction_commit(&trans, test_sql_commit_callback, commit_count);
+}
+
+static void test_sql_commit_read_order_db(const char *path)
+{
+	struct sql_db *db;
+	struct sql_result *result;
+	const char *value = NULL;
+	unsigned int i, commit_count = 0;
+
+	db = sql_init("sqlite", path);
+	sql_exec(db, "CREATE TABLE t (key TEXT, value TEXT)");
+
+	/* a synchronous read sees the commits that were queued before it */
+	for (i = 0; i < 10; i++)
+		test_sql_insert_async(db, i, &commit_count);
+	result = sql_query_s(db, "SELECT COUNT(*) FROM t");
+	test_assert(null_strcmp(test_sql_result_value(result), "10") == 0);
+	sql_result_unref(result);
+
+	/* an asynchronous read sees them too, and its callback is called
+	   after the commits' */
+	test_sql_insert_async(db, i, &commit_count);
+	sql_query(db, "SELECT COUNT(*) FROM t",
+		  test_sql_lookup_callback, &value);
+	if (value == NULL)
+		io_loop_run(current_ioloop);
+	test_assert(commit_count == 11);
+	test_assert(null_strcmp(value, "11") == 0);
+	sql_deinit(&db);
+}
+
+static void test_sql_commit_read_order_sqlite(void)
+{
+	test_begin("sql commit read order sqlite");
+	(void)unlink(TEST_DB_PATH);
+	test_sql_commit_read_order_db(TEST_DB_PATH);
+	(void)unlink(TEST_DB_PATH);
+	/* a private in-memory database is visible only if the queries are
+	   done using the same connection */
+	test_sql_commit_read_order_db(":memory:");
+	test_end();
+}
+#endif
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_sql_statement_get_query,
+#ifdef BUILD_SQLITE
+		test_sql_statement_sqlite,
+		test_sql_prepared_statement_sqlite,
+		test_sql_commit_read_order_sqlite,
+#endif
+		NULL
+	};
+	struct ioloop *ioloop;
+
+	test_init();
+	sql_drivers_init();
+#ifdef BUILD_SQLITE
+	sql_driver_register(&driver_sqlite_db);
+#endif
+	ioloop = io_loop_create();
+	test_run_funcs(test_functions);
+	io_loop_destroy(&ioloop);
+	sql_drivers_deinit();
+	return test_deinit();
+}
@@ -3,12 +3,20 @@
 
 #include "mdbox-map.h"
 
+/* Number of map_uid -> seq lookups to remember */
+#define MDBOX_MAP_SEQ_CACHE_SIZE 64
+
 struct dbox_mail_lookup_rec {
 	uint32_t map_uid;
 	uint16_t refcount;
 	struct mdbox_map_mail_index_record rec;
 };
 
+struct mdbox_map_seq_cache_rec {
+	uint32_t map_uid;
+	uint32_t seq;
+};
+
 struct mdbox_map {
 	struct mdbox_storage *storage;
 	const struct mdbox_settings *set;
@@ -18,6 +26,9 @@ struct mdbox_map {
 	struct mail_index_view *view;
 
 	uint32_t map_ext_id, ref_ext_id;
+	/* map_uid -> seq lookups done within the current view. Cleared
+	   whenever the view is synced. */
+	struct mdbox_map_seq_cache_rec seq_cache[MDBOX_MAP_SEQ_CACHE_SIZE];
 
 	struct mailbox_list *root_list;
 
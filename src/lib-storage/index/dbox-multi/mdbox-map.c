@@ -181,6 +181,7 @@ static int mdbox_map_open_internal(struct mdbox_map *map, bool create_missing)
 	}
 
 	map->view = mail_index_view_open(map->index);
+	memset(map->seq_cache, 0, sizeof(map->seq_cache));
 	mdbox_map_cleanup(map);
 
 	if (mail_index_get_header(map->view)->uid_validity == 0) {
@@ -228,6 +229,8 @@ int mdbox_map_refresh(struct mdbox_map *map)
 
 	ctx = mail_index_view_sync_begin(map->view,
 				MAIL_INDEX_VIEW_SYNC_FLAG_FIX_INCONSISTENT);
+	/* sequences may have changed */
+	memset(map->seq_cache, 0, sizeof(map->seq_cache));
 	fscked = mail_index_reset_fscked(map->view->index);
 	if (mail_index_view_sync_commit(&ctx, &delayed_expunges) < 0) {
 		mail_storage_set_internal_error(MAP_STORAGE(map));
@@ -279,14 +282,32 @@ mdbox_map_lookup_seq(struct mdbox_map *map, uint32_t seq,
 	return 0;
 }
 
+static bool
+mdbox_map_lookup_seq_cached(struct mdbox_map *map, uint32_t map_uid,
+			    uint32_t *seq_r)
+{
+	struct mdbox_map_seq_cache_rec *cache =
+		&map->seq_cache[map_uid % MDBOX_MAP_SEQ_CACHE_SIZE];
+
+	if (cache->map_uid == map_uid && map_uid != 0) {
+		*seq_r = cache->seq;
+		return TRUE;
+	}
+	if (!mail_index_lookup_seq(map->view, map_uid, seq_r))
+		return FALSE;
+	cache->map_uid = map_uid;
+	cache->seq = *seq_r;
+	return TRUE;
+}
+
 static int
 mdbox_map_get_seq(struct mdbox_map *map, uint32_t map_uid, uint32_t *seq_r)
 {
-	if (!mail_index_lookup_seq(map->view, map_uid, seq_r)) {
+	if (!mdbox_map_lookup_seq_cached(map, map_uid, seq_r)) {
 		/* not found - try again after a refresh */
 		if (mdbox_map_refresh(map) < 0)
 			return -1;
-		if (!mail_index_lookup_seq(map->view, map_uid, seq_r))
+		if (!mdbox_map_lookup_seq_cached(map, map_uid, seq_r))
 			return 0;
 	}
 	return 1;
@@ -417,15 +438,30 @@ int mdbox_map_get_file_msgs(struct mdbox_map *map, uint32_t file_id,
 	return 0;
 }
 
+static int
+mdbox_map_file_usage_cmp(const struct mdbox_map_file_usage *u1,
+			 const struct mdbox_map_file_usage *u2)
+{
+	if (u1->file_id < u2->file_id)
+		return -1;
+	if (u1->file_id > u2->file_id)
+		return 1;
+	return 0;
+}
+
 int mdbox_map_get_zero_ref_files(struct mdbox_map *map,
-				 ARRAY_TYPE(seq_range) *file_ids_r)
+				 ARRAY_TYPE(mdbox_map_file_usage) *files_r)
 {
 	const struct mail_index_header *hdr;
 	const struct mdbox_map_mail_index_record *rec;
 	const uint16_t *ref16_p;
 	const void *data;
+	ARRAY_TYPE(mdbox_map_file_usage) files;
+	HASH_TABLE(void *, void *) file_idx;
+	struct mdbox_map_file_usage *usage;
+	unsigned int idx;
 	uint32_t seq;
-	bool expunged;
+	bool expunged, zero_ref;
 	int ret;
 
 	if ((ret = mdbox_map_open(map)) <= 0) {
@@ -435,23 +471,47 @@ int mdbox_map_get_zero_ref_files(struct mdbox_map *map,
 	if (mdbox_map_refresh(map) < 0)
 		return -1;
 
+	/* file_id => index in files array + 1 */
+	hash_table_create_direct(&file_idx, default_pool, 0);
+	i_array_init(&files, 128);
+
 	hdr = mail_index_get_header(map->view);
 	for (seq = 1; seq <= hdr->messages_count; seq++) {
-		mail_index_lookup_ext(map->view, seq, map->ref_ext_id,
+		mail_index_lookup_ext(map->view, seq, map->map_ext_id,
 				      &data, &expunged);
-		if (data != NULL && !expunged) {
-			ref16_p = data;
-			if (*ref16_p != 0)
-				continue;
-		}
+		if (data == NULL || expunged)
+			continue;
+		rec = data;
 
-		mail_index_lookup_ext(map->view, seq, map->map_ext_id,
+		mail_index_lookup_ext(map->view, seq, map->ref_ext_id,
 				      &data, &expunged);
-		if (data != NULL && !expunged) {
-			rec = data;
-			seq_range_array_add(file_ids_r, rec->file_id);
+		ref16_p = data;
+		zero_ref = data == NULL || expunged || *ref16_p == 0;
+
+		idx = POINTER_CAST_TO(hash_table_lookup(file_idx,
+				POINTER_CAST(rec->file_id)), unsigned int);
+		if (idx == 0) {
+			usage = array_append_space(&files);
+			usage->file_id = rec->file_id;
+			hash_table_insert(file_idx, POINTER_CAST(rec->file_id),
+					  POINTER_CAST(array_count(&files)));
+		} else {
+			usage = array_idx_modifiable(&files, idx - 1);
 		}
+		usage->total_size += rec->size;
+		if (zero_ref) {
+			usage->zero_ref_count++;
+			usage->zero_ref_size += rec->size;
+		}
+	}
+
+	array_foreach_modifiable(&files, usage) {
+		if (usage->zero_ref_count > 0)
+			array_append(files_r, usage, 1);
 	}
+	array_sort(files_r, mdbox_map_file_usage_cmp);
+	array_free(&files);
+	hash_table_destroy(&file_idx);
 	return 0;
 }
 
@@ -615,30 +675,14 @@ void mdbox_map_transaction_free(struct mdbox_map_transaction_context **_ctx)
 	i_free(ctx);
 }
 
-int mdbox_map_update_refcount(struct mdbox_map_transaction_context *ctx,
-			      uint32_t map_uid, int diff)
+static int
+mdbox_map_update_refcount_seq(struct mdbox_map_transaction_context *ctx,
+			      uint32_t map_uid, uint32_t seq, int diff)
 {
 	struct mdbox_map *map = ctx->atomic->map;
 	const void *data;
-	uint32_t seq;
 	int old_diff, new_diff;
 
-	if (unlikely(ctx->trans == NULL))
-		return -1;
-
-	if (!mail_index_lookup_seq(map->view, map_uid, &seq)) {
-		/* we can't refresh map here since view has a
-		   transaction open. */
-		if (diff > 0) {
-			/* the message was probably just purged */
-			mail_storage_set_error(MAP_STORAGE(map), MAIL_ERROR_EXPUNGED,
-				"Some of the requested messages no longer exist.");
-		} else {
-			mdbox_map_set_corrupted(map,
-				"refcount update lost map_uid=%u", map_uid);
-		}
-		return -1;
-	}
 	mail_index_lookup_ext(map->view, seq, map->ref_ext_id, &data, NULL);
 	old_diff = data == NULL ? 0 : *((const uint16_t *)data);
 	ctx->changed = TRUE;
@@ -661,22 +705,109 @@ int mdbox_map_update_refcount(struct mdbox_map_transaction_context *ctx,
 	return 0;
 }
 
+int mdbox_map_update_refcount(struct mdbox_map_transaction_context *ctx,
+			      uint32_t map_uid, int diff)
+{
+	struct mdbox_map *map = ctx->atomic->map;
+	uint32_t seq;
+
+	if (unlikely(ctx->trans == NULL))
+		return -1;
+
+	if (!mdbox_map_lookup_seq_cached(map, map_uid, &seq)) {
+		/* we can't refresh map here since view has a
+		   transaction open. */
+		if (diff > 0) {
+			/* the message was probably just purged */
+			mail_storage_set_error(MAP_STORAGE(map), MAIL_ERROR_EXPUNGED,
+				"Some of the requested messages no longer exist.");
+		} else {
+			mdbox_map_set_corrupted(map,
+				"refcount update lost map_uid=%u", map_uid);
+		}
+		return -1;
+	}
+	return mdbox_map_update_refcount_seq(ctx, map_uid, seq, diff);
+}
+
+static int uint32_cmp(const uint32_t *u1, const uint32_t *u2)
+{
+	return *u1 < *u2 ? -1 :
+		(*u1 > *u2 ? 1 : 0);
+}
+
+static int
+mdbox_map_update_refcount_run(struct mdbox_map_transaction_context *ctx,
+			      const uint32_t *map_uids, unsigned int count,
+			      int diff)
+{
+	struct mdbox_map *map = ctx->atomic->map;
+	uint32_t seq, seq1 = 0, seq2 = 0;
+	unsigned int i, n;
+	bool all_found;
+
+	/* map_uids are sorted and each one is either the same or +1 from the
+	   previous one. if all of them still exist in the map, they're in
+	   consecutive sequences. */
+	all_found = mail_index_lookup_seq_range(map->view, map_uids[0],
+						map_uids[count-1],
+						&seq1, &seq2) &&
+		seq2 - seq1 == map_uids[count-1] - map_uids[0];
+
+	for (i = 0, seq = seq1; i < count; i += n, seq++) {
+		/* coalesce the same map_uid into a single update */
+		for (n = 1; i + n < count; n++) {
+			if (map_uids[i + n] != map_uids[i])
+				break;
+		}
+		if (all_found) {
+			if (mdbox_map_update_refcount_seq(ctx, map_uids[i], seq,
+							  diff * (int)n) < 0)
+				return -1;
+		} else {
+			/* some of them are missing. this is the error
+			   handling path. */
+			if (mdbox_map_update_refcount(ctx, map_uids[i],
+						      diff * (int)n) < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
 int mdbox_map_update_refcounts(struct mdbox_map_transaction_context *ctx,
 			       const ARRAY_TYPE(uint32_t) *map_uids, int diff)
 {
-	const uint32_t *uidp;
-	unsigned int i, count;
+	ARRAY_TYPE(uint32_t) sorted_uids;
+	const uint32_t *uids;
+	unsigned int i, j, count;
+	int ret = 0;
 
 	if (unlikely(ctx->trans == NULL))
 		return -1;
 
 	count = array_count(map_uids);
-	for (i = 0; i < count; i++) {
-		uidp = array_idx(map_uids, i);
-		if (mdbox_map_update_refcount(ctx, *uidp, diff) < 0)
-			return -1;
-	}
-	return 0;
+	if (count == 0)
+		return 0;
+
+	/* do the updates for consecutive map_uids as ranges, so we don't
+	   need to look up each one of them separately */
+	T_BEGIN {
+		t_array_init(&sorted_uids, count);
+		array_append_array(&sorted_uids, map_uids);
+		array_sort(&sorted_uids, uint32_cmp);
+		uids = array_idx(&sorted_uids, 0);
+
+		for (i = 0; i < count && ret == 0; i = j) {
+			for (j = i + 1; j < count; j++) {
+				if (uids[j] - uids[j-1] > 1)
+					break;
+			}
+			ret = mdbox_map_update_refcount_run(ctx, uids + i,
+							    j - i, diff);
+		}
+	} T_END;
+	return ret;
 }
 
 int mdbox_map_remove_file_id(struct mdbox_map *map, uint32_t file_id)
@@ -23,6 +23,16 @@ struct mdbox_map_mail_index_record {
 	uint32_t size; /* including pre/post metadata */
 };
 
+struct mdbox_map_file_usage {
+	uint32_t file_id;
+	/* sum of all the map records' sizes in the file */
+	uoff_t total_size;
+	/* number and sum of the sizes of the records with refcount=0 */
+	unsigned int zero_ref_count;
+	uoff_t zero_ref_size;
+};
+ARRAY_DEFINE_TYPE(mdbox_map_file_usage, struct mdbox_map_file_usage);
+
 struct mdbox_map_file_msg {
 	uint32_t map_uid;
 	uint32_t offset;
@@ -93,13 +103,17 @@ void mdbox_map_transaction_free(struct mdbox_map_transaction_context **ctx);
 
 int mdbox_map_update_refcount(struct mdbox_map_transaction_context *ctx,
 			      uint32_t map_uid, int diff);
+/* Add diff to the refcount of each map_uid. The same map_uid may exist
+   multiple times. The map_uids don't need to be sorted, but consecutive
+   map_uids are updated with a single range lookup. */
 int mdbox_map_update_refcounts(struct mdbox_map_transaction_context *ctx,
 			       const ARRAY_TYPE(uint32_t) *map_uids, int diff);
 int mdbox_map_remove_file_id(struct mdbox_map *map, uint32_t file_id);
 
-/* Return all files containing messages with zero refcount. */
+/* Return all files containing messages with zero refcount, sorted by
+   file_id. Each file's usage tells how much of it purging would reclaim. */
 int mdbox_map_get_zero_ref_files(struct mdbox_map *map,
-				 ARRAY_TYPE(seq_range) *file_ids_r);
+				 ARRAY_TYPE(mdbox_map_file_usage) *files_r);
 
 struct mdbox_map_append_context *
 mdbox_map_append_begin(struct mdbox_map_atomic_context *atomic);
@@ -6,15 +6,19 @@
 #include "ostream.h"
 #include "str.h"
 #include "hash.h"
+#include "time-util.h"
+#include "mail-worker.h"
 #include "dbox-attachment.h"
 #include "mdbox-storage.h"
 #include "mdbox-storage-rebuild.h"
 #include "mdbox-file.h"
-#include "mdbox-map.h"
+#include "mdbox-map-private.h"
 #include "mdbox-sync.h"
 
 #include <stdlib.h>
+#include <unistd.h>
 #include <dirent.h>
+#include <sys/wait.h>
 
 /*
    Altmoving works like:
@@ -31,6 +35,23 @@ enum mdbox_msg_action {
 	MDBOX_MSG_ACTION_MOVE_FROM_ALT
 };
 
+/* purge worker process exit codes */
+#define MDBOX_PURGE_WORKER_EXIT_FAILURE 1
+#define MDBOX_PURGE_WORKER_EXIT_CORRUPTED 2
+
+struct mdbox_purge_file {
+	uint32_t file_id;
+	/* per mille of the file's size that purging reclaims */
+	unsigned int reclaim_permille;
+};
+
+ARRAY_DEFINE_TYPE(mdbox_purge_file, struct mdbox_purge_file);
+
+struct mdbox_purge_file_stats {
+	unsigned int kept_count, expunged_count;
+	uoff_t read_bytes, copied_bytes;
+};
+
 struct mdbox_purge_context {
 	pool_t pool;
 	struct mdbox_storage *storage;
@@ -42,6 +63,8 @@ struct mdbox_purge_context {
 	ARRAY_TYPE(seq_range) primary_file_ids;
 	/* list of file_ids that we need to purge */
 	ARRAY_TYPE(seq_range) purge_file_ids;
+	/* files containing zero-refcount messages, sorted by file_id */
+	ARRAY_TYPE(mdbox_map_file_usage) zero_ref_files;
 
 	/* uint32_t map_uid => enum mdbox_msg_action action */
 	HASH_TABLE(void *, void *) altmoves;
@@ -49,6 +72,13 @@ struct mdbox_purge_context {
 
 	struct mdbox_map_atomic_context *atomic;
 	struct mdbox_map_append_context *append_ctx;
+
+	/* statistics of the file currently being purged */
+	struct mdbox_purge_file_stats file_stats;
+	/* bytes/sec this process may use, 0 = unlimited */
+	uoff_t max_io_rate;
+	uoff_t io_bytes;
+	struct timeval io_start_time;
 };
 
 static int mdbox_map_file_msg_offset_cmp(const struct mdbox_map_file_msg *m1,
@@ -366,6 +396,7 @@ mdbox_file_purge(struct mdbox_purge_context *ctx, struct dbox_file *file,
 				break;
 			seq_range_array_add(&expunged_map_uids,
 					    msgs[i].map_uid);
+			ctx->file_stats.expunged_count++;
 		} else {
 			/* non-expunged message. write it to output file. */
 			i_stream_seek(file->input, offset);
@@ -373,9 +404,13 @@ mdbox_file_purge(struct mdbox_purge_context *ctx, struct dbox_file *file,
 			if (ret <= 0)
 				break;
 			array_append(&copied_map_uids, &msgs[i].map_uid, 1);
+			ctx->file_stats.kept_count++;
+			ctx->file_stats.copied_bytes +=
+				file->input->v_offset - offset;
 		}
 		offset = file->input->v_offset;
 	}
+	ctx->file_stats.read_bytes = offset;
 	if (offset != (uoff_t)st.st_size && ret > 0) {
 		/* file has more messages than what map tells us */
 		dbox_file_set_corrupted(file,
@@ -476,6 +511,7 @@ mdbox_purge_alloc(struct mdbox_storage *storage)
 	ctx->lowest_primary_file_id = (uint32_t)-1;
 	i_array_init(&ctx->primary_file_ids, 64);
 	i_array_init(&ctx->purge_file_ids, 64);
+	i_array_init(&ctx->zero_ref_files, 64);
 	hash_table_create_direct(&ctx->altmoves, pool, 0);
 	return ctx;
 }
@@ -489,6 +525,7 @@ static void mdbox_purge_free(struct mdbox_purge_context **_ctx)
 	hash_table_destroy(&ctx->altmoves);
 	array_free(&ctx->primary_file_ids);
 	array_free(&ctx->purge_file_ids);
+	array_free(&ctx->zero_ref_files);
 	pool_unref(&ctx->pool);
 }
 
@@ -644,19 +681,255 @@ static int mdbox_altmove_add_files(struct mdbox_purge_context *ctx)
 	return ret;
 }
 
-int mdbox_purge(struct mail_storage *_storage)
+static int mdbox_purge_file_cmp(const struct mdbox_purge_file *f1,
+				const struct mdbox_purge_file *f2)
 {
-	struct mdbox_storage *storage = (struct mdbox_storage *)_storage;
-	struct mdbox_purge_context *ctx;
-	struct dbox_file *file;
+	/* purge the files with the most reclaimable space first */
+	if (f1->reclaim_permille > f2->reclaim_permille)
+		return -1;
+	if (f1->reclaim_permille < f2->reclaim_permille)
+		return 1;
+	return f1->file_id < f2->file_id ? -1 :
+		(f1->file_id > f2->file_id ? 1 : 0);
+}
+
+static int mdbox_purge_usage_file_id_cmp(const uint32_t *file_id,
+					 const struct mdbox_map_file_usage *u)
+{
+	return *file_id < u->file_id ? -1 :
+		(*file_id > u->file_id ? 1 : 0);
+}
+
+static void
+mdbox_purge_get_file_order(struct mdbox_purge_context *ctx,
+			   ARRAY_TYPE(mdbox_purge_file) *files)
+{
+	const struct mdbox_map_file_usage *usage;
+	struct mdbox_purge_file *file;
 	struct seq_range_iter iter;
 	unsigned int i = 0;
 	uint32_t file_id;
+
+	seq_range_array_iter_init(&iter, &ctx->purge_file_ids);
+	while (seq_range_array_iter_nth(&iter, i++, &file_id)) {
+		file = array_append_space(files);
+		file->file_id = file_id;
+
+		/* files that are only altmoved reclaim nothing */
+		usage = array_bsearch(&ctx->zero_ref_files, &file_id,
+				      mdbox_purge_usage_file_id_cmp);
+		if (usage != NULL && usage->total_size > 0) {
+			file->reclaim_permille =
+				usage->zero_ref_size * 1000 / usage->total_size;
+		}
+	}
+	array_sort(files, mdbox_purge_file_cmp);
+}
+
+static void mdbox_purge_throttle(struct mdbox_purge_context *ctx)
+{
+	struct timeval now;
+	long long wanted_usecs, used_usecs;
+
+	if (ctx->max_io_rate == 0)
+		return;
+
+	ctx->io_bytes += ctx->file_stats.read_bytes +
+		ctx->file_stats.copied_bytes;
+	wanted_usecs = (long long)(ctx->io_bytes * 1000000ULL /
+				   ctx->max_io_rate);
+	if (gettimeofday(&now, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	used_usecs = timeval_diff_usecs(&now, &ctx->io_start_time);
+	if (wanted_usecs > used_usecs) {
+		/* we're going faster than allowed. sleep until we're back
+		   within the budget. */
+		usleep(I_MIN(wanted_usecs - used_usecs, 1000000LL*60));
+	}
+}
+
+static int
+mdbox_purge_file_id(struct mdbox_purge_context *ctx, uint32_t file_id)
+{
+	struct mdbox_storage *storage = ctx->storage;
+	struct mail_storage *_storage = &storage->storage.storage;
+	struct dbox_file *file;
+	struct timeval start_time, end_time;
 	bool deleted;
+	int ret = 0;
+
+	if (gettimeofday(&start_time, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+
+	memset(&ctx->file_stats, 0, sizeof(ctx->file_stats));
+	file = mdbox_file_init(storage, file_id);
+	if (dbox_file_open(file, &deleted) > 0 && !deleted) {
+		if ((ret = mdbox_file_purge(ctx, file, file_id)) < 0)
+			ret = -1;
+	} else {
+		if (mdbox_map_remove_file_id(storage->map, file_id) < 0)
+			ret = -1;
+	}
+	dbox_file_unref(&file);
+
+	if (_storage->set->mail_debug && ret > 0) {
+		if (gettimeofday(&end_time, NULL) < 0)
+			i_fatal("gettimeofday() failed: %m");
+		i_debug("mdbox: Purged file_id=%u: "
+			"%u msgs kept (%"PRIuUOFF_T" bytes copied), "
+			"%u msgs expunged (%"PRIuUOFF_T" of %"PRIuUOFF_T
+			" bytes reclaimed) in %d ms", file_id,
+			ctx->file_stats.kept_count,
+			ctx->file_stats.copied_bytes,
+			ctx->file_stats.expunged_count,
+			ctx->file_stats.read_bytes -
+			ctx->file_stats.copied_bytes,
+			ctx->file_stats.read_bytes,
+			timeval_diff_msecs(&end_time, &start_time));
+	}
+	mdbox_purge_throttle(ctx);
+	return ret < 0 ? -1 : 0;
+}
+
+static int
+mdbox_purge_files(struct mdbox_purge_context *ctx,
+		  const ARRAY_TYPE(mdbox_purge_file) *files,
+		  unsigned int worker_idx, unsigned int worker_count)
+{
+	const struct mdbox_purge_file *purge_files;
+	unsigned int i, count;
+	int ret = 0;
+
+	if (gettimeofday(&ctx->io_start_time, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	ctx->max_io_rate = ctx->storage->set->mdbox_purge_max_io_rate /
+		worker_count;
+	if (ctx->max_io_rate == 0 &&
+	    ctx->storage->set->mdbox_purge_max_io_rate != 0)
+		ctx->max_io_rate = 1;
+
+	/* each worker handles every worker_count'th file, so that all of
+	   them start from the most reclaimable files */
+	purge_files = array_get(files, &count);
+	for (i = worker_idx; i < count && ret == 0; i += worker_count) T_BEGIN {
+		ret = mdbox_purge_file_id(ctx, purge_files[i].file_id);
+	} T_END;
+	return ret;
+}
+
+static void ATTR_NORETURN
+mdbox_purge_worker_run(struct mdbox_purge_context *ctx,
+		       const ARRAY_TYPE(mdbox_purge_file) *files,
+		       unsigned int worker_idx, unsigned int worker_count)
+{
+	struct mdbox_storage *storage = ctx->storage;
+	int ret;
+
+	/* the map index and the open dbox files' fds (and their offsets)
+	   are shared with the parent process. forget about them without
+	   closing, so nothing gets unlocked or flushed on the parent's
+	   behalf. this process exits without returning, so leaking them
+	   doesn't matter. */
+	array_clear(&storage->open_files);
+	storage->map = mdbox_map_init(storage, storage->map->root_list);
+
+	if (mdbox_map_open(storage->map) <= 0)
+		ret = -1;
+	else
+		ret = mdbox_purge_files(ctx, files, worker_idx, worker_count);
+	if (storage->corrupted)
+		_exit(MDBOX_PURGE_WORKER_EXIT_CORRUPTED);
+	_exit(ret < 0 ? MDBOX_PURGE_WORKER_EXIT_FAILURE : 0);
+}
+
+static int
+mdbox_purge_worker_wait(struct mdbox_storage *storage,
+			struct mail_workers *workers,
+			struct mail_worker **worker)
+{
+	struct mail_storage *_storage = &storage->storage.storage;
+	pid_t pid = (*worker)->pid;
+	int status;
+
+	if (mail_worker_wait(workers, worker, FALSE, &status) < 0)
+		return -1;
+	if (WIFSIGNALED(status)) {
+		mail_storage_set_critical(_storage,
+			"mdbox purge worker %s killed with signal %d",
+			dec2str(pid), WTERMSIG(status));
+		return -1;
+	}
+	if (!WIFEXITED(status))
+		return -1;
+
+	switch (WEXITSTATUS(status)) {
+	case 0:
+		return 0;
+	case MDBOX_PURGE_WORKER_EXIT_CORRUPTED:
+		storage->corrupted = TRUE;
+		return -1;
+	default:
+		/* the worker already logged the error */
+		return -1;
+	}
+}
+
+static int
+mdbox_purge_files_parallel(struct mdbox_purge_context *ctx,
+			   const ARRAY_TYPE(mdbox_purge_file) *files)
+{
+	struct mdbox_storage *storage = ctx->storage;
+	struct mail_workers *workers;
+	ARRAY(struct mail_worker *) worker_list;
+	struct mail_worker *worker, **workerp;
+	unsigned int i, worker_count;
+	bool child;
+	int ret;
+
+	worker_count = I_MIN(storage->set->mdbox_purge_workers,
+			     array_count(files));
+	if (worker_count <= 1)
+		return mdbox_purge_files(ctx, files, 0, 1);
+
+	/* purging different files is already safe to do concurrently by
+	   separate processes: each file is locked while it's being purged,
+	   and the map is locked only for the final refcount check and
+	   commit. */
+	workers = mail_workers_init();
+	t_array_init(&worker_list, worker_count);
+	for (i = 1; i < worker_count; i++) {
+		worker = mail_workers_fork(workers, FALSE, &child);
+		if (worker == NULL)
+			break;
+		if (child)
+			mdbox_purge_worker_run(ctx, files, i, worker_count);
+		array_append(&worker_list, &worker, 1);
+	}
+	ret = mdbox_purge_files(ctx, files, 0, worker_count);
+	/* if fork() failed, purge the missing workers' files ourself */
+	for (; i < worker_count && ret == 0; i++)
+		ret = mdbox_purge_files(ctx, files, i, worker_count);
+
+	array_foreach_modifiable(&worker_list, workerp) {
+		if (mdbox_purge_worker_wait(storage, workers, workerp) < 0)
+			ret = -1;
+	}
+	mail_workers_deinit(&workers);
+	return ret;
+}
+
+int mdbox_purge(struct mail_storage *_storage)
+{
+	struct mdbox_storage *storage = (struct mdbox_storage *)_storage;
+	struct mdbox_purge_context *ctx;
+	const struct mdbox_map_file_usage *usage;
+	ARRAY_TYPE(mdbox_purge_file) files;
 	int ret;
 
 	ctx = mdbox_purge_alloc(storage);
-	ret = mdbox_map_get_zero_ref_files(storage->map, &ctx->purge_file_ids);
+	ret = mdbox_map_get_zero_ref_files(storage->map, &ctx->zero_ref_files);
+	array_foreach(&ctx->zero_ref_files, usage)
+		seq_range_array_add(&ctx->purge_file_ids, usage->file_id);
 	if (storage->alt_storage_dir != NULL) {
 		if (mdbox_purge_get_primary_files(ctx) < 0)
 			ret = -1;
@@ -667,19 +940,14 @@ int mdbox_purge(struct mail_storage *_storage)
 		}
 	}
 
-	seq_range_array_iter_init(&iter, &ctx->purge_file_ids); i = 0;
-	while (ret == 0 &&
-	       seq_range_array_iter_nth(&iter, i++, &file_id)) T_BEGIN {
-		file = mdbox_file_init(storage, file_id);
-		if (dbox_file_open(file, &deleted) > 0 && !deleted) {
-			if (mdbox_file_purge(ctx, file, file_id) < 0)
-				ret = -1;
-		} else {
-			if (mdbox_map_remove_file_id(storage->map, file_id) < 0)
-				ret = -1;
-		}
-		dbox_file_unref(&file);
-	} T_END;
+	if (ret == 0) {
+		i_array_init(&files, array_count(&ctx->zero_ref_files) + 16);
+		mdbox_purge_get_file_order(ctx, &files);
+		T_BEGIN {
+			ret = mdbox_purge_files_parallel(ctx, &files);
+		} T_END;
+		array_free(&files);
+	}
 	mdbox_purge_free(&ctx);
 
 	if (storage->corrupted) {
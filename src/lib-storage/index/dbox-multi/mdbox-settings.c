@@ -15,6 +15,8 @@ static const struct setting_define mdbox_setting_defines[] = {
 	DEF(SET_BOOL, mdbox_preallocate_space),
 	DEF(SET_SIZE, mdbox_rotate_size),
 	DEF(SET_TIME, mdbox_rotate_interval),
+	DEF(SET_UINT, mdbox_purge_workers),
+	DEF(SET_SIZE, mdbox_purge_max_io_rate),
 
 	SETTING_DEFINE_LIST_END
 };
@@ -22,7 +24,9 @@ static const struct setting_define mdbox_setting_defines[] = {
 static const struct mdbox_settings mdbox_default_settings = {
 	.mdbox_preallocate_space = FALSE,
 	.mdbox_rotate_size = 2*1024*1024,
-	.mdbox_rotate_interval = 0
+	.mdbox_rotate_interval = 0,
+	.mdbox_purge_workers = 1,
+	.mdbox_purge_max_io_rate = 0
 };
 
 static const struct setting_parser_info mdbox_setting_parser_info = {
@@ -60,8 +60,7 @@ static int mdbox_sync_expunge(struct mdbox_sync_context *ctx, uint32_t seq,
 		return -1;
 	if (mdbox_mail_lookup(ctx->mbox, ctx->sync_view, seq, &map_uid) < 0)
 		return -1;
-	if (mdbox_map_update_refcount(ctx->map_trans, map_uid, -1) < 0)
-		return -1;
+	array_append(&ctx->expunged_map_uids, &map_uid, 1);
 	return 0;
 }
 
@@ -162,6 +161,7 @@ static int mdbox_sync_index(struct mdbox_sync_context *ctx)
 	if (mdbox_map_atomic_is_locked(ctx->atomic)) {
 		ctx->map_trans = mdbox_map_transaction_begin(ctx->atomic, FALSE);
 		i_array_init(&ctx->expunged_seqs, 64);
+		i_array_init(&ctx->expunged_map_uids, 64);
 	}
 	while (mail_index_sync_next(ctx->index_sync_ctx, &sync_rec)) {
 		if ((ret = mdbox_sync_rec(ctx, &sync_rec)) < 0)
@@ -171,6 +171,10 @@ static int mdbox_sync_index(struct mdbox_sync_context *ctx)
 	/* write refcount changes to map index. transaction commit updates the
 	   log head, while tail is left behind. */
 	if (mdbox_map_atomic_is_locked(ctx->atomic)) {
+		if (ret == 0) {
+			ret = mdbox_map_update_refcounts(ctx->map_trans,
+							 &ctx->expunged_map_uids, -1);
+		}
 		if (ret == 0)
 			ret = mdbox_map_transaction_commit(ctx->map_trans);
 		/* write changes to mailbox index */
@@ -183,6 +187,7 @@ static int mdbox_sync_index(struct mdbox_sync_context *ctx)
 			mdbox_map_atomic_set_failed(ctx->atomic);
 		mdbox_map_transaction_free(&ctx->map_trans);
 		array_free(&ctx->expunged_seqs);
+		array_free(&ctx->expunged_map_uids);
 	}
 
 	if (box->v.sync_notify != NULL)
@@ -22,6 +22,9 @@ struct mdbox_sync_context {
 	enum mdbox_sync_flags flags;
 
 	ARRAY_TYPE(seq_range) expunged_seqs;
+	/* map_uids of the expunged messages, whose refcounts get decreased
+	   in a single batch */
+	ARRAY_TYPE(uint32_t) expunged_map_uids;
 };
 
 int mdbox_sync_begin(struct mdbox_mailbox *mbox, enum mdbox_sync_flags flags,
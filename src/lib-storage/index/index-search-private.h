@@ -5,6 +5,9 @@
 
 #include <sys/time.h>
 
+struct index_search_multi;
+struct index_search_worker;
+
 struct index_search_context {
         struct mail_search_context mail_ctx;
 	struct mail_index_view *view;
@@ -15,7 +18,14 @@ struct index_search_context {
 	enum mail_fetch_field extra_wanted_fields;
 	struct mailbox_header_lookup_ctx *extra_wanted_headers;
 
+	/* flattened mail_ctx.args, used for matching messages */
+	struct mail_search_program *program;
+	/* BODY and TEXT args that are searched together */
+	struct index_search_multi *multi_body, *multi_text;
 	uint32_t seq1, seq2;
+	/* helper processes searching parts of seq1..seq2 */
+	ARRAY(struct index_search_worker) workers;
+	struct mail_workers *worker_procs;
 	struct mail *cur_mail;
 	struct index_mail *cur_imail;
 	struct mail_thread_context *thread_ctx;
@@ -33,6 +43,8 @@ struct index_search_context {
 	unsigned int have_seqsets:1;
 	unsigned int have_index_args:1;
 	unsigned int have_mailbox_args:1;
+	unsigned int workers_checked:1;
+	unsigned int workers_wait:1;
 };
 
 struct mail *index_search_get_mail(struct index_search_context *ctx);
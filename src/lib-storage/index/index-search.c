@@ -3,6 +3,9 @@
 #include "lib.h"
 #include "ioloop.h"
 #include "array.h"
+#include "buffer.h"
+#include "fd-set-nonblock.h"
+#include "write-full.h"
 #include "istream.h"
 #include "utc-offset.h"
 #include "str.h"
@@ -18,11 +21,15 @@
 #include "index-mail.h"
 #include "index-sort.h"
 #include "mail-search.h"
+#include "mail-search-program.h"
+#include "mail-worker.h"
 #include "mailbox-search-result-private.h"
 #include "index-search-private.h"
 
 #include <stdlib.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <poll.h>
 
 #define SEARCH_NOTIFY_INTERVAL_SECS 10
 
@@ -34,18 +41,40 @@
 
 #define SEARCH_MIN_NONBLOCK_USECS 200000
 #define SEARCH_MAX_NONBLOCK_USECS 250000
+
+/* Use search worker processes only when searching at least this many
+   messages' headers or bodies. */
+#define SEARCH_WORKERS_MIN_MESSAGES 1000
+/* Worker sends its progress after this many searched messages */
+#define SEARCH_WORKER_PROGRESS_INTERVAL 256
+/* Worker's reply is a stream of uint32_t values: a sequence that may match,
+   the last searched sequence with this bit set, or 0 when finished. */
+#define SEARCH_WORKER_PROGRESS_FLAG 0x80000000U
+
+struct index_search_worker {
+	struct mail_worker *proc;
+	uint32_t seq1, seq2;
+
+	/* sequences that may match. everything up to last_seq is known. */
+	ARRAY_TYPE(seq_range) seqs;
+	uint32_t last_seq;
+	buffer_t *input;
+
+	unsigned int finished:1;
+	unsigned int failed:1;
+};
 #define SEARCH_INITIAL_MAX_COST 30000
 #define SEARCH_RECALC_MIN_USECS 50000
 
 struct search_header_context {
         struct index_search_context *index_ctx;
         struct index_mail *imail;
-	struct mail_search_arg *args;
+	struct mail_search_program *program;
 
         struct message_header_line *hdr;
 
+	bool custom_header;
 	unsigned int parse_headers:1;
-	unsigned int custom_header:1;
 	unsigned int threading:1;
 };
 
@@ -55,6 +84,16 @@ struct search_body_context {
 	struct message_part *part;
 };
 
+struct index_search_multi {
+	/* searches for all the args' keys with a single pass */
+	struct message_search_context *search_ctx;
+	ARRAY(struct mail_search_arg *) args;
+
+	/* the message whose results search_ctx currently has */
+	uint32_t seq;
+	int ret;
+};
+
 static void search_parse_msgset_args(unsigned int messages_count,
 				     struct mail_search_arg *args,
 				     uint32_t *seq1_r, uint32_t *seq2_r);
@@ -424,6 +463,84 @@ msg_search_arg_context(struct index_search_context *ctx,
 	return arg->context;
 }
 
+static void
+search_multi_add_args(struct index_search_multi *multi,
+		      struct mail_search_arg *arg,
+		      enum mail_search_arg_type type)
+{
+	for (; arg != NULL; arg = arg->next) {
+		if (arg->type == SEARCH_OR || arg->type == SEARCH_SUB)
+			search_multi_add_args(multi, arg->value.subargs, type);
+		else if (arg->type == type)
+			array_append(&multi->args, &arg, 1);
+	}
+}
+
+static struct index_search_multi *
+search_multi_init(struct index_search_context *ctx,
+		  enum mail_search_arg_type type)
+{
+	struct index_search_multi *multi;
+	struct mail_search_arg *const *args;
+	ARRAY_TYPE(const_string) keys;
+	enum message_search_flags flags = 0;
+	unsigned int i, count;
+	const char *key;
+	string_t *dtc;
+
+	multi = i_new(struct index_search_multi, 1);
+	i_array_init(&multi->args, 8);
+	search_multi_add_args(multi, ctx->mail_ctx.args->args, type);
+	if (type == SEARCH_BODY)
+		flags |= MESSAGE_SEARCH_FLAG_SKIP_HEADERS;
+
+	T_BEGIN {
+		t_array_init(&keys, 8);
+		args = array_get(&multi->args, &count);
+		for (i = 0; i < count; ) {
+			dtc = t_str_new(128);
+			if (ctx->mail_ctx.normalizer(args[i]->value.str,
+					strlen(args[i]->value.str), dtc) < 0) {
+				i_panic("search key not utf8: %s",
+					args[i]->value.str);
+			}
+			if (str_len(dtc) == 0) {
+				/* never matches. leave it to search_body() */
+				array_delete(&multi->args, i, 1);
+				args = array_get(&multi->args, &count);
+			} else {
+				key = str_c(dtc);
+				array_append(&keys, &key, 1);
+				i++;
+			}
+		}
+		/* with a single key the normal search is faster */
+		if (count > 1) {
+			array_append_zero(&keys);
+			multi->search_ctx =
+				message_search_init_multi(array_idx(&keys, 0),
+						ctx->mail_ctx.normalizer, flags);
+		}
+	} T_END;
+
+	if (multi->search_ctx == NULL) {
+		array_free(&multi->args);
+		i_free(multi);
+		return NULL;
+	}
+	return multi;
+}
+
+static void search_multi_deinit(struct index_search_multi **_multi)
+{
+	struct index_search_multi *multi = *_multi;
+
+	*_multi = NULL;
+	message_search_deinit(&multi->search_ctx);
+	array_free(&multi->args);
+	i_free(multi);
+}
+
 static void compress_lwsp(string_t *dest, const unsigned char *src,
 			  unsigned int src_len)
 {
@@ -451,37 +568,28 @@ static void search_header_arg(struct mail_search_arg *arg,
 	struct message_header_line hdr;
 	int ret;
 
-	/* first check that the field name matches to argument. */
+	/* the search program gives us only the args that are looking
+	   for this header */
 	switch (arg->type) {
 	case SEARCH_BEFORE:
 	case SEARCH_ON:
 	case SEARCH_SINCE:
-		if (arg->value.date_type != MAIL_SEARCH_DATE_TYPE_SENT)
-			return;
-
 		/* date is handled differently than others */
-		if (strcasecmp(ctx->hdr->name, "Date") == 0) {
-			if (ctx->hdr->continues) {
-				ctx->hdr->use_full_value = TRUE;
-				return;
-			}
-			ret = search_sent(arg->type, arg->value.time,
-					  ctx->hdr->full_value,
-					  ctx->hdr->full_value_len);
-			ARG_SET_RESULT(arg, ret);
+		if (ctx->hdr->continues) {
+			ctx->hdr->use_full_value = TRUE;
+			return;
 		}
+		ret = search_sent(arg->type, arg->value.time,
+				  ctx->hdr->full_value,
+				  ctx->hdr->full_value_len);
+		ARG_SET_RESULT(arg, ret);
 		return;
-
 	case SEARCH_HEADER:
 	case SEARCH_HEADER_ADDRESS:
 	case SEARCH_HEADER_COMPRESS_LWSP:
-		ctx->custom_header = TRUE;
-
-		if (strcasecmp(ctx->hdr->name, arg->hdr_field_name) != 0)
-			return;
 		break;
 	default:
-		return;
+		i_unreached();
 	}
 
 	if (arg->value.str[0] == '\0') {
@@ -576,8 +684,8 @@ static void search_header(struct message_header_line *hdr,
 {
 	if (hdr == NULL) {
 		/* end of headers, mark all unknown SEARCH_HEADERs unmatched */
-		(void)mail_search_args_foreach(ctx->args, search_header_unmatch,
-					       ctx);
+		(void)mail_search_program_foreach(ctx->program,
+						  search_header_unmatch, ctx);
 		return;
 	}
 
@@ -591,30 +699,16 @@ static void search_header(struct message_header_line *hdr,
 		ctx->hdr = hdr;
 
 		ctx->custom_header = FALSE;
-		(void)mail_search_args_foreach(ctx->args, search_header_arg, ctx);
+		(void)mail_search_program_foreach_header(ctx->program,
+			hdr->name, &ctx->custom_header, search_header_arg, ctx);
 	}
 }
 
-static void search_body(struct mail_search_arg *arg,
-			struct search_body_context *ctx)
+static int search_body_msg(struct search_body_context *ctx,
+			   struct message_search_context *msg_search_ctx)
 {
-	struct message_search_context *msg_search_ctx;
 	int ret;
 
-	switch (arg->type) {
-	case SEARCH_BODY:
-	case SEARCH_TEXT:
-		break;
-	default:
-		return;
-	}
-
-	msg_search_ctx = msg_search_arg_context(ctx->index_ctx, arg);
-	if (msg_search_ctx == NULL) {
-		ARG_SET_RESULT(arg, 0);
-		return;
-	}
-
 	i_stream_seek(ctx->input, 0);
 	ret = message_search_msg(msg_search_ctx, ctx->input, ctx->part);
 	if (ret < 0 && ctx->input->stream_errno == 0) {
@@ -630,12 +724,69 @@ static void search_body(struct mail_search_arg *arg,
 		mail_storage_set_critical(ctx->index_ctx->box->storage,
 			"read(%s) failed: %m", i_stream_get_name(ctx->input));
 	}
+	return ret;
+}
+
+static bool
+search_body_multi(struct search_body_context *ctx,
+		  struct index_search_multi *multi, struct mail_search_arg *arg)
+{
+	struct mail_search_arg *const *args;
+	unsigned int i, count;
+	uint32_t seq = ctx->index_ctx->cur_mail->seq;
+
+	if (multi == NULL)
+		return FALSE;
+	args = array_get(&multi->args, &count);
+	for (i = 0; i < count; i++) {
+		if (args[i] == arg)
+			break;
+	}
+	if (i == count)
+		return FALSE;
+
+	if (multi->seq != seq) {
+		/* the first key for this message. search all of them. */
+		multi->ret = search_body_msg(ctx, multi->search_ctx);
+		multi->seq = seq;
+	}
+	if (multi->ret < 0)
+		ARG_SET_RESULT(arg, -1);
+	else {
+		ARG_SET_RESULT(arg, message_search_key_found(multi->search_ctx,
+							     i) ? 1 : 0);
+	}
+	return TRUE;
+}
+
+static void search_body(struct mail_search_arg *arg,
+			struct search_body_context *ctx)
+{
+	struct message_search_context *msg_search_ctx;
+
+	switch (arg->type) {
+	case SEARCH_BODY:
+		if (search_body_multi(ctx, ctx->index_ctx->multi_body, arg))
+			return;
+		break;
+	case SEARCH_TEXT:
+		if (search_body_multi(ctx, ctx->index_ctx->multi_text, arg))
+			return;
+		break;
+	default:
+		return;
+	}
+
+	msg_search_ctx = msg_search_arg_context(ctx->index_ctx, arg);
+	if (msg_search_ctx == NULL) {
+		ARG_SET_RESULT(arg, 0);
+		return;
+	}
 
-	ARG_SET_RESULT(arg, ret);
+	ARG_SET_RESULT(arg, search_body_msg(ctx, msg_search_ctx));
 }
 
-static int search_arg_match_text(struct mail_search_arg *args,
-				 struct index_search_context *ctx)
+static int search_arg_match_text(struct index_search_context *ctx)
 {
 	const enum message_header_parser_flags hdr_parser_flags =
 		MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE;
@@ -649,7 +800,8 @@ static int search_arg_match_text(struct mail_search_arg *args,
 	int ret;
 
 	/* first check what we need to use */
-	headers = mail_search_args_analyze(args, &have_headers, &have_body);
+	headers = mail_search_program_analyze(ctx->program,
+					      &have_headers, &have_body);
 	if (!have_headers && !have_body)
 		return -1;
 
@@ -659,7 +811,7 @@ static int search_arg_match_text(struct mail_search_arg *args,
 	   virtual mailboxes */
 	hdr_ctx.imail = (struct index_mail *)mail_get_real_mail(ctx->cur_mail);
 	hdr_ctx.custom_header = TRUE;
-	hdr_ctx.args = args;
+	hdr_ctx.program = ctx->program;
 
 	headers_ctx = headers == NULL ? NULL :
 		mailbox_header_lookup_init(ctx->box, headers);
@@ -715,7 +867,8 @@ static int search_arg_match_text(struct mail_search_arg *args,
 
 	if (have_headers) {
 		/* see if the header search succeeded in finishing the search */
-		ret = mail_search_args_foreach(args, search_none, (void *)NULL);
+		ret = mail_search_program_foreach(ctx->program, search_none,
+						  (void *)NULL);
 		if (ret >= 0 || !have_body)
 			return ret;
 	}
@@ -741,7 +894,8 @@ static int search_arg_match_text(struct mail_search_arg *args,
 	body_ctx.input = input;
 	(void)mail_get_parts(ctx->cur_mail, &body_ctx.part);
 
-	return mail_search_args_foreach(args, search_body, &body_ctx);
+	return mail_search_program_foreach(ctx->program, search_body,
+					   &body_ctx);
 }
 
 static bool
@@ -1170,6 +1324,247 @@ wanted_sort_fields_get(struct mailbox *box,
 	}
 }
 
+static int search_match_once(struct index_search_context *ctx)
+{
+	int ret;
+
+	ret = mail_search_program_foreach(ctx->program, search_cached_arg, ctx);
+	if (ret < 0)
+		ret = search_arg_match_text(ctx);
+	return ret;
+}
+
+static bool search_arg_want_text(struct mail_search_arg *arg)
+{
+	for (; arg != NULL; arg = arg->next) {
+		switch (arg->type) {
+		case SEARCH_OR:
+		case SEARCH_SUB:
+		case SEARCH_INTHREAD:
+			if (search_arg_want_text(arg->value.subargs))
+				return TRUE;
+			break;
+		case SEARCH_HEADER:
+		case SEARCH_HEADER_ADDRESS:
+		case SEARCH_HEADER_COMPRESS_LWSP:
+		case SEARCH_BODY:
+		case SEARCH_TEXT:
+			if (!arg->match_always && !arg->nonmatch_always)
+				return TRUE;
+			break;
+		default:
+			break;
+		}
+	}
+	return FALSE;
+}
+
+static void ATTR_NORETURN
+search_worker_run(struct index_search_context *ctx,
+		  const struct index_search_worker *worker)
+{
+	struct mail_search_context *_ctx = &ctx->mail_ctx;
+	struct mail *mail;
+	buffer_t *output;
+	uint32_t value;
+	unsigned int count = 0;
+	int fd = worker->proc->fd;
+	int match;
+
+	/* search our part of the mailbox with the parent's transaction,
+	   which is never committed. the index, cache and log files are
+	   shared with the parent, so make sure we don't write anything to
+	   them, not even cache updates. */
+	mailbox_set_worker_readonly(ctx->box);
+	ctx->seq1 = worker->seq1;
+	ctx->seq2 = worker->seq2;
+	ctx->workers_checked = TRUE;
+	memset(&ctx->workers, 0, sizeof(ctx->workers));
+	ctx->worker_procs = NULL;
+	_ctx->seq = 0;
+
+	output = buffer_create_dynamic(default_pool, 1024);
+	mail = mail_alloc(_ctx->transaction, 0, NULL);
+	mail_search_args_reset(_ctx->args->args, FALSE);
+	while (index_storage_search_next_update_seq(_ctx)) {
+		mail_set_seq(mail, _ctx->seq);
+		ctx->cur_mail = mail;
+		T_BEGIN {
+			match = search_match_once(ctx);
+		} T_END;
+		ctx->cur_mail = NULL;
+		mail_search_args_reset(_ctx->args->args, FALSE);
+
+		/* the parent does the final matching, so anything we're
+		   unsure about is sent as a possible match */
+		if (match != 0)
+			buffer_append(output, &_ctx->seq, sizeof(_ctx->seq));
+		if (++count % SEARCH_WORKER_PROGRESS_INTERVAL == 0) {
+			value = _ctx->seq | SEARCH_WORKER_PROGRESS_FLAG;
+			buffer_append(output, &value, sizeof(value));
+			if (write_full(fd, output->data, output->used) < 0)
+				_exit(1);
+			buffer_set_used_size(output, 0);
+		}
+	}
+	value = 0;
+	buffer_append(output, &value, sizeof(value));
+	if (write_full(fd, output->data, output->used) < 0)
+		_exit(1);
+	_exit(0);
+}
+
+static void search_workers_init(struct index_search_context *ctx)
+{
+	struct mail_search_context *_ctx = &ctx->mail_ctx;
+	struct mailbox *box = _ctx->transaction->box;
+	struct index_search_worker *worker;
+	struct mail_worker *proc;
+	unsigned int i, worker_count, msgs_count;
+	uint32_t chunk_size, seq;
+	bool child;
+
+	ctx->workers_checked = TRUE;
+
+	worker_count = box->storage->set->mail_search_workers;
+	if (worker_count <= 1 || ctx->seq1 == 0 || ctx->seq2 < ctx->seq1)
+		return;
+	msgs_count = ctx->seq2 - ctx->seq1 + 1;
+	if (msgs_count < SEARCH_WORKERS_MIN_MESSAGES ||
+	    !search_arg_want_text(_ctx->args->args))
+		return;
+	/* plugins (e.g. fts) and virtual mailboxes change the way messages
+	   are iterated. only the plain index search is parallelized. */
+	if (box->v.search_next_update_seq !=
+	    index_storage_search_next_update_seq ||
+	    _ctx->update_result != NULL)
+		return;
+
+	/* we search the first chunk ourself */
+	chunk_size = (msgs_count + worker_count - 1) / worker_count;
+	i_array_init(&ctx->workers, worker_count);
+	ctx->worker_procs = mail_workers_init();
+	for (i = 1; i < worker_count; i++) {
+		seq = ctx->seq1 + i * chunk_size;
+		if (seq > ctx->seq2)
+			break;
+		if ((proc = mail_workers_fork(ctx->worker_procs, TRUE,
+					      &child)) == NULL)
+			break;
+
+		worker = array_append_space(&ctx->workers);
+		worker->proc = proc;
+		worker->seq1 = seq;
+		worker->seq2 = I_MIN(seq + chunk_size - 1, ctx->seq2);
+		if (child)
+			search_worker_run(ctx, worker);
+		fd_set_nonblock(proc->fd, TRUE);
+		i_array_init(&worker->seqs, 64);
+		worker->input = buffer_create_dynamic(default_pool, 1024);
+	}
+}
+
+static void search_worker_finish(struct index_search_context *ctx,
+				 struct index_search_worker *worker)
+{
+	int status;
+
+	if (worker->proc != NULL) {
+		/* a worker that has sent all of its results exits by itself */
+		(void)mail_worker_wait(ctx->worker_procs, &worker->proc,
+				       !worker->finished || worker->failed,
+				       &status);
+	}
+	worker->finished = TRUE;
+}
+
+static void search_worker_read(struct index_search_context *ctx,
+			       struct index_search_worker *worker)
+{
+	const uint32_t *values;
+	unsigned int i, count;
+	size_t pos = worker->input->used;
+	ssize_t ret;
+
+	ret = read(worker->proc->fd,
+		   buffer_append_space_unsafe(worker->input, 4096), 4096);
+	buffer_set_used_size(worker->input, pos + (ret > 0 ? ret : 0));
+	if (ret <= 0) {
+		if (ret < 0 && errno == EAGAIN)
+			return;
+		if (ret < 0)
+			i_error("read(search worker) failed: %m");
+		else
+			i_error("search worker %s died unexpectedly",
+				dec2str(worker->proc->pid));
+		/* search the rest of the worker's messages ourself */
+		worker->failed = TRUE;
+		search_worker_finish(ctx, worker);
+		return;
+	}
+	values = worker->input->data;
+	count = worker->input->used / sizeof(uint32_t);
+	for (i = 0; i < count; i++) {
+		if (values[i] == 0) {
+			worker->finished = TRUE;
+			search_worker_finish(ctx, worker);
+			return;
+		}
+		if ((values[i] & SEARCH_WORKER_PROGRESS_FLAG) != 0)
+			worker->last_seq = values[i] & ~SEARCH_WORKER_PROGRESS_FLAG;
+		else {
+			seq_range_array_add(&worker->seqs, values[i]);
+			worker->last_seq = values[i];
+		}
+	}
+	/* keep the partially read value */
+	buffer_delete(worker->input, 0, count * sizeof(uint32_t));
+}
+
+static int search_workers_seq_check(struct index_search_context *ctx,
+				    uint32_t seq)
+{
+	struct index_search_worker *worker;
+	struct pollfd pfd;
+
+	array_foreach_modifiable(&ctx->workers, worker) {
+		if (seq < worker->seq1 || seq > worker->seq2)
+			continue;
+
+		if (!worker->finished && seq > worker->last_seq) {
+			search_worker_read(ctx, worker);
+			if (!worker->finished && seq > worker->last_seq) {
+				memset(&pfd, 0, sizeof(pfd));
+				pfd.fd = worker->proc->fd;
+				pfd.events = POLLIN;
+				if (poll(&pfd, 1, SEARCH_MAX_NONBLOCK_USECS/1000) > 0)
+					search_worker_read(ctx, worker);
+			}
+			if (!worker->finished && seq > worker->last_seq) {
+				/* worker hasn't gotten this far yet */
+				return -1;
+			}
+		}
+		if (worker->failed)
+			return 1;
+		return seq_range_exists(&worker->seqs, seq) ? 1 : 0;
+	}
+	return 1;
+}
+
+static void search_workers_deinit(struct index_search_context *ctx)
+{
+	struct index_search_worker *worker;
+
+	array_foreach_modifiable(&ctx->workers, worker) {
+		search_worker_finish(ctx, worker);
+		array_free(&worker->seqs);
+		buffer_free(&worker->input);
+	}
+	array_free(&ctx->workers);
+	mail_workers_deinit(&ctx->worker_procs);
+}
+
 struct mail_search_context *
 index_storage_search_init(struct mailbox_transaction_context *t,
 			  struct mail_search_args *args,
@@ -1226,6 +1621,9 @@ index_storage_search_init(struct mailbox_transaction_context *t,
 
 	/* Need to reset results for match_always cases */
 	mail_search_args_reset(ctx->mail_ctx.args->args, FALSE);
+	ctx->program = mail_search_program_compile(args->args);
+	ctx->multi_body = search_multi_init(ctx, SEARCH_BODY);
+	ctx->multi_text = search_multi_init(ctx, SEARCH_TEXT);
 	return &ctx->mail_ctx;
 }
 
@@ -1249,9 +1647,16 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 
 	ret = ctx->failed ? -1 : 0;
 
+	if (array_is_created(&ctx->workers))
+		search_workers_deinit(ctx);
 	mail_search_args_reset(ctx->mail_ctx.args->args, FALSE);
 	(void)mail_search_args_foreach(ctx->mail_ctx.args->args,
 				       search_arg_deinit, ctx);
+	mail_search_program_free(&ctx->program);
+	if (ctx->multi_body != NULL)
+		search_multi_deinit(&ctx->multi_body);
+	if (ctx->multi_text != NULL)
+		search_multi_deinit(&ctx->multi_text);
 
 	if (ctx->mail_ctx.wanted_headers != NULL)
 		mailbox_header_lookup_unref(&ctx->mail_ctx.wanted_headers);
@@ -1284,17 +1689,6 @@ search_get_cost(struct mailbox_transaction_context *trans)
 		(trans->stats.files_read_bytes/1024) * SEARCH_COST_KBYTE;
 }
 
-static int search_match_once(struct index_search_context *ctx)
-{
-	int ret;
-
-	ret = mail_search_args_foreach(ctx->mail_ctx.args->args,
-				       search_cached_arg, ctx);
-	if (ret < 0)
-		ret = search_arg_match_text(ctx->mail_ctx.args->args, ctx);
-	return ret;
-}
-
 static bool search_arg_is_static(struct mail_search_arg *arg)
 {
 	struct mail_search_arg *subarg;
@@ -1382,8 +1776,8 @@ static int search_match_next(struct index_search_context *ctx)
 	if (ctx->have_mailbox_args) {
 		/* check that the mailbox name matches.
 		   this makes sense only with virtual mailboxes. */
-		ret = mail_search_args_foreach(ctx->mail_ctx.args->args,
-					       search_mailbox_arg, ctx);
+		ret = mail_search_program_foreach(ctx->program,
+						  search_mailbox_arg, ctx);
 	}
 
 	/* avoid doing extra work for as long as possible */
@@ -1499,6 +1893,8 @@ static int search_more_with_mail(struct index_search_context *ctx,
 	    SEARCH_NOTIFY_INTERVAL_SECS)
 		index_storage_search_notify(box, ctx);
 
+	if (!ctx->workers_checked)
+		search_workers_init(ctx);
 	mail_search_args_reset(_ctx->args->args, FALSE);
 
 	cost1 = search_get_cost(mail->transaction);
@@ -1538,6 +1934,11 @@ static int search_more_with_mail(struct index_search_context *ctx,
 			break;
 		}
 	}
+	if (ctx->workers_wait) {
+		/* waiting for a search worker */
+		ctx->workers_wait = FALSE;
+		ret = 0;
+	}
 	cost2 = search_get_cost(mail->transaction);
 	ctx->cost += cost2 - cost1;
 	return ret;
@@ -1723,7 +2124,7 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 	}
 
 	if (!ctx->have_seqsets && !ctx->have_index_args &&
-	    _ctx->update_result == NULL) {
+	    _ctx->update_result == NULL && !array_is_created(&ctx->workers)) {
 		_ctx->progress_cur = _ctx->seq;
 		return _ctx->seq <= ctx->seq2;
 	}
@@ -1731,13 +2132,13 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 	ret = 0;
 	while (_ctx->seq <= ctx->seq2) {
 		/* check if the sequence matches */
-		ret = mail_search_args_foreach(ctx->mail_ctx.args->args,
-					       search_seqset_arg, ctx);
+		ret = mail_search_program_foreach(ctx->program,
+						  search_seqset_arg, ctx);
 		if (ret != 0 && ctx->have_index_args) {
 			/* check if flags/keywords match before anything else
 			   is done. mail_set_seq() can be a bit slow. */
-			ret = mail_search_args_foreach(ctx->mail_ctx.args->args,
-						       search_index_arg, ctx);
+			ret = mail_search_program_foreach(ctx->program,
+							  search_index_arg, ctx);
 		}
 		if (ret != 0 && _ctx->update_result != NULL) {
 			/* see if this message never matches */
@@ -1746,6 +2147,17 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 					     uid))
 				ret = 0;
 		}
+		if (ret != 0 && array_is_created(&ctx->workers)) {
+			/* skip messages that a search worker found to be
+			   non-matching */
+			if ((ret = search_workers_seq_check(ctx, _ctx->seq)) < 0) {
+				/* continue from this message later */
+				ctx->workers_wait = TRUE;
+				_ctx->seq--;
+				ctx->mail_ctx.progress_cur = _ctx->seq;
+				return FALSE;
+			}
+		}
 		if (ret != 0)
 			break;
 
@@ -1,6 +1,7 @@
 /* Copyright (c) 2009-2014 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "time-util.h"
 #include "mail-storage-private.h"
 #include "istream-private.h"
 #include "index-mail.h"
@@ -60,13 +61,20 @@ static ssize_t
 i_stream_mail_read(struct istream_private *stream)
 {
 	struct mail_istream *mstream = (struct mail_istream *)stream;
+	struct timeval start_time, end_time;
 	size_t size;
 	ssize_t ret;
 
 	i_stream_seek(stream->parent, stream->parent_start_offset +
 		      stream->istream.v_offset);
 
+	(void)gettimeofday(&start_time, NULL);
 	ret = i_stream_read_copy_from_parent(&stream->istream);
+	(void)gettimeofday(&end_time, NULL);
+	if (timeval_cmp(&end_time, &start_time) > 0) {
+		mstream->mail->transaction->stats.files_read_usecs +=
+			timeval_diff_usecs(&end_time, &start_time);
+	}
 	size = i_stream_get_data_size(&stream->istream);
 	if (ret > 0) {
 		mstream->mail->transaction->stats.files_read_bytes += ret;
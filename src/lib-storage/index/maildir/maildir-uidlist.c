@@ -140,6 +140,7 @@ static int maildir_uidlist_lock_timeout(struct maildir_uidlist *uidlist,
 	struct mailbox *box = uidlist->box;
 	const struct mailbox_permissions *perm = mailbox_get_permissions(box);
 	const char *path = uidlist->path;
+	struct timeval start_time;
 	mode_t old_mask;
 	const enum dotlock_create_flags dotlock_flags =
 		nonblock ? DOTLOCK_CREATE_FLAG_NONBLOCK : 0;
@@ -158,8 +159,11 @@ static int maildir_uidlist_lock_timeout(struct maildir_uidlist *uidlist,
 
 	for (i = 0;; i++) {
 		old_mask = umask(0777 & ~perm->file_create_mode);
+		(void)gettimeofday(&start_time, NULL);
 		ret = file_dotlock_create(&uidlist->dotlock_settings, path,
 					  dotlock_flags, &uidlist->dotlock);
+		mail_index_io_stats_add(MAIL_INDEX_IO_TYPE_LOCK_WAIT, 0,
+					&start_time);
 		umask(old_mask);
 		if (ret > 0)
 			break;
@@ -700,6 +704,7 @@ maildir_uidlist_update_read(struct maildir_uidlist *uidlist,
 	uint32_t orig_next_uid, orig_uid_validity;
 	struct istream *input;
 	struct stat st;
+	struct timeval start_time;
 	uoff_t last_read_offset;
 	int fd, ret;
 	bool readonly = FALSE;
@@ -758,6 +763,7 @@ maildir_uidlist_update_read(struct maildir_uidlist *uidlist,
 							    st.st_size/8));
 	}
 
+	(void)gettimeofday(&start_time, NULL);
 	input = i_stream_create_fd(fd, 4096, FALSE);
 	i_stream_seek(input, last_read_offset);
 
@@ -806,6 +812,9 @@ maildir_uidlist_update_read(struct maildir_uidlist *uidlist,
 			uidlist->next_uid = orig_next_uid;
 		}
 	}
+	mail_index_io_stats_add(MAIL_INDEX_IO_TYPE_BACKEND,
+				input->v_offset - last_read_offset,
+				&start_time);
 
         if (ret == 0) {
                 /* file is broken */
@@ -0,0 +1,225 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "mail-search-program.h"
+
+#define SEARCH_PROGRAM_NO_PARENT UINT_MAX
+
+struct mail_search_program_op {
+	struct mail_search_arg *arg;
+	/* index of the first op after this arg and its subargs */
+	unsigned int next;
+	/* index of the parent OR/SUB, or SEARCH_PROGRAM_NO_PARENT */
+	unsigned int parent;
+
+	/* header this arg looks at, or NULL */
+	const char *hdr_name;
+	unsigned int hdr_hash;
+
+	unsigned int group:1;
+	unsigned int custom_header:1;
+	unsigned int body:1;
+	unsigned int text:1;
+};
+
+struct mail_search_program {
+	ARRAY(struct mail_search_program_op) ops;
+	ARRAY(const char *) headers;
+};
+
+static void
+search_program_add(struct mail_search_program *program,
+		   struct mail_search_arg *arg, unsigned int parent)
+{
+	struct mail_search_program_op *op;
+	unsigned int idx;
+
+	for (; arg != NULL; arg = arg->next) {
+		idx = array_count(&program->ops);
+		op = array_append_space(&program->ops);
+		op->arg = arg;
+		op->parent = parent;
+
+		switch (arg->type) {
+		case SEARCH_OR:
+		case SEARCH_SUB:
+			i_assert(arg->value.subargs != NULL);
+			op->group = TRUE;
+			break;
+		case SEARCH_BEFORE:
+		case SEARCH_ON:
+		case SEARCH_SINCE:
+			if (arg->value.date_type == MAIL_SEARCH_DATE_TYPE_SENT)
+				op->hdr_name = "Date";
+			break;
+		case SEARCH_HEADER:
+		case SEARCH_HEADER_ADDRESS:
+		case SEARCH_HEADER_COMPRESS_LWSP:
+			op->hdr_name = arg->hdr_field_name;
+			op->custom_header = TRUE;
+			break;
+		case SEARCH_BODY:
+			op->body = TRUE;
+			break;
+		case SEARCH_TEXT:
+			op->body = TRUE;
+			op->text = TRUE;
+			break;
+		default:
+			break;
+		}
+		if (op->hdr_name != NULL)
+			op->hdr_hash = strcase_hash(op->hdr_name);
+
+		if (op->group)
+			search_program_add(program, arg->value.subargs, idx);
+		op = array_idx_modifiable(&program->ops, idx);
+		op->next = array_count(&program->ops);
+	}
+}
+
+struct mail_search_program *
+mail_search_program_compile(struct mail_search_arg *args)
+{
+	struct mail_search_program *program;
+
+	program = i_new(struct mail_search_program, 1);
+	i_array_init(&program->ops, 16);
+	i_array_init(&program->headers, 8);
+	search_program_add(program, args, SEARCH_PROGRAM_NO_PARENT);
+	return program;
+}
+
+void mail_search_program_free(struct mail_search_program **_program)
+{
+	struct mail_search_program *program = *_program;
+
+	*_program = NULL;
+	array_free(&program->ops);
+	array_free(&program->headers);
+	i_free(program);
+}
+
+static int
+search_program_run(struct mail_search_program *program,
+		   const char *hdr_name, bool *pending_r,
+		   mail_search_foreach_callback_t *callback, void *context)
+{
+	struct mail_search_program_op *ops, *op, *parent;
+	struct mail_search_arg *arg;
+	unsigned int i, next, count, hdr_hash = 0;
+	int result = 1;
+
+	if (hdr_name != NULL)
+		hdr_hash = strcase_hash(hdr_name);
+
+	ops = array_get_modifiable(&program->ops, &count);
+	for (i = 0; i < count; i = next) {
+		op = &ops[i];
+		arg = op->arg;
+		if (arg->result == -1) {
+			if (op->group) {
+				/* descend into the subargs. the result stays
+				   like this unless some subarg changes it. */
+				arg->result = arg->type == SEARCH_SUB ? 1 : 0;
+				next = i + 1;
+				continue;
+			}
+			if (hdr_name == NULL)
+				callback(arg, context);
+			else if (op->hdr_name != NULL) {
+				if (op->custom_header)
+					*pending_r = TRUE;
+				if (op->hdr_hash == hdr_hash &&
+				    strcasecmp(op->hdr_name, hdr_name) == 0)
+					callback(arg, context);
+			}
+		}
+
+		/* update the parents whose result this arg may have
+		   decided or who don't have any more subargs left */
+		next = op->next;
+		while (op->parent != SEARCH_PROGRAM_NO_PARENT) {
+			parent = &ops[op->parent];
+			if (arg->result == -1)
+				parent->arg->result = -1;
+			else if (arg->result == (parent->arg->type == SEARCH_OR)) {
+				/* matched OR or unmatched SUB */
+				parent->arg->result = arg->result;
+				next = parent->next;
+			}
+			if (next != parent->next)
+				break;
+
+			op = parent;
+			arg = op->arg;
+			if (arg->match_not && arg->result != -1)
+				arg->result = !arg->result;
+		}
+		if (op->parent == SEARCH_PROGRAM_NO_PARENT) {
+			if (arg->result == 0) {
+				/* didn't match */
+				return 0;
+			}
+			if (arg->result == -1)
+				result = -1;
+		}
+	}
+	return result;
+}
+
+#undef mail_search_program_foreach
+int mail_search_program_foreach(struct mail_search_program *program,
+				mail_search_foreach_callback_t *callback,
+				void *context)
+{
+	return search_program_run(program, NULL, NULL, callback, context);
+}
+
+#undef mail_search_program_foreach_header
+int mail_search_program_foreach_header(struct mail_search_program *program,
+				       const char *hdr_name, bool *pending_r,
+				       mail_search_foreach_callback_t *callback,
+				       void *context)
+{
+	i_assert(hdr_name != NULL);
+
+	return search_program_run(program, hdr_name, pending_r,
+				  callback, context);
+}
+
+const char *const *
+mail_search_program_analyze(struct mail_search_program *program,
+			    bool *have_headers, bool *have_body)
+{
+	const struct mail_search_program_op *ops;
+	unsigned int i, count;
+	bool have_text = FALSE;
+
+	*have_body = FALSE;
+	array_clear(&program->headers);
+
+	ops = array_get(&program->ops, &count);
+	for (i = 0; i < count; ) {
+		if (ops[i].arg->result != -1) {
+			i = ops[i].next;
+			continue;
+		}
+		if (ops[i].hdr_name != NULL)
+			array_append(&program->headers, &ops[i].hdr_name, 1);
+		if (ops[i].body)
+			*have_body = TRUE;
+		if (ops[i].text)
+			have_text = TRUE;
+		i++;
+	}
+
+	*have_headers = have_text || array_count(&program->headers) > 0;
+	if (array_count(&program->headers) == 0)
+		return NULL;
+
+	array_append_zero(&program->headers);
+	return array_idx(&program->headers, 0);
+}
@@ -0,0 +1,46 @@
+#ifndef MAIL_SEARCH_PROGRAM_H
+#define MAIL_SEARCH_PROGRAM_H
+
+#include "mail-search.h"
+
+/* A search program is the mail_search_arg tree flattened into a pre-ordered
+   array, where each OR/SUB knows where its subargs end. Running it gives
+   the same results as mail_search_args_foreach(), but without recursion.
+   The program points to the args, so their structure must not be changed
+   while the program exists. Their results may be reset normally. */
+struct mail_search_program;
+
+struct mail_search_program *
+mail_search_program_compile(struct mail_search_arg *args);
+void mail_search_program_free(struct mail_search_program **program);
+
+/* Same as mail_search_args_foreach(). */
+int mail_search_program_foreach(struct mail_search_program *program,
+				mail_search_foreach_callback_t *callback,
+				void *context) ATTR_NULL(3);
+#define mail_search_program_foreach(program, callback, context) \
+	  mail_search_program_foreach(((void)CALLBACK_TYPECHECK(callback, \
+		void (*)(struct mail_search_arg *, typeof(context))), program), \
+		(mail_search_foreach_callback_t *)callback, context)
+/* Like mail_search_program_foreach(), but call the callback only for the
+   args that look at the given header: SEARCH_HEADER* args with the same
+   field name and sent date args for the "Date" header. *pending_r is set
+   to TRUE if any SEARCH_HEADER* arg was still without a result. */
+int mail_search_program_foreach_header(struct mail_search_program *program,
+				       const char *hdr_name, bool *pending_r,
+				       mail_search_foreach_callback_t *callback,
+				       void *context) ATTR_NULL(5);
+#define mail_search_program_foreach_header(program, hdr_name, pending_r, \
+					   callback, context) \
+	  mail_search_program_foreach_header(program, hdr_name + \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			struct mail_search_arg *, typeof(context))), pending_r, \
+		(mail_search_foreach_callback_t *)callback, context)
+
+/* Same as mail_search_args_analyze(). The returned headers are valid until
+   the next call. */
+const char *const *
+mail_search_program_analyze(struct mail_search_program *program,
+			    bool *have_headers, bool *have_body);
+
+#endif
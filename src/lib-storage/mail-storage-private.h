@@ -449,6 +449,8 @@ struct mailbox_transaction_stats {
 	unsigned long files_read_count;
 	/* number of bytes we've had to read from files */
 	unsigned long long files_read_bytes;
+	/* microseconds spent reading the files */
+	unsigned long long files_read_usecs;
 	/* number of cache lookup hits */
 	unsigned long cache_hit_count;
 };
@@ -636,6 +638,10 @@ int mailbox_get_path_to(struct mailbox *box, enum mailbox_list_path_type type,
 const struct mailbox_permissions *mailbox_get_permissions(struct mailbox *box);
 /* Force permissions to be refreshed on next lookup */
 void mailbox_refresh_permissions(struct mailbox *box);
+/* Don't write anything to the opened mailbox's index, cache or transaction
+   log files anymore. This means it can't be synced either. Used by worker
+   processes, which share the opened files with their parent. */
+void mailbox_set_worker_readonly(struct mailbox *box);
 
 /* Open private index files for mailbox. Returns 1 if opened, 0 if there
    are no private indexes (or flags) in this mailbox, -1 if error. */
@@ -2245,6 +2245,17 @@ void mailbox_refresh_permissions(struct mailbox *box)
 	(void)mailbox_get_permissions(box);
 }
 
+void mailbox_set_worker_readonly(struct mailbox *box)
+{
+	i_assert(box->opened);
+
+	box->flags |= MAILBOX_FLAG_READONLY;
+	if (box->index != NULL)
+		mail_index_set_readonly(box->index);
+	if (box->index_pvt != NULL)
+		mail_index_set_readonly(box->index_pvt);
+}
+
 int mailbox_create_fd(struct mailbox *box, const char *path, int flags,
 		      int *fd_r)
 {
@@ -2377,5 +2388,7 @@ mail_storage_settings_to_index_flags(const struct mail_storage_settings *set)
 		index_flags |= MAIL_INDEX_OPEN_FLAG_DOTLOCK_USE_EXCL;
 	if (set->mail_nfs_index)
 		index_flags |= MAIL_INDEX_OPEN_FLAG_NFS_FLUSH;
+	if (set->mail_index_group_commit)
+		index_flags |= MAIL_INDEX_OPEN_FLAG_GROUP_COMMIT;
 	return index_flags;
 }
@@ -0,0 +1,147 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "mail-worker.h"
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+struct mail_workers {
+	ARRAY(struct mail_worker *) workers;
+};
+
+struct mail_workers *mail_workers_init(void)
+{
+	struct mail_workers *workers;
+
+	workers = i_new(struct mail_workers, 1);
+	i_array_init(&workers->workers, 8);
+	return workers;
+}
+
+void mail_workers_deinit(struct mail_workers **_workers)
+{
+	struct mail_workers *workers = *_workers;
+	struct mail_worker *const *workerp, *worker;
+	int status;
+
+	*_workers = NULL;
+	while (array_count(&workers->workers) > 0) {
+		workerp = array_idx(&workers->workers, 0);
+		worker = *workerp;
+		(void)mail_worker_wait(workers, &worker, TRUE, &status);
+	}
+	array_free(&workers->workers);
+	i_free(workers);
+}
+
+static void mail_worker_free(struct mail_worker *worker)
+{
+	if (worker->fd != -1)
+		i_close_fd(&worker->fd);
+	i_free(worker);
+}
+
+static void
+mail_workers_remove(struct mail_workers *workers, struct mail_worker *worker)
+{
+	struct mail_worker *const *workerp;
+
+	array_foreach(&workers->workers, workerp) {
+		if (*workerp == worker) {
+			array_delete(&workers->workers,
+				     array_foreach_idx(&workers->workers,
+						       workerp), 1);
+			return;
+		}
+	}
+	i_unreached();
+}
+
+static void
+mail_workers_forget_others(struct mail_workers *workers,
+			   struct mail_worker *worker)
+{
+	struct mail_worker *const *workerp;
+
+	/* the other workers' pipes would otherwise be kept open by us,
+	   and they wouldn't notice if the parent died */
+	array_foreach(&workers->workers, workerp) {
+		if (*workerp != worker)
+			mail_worker_free(*workerp);
+	}
+	array_clear(&workers->workers);
+	array_append(&workers->workers, &worker, 1);
+}
+
+struct mail_worker *
+mail_workers_fork(struct mail_workers *workers, bool with_pipe,
+		  bool *child_r)
+{
+	struct mail_worker *worker;
+	int fd[2] = { -1, -1 };
+
+	*child_r = FALSE;
+	if (with_pipe && pipe(fd) < 0) {
+		i_error("pipe() failed: %m");
+		return NULL;
+	}
+
+	worker = i_new(struct mail_worker, 1);
+	worker->fd = -1;
+	if ((worker->pid = fork()) < 0) {
+		i_error("fork() failed: %m");
+		if (with_pipe) {
+			i_close_fd(&fd[0]);
+			i_close_fd(&fd[1]);
+		}
+		i_free(worker);
+		return NULL;
+	}
+	array_append(&workers->workers, &worker, 1);
+
+	if (worker->pid == 0) {
+		*child_r = TRUE;
+		worker->pid = getpid();
+		if (with_pipe) {
+			i_close_fd(&fd[0]);
+			worker->fd = fd[1];
+		}
+		mail_workers_forget_others(workers, worker);
+		return worker;
+	}
+	if (with_pipe) {
+		i_close_fd(&fd[1]);
+		worker->fd = fd[0];
+	}
+	return worker;
+}
+
+int mail_worker_wait(struct mail_workers *workers,
+		     struct mail_worker **_worker, bool kill_worker,
+		     int *status_r)
+{
+	struct mail_worker *worker = *_worker;
+	int ret = 0;
+
+	*_worker = NULL;
+	mail_workers_remove(workers, worker);
+
+	/* close the pipe first, so a worker blocked on writing to it
+	   notices that we're no longer reading */
+	if (worker->fd != -1)
+		i_close_fd(&worker->fd);
+	if (kill_worker)
+		(void)kill(worker->pid, SIGKILL);
+	while (waitpid(worker->pid, status_r, 0) < 0) {
+		if (errno != EINTR) {
+			i_error("waitpid(%s) failed: %m", dec2str(worker->pid));
+			ret = -1;
+			break;
+		}
+	}
+	mail_worker_free(worker);
+	return ret;
+}
@@ -0,0 +1,33 @@
+#ifndef MAIL_WORKER_H
+#define MAIL_WORKER_H
+
+/* Helper for forking worker processes that split a storage operation
+   between them. The workers share the parent's open files, so they must
+   not write anything that the parent could also be writing. */
+
+struct mail_worker {
+	pid_t pid;
+	/* Reading end of the pipe in the parent, writing end in the worker.
+	   -1 if the worker was created without a pipe. */
+	int fd;
+};
+
+struct mail_workers *mail_workers_init(void);
+/* Kill and wait for all the workers that haven't been waited for yet. */
+void mail_workers_deinit(struct mail_workers **workers);
+
+/* Fork a new worker, optionally with a pipe from it to the parent. Returns
+   NULL if pipe() or fork() failed. Otherwise the worker is returned in both
+   processes, and in the worker process *child_r is set to TRUE and the
+   other workers' pipes are closed. */
+struct mail_worker *
+mail_workers_fork(struct mail_workers *workers, bool with_pipe,
+		  bool *child_r);
+/* Close the worker's pipe and wait for it to exit. If kill_worker is TRUE,
+   the worker is killed first. Returns 0 and the waitpid() status on
+   success, -1 if waitpid() failed. The worker is freed in any case. */
+int mail_worker_wait(struct mail_workers *workers,
+		     struct mail_worker **worker, bool kill_worker,
+		     int *status_r);
+
+#endif
@@ -0,0 +1,231 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "test-common.h"
+#include "mail-namespace.h"
+#include "mail-search-build.h"
+#include "mail-search-program.h"
+#include "mail-storage-private.h"
+
+#include <stdlib.h>
+
+#define TEST_MAX_LEAFS 64
+
+struct test_search_ctx {
+	string_t *calls;
+	const char *hdr_name;
+	bool pending;
+};
+
+static const char *test_hdr_names[] = { "From", "subject", "To", "date" };
+static int test_answers[TEST_MAX_LEAFS];
+static int test_presets[TEST_MAX_LEAFS];
+static unsigned int test_leaf_count;
+
+char mail_namespace_get_sep(struct mail_namespace *ns ATTR_UNUSED) { return '/'; }
+struct mail_search_args *mail_search_build_init(void) { i_unreached(); }
+struct mail_namespace *
+mailbox_get_namespace(const struct mailbox *box ATTR_UNUSED) { return NULL; }
+void mailbox_get_seq_range(struct mailbox *box ATTR_UNUSED,
+			   uint32_t uid1 ATTR_UNUSED, uint32_t uid2 ATTR_UNUSED,
+			   uint32_t *seq1_r ATTR_UNUSED,
+			   uint32_t *seq2_r ATTR_UNUSED) { i_unreached(); }
+void mailbox_get_uid_range(struct mailbox *box ATTR_UNUSED,
+			   const ARRAY_TYPE(seq_range) *seqs ATTR_UNUSED,
+			   ARRAY_TYPE(seq_range) *uids ATTR_UNUSED) { i_unreached(); }
+struct mail_keywords *
+mailbox_keywords_create_valid(struct mailbox *box ATTR_UNUSED,
+			      const char *const keywords[] ATTR_UNUSED) { i_unreached(); }
+void mailbox_keywords_unref(struct mail_keywords **keywords ATTR_UNUSED) { }
+void mailbox_search_result_free(struct mail_search_result **result ATTR_UNUSED) { }
+
+static struct mail_search_arg *
+test_search_args_build(pool_t pool, unsigned int depth)
+{
+	struct mail_search_arg *first = NULL, **argp = &first, *arg;
+	unsigned int i, count = rand() % 4 + 1;
+
+	for (i = 0; i < count && test_leaf_count < TEST_MAX_LEAFS; i++) {
+		arg = p_new(pool, struct mail_search_arg, 1);
+		arg->match_not = rand() % 3 == 0;
+		arg->result = -1;
+		switch (depth < 3 ? rand() % 8 : rand() % 6) {
+		case 0:
+			arg->type = SEARCH_FLAGS;
+			break;
+		case 1:
+		case 2:
+			arg->type = rand() % 2 == 0 ? SEARCH_HEADER :
+				SEARCH_HEADER_ADDRESS;
+			arg->hdr_field_name = test_hdr_names[rand() % 3];
+			arg->value.str = "x";
+			break;
+		case 3:
+			arg->type = rand() % 2 == 0 ? SEARCH_BODY : SEARCH_TEXT;
+			arg->value.str = "x";
+			break;
+		case 4:
+		case 5:
+			arg->type = SEARCH_SINCE;
+			arg->value.date_type = rand() % 2 == 0 ?
+				MAIL_SEARCH_DATE_TYPE_SENT :
+				MAIL_SEARCH_DATE_TYPE_RECEIVED;
+			break;
+		default:
+			arg->type = rand() % 2 == 0 ? SEARCH_OR : SEARCH_SUB;
+			arg->value.subargs = test_search_args_build(pool, depth+1);
+			break;
+		}
+		if (arg->type != SEARCH_OR && arg->type != SEARCH_SUB)
+			arg->value.size = test_leaf_count++;
+		*argp = arg;
+		argp = &arg->next;
+	}
+	return first;
+}
+
+static void test_search_args_preset(struct mail_search_arg *arg)
+{
+	for (; arg != NULL; arg = arg->next) {
+		if (arg->type == SEARCH_OR || arg->type == SEARCH_SUB)
+			test_search_args_preset(arg->value.subargs);
+		else
+			arg->result = test_presets[arg->value.size];
+	}
+}
+
+static void
+test_search_args_results(struct mail_search_arg *arg, string_t *dest)
+{
+	for (; arg != NULL; arg = arg->next) {
+		str_printfa(dest, "%d,", arg->result);
+		if (arg->type == SEARCH_OR || arg->type == SEARCH_SUB)
+			test_search_args_results(arg->value.subargs, dest);
+	}
+}
+
+static void test_search_arg(struct mail_search_arg *arg,
+			    struct test_search_ctx *ctx)
+{
+	if (ctx->hdr_name != NULL) {
+		/* emulate the filtering that foreach_header() does */
+		const char *name;
+
+		switch (arg->type) {
+		case SEARCH_SINCE:
+			if (arg->value.date_type != MAIL_SEARCH_DATE_TYPE_SENT)
+				return;
+			name = "Date";
+			break;
+		case SEARCH_HEADER:
+		case SEARCH_HEADER_ADDRESS:
+			ctx->pending = TRUE;
+			name = arg->hdr_field_name;
+			break;
+		default:
+			return;
+		}
+		if (strcasecmp(name, ctx->hdr_name) != 0)
+			return;
+	}
+	str_printfa(ctx->calls, "%u,", (unsigned int)arg->value.size);
+	ARG_SET_RESULT(arg, test_answers[arg->value.size]);
+}
+
+static void test_header_list(const char *const *headers, string_t *dest)
+{
+	for (; headers != NULL && *headers != NULL; headers++)
+		str_printfa(dest, "%s,", *headers);
+}
+
+static void
+test_search_run(struct mail_search_arg *args,
+		struct mail_search_program *program, bool use_program,
+		const char *hdr_name, string_t *dest)
+{
+	struct test_search_ctx ctx;
+	const char *const *headers;
+	bool have_headers, have_body;
+	int ret;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.calls = dest;
+	mail_search_args_reset(args, TRUE);
+	test_search_args_preset(args);
+
+	headers = use_program ?
+		mail_search_program_analyze(program, &have_headers, &have_body) :
+		mail_search_args_analyze(args, &have_headers, &have_body);
+	test_header_list(headers, dest);
+	str_printfa(dest, "%d%d|", have_headers, have_body);
+
+	/* header pass followed by a full pass */
+	ctx.hdr_name = hdr_name;
+	if (use_program) {
+		ret = mail_search_program_foreach_header(program, hdr_name,
+							 &ctx.pending,
+							 test_search_arg, &ctx);
+	} else {
+		ret = mail_search_args_foreach(args, test_search_arg, &ctx);
+	}
+	str_printfa(dest, "=%d,%d|", ret, ctx.pending);
+	test_search_args_results(args, dest);
+
+	ctx.hdr_name = NULL;
+	ret = use_program ?
+		mail_search_program_foreach(program, test_search_arg, &ctx) :
+		mail_search_args_foreach(args, test_search_arg, &ctx);
+	str_printfa(dest, "=%d|", ret);
+	test_search_args_results(args, dest);
+}
+
+static void test_mail_search_program_equal(void)
+{
+	struct mail_search_program *program;
+	struct mail_search_arg *args;
+	pool_t pool;
+	string_t *str1, *str2;
+	unsigned int i, j, n;
+
+	test_begin("mail search program equals tree");
+	pool = pool_alloconly_create("search program", 1024*32);
+	str1 = str_new(default_pool, 256);
+	str2 = str_new(default_pool, 256);
+	for (i = 0; i < 1000; i++) {
+		p_clear(pool);
+		test_leaf_count = 0;
+		args = test_search_args_build(pool, 0);
+		program = mail_search_program_compile(args);
+
+		for (n = 0; n < 20; n++) {
+			for (j = 0; j < test_leaf_count; j++) {
+				test_answers[j] = rand() % 3 - 1;
+				test_presets[j] = rand() % 4 != 0 ? -1 :
+					rand() % 2;
+			}
+			str_truncate(str1, 0);
+			str_truncate(str2, 0);
+			test_search_run(args, program, FALSE,
+					test_hdr_names[n % 4], str1);
+			test_search_run(args, program, TRUE,
+					test_hdr_names[n % 4], str2);
+			test_assert(strcmp(str_c(str1), str_c(str2)) == 0);
+		}
+		mail_search_program_free(&program);
+	}
+	str_free(&str1);
+	str_free(&str2);
+	pool_unref(&pool);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_mail_search_program_equal,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -0,0 +1,202 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "seq-range-array.h"
+#include "unlink-directory.h"
+#include "master-service.h"
+#include "mail-storage-service.h"
+#include "mail-namespace.h"
+#include "mail-search-build.h"
+#include "mail-storage-private.h"
+#include "test-common.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define TEST_HOME ".test-mail-search-workers"
+/* more than index-search.c's SEARCH_WORKERS_MIN_MESSAGES */
+#define TEST_MAILS_COUNT 1500
+#define TEST_MAILS_MATCH_INTERVAL 7
+
+static struct mail_storage_service_ctx *test_storage_service;
+
+static struct mail_user *
+test_user_init(struct mail_storage_service_user **service_user_r)
+{
+	struct mail_storage_service_input input;
+	struct mail_user *user;
+	const char *home, *userdb_fields[3], *error;
+	char cwd[PATH_MAX];
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+		i_fatal("getcwd() failed: %m");
+	home = t_strconcat(cwd, "/"TEST_HOME, NULL);
+	userdb_fields[0] = t_strconcat("home=", home, NULL);
+	userdb_fields[1] = t_strconcat("mail=sdbox:", home, "/mail", NULL);
+	userdb_fields[2] = NULL;
+
+	memset(&input, 0, sizeof(input));
+	input.username = "testuser";
+	input.no_userdb_lookup = TRUE;
+	input.userdb_fields = userdb_fields;
+	if (mail_storage_service_lookup_next(test_storage_service, &input,
+					     service_user_r, &user,
+					     &error) <= 0)
+		i_fatal("User lookup failed: %s", error);
+	return user;
+}
+
+static void test_mails_save(struct mailbox *box)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	const char *text;
+	unsigned int i;
+	int ret;
+
+	trans = mailbox_transaction_begin(box,
+					  MAILBOX_TRANSACTION_FLAG_EXTERNAL);
+	for (i = 1; i <= TEST_MAILS_COUNT; i++) T_BEGIN {
+		text = t_strdup_printf("From: user%u@example.com\n"
+			"Subject: mail %u\n\nbody of mail %u%s\n", i, i, i,
+			i % TEST_MAILS_MATCH_INTERVAL == 0 ? " with needle" : "");
+		input = i_stream_create_from_data(text, strlen(text));
+		save_ctx = mailbox_save_alloc(trans);
+		if (mailbox_save_begin(&save_ctx, input) < 0)
+			i_fatal("mailbox_save_begin() failed");
+		while ((ret = i_stream_read(input)) > 0 || ret == -2) {
+			if (mailbox_save_continue(save_ctx) < 0)
+				break;
+		}
+		if (mailbox_save_finish(&save_ctx) < 0)
+			i_fatal("mailbox_save_finish() failed");
+		i_stream_unref(&input);
+	} T_END;
+	if (mailbox_transaction_commit(&trans) < 0)
+		i_fatal("mailbox_transaction_commit() failed");
+	if (mailbox_sync(box, 0) < 0)
+		i_fatal("mailbox_sync() failed");
+}
+
+static void
+test_mails_search(struct mailbox *box, enum mail_search_arg_type type,
+		  const char *value, ARRAY_TYPE(seq_range) *seqs)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_search_args *args;
+	struct mail_search_arg *arg;
+	struct mail_search_context *ctx;
+	struct mail *mail;
+
+	args = mail_search_build_init();
+	arg = mail_search_build_add(args, type);
+	arg->value.str = p_strdup(args->pool, value);
+	if (type == SEARCH_HEADER)
+		arg->hdr_field_name = p_strdup(args->pool, "Subject");
+
+	trans = mailbox_transaction_begin(box, 0);
+	ctx = mailbox_search_init(trans, args, NULL, 0, NULL);
+	while (mailbox_search_next(ctx, &mail))
+		seq_range_array_add(seqs, mail->seq);
+	test_assert(mailbox_search_deinit(&ctx) == 0);
+	(void)mailbox_transaction_commit(&trans);
+	mail_search_args_unref(&args);
+}
+
+static void
+test_mails_search_compare(struct mailbox *box,
+			  enum mail_search_arg_type type, const char *value)
+{
+	struct mail_storage_settings *set =
+		(struct mail_storage_settings *)box->storage->set;
+	ARRAY_TYPE(seq_range) seqs1, seqs4;
+
+	t_array_init(&seqs1, 64);
+	t_array_init(&seqs4, 64);
+	set->mail_search_workers = 1;
+	test_mails_search(box, type, value, &seqs1);
+	set->mail_search_workers = 4;
+	test_mails_search(box, type, value, &seqs4);
+	test_assert(array_count(&seqs1) > 0);
+	test_assert(array_cmp(&seqs1, &seqs4));
+	/* all the workers were waited for */
+	test_assert(waitpid(-1, NULL, WNOHANG) < 0 && errno == ECHILD);
+}
+
+static void test_mail_search_workers(void)
+{
+	struct mail_storage_service_user *service_user;
+	struct mail_user *user;
+	struct mail_namespace *ns;
+	struct mailbox *box;
+	ARRAY_TYPE(seq_range) seqs;
+	struct seq_range *range;
+	unsigned int seq;
+
+	test_begin("mail search workers");
+	user = test_user_init(&service_user);
+	ns = mail_namespace_find_inbox(user->namespaces);
+	box = mailbox_alloc(ns->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_mails_save(box);
+
+	test_mails_search_compare(box, SEARCH_BODY, "needle");
+	test_mails_search_compare(box, SEARCH_TEXT, "needle");
+	test_mails_search_compare(box, SEARCH_HEADER, "mail 1");
+
+	/* the workers didn't break the mailbox */
+	t_array_init(&seqs, 64);
+	test_mails_search(box, SEARCH_BODY, "needle", &seqs);
+	test_assert(seq_range_count(&seqs) ==
+		    TEST_MAILS_COUNT / TEST_MAILS_MATCH_INTERVAL);
+	array_foreach_modifiable(&seqs, range) {
+		for (seq = range->seq1; seq <= range->seq2; seq++)
+			test_assert(seq % TEST_MAILS_MATCH_INTERVAL == 0);
+	}
+	test_assert(mailbox_sync(box, 0) == 0);
+
+	mailbox_free(&box);
+	mail_user_unref(&user);
+	mail_storage_service_user_free(&service_user);
+	test_end();
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*test_functions[])(void) = {
+		test_mail_search_workers,
+		NULL
+	};
+	struct ioloop *ioloop;
+
+	master_service = master_service_init("test-mail-search-workers",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT,
+					     &argc, &argv, "");
+	master_service_init_finish(master_service);
+	test_storage_service =
+		mail_storage_service_init(master_service, NULL,
+			MAIL_STORAGE_SERVICE_FLAG_NO_RESTRICT_ACCESS |
+			MAIL_STORAGE_SERVICE_FLAG_NO_CHDIR |
+			MAIL_STORAGE_SERVICE_FLAG_NO_LOG_INIT |
+			MAIL_STORAGE_SERVICE_FLAG_NO_PLUGINS);
+
+	(void)unlink_directory(TEST_HOME, TRUE);
+	if (mkdir(TEST_HOME, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_HOME);
+	ioloop = io_loop_create();
+	test_init();
+	test_run_funcs(test_functions);
+	io_loop_destroy(&ioloop);
+	(void)unlink_directory(TEST_HOME, TRUE);
+
+	mail_storage_service_deinit(&test_storage_service);
+	/* this deinitializes the lib also for the master service */
+	return test_deinit();
+}
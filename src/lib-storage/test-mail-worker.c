@@ -0,0 +1,94 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "write-full.h"
+#include "mail-worker.h"
+#include "test-common.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+static void test_mail_worker_exit(void)
+{
+	struct mail_workers *workers;
+	struct mail_worker *worker;
+	bool child;
+	char c = 0;
+	int status;
+
+	test_begin("mail worker exit");
+	workers = mail_workers_init();
+	worker = mail_workers_fork(workers, TRUE, &child);
+	test_assert(worker != NULL);
+	if (child)
+		_exit(write_full(worker->fd, "x", 1) < 0 ? 1 : 0);
+	test_assert(read(worker->fd, &c, 1) == 1 && c == 'x');
+	test_assert(mail_worker_wait(workers, &worker, FALSE, &status) == 0);
+	test_assert(worker == NULL);
+	test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	worker = mail_workers_fork(workers, FALSE, &child);
+	test_assert(worker != NULL);
+	if (child)
+		_exit(2);
+	test_assert(worker->fd == -1);
+	test_assert(mail_worker_wait(workers, &worker, FALSE, &status) == 0);
+	test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 2);
+	mail_workers_deinit(&workers);
+	test_end();
+}
+
+static void test_mail_worker_kill(void)
+{
+	struct mail_workers *workers;
+	struct mail_worker *worker1, *worker2;
+	bool child;
+	char c = 0;
+	int status;
+
+	test_begin("mail worker kill");
+	workers = mail_workers_init();
+	worker1 = mail_workers_fork(workers, TRUE, &child);
+	test_assert(worker1 != NULL);
+	if (child) {
+		for (;;)
+			pause();
+	}
+
+	worker2 = mail_workers_fork(workers, TRUE, &child);
+	test_assert(worker2 != NULL);
+	if (child) {
+		/* the other worker's pipe isn't inherited */
+		c = fcntl(worker1->fd, F_GETFD) < 0 && errno == EBADF ?
+			'y' : 'n';
+		_exit(write_full(worker2->fd, &c, 1) < 0 ? 1 : 0);
+	}
+	test_assert(read(worker2->fd, &c, 1) == 1 && c == 'y');
+	test_assert(mail_worker_wait(workers, &worker2, FALSE, &status) == 0);
+	test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	test_assert(mail_worker_wait(workers, &worker1, TRUE, &status) == 0);
+	test_assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+
+	/* deinit kills the workers that are left */
+	worker1 = mail_workers_fork(workers, TRUE, &child);
+	test_assert(worker1 != NULL);
+	if (child) {
+		for (;;)
+			pause();
+	}
+	mail_workers_deinit(&workers);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_mail_worker_exit,
+		test_mail_worker_kill,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -116,6 +116,20 @@ void seq_range_array_add_range(ARRAY_TYPE(seq_range) *array,
 	struct seq_range *data, value;
 	unsigned int idx1, idx2, count;
 
+	/* quick check for appending */
+	data = array_get_modifiable(array, &count);
+	if (count > 0 && data[count-1].seq2 < seq1) {
+		if (data[count-1].seq2 == seq1-1) {
+			/* grow last range */
+			data[count-1].seq2 = seq2;
+		} else {
+			value.seq1 = seq1;
+			value.seq2 = seq2;
+			array_append(array, &value, 1);
+		}
+		return;
+	}
+
 	seq_range_lookup(array, seq1, &idx1);
 	seq_range_lookup(array, seq2, &idx2);
 
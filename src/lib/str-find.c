@@ -180,3 +180,171 @@ void str_find_reset(struct str_find_context *ctx)
 {
 	ctx->match_count = 0;
 }
+
+#define STR_FIND_MULTI_NO_KEY UINT_MAX
+
+struct str_find_multi_context {
+	pool_t pool;
+	unsigned int key_count, found_count;
+	unsigned int state_count, state;
+
+	/* DFA transitions: delta[state * 256 + byte] */
+	unsigned int *delta;
+	/* first key that ends at the state, or STR_FIND_MULTI_NO_KEY */
+	unsigned int *state_key;
+	/* longest proper suffix state with keys ending at it, or 0 */
+	unsigned int *output_link;
+	/* next key with identical contents, or STR_FIND_MULTI_NO_KEY */
+	unsigned int *key_next;
+	bool *found;
+};
+
+static void str_find_multi_build(struct str_find_multi_context *ctx)
+{
+	unsigned int *fail, *queue, queue_head = 0, queue_tail = 0;
+	unsigned int s, u, f, c;
+
+	fail = t_new(unsigned int, ctx->state_count);
+	queue = t_new(unsigned int, ctx->state_count);
+	for (c = 0; c <= UCHAR_MAX; c++) {
+		if ((u = ctx->delta[c]) != 0)
+			queue[queue_tail++] = u;
+	}
+	/* the trie edges always point to a later state, so while a state's
+	   row isn't yet filled, non-zero entries are its children */
+	while (queue_head < queue_tail) {
+		s = queue[queue_head++];
+		for (c = 0; c <= UCHAR_MAX; c++) {
+			u = ctx->delta[s * 256 + c];
+			if (u == 0) {
+				ctx->delta[s * 256 + c] =
+					ctx->delta[fail[s] * 256 + c];
+				continue;
+			}
+			f = ctx->delta[fail[s] * 256 + c];
+			fail[u] = f;
+			ctx->output_link[u] =
+				ctx->state_key[f] != STR_FIND_MULTI_NO_KEY ? f :
+				ctx->output_link[f];
+			queue[queue_tail++] = u;
+		}
+	}
+}
+
+struct str_find_multi_context *
+str_find_multi_init(pool_t pool, const char *const *keys)
+{
+	struct str_find_multi_context *ctx;
+	const unsigned char *p;
+	unsigned int i, s, max_states = 1;
+
+	ctx = p_new(pool, struct str_find_multi_context, 1);
+	ctx->pool = pool;
+	for (i = 0; keys[i] != NULL; i++) {
+		i_assert(keys[i][0] != '\0');
+		max_states += strlen(keys[i]);
+	}
+	i_assert(i > 0);
+	ctx->key_count = i;
+
+	ctx->delta = p_new(pool, unsigned int, max_states * 256);
+	ctx->state_key = p_new(pool, unsigned int, max_states);
+	ctx->output_link = p_new(pool, unsigned int, max_states);
+	ctx->key_next = p_new(pool, unsigned int, ctx->key_count);
+	ctx->found = p_new(pool, bool, ctx->key_count);
+	ctx->state_key[0] = STR_FIND_MULTI_NO_KEY;
+	ctx->state_count = 1;
+
+	T_BEGIN {
+		/* build the trie */
+		for (i = 0; i < ctx->key_count; i++) {
+			s = 0;
+			for (p = (const unsigned char *)keys[i]; *p != '\0'; p++) {
+				if (ctx->delta[s * 256 + *p] == 0) {
+					ctx->state_key[ctx->state_count] =
+						STR_FIND_MULTI_NO_KEY;
+					ctx->delta[s * 256 + *p] =
+						ctx->state_count++;
+				}
+				s = ctx->delta[s * 256 + *p];
+			}
+			ctx->key_next[i] = ctx->state_key[s];
+			ctx->state_key[s] = i;
+		}
+		str_find_multi_build(ctx);
+	} T_END;
+	return ctx;
+}
+
+void str_find_multi_deinit(struct str_find_multi_context **_ctx)
+{
+	struct str_find_multi_context *ctx = *_ctx;
+
+	*_ctx = NULL;
+	p_free(ctx->pool, ctx->delta);
+	p_free(ctx->pool, ctx->state_key);
+	p_free(ctx->pool, ctx->output_link);
+	p_free(ctx->pool, ctx->key_next);
+	p_free(ctx->pool, ctx->found);
+	p_free(ctx->pool, ctx);
+}
+
+static void
+str_find_multi_output(struct str_find_multi_context *ctx, unsigned int s)
+{
+	unsigned int key;
+
+	for (; s != 0; s = ctx->output_link[s]) {
+		key = ctx->state_key[s];
+		for (; key != STR_FIND_MULTI_NO_KEY; key = ctx->key_next[key]) {
+			if (!ctx->found[key]) {
+				ctx->found[key] = TRUE;
+				ctx->found_count++;
+			}
+		}
+	}
+}
+
+bool str_find_multi_more(struct str_find_multi_context *ctx,
+			 const unsigned char *data, size_t size)
+{
+	const unsigned int *delta = ctx->delta;
+	unsigned int s = ctx->state;
+	size_t i;
+
+	if (ctx->found_count == ctx->key_count)
+		return TRUE;
+
+	for (i = 0; i < size; i++) {
+		s = delta[s * 256 + data[i]];
+		if (ctx->state_key[s] == STR_FIND_MULTI_NO_KEY &&
+		    ctx->output_link[s] == 0)
+			continue;
+
+		str_find_multi_output(ctx, s);
+		if (ctx->found_count == ctx->key_count) {
+			ctx->state = s;
+			return TRUE;
+		}
+	}
+	ctx->state = s;
+	return FALSE;
+}
+
+bool str_find_multi_is_found(struct str_find_multi_context *ctx,
+			     unsigned int key_idx)
+{
+	i_assert(key_idx < ctx->key_count);
+	return ctx->found[key_idx];
+}
+
+void str_find_multi_reset(struct str_find_multi_context *ctx)
+{
+	ctx->state = 0;
+}
+
+void str_find_multi_reset_found(struct str_find_multi_context *ctx)
+{
+	memset(ctx->found, 0, sizeof(ctx->found[0]) * ctx->key_count);
+	ctx->found_count = 0;
+}
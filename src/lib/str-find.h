@@ -2,6 +2,7 @@
 #define STR_FIND_H
 
 struct str_find_context;
+struct str_find_multi_context;
 
 struct str_find_context *str_find_init(pool_t pool, const char *key);
 void str_find_deinit(struct str_find_context **ctx);
@@ -17,4 +18,22 @@ size_t str_find_get_match_end_pos(struct str_find_context *ctx);
    to earlier data. */
 void str_find_reset(struct str_find_context *ctx);
 
+/* Search for multiple keys at the same time. The data is scanned only once
+   regardless of the number of keys (Aho-Corasick). */
+struct str_find_multi_context *
+str_find_multi_init(pool_t pool, const char *const *keys);
+void str_find_multi_deinit(struct str_find_multi_context **ctx);
+
+/* Returns TRUE if all the keys have now been found. Like with str_find_more()
+   the data can be sent in arbitrary blocks. */
+bool str_find_multi_more(struct str_find_multi_context *ctx,
+			 const unsigned char *data, size_t size);
+/* Returns TRUE if key with the given index has been found. */
+bool str_find_multi_is_found(struct str_find_multi_context *ctx,
+			     unsigned int key_idx);
+/* Reset input data, but remember the keys that have already been found. */
+void str_find_multi_reset(struct str_find_multi_context *ctx);
+/* Forget the keys that have been found. */
+void str_find_multi_reset_found(struct str_find_multi_context *ctx);
+
 #endif
@@ -54,6 +54,39 @@ static void test_seq_range_array_add_merge(void)
 	test_end();
 }
 
+static void test_seq_range_array_add_range_append(void)
+{
+	ARRAY_TYPE(seq_range) range;
+	const struct seq_range *seqs;
+	unsigned int count;
+
+	test_begin("seq_range_array_add_range() appending");
+	t_array_init(&range, 8);
+	seq_range_array_add_range(&range, 1, 3);
+	/* grows the last range */
+	seq_range_array_add_range(&range, 4, 6);
+	/* appends a new range */
+	seq_range_array_add_range(&range, 10, 12);
+	seq_range_array_add_range(&range, 14, 14);
+	seq_range_array_add_range(&range, 15, (uint32_t)-1);
+	seqs = array_get(&range, &count);
+	test_assert(count == 3);
+	test_assert(seqs[0].seq1 == 1 && seqs[0].seq2 == 6);
+	test_assert(seqs[1].seq1 == 10 && seqs[1].seq2 == 12);
+	test_assert(seqs[2].seq1 == 14 && seqs[2].seq2 == (uint32_t)-1);
+
+	/* not appending: overlapping and preceding ranges still merge */
+	array_clear(&range);
+	seq_range_array_add_range(&range, 5, 8);
+	seq_range_array_add_range(&range, 8, 10);
+	seq_range_array_add_range(&range, 1, 3);
+	seq_range_array_add_range(&range, 4, 4);
+	seqs = array_get(&range, &count);
+	test_assert(count == 1);
+	test_assert(seqs[0].seq1 == 1 && seqs[0].seq2 == 10);
+	test_end();
+}
+
 static void test_seq_range_array_random(void)
 {
 #define SEQ_RANGE_TEST_BUFSIZE 20
@@ -206,6 +239,7 @@ void test_seq_range_array(void)
 {
 	test_seq_range_array_add_boundaries();
 	test_seq_range_array_add_merge();
+	test_seq_range_array_add_range_append();
 	test_seq_range_array_invert();
 	test_seq_range_array_have_common();
 	test_seq_range_array_random();
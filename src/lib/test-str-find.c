@@ -3,6 +3,8 @@
 #include "test-lib.h"
 #include "str-find.h"
 
+#include <stdlib.h>
+
 static const char *str_find_text = "xababcd";
 
 static bool test_str_find_substring(const char *key, int expected_pos)
@@ -51,6 +53,63 @@ static bool test_str_find_substring(const char *key, int expected_pos)
 	return TRUE;
 }
 
+static bool test_str_find_multi_random(void)
+{
+	struct str_find_multi_context *ctx;
+	const char *keys[6], *text;
+	char *buf;
+	unsigned int i, j, key_count, text_len, pos, len;
+	bool found, all_found, expected_all;
+
+	key_count = rand() % 5 + 1;
+	for (i = 0; i < key_count; i++) {
+		len = rand() % 4 + 1;
+		buf = t_malloc(len + 1);
+		for (j = 0; j < len; j++)
+			buf[j] = 'a' + rand() % 3;
+		buf[len] = '\0';
+		keys[i] = buf;
+	}
+	keys[i] = NULL;
+
+	text_len = rand() % 30;
+	buf = t_malloc(text_len + 1);
+	for (j = 0; j < text_len; j++)
+		buf[j] = 'a' + rand() % 3;
+	buf[text_len] = '\0';
+	text = buf;
+
+	ctx = str_find_multi_init(pool_datastack_create(), keys);
+	all_found = FALSE;
+	for (pos = 0; pos < text_len && !all_found; pos += len) {
+		len = rand() % 5 + 1;
+		len = I_MIN(len, text_len - pos);
+		all_found = str_find_multi_more(ctx,
+			(const unsigned char *)text + pos, len);
+	}
+
+	/* the found keys are remembered over input resets */
+	str_find_multi_reset(ctx);
+	expected_all = TRUE;
+	for (i = 0; i < key_count; i++) {
+		found = strstr(text, keys[i]) != NULL;
+		if (str_find_multi_is_found(ctx, i) != found)
+			return FALSE;
+		if (!found)
+			expected_all = FALSE;
+	}
+	if (all_found != expected_all)
+		return FALSE;
+
+	str_find_multi_reset_found(ctx);
+	for (i = 0; i < key_count; i++) {
+		if (str_find_multi_is_found(ctx, i))
+			return FALSE;
+	}
+	str_find_multi_deinit(&ctx);
+	return TRUE;
+}
+
 struct str_find_input {
 	const char *str;
 	int pos;
@@ -83,4 +142,10 @@ void test_str_find(void)
 	for (i = 0; i < N_ELEMENTS(fail_input) && success; i++)
 		success = test_str_find_substring(fail_input[i], -1);
 	test_out("str_find()", success);
+
+	success = TRUE;
+	for (i = 0; i < 10000 && success; i++) T_BEGIN {
+		success = test_str_find_multi_random();
+	} T_END;
+	test_out("str_find_multi()", success);
 }
@@ -42,6 +42,7 @@ extern struct auth_client *auth_client;
 extern struct master_auth *master_auth;
 extern bool closing_down;
 extern struct anvil_client *anvil;
+extern struct connect_limit_shm *anvil_connect_limit_shm;
 extern const char *login_rawlog_dir;
 extern unsigned int initial_service_count;
 
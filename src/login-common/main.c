@@ -12,6 +12,7 @@
 #include "client-common.h"
 #include "access-lookup.h"
 #include "anvil-client.h"
+#include "connect-limit-shm.h"
 #include "auth-client.h"
 #include "dsasl-client.h"
 #include "master-service-ssl-settings.h"
@@ -37,6 +38,7 @@ struct auth_client *auth_client;
 struct master_auth *master_auth;
 bool closing_down;
 struct anvil_client *anvil;
+struct connect_limit_shm *anvil_connect_limit_shm;
 const char *login_rawlog_dir = NULL;
 unsigned int initial_service_count;
 
@@ -274,12 +276,16 @@ static bool anvil_reconnect_callback(void)
 	   chrooted, so just die after we've finished handling the current
 	   connections. */
 	master_service_stop_new_connections(master_service);
+	/* the new anvil doesn't update the old counts anymore */
+	if (anvil_connect_limit_shm != NULL)
+		connect_limit_shm_free(&anvil_connect_limit_shm);
 	return FALSE;
 }
 
 static void main_preinit(bool allow_core_dumps)
 {
 	unsigned int max_fds;
+	int fd;
 
 	random_init();
 	/* Initialize SSL proxy so it can read certificate and private
@@ -310,6 +316,11 @@ static void main_preinit(bool allow_core_dumps)
 		anvil = anvil_client_init("anvil", anvil_reconnect_callback, 0);
 		if (anvil_client_connect(anvil, TRUE) < 0)
 			i_fatal("Couldn't connect to anvil");
+		/* look up the connection counts directly from anvil's
+		   shared memory if possible */
+		fd = anvil_client_get_connect_limit_shm_fd(anvil);
+		if (fd != -1)
+			anvil_connect_limit_shm = connect_limit_shm_open(fd);
 	}
 
 	restrict_access_by_env(NULL, TRUE);
@@ -357,6 +368,8 @@ static void main_deinit(void)
 	auth_client_deinit(&auth_client);
 	master_auth_deinit(&master_auth);
 
+	if (anvil_connect_limit_shm != NULL)
+		connect_limit_shm_free(&anvil_connect_limit_shm);
 	if (anvil != NULL)
 		anvil_client_deinit(&anvil);
 	if (auth_client_to != NULL)
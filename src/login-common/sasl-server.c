@@ -10,6 +10,7 @@
 #include "strescape.h"
 #include "str-sanitize.h"
 #include "anvil-client.h"
+#include "connect-limit-shm.h"
 #include "auth-client.h"
 #include "ssl-proxy.h"
 #include "master-service.h"
@@ -156,16 +157,14 @@ static void master_send_request(struct anvil_request *anvil_request)
 			    master_auth_callback, client, &client->master_tag);
 }
 
-static void ATTR_NULL(1)
-anvil_lookup_callback(const char *reply, void *context)
+static void
+anvil_lookup_finish(struct anvil_request *req, unsigned int conn_count)
 {
-	struct anvil_request *req = context;
 	struct client *client = req->client;
 	const struct login_settings *set = client->set;
 	const char *errmsg;
 
-	if (reply == NULL ||
-	    strtoul(reply, NULL, 10) < set->mail_max_userip_connections)
+	if (conn_count < set->mail_max_userip_connections)
 		master_send_request(req);
 	else {
 		client->authenticating = FALSE;
@@ -178,12 +177,23 @@ anvil_lookup_callback(const char *reply, void *context)
 	i_free(req);
 }
 
+static void ATTR_NULL(1)
+anvil_lookup_callback(const char *reply, void *context)
+{
+	struct anvil_request *req = context;
+
+	/* allow the login if anvil lookup failed */
+	anvil_lookup_finish(req, reply == NULL ? 0 :
+			    strtoul(reply, NULL, 10));
+}
+
 static void
 anvil_check_too_many_connections(struct client *client,
 				 struct auth_client_request *request)
 {
 	struct anvil_request *req;
-	const char *query, *cookie;
+	const char *ident, *cookie;
+	unsigned int conn_count;
 	buffer_t buf;
 
 	req = i_new(struct anvil_request, 1);
@@ -198,14 +208,21 @@ anvil_check_too_many_connections(struct client *client,
 
 	if (client->virtual_user == NULL ||
 	    client->set->mail_max_userip_connections == 0) {
-		anvil_lookup_callback(NULL, req);
+		anvil_lookup_finish(req, 0);
 		return;
 	}
 
-	query = t_strconcat("LOOKUP\t", login_binary->protocol, "/",
+	ident = t_strconcat(login_binary->protocol, "/",
 			    net_ip2addr(&client->ip), "/",
 			    str_tabescape(client->virtual_user), NULL);
-	anvil_client_query(anvil, query, anvil_lookup_callback, req);
+	if (anvil_connect_limit_shm != NULL &&
+	    connect_limit_shm_lookup(anvil_connect_limit_shm, ident,
+				     &conn_count)) {
+		anvil_lookup_finish(req, conn_count);
+		return;
+	}
+	anvil_client_query(anvil, t_strconcat("LOOKUP\t", ident, NULL),
+			   anvil_lookup_callback, req);
 }
 
 static void
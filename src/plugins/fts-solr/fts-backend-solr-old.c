@@ -236,8 +236,8 @@ fts_backend_solr_init(struct fts_backend *_backend, const char **error_r)
 		*error_r = "Invalid fts_solr setting";
 		return -1;
 	}
-	if (solr_connection_init(fuser->set.url, fuser->set.debug,
-				 &backend->solr_conn, error_r) < 0)
+	if (solr_connection_init(&fuser->set, &backend->solr_conn,
+				 error_r) < 0)
 		return -1;
 
 	str = solr_escape_id_str(_backend->ns->user->username);
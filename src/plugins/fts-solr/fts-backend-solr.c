@@ -29,6 +29,7 @@
 struct solr_fts_backend {
 	struct fts_backend backend;
 	struct solr_connection *solr_conn;
+	unsigned int batch_size;
 };
 
 struct solr_fts_field {
@@ -47,10 +48,13 @@ struct solr_fts_backend_update_context {
 	string_t *cmd, *cur_value, *cur_value2;
 	string_t *cmd_expunge;
 	ARRAY(struct solr_fts_field) fields;
+	/* bulk mode: offset of the current document in cmd */
+	size_t doc_offset;
 
 	uint32_t last_indexed_uid;
 
 	unsigned int last_indexed_uid_set:1;
+	unsigned int doc_post_failed:1;
 	unsigned int body_open:1;
 	unsigned int documents_added:1;
 	unsigned int expunges:1;
@@ -165,14 +169,16 @@ fts_backend_solr_init(struct fts_backend *_backend, const char **error_r)
 		*error_r = "Invalid fts_solr setting";
 		return -1;
 	}
-	return solr_connection_init(fuser->set.url, fuser->set.debug,
-				    &backend->solr_conn, error_r);
+	backend->batch_size = fuser->set.batch_size;
+	return solr_connection_init(&fuser->set, &backend->solr_conn, error_r);
 }
 
 static void fts_backend_solr_deinit(struct fts_backend *_backend)
 {
 	struct solr_fts_backend *backend = (struct solr_fts_backend *)_backend;
 
+	if (backend->solr_conn != NULL)
+		solr_connection_deinit(backend->solr_conn);
 	i_free(backend);
 }
 
@@ -268,6 +274,7 @@ fts_backend_solr_doc_open(struct solr_fts_backend_update_context *ctx,
 			  uint32_t uid)
 {
 	ctx->documents_added = TRUE;
+	ctx->doc_offset = str_len(ctx->cmd);
 
 	str_printfa(ctx->cmd, "<doc>"
 		    "<field name=\"uid\">%u</field>"
@@ -320,20 +327,76 @@ fts_backend_solr_doc_close(struct solr_fts_backend_update_context *ctx)
 	str_append(ctx->cmd, "</doc>");
 }
 
-static int
-fts_backed_solr_build_commit(struct solr_fts_backend_update_context *ctx)
+static void
+fts_backend_solr_batch_send(struct solr_fts_backend_update_context *ctx)
 {
-	if (ctx->post == NULL)
-		return 0;
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)ctx->ctx.backend;
 
-	fts_backend_solr_doc_close(ctx);
 	str_append(ctx->cmd, "</add>");
+	solr_connection_post_async(backend->solr_conn, str_data(ctx->cmd),
+				   str_len(ctx->cmd));
+	str_truncate(ctx->cmd, 0);
+}
+
+static void
+fts_backend_solr_doc_stream_begin(struct solr_fts_backend_update_context *ctx)
+{
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)ctx->ctx.backend;
+	string_t *doc;
+
+	/* bulk mode: the document is too large to keep in memory. send the
+	   pending batch and stream the document in its own post. */
+	doc = str_new(default_pool, str_len(ctx->cmd) - ctx->doc_offset);
+	buffer_append(doc, str_data(ctx->cmd) + ctx->doc_offset,
+		      str_len(ctx->cmd) - ctx->doc_offset);
+	str_truncate(ctx->cmd, ctx->doc_offset);
+	if (ctx->doc_offset > strlen("<add>"))
+		fts_backend_solr_batch_send(ctx);
+	str_truncate(ctx->cmd, 0);
 
+	ctx->post = solr_connection_post_begin(backend->solr_conn);
+	str_append(ctx->cmd, "<add>");
+	str_append_str(ctx->cmd, doc);
+	str_free(&doc);
+}
+
+static int
+fts_backend_solr_doc_stream_end(struct solr_fts_backend_update_context *ctx)
+{
+	str_append(ctx->cmd, "</add>");
 	solr_connection_post_more(ctx->post, str_data(ctx->cmd),
 				  str_len(ctx->cmd));
+	str_truncate(ctx->cmd, 0);
 	return solr_connection_post_end(ctx->post);
 }
 
+static int
+fts_backed_solr_build_commit(struct solr_fts_backend_update_context *ctx)
+{
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)ctx->ctx.backend;
+	int ret = 0;
+
+	if (ctx->cmd == NULL)
+		return 0;
+
+	fts_backend_solr_doc_close(ctx);
+	if (backend->batch_size == 0)
+		return fts_backend_solr_doc_stream_end(ctx);
+
+	/* bulk mode: wait for the batches still in flight */
+	if (ctx->post == NULL)
+		fts_backend_solr_batch_send(ctx);
+	else if (fts_backend_solr_doc_stream_end(ctx) < 0)
+		ret = -1;
+	if (solr_connection_post_wait(backend->solr_conn) < 0 ||
+	    ctx->doc_post_failed)
+		ret = -1;
+	return ret;
+}
+
 static void
 fts_backend_solr_expunge_flush(struct solr_fts_backend_update_context *ctx)
 {
@@ -367,7 +430,11 @@ fts_backend_solr_update_deinit(struct fts_backend_update_context *_ctx)
 			fts_backend_solr_expunge_flush(ctx);
 		str = t_strdup_printf("<commit softCommit=\"true\" waitSearcher=\"%s\"/>",
 				      ctx->documents_added ? "true" : "false");
-		if (solr_connection_post(backend->solr_conn, str) < 0)
+		if (backend->batch_size != 0) {
+			/* don't wait for the commit now. the next search
+			   waits for it before it's sent. */
+			solr_connection_commit_async(backend->solr_conn, str);
+		} else if (solr_connection_post(backend->solr_conn, str) < 0)
 			ret = -1;
 	}
 
@@ -451,14 +518,26 @@ fts_backend_solr_uid_changed(struct solr_fts_backend_update_context *ctx,
 	struct solr_fts_backend *backend =
 		(struct solr_fts_backend *)ctx->ctx.backend;
 
-	if (ctx->post == NULL) {
+	if (ctx->cmd == NULL) {
 		i_assert(ctx->prev_uid == 0);
 
 		ctx->cmd = str_new(default_pool, SOLR_CMDBUF_SIZE);
-		ctx->post = solr_connection_post_begin(backend->solr_conn);
+		if (backend->batch_size == 0)
+			ctx->post = solr_connection_post_begin(backend->solr_conn);
 		str_append(ctx->cmd, "<add>");
 	} else {
 		fts_backend_solr_doc_close(ctx);
+		if (ctx->post != NULL && backend->batch_size != 0) {
+			/* the previous document was streamed */
+			if (fts_backend_solr_doc_stream_end(ctx) < 0)
+				ctx->doc_post_failed = TRUE;
+			ctx->post = NULL;
+			str_append(ctx->cmd, "<add>");
+		} else if (ctx->post == NULL &&
+			   str_len(ctx->cmd) >= backend->batch_size) {
+			fts_backend_solr_batch_send(ctx);
+			str_append(ctx->cmd, "<add>");
+		}
 	}
 	ctx->prev_uid = uid;
 	ctx->truncate_header = FALSE;
@@ -523,15 +602,21 @@ fts_backend_solr_update_build_more(struct fts_backend_update_context *_ctx,
 {
 	struct solr_fts_backend_update_context *ctx =
 		(struct solr_fts_backend_update_context *)_ctx;
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)_ctx->backend;
 	unsigned int len;
 
 	if (_ctx->failed)
 		return -1;
 
 	if (ctx->cur_value2 == NULL && ctx->cur_value == ctx->cmd) {
+		if (ctx->post == NULL && backend->batch_size != 0 &&
+		    str_len(ctx->cmd) - ctx->doc_offset + size >=
+		    I_MAX(backend->batch_size, SOLR_CMDBUF_FLUSH_SIZE))
+			fts_backend_solr_doc_stream_begin(ctx);
 		/* we're writing to message body. if size is huge,
 		   flush it once in a while */
-		while (size >= SOLR_CMDBUF_FLUSH_SIZE) {
+		while (ctx->post != NULL && size >= SOLR_CMDBUF_FLUSH_SIZE) {
 			if (str_len(ctx->cmd) >= SOLR_CMDBUF_FLUSH_SIZE) {
 				solr_connection_post_more(ctx->post,
 							  str_data(ctx->cmd),
@@ -556,15 +641,16 @@ fts_backend_solr_update_build_more(struct fts_backend_update_context *_ctx,
 			xml_encode_data(ctx->cur_value2, data, size);
 	}
 
-	if (str_len(ctx->cmd) >= SOLR_CMDBUF_FLUSH_SIZE) {
+	/* in bulk mode the whole batch is sent at once, unless a large
+	   document is being streamed */
+	if (ctx->post != NULL && str_len(ctx->cmd) >= SOLR_CMDBUF_FLUSH_SIZE) {
 		solr_connection_post_more(ctx->post, str_data(ctx->cmd),
 					  str_len(ctx->cmd));
 		str_truncate(ctx->cmd, 0);
 	}
-	if (!ctx->truncate_header &&
+	if (!ctx->truncate_header && ctx->cur_value != ctx->cmd &&
 	    str_len(ctx->cur_value) >= SOLR_HEADER_MAX_SIZE) {
 		/* a large header */
-		i_assert(ctx->cur_value != ctx->cmd);
 
 		i_warning("fts-solr(%s): Mailbox %s UID=%u header size is huge, truncating",
 			  ctx->cur_box->storage->user->username,
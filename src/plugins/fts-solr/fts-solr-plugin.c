@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "strnum.h"
 #include "http-client.h"
 #include "mail-user.h"
 #include "mail-storage-hooks.h"
@@ -24,6 +25,7 @@ fts_solr_plugin_init_settings(struct mail_user *user,
 
 	if (str == NULL)
 		str = "";
+	set->max_parallel = 1;
 
 	for (tmp = t_strsplit_spaces(str, " "); *tmp != NULL; tmp++) {
 		if (strncmp(*tmp, "url=", 4) == 0) {
@@ -32,6 +34,19 @@ fts_solr_plugin_init_settings(struct mail_user *user,
 			set->debug = TRUE;
 		} else if (strcmp(*tmp, "break-imap-search") == 0) {
 			/* for backwards compatibility */
+		} else if (strncmp(*tmp, "batch_size=", 11) == 0) {
+			if (str_to_uint(*tmp + 11, &set->batch_size) < 0) {
+				i_error("fts_solr: Invalid batch_size: %s",
+					*tmp + 11);
+				return -1;
+			}
+		} else if (strncmp(*tmp, "max_parallel=", 13) == 0) {
+			if (str_to_uint(*tmp + 13, &set->max_parallel) < 0 ||
+			    set->max_parallel == 0) {
+				i_error("fts_solr: Invalid max_parallel: %s",
+					*tmp + 13);
+				return -1;
+			}
 		} else if (strcmp(*tmp, "default_ns=") == 0) {
 			set->default_ns_prefix =
 				p_strdup(user->pool, *tmp + 11);
@@ -10,6 +10,9 @@
 
 struct fts_solr_settings {
 	const char *url, *default_ns_prefix;
+	/* with batch_size != 0 the documents are sent in batches of this many
+	   bytes, keeping up to max_parallel of them in flight */
+	unsigned int batch_size, max_parallel;
 	bool debug;
 };
 
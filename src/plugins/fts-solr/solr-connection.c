@@ -67,12 +67,28 @@ struct solr_connection {
 	struct istream *payload;
 	struct io *io;
 
+	/* asynchronous posts that haven't finished yet */
+	unsigned int pending_posts, max_pending_posts;
+	struct ioloop *ioloop;
+	/* asynchronous commit that failed and must be sent again */
+	char *failed_commit;
+
 	unsigned int debug:1;
 	unsigned int posting:1;
 	unsigned int xml_failed:1;
 	unsigned int http_ssl:1;
+	unsigned int async_failed:1;
 };
 
+struct solr_connection_async_post {
+	struct solr_connection *conn;
+	/* the commit command, NULL for document batches */
+	char *commit;
+};
+
+static int solr_connection_post_now(struct solr_connection *conn,
+				    const char *cmd);
+
 static int solr_xml_parse(struct solr_connection *conn,
 			  const void *data, size_t size, bool done)
 {
@@ -98,7 +114,7 @@ static int solr_xml_parse(struct solr_connection *conn,
 	return 0;
 }
 
-int solr_connection_init(const char *url, bool debug,
+int solr_connection_init(const struct fts_solr_settings *set,
 			 struct solr_connection **conn_r, const char **error_r)
 {
 	struct http_client_settings http_set;
@@ -106,7 +122,7 @@ int solr_connection_init(const char *url, bool debug,
 	struct http_url *http_url;
 	const char *error;
 
-	if (http_url_parse(url, NULL, 0, pool_datastack_create(),
+	if (http_url_parse(set->url, NULL, 0, pool_datastack_create(),
 			   &http_url, &error) < 0) {
 		*error_r = t_strdup_printf(
 			"fts_solr: Failed to parse HTTP url: %s", error);
@@ -118,16 +134,17 @@ int solr_connection_init(const char *url, bool debug,
 	conn->http_port = http_url->port;
 	conn->http_base_url = i_strconcat(http_url->path, http_url->enc_query, NULL);
 	conn->http_ssl = http_url->have_ssl;
-	conn->debug = debug;
+	conn->debug = set->debug;
+	conn->max_pending_posts = I_MAX(set->max_parallel, 1);
 
 	if (solr_http_client == NULL) {
 		memset(&http_set, 0, sizeof(http_set));
 		http_set.max_idle_time_msecs = 5*1000;
-		http_set.max_parallel_connections = 1;
+		http_set.max_parallel_connections = I_MAX(set->max_parallel, 1);
 		http_set.max_pipelined_requests = 1;
 		http_set.max_redirects = 1;
 		http_set.max_attempts = 3;
-		http_set.debug = debug;
+		http_set.debug = set->debug;
 		solr_http_client = http_client_init(&http_set);
 	}
 
@@ -142,6 +159,26 @@ int solr_connection_init(const char *url, bool debug,
 
 void solr_connection_deinit(struct solr_connection *conn)
 {
+	struct http_client_stats stats;
+
+	/* the pending posts' callbacks still point to us */
+	(void)solr_connection_post_wait(conn);
+
+	if (conn->debug &&
+	    http_client_get_host_stats(solr_http_client, conn->http_host,
+				       &stats) && stats.requests_sent > 0) {
+		i_debug("fts_solr: %u requests sent (%u reused connection, "
+			"%u pipelined), %u connects in %llu ms, "
+			"avg queue wait %llu ms, avg first byte %llu ms",
+			stats.requests_sent, stats.requests_reused,
+			stats.requests_pipelined, stats.connects,
+			(unsigned long long)stats.connect_msecs,
+			(unsigned long long)(stats.queue_msecs /
+					     stats.requests_sent),
+			(unsigned long long)(stats.first_byte_msecs /
+					     stats.requests_sent));
+	}
+
 	XML_ParserFree(conn->xml_parser);
 	i_free(conn->http_host);
 	i_free(conn->http_base_url);
@@ -395,6 +432,84 @@ solr_connection_select_response(const struct http_response *response,
 	solr_connection_payload_input(conn);
 }
 
+static void
+solr_connection_async_response(const struct http_response *response,
+			       struct solr_connection_async_post *apost)
+{
+	struct solr_connection *conn = apost->conn;
+	const char *reason;
+
+	i_assert(conn->pending_posts > 0);
+	conn->pending_posts--;
+
+	if (response == NULL || response->status / 100 != 2) {
+		reason = response == NULL ? "HTTP POST request failed" :
+			response->reason;
+		if (apost->commit == NULL) {
+			/* reported to the transaction waiting for the batches */
+			i_error("fts_solr: Indexing failed: %s", reason);
+			conn->async_failed = TRUE;
+		} else {
+			/* the transaction that sent the commit is already
+			   finished, so send it again before the next request
+			   instead */
+			i_error("fts_solr: Commit failed: %s - "
+				"retrying it before the next request", reason);
+			if (conn->failed_commit == NULL) {
+				conn->failed_commit = apost->commit;
+				apost->commit = NULL;
+			}
+		}
+	}
+	i_free(apost->commit);
+	i_free(apost);
+	if (conn->ioloop != NULL)
+		io_loop_stop(conn->ioloop);
+}
+
+static void solr_connection_resend_commit(struct solr_connection *conn)
+{
+	char *cmd = conn->failed_commit;
+
+	conn->failed_commit = NULL;
+	if (solr_connection_post_now(conn, cmd) < 0) {
+		i_error("fts_solr: Commit failed again - the latest updates "
+			"are visible only after Solr's next commit");
+	}
+	i_free(cmd);
+}
+
+static void
+solr_connection_wait_pending(struct solr_connection *conn,
+			     unsigned int max_pending)
+{
+	struct ioloop *prev_ioloop = current_ioloop;
+
+	if (max_pending == 0) {
+		if (conn->pending_posts > 0) {
+			http_client_wait(solr_http_client);
+			i_assert(conn->pending_posts == 0);
+		}
+		if (conn->failed_commit != NULL)
+			solr_connection_resend_commit(conn);
+		return;
+	}
+	if (conn->pending_posts <= max_pending)
+		return;
+
+	/* the other posts are left running in the background */
+	i_assert(conn->ioloop == NULL);
+	conn->ioloop = io_loop_create();
+	http_client_switch_ioloop(solr_http_client);
+	while (conn->pending_posts > max_pending)
+		io_loop_run(conn->ioloop);
+
+	io_loop_set_current(prev_ioloop);
+	http_client_switch_ioloop(solr_http_client);
+	io_loop_set_current(conn->ioloop);
+	io_loop_destroy(&conn->ioloop);
+}
+
 int solr_connection_select(struct solr_connection *conn, const char *query,
 			   pool_t pool, struct solr_result ***box_results_r)
 {
@@ -405,6 +520,9 @@ int solr_connection_select(struct solr_connection *conn, const char *query,
 
 	i_assert(!conn->posting);
 
+	/* make sure the search sees the updates that are still pending */
+	solr_connection_wait_pending(conn, 0);
+
 	memset(&solr_lookup_context, 0, sizeof(solr_lookup_context));
 	solr_lookup_context.result_pool = pool;
 	hash_table_create(&solr_lookup_context.mailboxes, default_pool, 0,
@@ -462,16 +580,25 @@ solr_connection_update_response(const struct http_response *response,
 }
 
 static struct http_client_request *
-solr_connection_post_request(struct solr_connection *conn)
+solr_connection_post_request(struct solr_connection *conn,
+			     struct solr_connection_async_post *apost)
 {
 	struct http_client_request *http_req;
 	const char *url;
 
 	url = t_strconcat(conn->http_base_url, "update", NULL);
 
-	http_req = http_client_request(solr_http_client, "POST",
-				       conn->http_host, url,
-				       solr_connection_update_response, conn);
+	if (apost == NULL) {
+		http_req = http_client_request(solr_http_client, "POST",
+					       conn->http_host, url,
+					       solr_connection_update_response,
+					       conn);
+	} else {
+		http_req = http_client_request(solr_http_client, "POST",
+					       conn->http_host, url,
+					       solr_connection_async_response,
+					       apost);
+	}
 	http_client_request_set_port(http_req, conn->http_port);
 	http_client_request_set_ssl(http_req, conn->http_ssl);
 	http_client_request_add_header(http_req, "Content-Type", "text/xml");
@@ -484,11 +611,12 @@ solr_connection_post_begin(struct solr_connection *conn)
 	struct solr_connection_post *post;
 
 	i_assert(!conn->posting);
+	solr_connection_wait_pending(conn, 0);
 	conn->posting = TRUE;
 
 	post = i_new(struct solr_connection_post, 1);
 	post->conn = conn;
-	post->http_req = solr_connection_post_request(conn);
+	post->http_req = solr_connection_post_request(conn, NULL);
 	XML_ParserReset(conn->xml_parser, "UTF-8");
 	return post;
 }
@@ -530,13 +658,21 @@ int solr_connection_post_end(struct solr_connection_post *post)
 }
 
 int solr_connection_post(struct solr_connection *conn, const char *cmd)
+{
+	i_assert(!conn->posting);
+
+	/* keep the updates in the order they were sent */
+	solr_connection_wait_pending(conn, 0);
+	return solr_connection_post_now(conn, cmd);
+}
+
+static int solr_connection_post_now(struct solr_connection *conn,
+				    const char *cmd)
 {
 	struct http_client_request *http_req;
 	struct istream *post_payload;
 
-	i_assert(!conn->posting);
-
-	http_req = solr_connection_post_request(conn);
+	http_req = solr_connection_post_request(conn, NULL);
 	post_payload = i_stream_create_from_data(cmd, strlen(cmd));
 	http_client_request_set_payload(http_req, post_payload, TRUE);
 	i_stream_unref(&post_payload);
@@ -549,3 +685,63 @@ int solr_connection_post(struct solr_connection *conn, const char *cmd)
 
 	return conn->request_status;
 }
+
+static void solr_connection_payload_free(buffer_t *payload)
+{
+	buffer_free(&payload);
+}
+
+static void
+solr_connection_post_async_full(struct solr_connection *conn,
+				const unsigned char *data, size_t size,
+				const char *commit)
+{
+	struct solr_connection_async_post *apost;
+	struct http_client_request *http_req;
+	struct istream *post_payload;
+	buffer_t *payload;
+
+	i_assert(!conn->posting);
+
+	/* leave room for this one */
+	solr_connection_wait_pending(conn, conn->max_pending_posts - 1);
+
+	payload = buffer_create_dynamic(default_pool, size);
+	buffer_append(payload, data, size);
+
+	apost = i_new(struct solr_connection_async_post, 1);
+	apost->conn = conn;
+	apost->commit = i_strdup(commit);
+	http_req = solr_connection_post_request(conn, apost);
+	post_payload = i_stream_create_from_data(payload->data, payload->used);
+	i_stream_add_destroy_callback(post_payload,
+				      solr_connection_payload_free, payload);
+	http_client_request_set_payload(http_req, post_payload, TRUE);
+	i_stream_unref(&post_payload);
+
+	conn->pending_posts++;
+	http_client_request_submit(http_req);
+}
+
+void solr_connection_post_async(struct solr_connection *conn,
+				const unsigned char *data, size_t size)
+{
+	solr_connection_post_async_full(conn, data, size, NULL);
+}
+
+void solr_connection_commit_async(struct solr_connection *conn,
+				  const char *cmd)
+{
+	solr_connection_post_async_full(conn, (const unsigned char *)cmd,
+					strlen(cmd), cmd);
+}
+
+int solr_connection_post_wait(struct solr_connection *conn)
+{
+	int ret;
+
+	solr_connection_wait_pending(conn, 0);
+	ret = conn->async_failed ? -1 : 0;
+	conn->async_failed = FALSE;
+	return ret;
+}
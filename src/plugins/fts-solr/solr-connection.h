@@ -4,6 +4,7 @@
 #include "seq-range-array.h"
 #include "fts-api.h"
 
+struct fts_solr_settings;
 struct solr_connection;
 
 struct solr_result {
@@ -13,7 +14,7 @@ struct solr_result {
 	ARRAY_TYPE(fts_score_map) scores;
 };
 
-int solr_connection_init(const char *url, bool debug,
+int solr_connection_init(const struct fts_solr_settings *set,
 			 struct solr_connection **conn_r, const char **error_r);
 void solr_connection_deinit(struct solr_connection *conn);
 
@@ -27,4 +28,16 @@ void solr_connection_post_more(struct solr_connection_post *post,
 			       const unsigned char *data, size_t size);
 int solr_connection_post_end(struct solr_connection_post *post);
 
+/* Submit a POST without waiting for its reply. If max_parallel posts are
+   already pending, wait until one of them has finished. */
+void solr_connection_post_async(struct solr_connection *conn,
+				const unsigned char *data, size_t size);
+/* Submit a commit without waiting for its reply. A failed commit is logged
+   and sent again before the connection's next request. */
+void solr_connection_commit_async(struct solr_connection *conn,
+				  const char *cmd);
+/* Wait until all the asynchronous posts have finished. Returns -1 if any of
+   the document posts failed since the last call. */
+int solr_connection_post_wait(struct solr_connection *conn);
+
 #endif
@@ -0,0 +1,299 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "unlink-directory.h"
+#include "master-service.h"
+#include "mail-storage-service.h"
+#include "mail-namespace.h"
+#include "solr-connection.h"
+#include "fts-solr-plugin.h"
+#include "test-common.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TEST_HOME ".test-fts-backend-solr"
+/* larger than the backend's command buffer, so the body has to be
+   streamed */
+#define TEST_BODY_SIZE (1024*300)
+/* the backend flushes its command buffer to the post once it's at least
+   this large, so no single write should be larger than this */
+#define TEST_MAX_WRITE_SIZE (1024*64*2)
+
+struct test_post {
+	string_t *data;
+	bool streamed;
+};
+
+static struct mail_storage_service_ctx *test_storage_service;
+static ARRAY(struct test_post) test_posts;
+static struct test_post *test_cur_post;
+static size_t test_max_write_size;
+
+int solr_connection_init(const struct fts_solr_settings *set ATTR_UNUSED,
+			 struct solr_connection **conn_r,
+			 const char **error_r ATTR_UNUSED)
+{
+	static int test_conn;
+
+	*conn_r = (void *)&test_conn;
+	return 0;
+}
+
+void solr_connection_deinit(struct solr_connection *conn ATTR_UNUSED)
+{
+}
+
+int solr_connection_select(struct solr_connection *conn ATTR_UNUSED,
+			   const char *query ATTR_UNUSED,
+			   pool_t pool ATTR_UNUSED,
+			   struct solr_result ***box_results_r ATTR_UNUSED)
+{
+	return -1;
+}
+
+int solr_connection_post(struct solr_connection *conn ATTR_UNUSED,
+			 const char *cmd ATTR_UNUSED)
+{
+	return 0;
+}
+
+static struct test_post *test_post_add(bool streamed)
+{
+	struct test_post *post;
+
+	test_assert(test_cur_post == NULL);
+	post = array_append_space(&test_posts);
+	post->data = str_new(default_pool, 1024);
+	post->streamed = streamed;
+	return post;
+}
+
+struct solr_connection_post *
+solr_connection_post_begin(struct solr_connection *conn ATTR_UNUSED)
+{
+	test_cur_post = test_post_add(TRUE);
+	return (struct solr_connection_post *)test_cur_post;
+}
+
+void solr_connection_post_more(struct solr_connection_post *post,
+			       const unsigned char *data, size_t size)
+{
+	test_assert((struct test_post *)post == test_cur_post);
+	buffer_append(test_cur_post->data, data, size);
+	test_max_write_size = I_MAX(test_max_write_size, size);
+}
+
+int solr_connection_post_end(struct solr_connection_post *post)
+{
+	test_assert((struct test_post *)post == test_cur_post);
+	test_cur_post = NULL;
+	return 0;
+}
+
+void solr_connection_post_async(struct solr_connection *conn ATTR_UNUSED,
+				const unsigned char *data, size_t size)
+{
+	struct test_post *post = test_post_add(FALSE);
+
+	buffer_append(post->data, data, size);
+	test_max_write_size = I_MAX(test_max_write_size, size);
+}
+
+void solr_connection_commit_async(struct solr_connection *conn ATTR_UNUSED,
+				  const char *cmd ATTR_UNUSED)
+{
+}
+
+int solr_connection_post_wait(struct solr_connection *conn ATTR_UNUSED)
+{
+	return 0;
+}
+
+static void
+test_build_body(struct fts_backend_update_context *ctx, uint32_t uid,
+		size_t size)
+{
+	struct fts_backend_build_key key;
+	unsigned char data[1024];
+	size_t len;
+
+	memset(&key, 0, sizeof(key));
+	key.uid = uid;
+	key.type = FTS_BACKEND_BUILD_KEY_BODY_PART;
+	key.body_content_type = "text/plain";
+	test_assert(fts_backend_solr.v.update_set_build_key(ctx, &key));
+	memset(data, 'x', sizeof(data));
+	for (; size > 0; size -= len) {
+		len = I_MIN(size, sizeof(data));
+		test_assert(fts_backend_solr.v.update_build_more(ctx, data,
+								 len) == 0);
+	}
+	fts_backend_solr.v.update_unset_build_key(ctx);
+}
+
+static unsigned int test_str_count(const char *str, const char *substr)
+{
+	unsigned int count = 0;
+
+	while ((str = strstr(str, substr)) != NULL) {
+		str += strlen(substr);
+		count++;
+	}
+	return count;
+}
+
+static void test_posts_check(const char *const *expected_uids)
+{
+	const struct test_post *posts;
+	const char *data;
+	unsigned int i, count;
+
+	posts = array_get(&test_posts, &count);
+	test_assert(count == str_array_length(expected_uids));
+	for (i = 0; i < count && expected_uids[i] != NULL; i++) {
+		data = str_c(posts[i].data);
+		test_assert(strncmp(data, "<add><doc>", 10) == 0);
+		test_assert(strcmp(data + strlen(data) - 12,
+				   "</doc></add>") == 0);
+		test_assert(strstr(data, expected_uids[i]) != NULL);
+		test_assert(test_str_count(data, "<doc>") == 1);
+	}
+}
+
+static void test_posts_free(void)
+{
+	struct test_post *post;
+
+	array_foreach_modifiable(&test_posts, post)
+		str_free(&post->data);
+	array_clear(&test_posts);
+	test_max_write_size = 0;
+}
+
+static struct mail_user *
+test_user_init(struct mail_storage_service_user **service_user_r)
+{
+	struct mail_storage_service_input input;
+	struct mail_user *user;
+	const char *home, *userdb_fields[3], *error;
+	char cwd[PATH_MAX];
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+		i_fatal("getcwd() failed: %m");
+	home = t_strconcat(cwd, "/"TEST_HOME, NULL);
+	userdb_fields[0] = t_strconcat("home=", home, NULL);
+	userdb_fields[1] = t_strconcat("mail=sdbox:", home, "/mail", NULL);
+	userdb_fields[2] = NULL;
+
+	memset(&input, 0, sizeof(input));
+	input.username = "testuser";
+	input.no_userdb_lookup = TRUE;
+	input.userdb_fields = userdb_fields;
+	if (mail_storage_service_lookup_next(test_storage_service, &input,
+					     service_user_r, &user,
+					     &error) <= 0)
+		i_fatal("User lookup failed: %s", error);
+	return user;
+}
+
+static void test_fts_backend_solr_build(unsigned int batch_size)
+{
+	static const char *expected_uids[] = {
+		"<field name=\"uid\">1</field>",
+		"<field name=\"uid\">2</field>",
+		"<field name=\"uid\">3</field>",
+		NULL
+	};
+	struct mail_storage_service_user *service_user;
+	struct mail_user *user;
+	struct fts_solr_user *fuser;
+	struct fts_backend *backend;
+	struct fts_backend_update_context *ctx;
+	const struct test_post *posts;
+	const char *error;
+
+	user = test_user_init(&service_user);
+	fuser = p_new(user->pool, struct fts_solr_user, 1);
+	fuser->set.batch_size = batch_size;
+	MODULE_CONTEXT_SET(user, fts_solr_user_module, fuser);
+
+	backend = fts_backend_solr.v.alloc();
+	backend->ns = user->namespaces;
+	test_assert(fts_backend_solr.v.init(backend, &error) == 0);
+
+	ctx = fts_backend_solr.v.update_init(backend);
+	test_build_body(ctx, 1, 100);
+	test_build_body(ctx, 2, TEST_BODY_SIZE);
+	test_build_body(ctx, 3, 100);
+	test_assert(fts_backend_solr.v.update_deinit(ctx) == 0);
+	fts_backend_solr.v.deinit(backend);
+
+	/* the large body was written in small pieces */
+	test_assert(test_cur_post == NULL);
+	test_assert(test_max_write_size <= TEST_MAX_WRITE_SIZE);
+	posts = array_idx(&test_posts, 0);
+	if (batch_size == 0) {
+		test_assert(array_count(&test_posts) == 1);
+		test_assert(posts[0].streamed);
+		test_assert(test_str_count(str_c(posts[0].data), "<doc>") == 3);
+	} else {
+		/* the pending batch is sent before the large document
+		   is streamed in its own post */
+		test_posts_check(expected_uids);
+		test_assert(!posts[0].streamed);
+		test_assert(posts[1].streamed);
+		test_assert(str_len(posts[1].data) > TEST_BODY_SIZE);
+		test_assert(!posts[2].streamed);
+	}
+	test_posts_free();
+	mail_user_unref(&user);
+	mail_storage_service_user_free(&service_user);
+}
+
+static void test_fts_backend_solr_large_body(void)
+{
+	test_begin("fts solr large body");
+	test_fts_backend_solr_build(0);
+	test_end();
+
+	test_begin("fts solr large body in bulk mode");
+	test_fts_backend_solr_build(1024);
+	test_end();
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*test_functions[])(void) = {
+		test_fts_backend_solr_large_body,
+		NULL
+	};
+
+	master_service = master_service_init("test-fts-backend-solr",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT,
+					     &argc, &argv, "");
+	master_service_init_finish(master_service);
+	test_storage_service =
+		mail_storage_service_init(master_service, NULL,
+			MAIL_STORAGE_SERVICE_FLAG_NO_RESTRICT_ACCESS |
+			MAIL_STORAGE_SERVICE_FLAG_NO_CHDIR |
+			MAIL_STORAGE_SERVICE_FLAG_NO_LOG_INIT |
+			MAIL_STORAGE_SERVICE_FLAG_NO_PLUGINS);
+	i_array_init(&test_posts, 8);
+
+	(void)unlink_directory(TEST_HOME, TRUE);
+	if (mkdir(TEST_HOME, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_HOME);
+	test_init();
+	test_run_funcs(test_functions);
+	(void)unlink_directory(TEST_HOME, TRUE);
+
+	array_free(&test_posts);
+	mail_storage_service_deinit(&test_storage_service);
+	/* this deinitializes the lib also for the master service */
+	return test_deinit();
+}
@@ -1853,7 +1853,7 @@ squat_trie_filter_type(enum squat_index_type type,
 	const struct seq_range *src_range;
 	struct seq_range new_range;
 	unsigned int i, count, mask;
-	uint32_t next_seq, uid;
+	uint32_t next_seq, first, last;
 
 	array_clear(dest);
 	src_range = array_get(src, &count);
@@ -1879,13 +1879,15 @@ squat_trie_filter_type(enum squat_index_type type,
 		return;
 	}
 
-	/* we'll have to drop either header or body UIDs */
+	/* we'll have to drop either header or body UIDs. the wanted UIDs
+	   in a range are every other one, so they become a single range. */
 	mask = (type & SQUAT_INDEX_TYPE_HEADER) != 0 ? 1 : 0;
 	for (i = 0; i < count; i++) {
-		for (uid = src_range[i].seq1; uid <= src_range[i].seq2; uid++) {
-			if ((uid & 1) == mask)
-				seq_range_array_add(dest, uid/2);
-		}
+		first = src_range[i].seq1 + ((src_range[i].seq1 & 1) != mask);
+		last = src_range[i].seq2 - ((src_range[i].seq2 & 1) != mask);
+		if (first > last || last == (uint32_t)-1)
+			continue;
+		seq_range_array_add_range(dest, first/2, last/2);
 	}
 }
 
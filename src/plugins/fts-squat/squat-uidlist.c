@@ -1285,15 +1285,25 @@ static void uidlist_array_append_range(ARRAY_TYPE(uint32_t) *uids,
 	array_append(uids, &uid2, 1);
 }
 
+static void uidlist_array_append_run(ARRAY_TYPE(uint32_t) *uids,
+				     uint32_t uid1, uint32_t uid2)
+{
+	if (uid1 == uid2)
+		uidlist_array_append(uids, uid1);
+	else
+		uidlist_array_append_range(uids, uid1, uid2);
+}
+
 static int
 squat_uidlist_get_at_offset(struct squat_uidlist *uidlist, uoff_t offset,
 			    uint32_t num, ARRAY_TYPE(uint32_t) *uids)
 {
 	const uint32_t *uid_list;
 	const uint8_t *p, *end;
-	uint32_t size, base_uid, next_uid, flags, prev;
+	uint32_t size, base_uid, next_uid, flags, prev, run_uid;
 	uoff_t uidlist_data_offset;
 	unsigned int i, j, count;
+	bool in_run;
 
 	if (num != 0)
 		uidlist_data_offset = offset;
@@ -1356,13 +1366,31 @@ squat_uidlist_get_at_offset(struct squat_uidlist *uidlist, uoff_t offset,
 		/* bitmask */
 		size = end - p;
 
-		uidlist_array_append(uids, base_uid++);
+		/* add the set bits a run at a time. base_uid is always
+		   set. */
+		run_uid = base_uid++;
+		in_run = TRUE;
 		for (i = 0; i < size; i++) {
+			if (p[i] == (in_run ? 0xff : 0x00)) {
+				/* the whole byte continues the current state */
+				base_uid += 8;
+				continue;
+			}
 			for (j = 0; j < 8; j++, base_uid++) {
-				if ((p[i] & (1 << j)) != 0)
-					uidlist_array_append(uids, base_uid);
+				if ((p[i] & (1 << j)) == 0) {
+					if (in_run) {
+						uidlist_array_append_run(uids,
+							run_uid, base_uid-1);
+						in_run = FALSE;
+					}
+				} else if (!in_run) {
+					run_uid = base_uid;
+					in_run = TRUE;
+				}
 			}
 		}
+		if (in_run)
+			uidlist_array_append_run(uids, run_uid, base_uid-1);
 	} else {
 		/* range */
 		for (;;) {
@@ -1529,6 +1557,26 @@ int squat_uidlist_get_seqrange(struct squat_uidlist *uidlist,
 	return ret;
 }
 
+static void
+uidlist_filter_skip(const struct seq_range *parent_range,
+		    unsigned int parent_count, unsigned int *parent_idx,
+		    uint32_t *parent_uid, uint32_t count)
+{
+	uint32_t left;
+
+	/* move parent_uid forward by count UIDs */
+	while (count > 0 && *parent_idx < parent_count) {
+		left = parent_range[*parent_idx].seq2 - *parent_uid;
+		if (count <= left) {
+			*parent_uid += count;
+			break;
+		}
+		count -= left + 1;
+		if (++*parent_idx < parent_count)
+			*parent_uid = parent_range[*parent_idx].seq1;
+	}
+}
+
 int squat_uidlist_filter(struct squat_uidlist *uidlist, uint32_t uid_list_idx,
 			 ARRAY_TYPE(seq_range) *uids)
 {
@@ -1536,8 +1584,8 @@ int squat_uidlist_filter(struct squat_uidlist *uidlist, uint32_t uid_list_idx,
 	ARRAY_TYPE(seq_range) dest_uids;
 	ARRAY_TYPE(uint32_t) relative_uids;
 	const uint32_t *rel_range;
-	unsigned int i, rel_count, parent_idx, parent_count, diff, parent_uid;
-	uint32_t prev_seq, seq1, seq2;
+	unsigned int i, rel_count, parent_idx, parent_count;
+	uint32_t prev_seq, seq1, seq2, parent_uid, left, n;
 	int ret = 0;
 
 	parent_range = array_get(uids, &parent_count);
@@ -1549,11 +1597,14 @@ int squat_uidlist_filter(struct squat_uidlist *uidlist, uint32_t uid_list_idx,
 	if (squat_uidlist_get(uidlist, uid_list_idx, &relative_uids) < 0)
 		ret = -1;
 
+	/* the relative UIDs are indexes to the parent UIDs. parent_uid is
+	   the parent UID at index prev_seq. go through both of them a range
+	   at a time. */
 	parent_idx = 0;
 	rel_range = array_get(&relative_uids, &rel_count);
 	prev_seq = 0; parent_uid = parent_range[0].seq1;
 	for (i = 0; i < rel_count; i++) {
-		if (unlikely(parent_uid == (uint32_t)-1)) {
+		if (unlikely(parent_idx == parent_count)) {
 			i_error("broken UID ranges");
 			ret = -1;
 			break;
@@ -1565,45 +1616,27 @@ int squat_uidlist_filter(struct squat_uidlist *uidlist, uint32_t uid_list_idx,
 			seq2 = rel_range[++i];
 		}
 		i_assert(seq1 >= prev_seq);
-		diff = seq1 - prev_seq;
-		while (diff > 0) {
-			if (unlikely(parent_uid == (uint32_t)-1)) {
-				i_error("broken UID ranges");
-				ret = -1;
-				break;
-			}
-
-			for (; parent_idx < parent_count; parent_idx++) {
-				if (parent_range[parent_idx].seq2 <= parent_uid)
-					continue;
-				if (parent_uid < parent_range[parent_idx].seq1)
-					parent_uid = parent_range[parent_idx].seq1;
-				else
-					parent_uid++;
-				break;
-			}
-			diff--;
+		uidlist_filter_skip(parent_range, parent_count, &parent_idx,
+				    &parent_uid, seq1 - prev_seq);
+
+		left = seq2 - seq1 + 1;
+		while (left > 0 && parent_idx < parent_count) {
+			/* add n+1 UIDs from this parent range */
+			n = parent_range[parent_idx].seq2 - parent_uid;
+			if (n > left - 1)
+				n = left - 1;
+			seq_range_array_add_range(&dest_uids, parent_uid,
+						  parent_uid + n);
+			left -= n + 1;
+			uidlist_filter_skip(parent_range, parent_count,
+					    &parent_idx, &parent_uid, n + 1);
 		}
-		diff = seq2 - seq1 + 1;
-		while (diff > 0) {
-			if (unlikely(parent_uid == (uint32_t)-1)) {
-				i_error("broken UID ranges");
-				ret = -1;
-				break;
-			}
-			seq_range_array_add(&dest_uids, parent_uid);
-			for (; parent_idx < parent_count; parent_idx++) {
-				if (parent_range[parent_idx].seq2 <= parent_uid)
-					continue;
-				if (parent_uid < parent_range[parent_idx].seq1)
-					parent_uid = parent_range[parent_idx].seq1;
-				else
-					parent_uid++;
-				break;
-			}
-			diff--;
+		if (unlikely(left > 0)) {
+			/* the relative UIDs point past the parent's UIDs */
+			i_error("broken UID ranges");
+			ret = -1;
+			break;
 		}
-
 		prev_seq = seq2 + 1;
 	}
 
@@ -1,18 +1,23 @@
 /* Copyright (c) 2006-2014 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "istream.h"
 #include "buffer.h"
 #include "str.h"
+#include "write-full.h"
 #include "rfc822-parser.h"
 #include "message-address.h"
 #include "message-parser.h"
 #include "message-decoder.h"
-#include "mail-storage.h"
+#include "mail-storage-private.h"
+#include "mail-worker.h"
 #include "fts-parser.h"
 #include "fts-api-private.h"
 #include "fts-build-mail.h"
 
+#include <unistd.h>
+
 /* there are other characters as well, but this doesn't have to be exact */
 #define IS_WORD_WHITESPACE(c) \
 	((c) == ' ' || (c) == '\t' || (c) == '\n')
@@ -20,6 +25,59 @@
    wherever */
 #define MAX_WORD_SIZE 1024
 
+/* Build worker writes its output to the pipe after this many bytes.
+   Together with the pipe buffer this limits how far ahead of the parent
+   the worker can get. */
+#define FTS_BUILD_WORKER_FLUSH_SIZE (32*1024)
+
+/* Build worker's output is a stream of records. Each record begins with
+   a type byte and a 32bit payload size. */
+enum fts_build_worker_record {
+	/* uint32_t seq */
+	FTS_BUILD_WORKER_RECORD_MAIL = 'M',
+	/* uint32_t uid, uint8_t type, uint8_t flags for the following
+	   NUL-terminated hdr_name, body_content_type and
+	   body_content_disposition strings that are non-NULL */
+	FTS_BUILD_WORKER_RECORD_KEY = 'K',
+	FTS_BUILD_WORKER_RECORD_UNSET_KEY = 'U',
+	/* fts_backend_update_build_more() data */
+	FTS_BUILD_WORKER_RECORD_DATA = 'D',
+	/* int32_t fts_build_mail() return value */
+	FTS_BUILD_WORKER_RECORD_MAIL_END = 'E'
+};
+#define FTS_BUILD_WORKER_RECORD_HDR_SIZE (1 + sizeof(uint32_t))
+
+struct fts_build_worker {
+	struct mail_worker *proc;
+	struct istream *input;
+	/* mail whose MAIL record was read, but not its contents yet,
+	   or 0 if none */
+	uint32_t next_seq;
+	/* records of the mail that is being read */
+	buffer_t *mail_records;
+
+	unsigned int failed:1;
+};
+
+struct fts_build_workers {
+	struct fts_backend_update_context *update_ctx;
+	uint32_t seq1, seq2;
+	/* worker N builds mails seq1+N, seq1+N+step, .. */
+	unsigned int step;
+
+	struct mail_workers *procs;
+	ARRAY(struct fts_build_worker) workers;
+};
+
+/* fts_backend_update_context that serializes the build into a pipe */
+struct fts_build_worker_update_context {
+	struct fts_backend_update_context ctx;
+	struct fts_backend backend;
+
+	int fd;
+	buffer_t *output;
+};
+
 struct fts_mail_build_context {
 	struct mail *mail;
 	struct fts_backend_update_context *update_ctx;
@@ -379,3 +437,392 @@ int fts_build_mail(struct fts_backend_update_context *update_ctx,
 	} T_END;
 	return ret;
 }
+
+static void fts_build_worker_flush(struct fts_build_worker_update_context *ctx)
+{
+	if (write_full(ctx->fd, ctx->output->data, ctx->output->used) < 0) {
+		/* parent is gone */
+		_exit(1);
+	}
+	buffer_set_used_size(ctx->output, 0);
+}
+
+static void
+fts_build_worker_record(buffer_t *output, enum fts_build_worker_record type,
+			size_t size)
+{
+	uint32_t size32 = size;
+
+	buffer_append_c(output, type);
+	buffer_append(output, &size32, sizeof(size32));
+}
+
+static void
+fts_build_worker_set_mailbox(struct fts_backend_update_context *ctx ATTR_UNUSED,
+			     struct mailbox *box ATTR_UNUSED)
+{
+}
+
+static bool
+fts_build_worker_set_build_key(struct fts_backend_update_context *_ctx,
+			       const struct fts_backend_build_key *key)
+{
+	struct fts_build_worker_update_context *ctx =
+		(struct fts_build_worker_update_context *)_ctx;
+	const char *strings[3];
+	size_t size = sizeof(key->uid) + 2;
+	uint8_t flags = 0;
+	unsigned int i;
+
+	strings[0] = key->hdr_name;
+	strings[1] = key->body_content_type;
+	strings[2] = key->body_content_disposition;
+	for (i = 0; i < N_ELEMENTS(strings); i++) {
+		if (strings[i] != NULL) {
+			flags |= 1 << i;
+			size += strlen(strings[i]) + 1;
+		}
+	}
+
+	fts_build_worker_record(ctx->output, FTS_BUILD_WORKER_RECORD_KEY, size);
+	buffer_append(ctx->output, &key->uid, sizeof(key->uid));
+	buffer_append_c(ctx->output, key->type);
+	buffer_append_c(ctx->output, flags);
+	for (i = 0; i < N_ELEMENTS(strings); i++) {
+		if (strings[i] != NULL) {
+			buffer_append(ctx->output, strings[i],
+				      strlen(strings[i]) + 1);
+		}
+	}
+	/* the parent decides if the backend wants it */
+	return TRUE;
+}
+
+static void
+fts_build_worker_unset_build_key(struct fts_backend_update_context *_ctx)
+{
+	struct fts_build_worker_update_context *ctx =
+		(struct fts_build_worker_update_context *)_ctx;
+
+	fts_build_worker_record(ctx->output, FTS_BUILD_WORKER_RECORD_UNSET_KEY,
+				0);
+}
+
+static int
+fts_build_worker_build_more(struct fts_backend_update_context *_ctx,
+			    const unsigned char *data, size_t size)
+{
+	struct fts_build_worker_update_context *ctx =
+		(struct fts_build_worker_update_context *)_ctx;
+
+	fts_build_worker_record(ctx->output, FTS_BUILD_WORKER_RECORD_DATA, size);
+	buffer_append(ctx->output, data, size);
+	if (ctx->output->used >= FTS_BUILD_WORKER_FLUSH_SIZE)
+		fts_build_worker_flush(ctx);
+	return 0;
+}
+
+static void ATTR_NORETURN
+fts_build_worker_run(struct fts_build_workers *workers,
+		     struct mailbox_transaction_context *trans,
+		     uint32_t seq, int fd)
+{
+	struct fts_build_worker_update_context ctx;
+	struct fts_backend *backend = workers->update_ctx->backend;
+	struct mail *mail;
+	int32_t ret;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.backend.name = "build-worker";
+	ctx.backend.flags = backend->flags;
+	ctx.backend.ns = backend->ns;
+	ctx.backend.v.update_set_mailbox = fts_build_worker_set_mailbox;
+	ctx.backend.v.update_set_build_key = fts_build_worker_set_build_key;
+	ctx.backend.v.update_unset_build_key = fts_build_worker_unset_build_key;
+	ctx.backend.v.update_build_more = fts_build_worker_build_more;
+	ctx.ctx.backend = &ctx.backend;
+	ctx.ctx.normalizer = workers->update_ctx->normalizer;
+	ctx.ctx.cur_box = mailbox_transaction_get_mailbox(trans);
+	ctx.fd = fd;
+	ctx.output = buffer_create_dynamic(default_pool,
+					   FTS_BUILD_WORKER_FLUSH_SIZE + 1024);
+
+	/* build our mails with the parent's transaction, which is never
+	   committed. the index, cache and log files are shared with the
+	   parent, so make sure we don't write anything to them. */
+	mailbox_set_worker_readonly(ctx.ctx.cur_box);
+	mail = mail_alloc(trans, MAIL_FETCH_STREAM_HEADER |
+			  MAIL_FETCH_STREAM_BODY, NULL);
+	for (; seq <= workers->seq2; seq += workers->step) {
+		mail_set_seq(mail, seq);
+		fts_build_worker_record(ctx.output, FTS_BUILD_WORKER_RECORD_MAIL,
+					sizeof(seq));
+		buffer_append(ctx.output, &seq, sizeof(seq));
+		ret = fts_build_mail(&ctx.ctx, mail);
+		fts_build_worker_record(ctx.output,
+					FTS_BUILD_WORKER_RECORD_MAIL_END,
+					sizeof(ret));
+		buffer_append(ctx.output, &ret, sizeof(ret));
+		if (ctx.output->used >= FTS_BUILD_WORKER_FLUSH_SIZE)
+			fts_build_worker_flush(&ctx);
+	}
+	fts_build_worker_flush(&ctx);
+	_exit(0);
+}
+
+struct fts_build_workers *
+fts_build_workers_init(struct mailbox_transaction_context *trans,
+		       struct fts_backend_update_context *update_ctx,
+		       uint32_t seq1, uint32_t seq2, unsigned int count)
+{
+	struct fts_build_workers *workers;
+	struct fts_build_worker *worker;
+	struct mail_worker *proc;
+	unsigned int i;
+	bool child;
+
+	i_assert(count > 0);
+	i_assert(seq1 <= seq2);
+
+	workers = i_new(struct fts_build_workers, 1);
+	workers->update_ctx = update_ctx;
+	workers->seq1 = seq1;
+	workers->seq2 = seq2;
+	workers->step = count;
+	workers->procs = mail_workers_init();
+	i_array_init(&workers->workers, count);
+	for (i = 0; i < count && seq1 + i <= seq2; i++) {
+		if ((proc = mail_workers_fork(workers->procs, TRUE,
+					      &child)) == NULL)
+			break;
+		if (child)
+			fts_build_worker_run(workers, trans, seq1 + i, proc->fd);
+
+		worker = array_append_space(&workers->workers);
+		worker->proc = proc;
+		worker->input = i_stream_create_fd(proc->fd, (size_t)-1, FALSE);
+		worker->input->blocking = TRUE;
+		worker->mail_records =
+			buffer_create_dynamic(default_pool, 1024);
+	}
+	/* the mails of workers that couldn't be created are built by us */
+	return workers;
+}
+
+static void
+fts_build_worker_stop(struct fts_build_workers *workers,
+		      struct fts_build_worker *worker)
+{
+	int status;
+
+	if (worker->input != NULL)
+		i_stream_destroy(&worker->input);
+	/* the worker may still be blocked writing mails that weren't
+	   wanted after all */
+	if (worker->proc != NULL) {
+		(void)mail_worker_wait(workers->procs, &worker->proc, TRUE,
+				       &status);
+	}
+}
+
+void fts_build_workers_deinit(struct fts_build_workers **_workers)
+{
+	struct fts_build_workers *workers = *_workers;
+	struct fts_build_worker *worker;
+
+	*_workers = NULL;
+	array_foreach_modifiable(&workers->workers, worker) {
+		fts_build_worker_stop(workers, worker);
+		buffer_free(&worker->mail_records);
+	}
+	mail_workers_deinit(&workers->procs);
+	array_free(&workers->workers);
+	i_free(workers);
+}
+
+static void
+fts_build_worker_failed(struct fts_build_workers *workers,
+			struct fts_build_worker *worker)
+{
+	i_error("fts build worker %s died unexpectedly",
+		dec2str(worker->proc->pid));
+	worker->failed = TRUE;
+	fts_build_worker_stop(workers, worker);
+}
+
+static int
+fts_build_worker_read(struct fts_build_worker *worker,
+		      enum fts_build_worker_record *type_r,
+		      const unsigned char **data_r, uint32_t *size_r)
+{
+	const unsigned char *data;
+	size_t size;
+	uint32_t rec_size;
+
+	if (i_stream_read_data(worker->input, &data, &size,
+			       FTS_BUILD_WORKER_RECORD_HDR_SIZE-1) <= 0)
+		return -1;
+	memcpy(&rec_size, data + 1, sizeof(rec_size));
+	if (i_stream_read_data(worker->input, &data, &size,
+			       FTS_BUILD_WORKER_RECORD_HDR_SIZE +
+			       rec_size - 1) <= 0)
+		return -1;
+
+	*type_r = data[0];
+	*data_r = data + FTS_BUILD_WORKER_RECORD_HDR_SIZE;
+	*size_r = rec_size;
+	/* the data stays valid until the next read */
+	i_stream_skip(worker->input,
+		      FTS_BUILD_WORKER_RECORD_HDR_SIZE + rec_size);
+	return 0;
+}
+
+static bool
+fts_build_worker_parse_key(const unsigned char *data, uint32_t size,
+			   struct fts_backend_build_key *key_r)
+{
+	const char **strings[3];
+	const unsigned char *end = data + size, *p;
+	uint8_t flags;
+	unsigned int i;
+
+	memset(key_r, 0, sizeof(*key_r));
+	if (size < sizeof(key_r->uid) + 2)
+		return FALSE;
+	memcpy(&key_r->uid, data, sizeof(key_r->uid));
+	data += sizeof(key_r->uid);
+	key_r->type = *data++;
+	flags = *data++;
+
+	strings[0] = &key_r->hdr_name;
+	strings[1] = &key_r->body_content_type;
+	strings[2] = &key_r->body_content_disposition;
+	for (i = 0; i < N_ELEMENTS(strings); i++) {
+		if ((flags & (1 << i)) == 0)
+			continue;
+		p = memchr(data, '\0', end - data);
+		if (p == NULL)
+			return FALSE;
+		*strings[i] = (const char *)data;
+		data = p + 1;
+	}
+	return TRUE;
+}
+
+static int
+fts_build_worker_read_mail(struct fts_build_worker *worker)
+{
+	struct fts_backend_build_key key;
+	enum fts_build_worker_record type;
+	const unsigned char *data;
+	uint32_t size;
+
+	/* read all of the mail's records before giving anything to the
+	   backend, so a worker dying in the middle of a mail doesn't leave
+	   it partially indexed */
+	buffer_set_used_size(worker->mail_records, 0);
+	do {
+		if (fts_build_worker_read(worker, &type, &data, &size) < 0)
+			return -1;
+
+		switch (type) {
+		case FTS_BUILD_WORKER_RECORD_KEY:
+			if (!fts_build_worker_parse_key(data, size, &key))
+				return -1;
+			break;
+		case FTS_BUILD_WORKER_RECORD_UNSET_KEY:
+		case FTS_BUILD_WORKER_RECORD_DATA:
+			break;
+		case FTS_BUILD_WORKER_RECORD_MAIL_END:
+			if (size != sizeof(int32_t))
+				return -1;
+			break;
+		default:
+			return -1;
+		}
+		fts_build_worker_record(worker->mail_records, type, size);
+		buffer_append(worker->mail_records, data, size);
+	} while (type != FTS_BUILD_WORKER_RECORD_MAIL_END);
+	return 0;
+}
+
+static int
+fts_build_worker_replay(struct fts_build_workers *workers,
+			const buffer_t *records)
+{
+	struct fts_backend_update_context *update_ctx = workers->update_ctx;
+	struct fts_backend_build_key key;
+	const unsigned char *p, *data, *end;
+	uint32_t size;
+	int32_t ret32;
+	int ret = 0;
+
+	/* the records were already verified while reading them */
+	p = records->data;
+	end = p + records->used;
+	while (p < end) {
+		memcpy(&size, p + 1, sizeof(size));
+		data = p + FTS_BUILD_WORKER_RECORD_HDR_SIZE;
+
+		switch ((enum fts_build_worker_record)p[0]) {
+		case FTS_BUILD_WORKER_RECORD_KEY:
+			(void)fts_build_worker_parse_key(data, size, &key);
+			(void)fts_backend_update_set_build_key(update_ctx, &key);
+			break;
+		case FTS_BUILD_WORKER_RECORD_UNSET_KEY:
+			fts_backend_update_unset_build_key(update_ctx);
+			break;
+		case FTS_BUILD_WORKER_RECORD_DATA:
+			/* skip data for keys that backend didn't want */
+			if (update_ctx->build_key_open &&
+			    fts_backend_update_build_more(update_ctx,
+							  data, size) < 0)
+				ret = -1;
+			break;
+		case FTS_BUILD_WORKER_RECORD_MAIL_END:
+			memcpy(&ret32, data, sizeof(ret32));
+			return ret < 0 ? -1 : ret32;
+		default:
+			i_unreached();
+		}
+		p = data + size;
+	}
+	i_unreached();
+}
+
+int fts_build_workers_mail(struct fts_build_workers *workers,
+			   struct mail *mail)
+{
+	struct fts_build_worker *worker;
+	enum fts_build_worker_record type;
+	const unsigned char *data;
+	uint32_t size, idx;
+
+	if (mail->seq < workers->seq1 || mail->seq > workers->seq2)
+		return fts_build_mail(workers->update_ctx, mail);
+	idx = (mail->seq - workers->seq1) % workers->step;
+	if (idx >= array_count(&workers->workers))
+		return fts_build_mail(workers->update_ctx, mail);
+	worker = array_idx_modifiable(&workers->workers, idx);
+
+	/* find the mail from the worker's output. mails that the caller
+	   skipped are ignored. */
+	while (!worker->failed && worker->next_seq < mail->seq) {
+		if (fts_build_worker_read(worker, &type, &data, &size) < 0)
+			fts_build_worker_failed(workers, worker);
+		else if (type == FTS_BUILD_WORKER_RECORD_MAIL &&
+			 size == sizeof(worker->next_seq))
+			memcpy(&worker->next_seq, data, size);
+	}
+	if (worker->failed || worker->next_seq != mail->seq)
+		return fts_build_mail(workers->update_ctx, mail);
+
+	worker->next_seq = 0;
+	if (fts_build_worker_read_mail(worker) < 0) {
+		/* nothing was given to the backend yet, so this mail and
+		   the rest of the worker's mails are built by us */
+		fts_build_worker_failed(workers, worker);
+		return fts_build_mail(workers->update_ctx, mail);
+	}
+	return fts_build_worker_replay(workers, worker->mail_records);
+}
@@ -1,7 +1,22 @@
 #ifndef FTS_BUILD_MAIL_H
 #define FTS_BUILD_MAIL_H
 
+struct mailbox_transaction_context;
+
 int fts_build_mail(struct fts_backend_update_context *update_ctx,
 		   struct mail *mail);
 
+/* Parse and decode the mails seq1..seq2 in count forked worker processes.
+   The results are sent to update_ctx by fts_build_workers_mail(), so the
+   backend is still updated only by this process. */
+struct fts_build_workers *
+fts_build_workers_init(struct mailbox_transaction_context *trans,
+		       struct fts_backend_update_context *update_ctx,
+		       uint32_t seq1, uint32_t seq2, unsigned int count);
+void fts_build_workers_deinit(struct fts_build_workers **workers);
+/* Same as fts_build_mail(), but use the mail built by a worker if it's
+   available. Mails are expected in ascending order. */
+int fts_build_workers_mail(struct fts_build_workers *workers,
+			   struct mail *mail);
+
 #endif
@@ -29,6 +29,9 @@
 #define INDEXER_SOCKET_NAME "indexer"
 #define INDEXER_HANDSHAKE "VERSION\tindexer\t1\t0\n"
 
+/* Use fts_index_workers only when indexing at least this many mails */
+#define FTS_BUILD_WORKERS_MIN_MESSAGES 100
+
 struct fts_mailbox_list {
 	union mailbox_list_module_context module_ctx;
 	struct fts_backend *backend;
@@ -46,6 +49,7 @@ struct fts_transaction_context {
 	union mailbox_transaction_module_context module_ctx;
 
 	struct fts_scores *scores;
+	struct fts_build_workers *build_workers;
 	uint32_t next_index_seq;
 	uint32_t highest_virtual_uid;
 
@@ -373,6 +377,16 @@ static int fts_mail_get_special(struct mail *_mail, enum mail_fetch_field field,
 	return fmail->module_ctx.super.get_special(_mail, field, value_r);
 }
 
+static int
+fts_mail_build(struct mail *mail, struct fts_backend_update_context *update_ctx)
+{
+	struct fts_transaction_context *ft = FTS_CONTEXT(mail->transaction);
+
+	if (ft->build_workers != NULL)
+		return fts_build_workers_mail(ft->build_workers, mail);
+	return fts_build_mail(update_ctx, mail);
+}
+
 static int
 fts_mail_precache_range(struct mailbox_transaction_context *trans,
 			struct fts_backend_update_context *update_ctx,
@@ -391,7 +405,7 @@ fts_mail_precache_range(struct mailbox_transaction_context *trans,
 	mail_search_args_unref(&search_args);
 
 	while (mailbox_search_next(ctx, &mail)) {
-		if (fts_build_mail(update_ctx, mail) < 0) {
+		if (fts_mail_build(mail, update_ctx) < 0) {
 			ret = -1;
 			break;
 		}
@@ -402,6 +416,33 @@ fts_mail_precache_range(struct mailbox_transaction_context *trans,
 	return ret;
 }
 
+static void
+fts_mail_build_workers_init(struct mailbox_transaction_context *t,
+			    struct fts_backend_update_context *update_ctx,
+			    uint32_t seq1)
+{
+	struct fts_transaction_context *ft = FTS_CONTEXT(t);
+	const char *value;
+	unsigned int count;
+	uint32_t seq2;
+
+	value = mail_user_plugin_getenv(t->box->storage->user,
+					"fts_index_workers");
+	if (value == NULL)
+		return;
+	if (str_to_uint(value, &count) < 0) {
+		i_error("Invalid fts_index_workers setting: %s", value);
+		return;
+	}
+
+	seq2 = mail_index_view_get_messages_count(t->view);
+	if (count == 0 || seq2 < seq1 ||
+	    seq2 - seq1 + 1 < FTS_BUILD_WORKERS_MIN_MESSAGES)
+		return;
+	ft->build_workers =
+		fts_build_workers_init(t, update_ctx, seq1, seq2, count);
+}
+
 static int fts_mail_precache_init(struct mail *_mail)
 {
 	struct fts_transaction_context *ft = FTS_CONTEXT(_mail->transaction);
@@ -416,6 +457,8 @@ static int fts_mail_precache_init(struct mail *_mail)
 	if (flist->update_ctx == NULL)
 		flist->update_ctx = fts_backend_update_init(flist->backend);
 	flist->update_ctx_refcount++;
+	fts_mail_build_workers_init(_mail->transaction, flist->update_ctx,
+				    ft->next_index_seq);
 	return 0;
 }
 
@@ -448,7 +491,7 @@ static void fts_mail_index(struct mail *_mail)
 
 	if (ft->next_index_seq == _mail->seq) {
 		fts_backend_update_set_mailbox(flist->update_ctx, _mail->box);
-		if (fts_build_mail(flist->update_ctx, _mail) < 0)
+		if (fts_mail_build(_mail, flist->update_ctx) < 0)
 			ft->failed = TRUE;
 		ft->next_index_seq = _mail->seq + 1;
 	}
@@ -511,6 +554,8 @@ static int fts_transaction_end(struct mailbox_transaction_context *t)
 	struct fts_mailbox_list *flist = FTS_LIST_CONTEXT(t->box->list);
 	int ret = ft->failed ? -1 : 0;
 
+	if (ft->build_workers != NULL)
+		fts_build_workers_deinit(&ft->build_workers);
 	if (ft->precached) {
 		i_assert(flist->update_ctx_refcount > 0);
 		if (--flist->update_ctx_refcount == 0) {
@@ -0,0 +1,291 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "str.h"
+#include "unlink-directory.h"
+#include "master-service.h"
+#include "mail-storage-service.h"
+#include "mail-namespace.h"
+#include "mail-storage-private.h"
+#include "fts-api-private.h"
+#include "fts-build-mail.h"
+#include "test-common.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define TEST_HOME ".test-fts-build-mail"
+#define TEST_MAILS_COUNT 10
+/* this mail's worker dies after it has already sent a part of the mail */
+#define TEST_DIE_MAIL_SEQ 5
+#define TEST_DIE_HEADER_VALUE "die-in-worker"
+
+static struct mail_storage_service_ctx *test_storage_service;
+static string_t *test_output;
+static pid_t test_parent_pid;
+static bool test_die_in_worker;
+static unsigned int test_error_count;
+static failure_callback_t *test_orig_error_handler;
+
+static void ATTR_FORMAT(2, 0)
+test_count_error_handler(const struct failure_context *ctx ATTR_UNUSED,
+			 const char *format ATTR_UNUSED,
+			 va_list args ATTR_UNUSED)
+{
+	test_error_count++;
+}
+
+static int test_normalizer(const void *input, size_t size, buffer_t *dest)
+{
+	if (test_die_in_worker && getpid() != test_parent_pid &&
+	    size == strlen(TEST_DIE_HEADER_VALUE) &&
+	    memcmp(input, TEST_DIE_HEADER_VALUE, size) == 0)
+		_exit(1);
+	buffer_append(dest, input, size);
+	return 0;
+}
+
+static void
+test_backend_set_mailbox(struct fts_backend_update_context *ctx ATTR_UNUSED,
+			 struct mailbox *box ATTR_UNUSED)
+{
+}
+
+static bool
+test_backend_set_build_key(struct fts_backend_update_context *ctx ATTR_UNUSED,
+			   const struct fts_backend_build_key *key)
+{
+	str_printfa(test_output, "\nkey %u %d %s %s %s\n", key->uid, key->type,
+		    key->hdr_name == NULL ? "" : key->hdr_name,
+		    key->body_content_type == NULL ? "" :
+		    key->body_content_type,
+		    key->body_content_disposition == NULL ? "" :
+		    key->body_content_disposition);
+	return TRUE;
+}
+
+static void
+test_backend_unset_build_key(struct fts_backend_update_context *ctx ATTR_UNUSED)
+{
+	str_append(test_output, "\nunset\n");
+}
+
+static int
+test_backend_build_more(struct fts_backend_update_context *ctx ATTR_UNUSED,
+			const unsigned char *data, size_t size)
+{
+	str_append_n(test_output, data, size);
+	return 0;
+}
+
+static struct mail_user *
+test_user_init(struct mail_storage_service_user **service_user_r)
+{
+	struct mail_storage_service_input input;
+	struct mail_user *user;
+	const char *home, *userdb_fields[3], *error;
+	char cwd[PATH_MAX];
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+		i_fatal("getcwd() failed: %m");
+	home = t_strconcat(cwd, "/"TEST_HOME, NULL);
+	userdb_fields[0] = t_strconcat("home=", home, NULL);
+	userdb_fields[1] = t_strconcat("mail=sdbox:", home, "/mail", NULL);
+	userdb_fields[2] = NULL;
+
+	memset(&input, 0, sizeof(input));
+	input.username = "testuser";
+	input.no_userdb_lookup = TRUE;
+	input.userdb_fields = userdb_fields;
+	if (mail_storage_service_lookup_next(test_storage_service, &input,
+					     service_user_r, &user,
+					     &error) <= 0)
+		i_fatal("User lookup failed: %s", error);
+	return user;
+}
+
+static const char *test_mail_text(unsigned int i)
+{
+	string_t *str = t_str_new(1024);
+	unsigned int j;
+
+	str_printfa(str, "From: user%u@example.com\n"
+		    "Subject: mail %u\n"
+		    "MIME-Version: 1.0\n"
+		    "Content-Type: multipart/mixed; boundary=\"b\"\n\n"
+		    "--b\n\n", i, i);
+	/* large enough that the worker has to send it before the mail is
+	   finished */
+	for (j = 0; j < 1000; j++)
+		str_printfa(str, "line %u of mail %u's first part\n", j, i);
+	str_printfa(str, "--b\nX-Test: %s\n\nsecond part\n--b--\n",
+		    i == TEST_DIE_MAIL_SEQ ? TEST_DIE_HEADER_VALUE : "ok");
+	return str_c(str);
+}
+
+static void test_mails_save(struct mailbox *box)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	const char *text;
+	unsigned int i;
+	int ret;
+
+	trans = mailbox_transaction_begin(box,
+					  MAILBOX_TRANSACTION_FLAG_EXTERNAL);
+	for (i = 1; i <= TEST_MAILS_COUNT; i++) T_BEGIN {
+		text = test_mail_text(i);
+		input = i_stream_create_from_data(text, strlen(text));
+		save_ctx = mailbox_save_alloc(trans);
+		if (mailbox_save_begin(&save_ctx, input) < 0)
+			i_fatal("mailbox_save_begin() failed");
+		while ((ret = i_stream_read(input)) > 0 || ret == -2) {
+			if (mailbox_save_continue(save_ctx) < 0)
+				break;
+		}
+		if (mailbox_save_finish(&save_ctx) < 0)
+			i_fatal("mailbox_save_finish() failed");
+		i_stream_unref(&input);
+	} T_END;
+	if (mailbox_transaction_commit(&trans) < 0)
+		i_fatal("mailbox_transaction_commit() failed");
+	if (mailbox_sync(box, 0) < 0)
+		i_fatal("mailbox_sync() failed");
+}
+
+static const char *
+test_mails_build(struct fts_backend_update_context *update_ctx,
+		 struct mailbox *box, unsigned int worker_count)
+{
+	struct mailbox_transaction_context *trans;
+	struct fts_build_workers *workers = NULL;
+	struct mail *mail;
+	uint32_t seq;
+
+	/* the previous run's last key is left open */
+	fts_backend_update_unset_build_key(update_ctx);
+	str_truncate(test_output, 0);
+	trans = mailbox_transaction_begin(box, 0);
+	if (worker_count > 0) {
+		workers = fts_build_workers_init(trans, update_ctx, 1,
+						 TEST_MAILS_COUNT,
+						 worker_count);
+	}
+	mail = mail_alloc(trans, MAIL_FETCH_STREAM_HEADER |
+			  MAIL_FETCH_STREAM_BODY, NULL);
+	for (seq = 1; seq <= TEST_MAILS_COUNT; seq++) {
+		mail_set_seq(mail, seq);
+		if (workers == NULL)
+			test_assert(fts_build_mail(update_ctx, mail) > 0);
+		else
+			test_assert(fts_build_workers_mail(workers, mail) > 0);
+	}
+	mail_free(&mail);
+	if (workers != NULL)
+		fts_build_workers_deinit(&workers);
+	mailbox_transaction_rollback(&trans);
+	/* all the workers were waited for */
+	test_assert(waitpid(-1, NULL, WNOHANG) < 0 && errno == ECHILD);
+	return t_strdup(str_c(test_output));
+}
+
+static void test_fts_build_workers(void)
+{
+	struct mail_storage_service_user *service_user;
+	struct mail_user *user;
+	struct mail_namespace *ns;
+	struct mailbox *box;
+	struct fts_backend backend;
+	struct fts_backend_update_context update_ctx;
+	failure_callback_t *fatal, *info, *debug;
+	const char *expected;
+
+	test_begin("fts build workers");
+	user = test_user_init(&service_user);
+	ns = mail_namespace_find_inbox(user->namespaces);
+	box = mailbox_alloc(ns->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_mails_save(box);
+
+	memset(&backend, 0, sizeof(backend));
+	backend.name = "test";
+	backend.ns = ns;
+	backend.v.update_set_mailbox = test_backend_set_mailbox;
+	backend.v.update_set_build_key = test_backend_set_build_key;
+	backend.v.update_unset_build_key = test_backend_unset_build_key;
+	backend.v.update_build_more = test_backend_build_more;
+	memset(&update_ctx, 0, sizeof(update_ctx));
+	update_ctx.backend = &backend;
+	update_ctx.normalizer = test_normalizer;
+	fts_backend_update_set_mailbox(&update_ctx, box);
+
+	test_output = str_new(default_pool, 1024*64);
+	expected = test_mails_build(&update_ctx, box, 0);
+	test_assert(strstr(expected, "second part") != NULL);
+
+	/* the same mails are built by the workers */
+	test_assert(strcmp(test_mails_build(&update_ctx, box, 1),
+			   expected) == 0);
+	test_assert(strcmp(test_mails_build(&update_ctx, box, 3),
+			   expected) == 0);
+
+	/* a worker dying in the middle of a mail doesn't leave a partial
+	   mail to the backend. the rest of its mails are built by us. */
+	test_die_in_worker = TRUE;
+	i_get_failure_handlers(&fatal, &test_orig_error_handler, &info, &debug);
+	i_set_error_handler(test_count_error_handler);
+	test_error_count = 0;
+	test_assert(strcmp(test_mails_build(&update_ctx, box, 3),
+			   expected) == 0);
+	i_set_error_handler(test_orig_error_handler);
+	test_assert(test_error_count == 1);
+	test_die_in_worker = FALSE;
+
+	str_free(&test_output);
+	fts_backend_update_set_mailbox(&update_ctx, NULL);
+	mailbox_free(&box);
+	mail_user_unref(&user);
+	mail_storage_service_user_free(&service_user);
+	test_end();
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*test_functions[])(void) = {
+		test_fts_build_workers,
+		NULL
+	};
+	struct ioloop *ioloop;
+
+	master_service = master_service_init("test-fts-build-mail",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT,
+					     &argc, &argv, "");
+	master_service_init_finish(master_service);
+	test_storage_service =
+		mail_storage_service_init(master_service, NULL,
+			MAIL_STORAGE_SERVICE_FLAG_NO_RESTRICT_ACCESS |
+			MAIL_STORAGE_SERVICE_FLAG_NO_CHDIR |
+			MAIL_STORAGE_SERVICE_FLAG_NO_LOG_INIT |
+			MAIL_STORAGE_SERVICE_FLAG_NO_PLUGINS);
+	test_parent_pid = getpid();
+
+	(void)unlink_directory(TEST_HOME, TRUE);
+	if (mkdir(TEST_HOME, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_HOME);
+	ioloop = io_loop_create();
+	test_init();
+	test_run_funcs(test_functions);
+	io_loop_destroy(&ioloop);
+	(void)unlink_directory(TEST_HOME, TRUE);
+
+	mail_storage_service_deinit(&test_storage_service);
+	/* this deinitializes the lib also for the master service */
+	return test_deinit();
+}
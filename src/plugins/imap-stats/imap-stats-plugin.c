@@ -10,10 +10,12 @@
 #define IMAP_STATS_IMAP_CONTEXT(obj) \
 	MODULE_CONTEXT(obj, imap_stats_imap_module)
 
+#define IMAP_STATS_MAX_NAME_LEN 128
+
 struct stats_client_command {
 	union imap_module_context module_ctx;
 
-	unsigned int id;
+	uint32_t id;
 	bool continued;
 	struct mail_stats stats, pre_stats;
 	struct mailbox_transaction_stats pre_trans_stats;
@@ -54,7 +56,9 @@ static void stats_command_post(struct client_command_context *cmd)
 	struct stats_user *suser = STATS_USER_CONTEXT(cmd->client->user);
 	struct stats_client_command *scmd = IMAP_STATS_IMAP_CONTEXT(cmd);
 	struct mail_stats stats, pre_trans_stats, trans_stats;
-	unsigned int args_pos = 0;
+	uint8_t flags = 0;
+	size_t args_max_len;
+	buffer_t *stats_buf;
 	string_t *str;
 
 	if (scmd == NULL)
@@ -71,35 +75,30 @@ static void stats_command_post(struct client_command_context *cmd)
 	trans_stats.trans_stats = suser->session_stats.trans_stats;
 	mail_stats_add_diff(&scmd->stats, &pre_trans_stats, &trans_stats);
 
-	str = t_str_new(128);
-	str_append(str, "UPDATE-CMD\t");
-	str_append(str, guid_128_to_string(suser->session_guid));
+	stats_buf = buffer_create_dynamic(pool_datastack_create(), 256);
+	mail_stats_export_binary(stats_buf, &scmd->stats);
 
-	str_printfa(str, "\t%u\t", scmd->id);
+	str = t_str_new(256);
+	stats_record_init(str, STATS_RECORD_TYPE_UPDATE_CMD,
+			  suser->session_guid);
+	buffer_append(str, &scmd->id, sizeof(uint32_t));
 	if (cmd->state == CLIENT_COMMAND_STATE_DONE)
-		str_append_c(str, 'd');
+		flags |= STATS_RECORD_CMD_FLAG_DONE;
 	if (scmd->continued)
-		str_append_c(str, 'c');
-	else {
-		str_append_c(str, '\t');
-		str_append(str, cmd->name);
-		str_append_c(str, '\t');
-		args_pos = str_len(str);
-		if (cmd->args != NULL)
-			str_append(str, cmd->args);
+		flags |= STATS_RECORD_CMD_FLAG_CONTINUED;
+	buffer_append(str, &flags, sizeof(flags));
+	if (!scmd->continued) {
+		stats_record_append_str(str, cmd->name, IMAP_STATS_MAX_NAME_LEN);
+		/* truncate the args so the record fits into PIPE_BUF */
+		i_assert(str_len(str) + sizeof(uint16_t) + stats_buf->used <
+			 PIPE_BUF);
+		args_max_len = PIPE_BUF - str_len(str) - sizeof(uint16_t) -
+			stats_buf->used;
+		stats_record_append_str(str, cmd->args == NULL ? "" :
+					cmd->args, args_max_len);
 		scmd->continued = TRUE;
 	}
-
-	mail_stats_export(str, &scmd->stats);
-	str_append_c(str, '\n');
-
-	if (str_len(str) > PIPE_BUF) {
-		/* truncate the args so it fits */
-		i_assert(args_pos != 0);
-		str_delete(str, args_pos, str_len(str) - PIPE_BUF);
-		i_assert(str_len(str) == PIPE_BUF);
-	}
-
+	buffer_append_buf(str, stats_buf, 0, (size_t)-1);
 	stats_connection_send(suser->stats_conn, str);
 }
 
@@ -0,0 +1,124 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "pop3-common.h"
+#include "str.h"
+#include "pop3-commands.h"
+#include "stats-plugin.h"
+#include "stats-connection.h"
+#include "pop3-stats-plugin.h"
+
+#define POP3_STATS_POP3_CONTEXT(obj) \
+	MODULE_CONTEXT(obj, pop3_stats_pop3_module)
+
+#define POP3_STATS_MAX_NAME_LEN 128
+
+struct stats_client_command {
+	union pop3_module_context module_ctx;
+
+	uint32_t id;
+	bool running;
+	bool continued;
+	struct mail_stats stats, pre_stats;
+	struct mailbox_transaction_stats pre_trans_stats;
+};
+
+static MODULE_CONTEXT_DEFINE_INIT(pop3_stats_pop3_module,
+				  &pop3_module_register);
+
+const char *pop3_stats_plugin_version = DOVECOT_ABI_VERSION;
+
+static void stats_command_pre(struct client *client, const char *name,
+			      const char *args ATTR_UNUSED)
+{
+	struct stats_user *suser = STATS_USER_CONTEXT(client->user);
+	struct stats_client_command *scmd;
+	static unsigned int stats_cmd_id_counter = 0;
+
+	if (suser == NULL || !suser->track_commands)
+		return;
+
+	/* there's only one command running at a time, so the same context
+	   is reused for all of the client's commands */
+	scmd = POP3_STATS_POP3_CONTEXT(client);
+	if (scmd == NULL) {
+		scmd = p_new(client->pool, struct stats_client_command, 1);
+		MODULE_CONTEXT_SET(client, pop3_stats_pop3_module, scmd);
+	}
+	if (name != NULL) {
+		scmd->id = ++stats_cmd_id_counter;
+		scmd->running = TRUE;
+		scmd->continued = FALSE;
+		memset(&scmd->stats, 0, sizeof(scmd->stats));
+	} else if (!scmd->running) {
+		return;
+	}
+	mail_stats_get(suser, &scmd->pre_stats);
+	scmd->pre_trans_stats = suser->session_stats.trans_stats;
+}
+
+static void stats_command_post(struct client *client, const char *name,
+			       const char *args)
+{
+	struct stats_user *suser = STATS_USER_CONTEXT(client->user);
+	struct stats_client_command *scmd = POP3_STATS_POP3_CONTEXT(client);
+	struct mail_stats stats, pre_trans_stats, trans_stats;
+	uint8_t flags = 0;
+	size_t args_max_len;
+	buffer_t *stats_buf;
+	string_t *str;
+
+	if (scmd == NULL || !scmd->running)
+		return;
+
+	mail_stats_get(suser, &stats);
+	mail_stats_add_diff(&scmd->stats, &scmd->pre_stats, &stats);
+
+	/* mail_stats_get() can't see the transactions that already went
+	   away, so we'll need to use the session's stats difference */
+	memset(&pre_trans_stats, 0, sizeof(pre_trans_stats));
+	memset(&trans_stats, 0, sizeof(trans_stats));
+	pre_trans_stats.trans_stats = scmd->pre_trans_stats;
+	trans_stats.trans_stats = suser->session_stats.trans_stats;
+	mail_stats_add_diff(&scmd->stats, &pre_trans_stats, &trans_stats);
+
+	stats_buf = buffer_create_dynamic(pool_datastack_create(), 256);
+	mail_stats_export_binary(stats_buf, &scmd->stats);
+
+	str = t_str_new(256);
+	stats_record_init(str, STATS_RECORD_TYPE_UPDATE_CMD,
+			  suser->session_guid);
+	buffer_append(str, &scmd->id, sizeof(uint32_t));
+	if (client->cmd == NULL) {
+		flags |= STATS_RECORD_CMD_FLAG_DONE;
+		scmd->running = FALSE;
+	}
+	if (scmd->continued)
+		flags |= STATS_RECORD_CMD_FLAG_CONTINUED;
+	buffer_append(str, &flags, sizeof(flags));
+	if (!scmd->continued) {
+		i_assert(name != NULL);
+		stats_record_append_str(str, name, POP3_STATS_MAX_NAME_LEN);
+		/* truncate the args so the record fits into PIPE_BUF */
+		i_assert(str_len(str) + sizeof(uint16_t) + stats_buf->used <
+			 PIPE_BUF);
+		args_max_len = PIPE_BUF - str_len(str) - sizeof(uint16_t) -
+			stats_buf->used;
+		stats_record_append_str(str, args, args_max_len);
+		scmd->continued = TRUE;
+	}
+	buffer_append_buf(str, stats_buf, 0, (size_t)-1);
+	stats_connection_send(suser->stats_conn, str);
+}
+
+void pop3_stats_plugin_init(struct module *module ATTR_UNUSED)
+{
+	command_hook_register(stats_command_pre, stats_command_post);
+}
+
+void pop3_stats_plugin_deinit(void)
+{
+	command_hook_unregister(stats_command_pre, stats_command_post);
+}
+
+const char *pop3_stats_plugin_dependencies[] = { "stats", NULL };
+const char pop3_stats_plugin_binary_dependency[] = "pop3";
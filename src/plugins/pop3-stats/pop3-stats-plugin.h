@@ -0,0 +1,12 @@
+#ifndef POP3_STATS_PLUGIN_H
+#define POP3_STATS_PLUGIN_H
+
+struct module;
+
+extern const char *pop3_stats_plugin_dependencies[];
+extern const char pop3_stats_plugin_binary_dependency[];
+
+void pop3_stats_plugin_init(struct module *module);
+void pop3_stats_plugin_deinit(void);
+
+#endif
@@ -231,6 +231,7 @@ static int pop3_uidl_proxy_get_special(struct mail *_mail, enum mail_fetch_field
 	/* sqlite handling */
 	sqlite3 		*conn;
 	sqlite3_stmt    *res;
+	sqlite3_stmt    *map_stmt;
 	int     		error = 0;
 	int     		rec_count = 0;
 	const char      *errMSG;
@@ -311,40 +312,28 @@ static int pop3_uidl_proxy_get_special(struct mail *_mail, enum mail_fetch_field
 			i_debug("%u: pop3_map[%u].pop3_uidl: %s", i, i, pop3_map[i].pop3_uidl);
 		}	
 	    
-	    for (i = 0; i < count; i++) {
-			string_t *query = t_str_new(256);
-			str_append(query, "SELECT cuidl FROM mapping ");                    
-			str_append(query, "WHERE ");
-			str_printfa(query, "zuidl = '%s'", pop3_map[i].pop3_uidl);   
-
-			error = sqlite3_prepare_v2(conn, str_c(query), 1000, &res, &tail);
-
-	    	// WORKING
-	    	// error = sqlite3_prepare_v2(conn,
-	    	// 	"SELECT cuidl FROM mapping WHERE zuidl = '262.AdilAtzDMypFIP1Snde,Q2u1aMkA2yjjZVCstCY5Fbc='", 1000, &res, &tail);
-
-	 		// i_debug("pop3_uidl: %s", pop3_map[i].pop3_uidl);
- 			
- 			// sprintf(sqlquery, "SELECT cuidl FROM mapping WHERE zuidl = '%s'\0", );
-
-			
-			// error = sqlite3_prepare_v2(conn,
-			//	sqlquery, 1000, &res, &tail);
-
-
-	    	if (error != SQLITE_OK) {
-	    		i_debug("We did not get any data!");
-	    		// sqlite3_finalize(res);
-	    		// sqlite3_close(conn);
-	    	}
-
-	    	while (sqlite3_step(res) == SQLITE_ROW) {
+	    /* prepare the mapping lookup only once and bind each UIDL to it,
+	       instead of building and parsing a new query for every message */
+	    error = sqlite3_prepare_v2(conn,
+		    "SELECT cuidl FROM mapping WHERE zuidl = ?", -1, &map_stmt, NULL);
+	    if (error != SQLITE_OK) {
+		    i_debug("We did not get any data!");
+		    map_stmt = NULL;
+	    }
+
+	    for (i = 0; i < count && map_stmt != NULL; i++) {
+			sqlite3_reset(map_stmt);
+			sqlite3_bind_text(map_stmt, 1, pop3_map[i].pop3_uidl, -1,
+					  SQLITE_STATIC);
+
+	    	while (sqlite3_step(map_stmt) == SQLITE_ROW) {
 	    		i_debug("SQLite DB has a mapping");   			    			
-	    		i_debug("%s", sqlite3_column_text(res, 0));   			    			
-				strcpy(msg, (char*) sqlite3_column_text(res, 0));
+	    		i_debug("%s", sqlite3_column_text(map_stmt, 0));
+				strcpy(msg, (char*) sqlite3_column_text(map_stmt, 0));
 	    		i_debug("pop3_uidl_proxy_get_special field %u value %s", field, msg);	    		
 	    	}		
 	    }	
+	    sqlite3_finalize(map_stmt);
 
 	    i_debug("pop3_uidl_proxy_get_special field %u value %s", field, msg);
 
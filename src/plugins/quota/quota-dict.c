@@ -1,7 +1,9 @@
 /* Copyright (c) 2005-2014 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
 #include "str.h"
+#include "time-util.h"
 #include "dict.h"
 #include "mail-user.h"
 #include "mail-namespace.h"
@@ -13,9 +15,23 @@
 #define DICT_QUOTA_CURRENT_BYTES_PATH DICT_QUOTA_CURRENT_PATH"storage"
 #define DICT_QUOTA_CURRENT_COUNT_PATH DICT_QUOTA_CURRENT_PATH"messages"
 
+struct dict_quota_value {
+	/* 1 if found, 0 if not found, -1 if lookup failed */
+	int ret;
+	long long value;
+};
+
 struct dict_quota_root {
 	struct quota_root root;
 	struct dict *dict;
+
+	/* both resources are looked up at once. the one that wasn't asked
+	   for is used by the next get_resource() call, if it happens during
+	   the same ioloop run and quota wasn't updated before it. */
+	struct dict_quota_value prefetched;
+	struct timeval prefetch_time;
+	unsigned int prefetched_bytes:1;
+	unsigned int prefetch_valid:1;
 };
 
 extern struct quota_backend quota_backend_dict;
@@ -113,6 +129,7 @@ dict_quota_count(struct dict_quota_root *root,
 	struct dict_transaction_context *dt;
 	uint64_t bytes, count;
 
+	root->prefetch_valid = FALSE;
 	if (quota_count(&root->root, &bytes, &count) < 0)
 		return -1;
 
@@ -131,13 +148,56 @@ dict_quota_count(struct dict_quota_root *root,
 	return 1;
 }
 
+static void
+dict_quota_lookup(struct dict_quota_root *root, bool want_bytes,
+		  struct dict_quota_value *value_r)
+{
+	static const char *keys[] = {
+		DICT_QUOTA_CURRENT_BYTES_PATH,
+		DICT_QUOTA_CURRENT_COUNT_PATH,
+		NULL
+	};
+	struct dict_quota_value values[2];
+	const char *strvalues[2];
+	unsigned int i;
+	int ret;
+
+	if (root->prefetch_valid && root->prefetched_bytes == want_bytes &&
+	    timeval_cmp(&root->prefetch_time, &ioloop_timeval) == 0) {
+		root->prefetch_valid = FALSE;
+		*value_r = root->prefetched;
+		return;
+	}
+
+	/* both values are looked up with one roundtrip with drivers that
+	   support it */
+	T_BEGIN {
+		ret = dict_lookup_multi(root->dict, pool_datastack_create(),
+					keys, strvalues);
+		for (i = 0; i < N_ELEMENTS(values); i++) {
+			if (ret < 0)
+				values[i].ret = -1;
+			else
+				values[i].ret = strvalues[i] != NULL ? 1 : 0;
+			values[i].value = values[i].ret <= 0 ? -1 :
+				strtoll(strvalues[i], NULL, 10);
+		}
+	} T_END;
+
+	*value_r = values[want_bytes ? 0 : 1];
+	root->prefetched = values[want_bytes ? 1 : 0];
+	root->prefetched_bytes = !want_bytes;
+	root->prefetch_time = ioloop_timeval;
+	root->prefetch_valid = TRUE;
+}
+
 static int
 dict_quota_get_resource(struct quota_root *_root,
 			const char *name, uint64_t *value_r)
 {
 	struct dict_quota_root *root = (struct dict_quota_root *)_root;
+	struct dict_quota_value value;
 	bool want_bytes;
-	int ret;
 
 	if (strcmp(name, QUOTA_NAME_STORAGE_BYTES) == 0)
 		want_bytes = TRUE;
@@ -146,29 +206,16 @@ dict_quota_get_resource(struct quota_root *_root,
 	else
 		return 0;
 
-	T_BEGIN {
-		const char *value;
-
-		ret = dict_lookup(root->dict, unsafe_data_stack_pool,
-				  want_bytes ? DICT_QUOTA_CURRENT_BYTES_PATH :
-				  DICT_QUOTA_CURRENT_COUNT_PATH, &value);
-		if (ret < 0)
-			*value_r = 0;
-		else {
-			long long tmp;
-
-			/* recalculate quota if it's negative or if it
-			   wasn't found */
-			tmp = ret == 0 ? -1 : strtoll(value, NULL, 10);
-			if (tmp >= 0)
-				*value_r = tmp;
-			else {
-				ret = dict_quota_count(root, want_bytes,
-						       value_r);
-			}
-		}
-	} T_END;
-	return ret;
+	dict_quota_lookup(root, want_bytes, &value);
+	if (value.ret < 0) {
+		*value_r = 0;
+		return -1;
+	}
+	/* recalculate quota if it's negative or if it wasn't found */
+	if (value.value < 0)
+		return dict_quota_count(root, want_bytes, value_r);
+	*value_r = value.value;
+	return 1;
 }
 
 static void dict_quota_update_callback(int ret, void *context)
@@ -192,6 +239,7 @@ dict_quota_update(struct quota_root *_root,
 	struct dict_transaction_context *dt;
 	uint64_t value;
 
+	root->prefetch_valid = FALSE;
 	if (ctx->recalculate) {
 		if (dict_quota_count(root, TRUE, &value) < 0)
 			return -1;
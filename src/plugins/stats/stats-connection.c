@@ -1,6 +1,8 @@
 /* Copyright (c) 2011-2014 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
+#include "buffer.h"
 #include "hostpid.h"
 #include "net.h"
 #include "str.h"
@@ -10,12 +12,22 @@
 #include "stats-plugin.h"
 #include "stats-connection.h"
 
+/* Pending updates are written to the FIFO after this many milliseconds */
+#define STATS_CONNECTION_FLUSH_MSECS 500
+
 struct stats_connection {
 	int refcount;
 
 	int fd;
 	char *path;
 
+	/* Updates waiting to be written. They're written with a single
+	   write() of max. PIPE_BUF bytes, which is atomic so different
+	   processes' updates don't get mixed together. */
+	buffer_t *pending;
+	struct ioloop *ioloop;
+	struct timeout *to_flush;
+
 	bool open_failed;
 };
 
@@ -41,6 +53,8 @@ stats_connection_create(const char *path)
 	conn = i_new(struct stats_connection, 1);
 	conn->refcount = 1;
 	conn->path = i_strdup(path);
+	conn->pending = buffer_create_dynamic(default_pool, PIPE_BUF);
+	conn->ioloop = current_ioloop;
 	(void)stats_connection_open(conn);
 	return conn;
 }
@@ -59,6 +73,8 @@ void stats_connection_unref(struct stats_connection **_conn)
 		return;
 
 	*_conn = NULL;
+	stats_connection_flush(conn);
+	buffer_free(&conn->pending);
 	if (conn->fd != -1) {
 		if (close(conn->fd) < 0)
 			i_error("close(%s) failed: %m", conn->path);
@@ -67,9 +83,10 @@ void stats_connection_unref(struct stats_connection **_conn)
 	i_free(conn);
 }
 
-void stats_connection_send(struct stats_connection *conn, const string_t *str)
+static void
+stats_connection_write(struct stats_connection *conn,
+		       const void *data, size_t size)
 {
-	static bool pipe_warned = FALSE;
 	ssize_t ret;
 
 	/* if master process has been stopped (and restarted), don't even try
@@ -83,21 +100,14 @@ void stats_connection_send(struct stats_connection *conn, const string_t *str)
 			return;
 	}
 
-	if (str_len(str) > PIPE_BUF && !pipe_warned) {
-		i_warning("stats update sent more bytes that PIPE_BUF "
-			  "(%"PRIuSIZE_T" > %u), this may break statistics",
-			  str_len(str), (unsigned int)PIPE_BUF);
-		pipe_warned = TRUE;
-	}
-
-	ret = write(conn->fd, str_data(str), str_len(str));
-	if (ret != (ssize_t)str_len(str)) {
+	ret = write(conn->fd, data, size);
+	if (ret != (ssize_t)size) {
 		if (ret < 0) {
 			/* don't log EPIPE errors. they can happen when
 			   Dovecot is stopped. */
 			if (errno != EPIPE)
 				i_error("write(%s) failed: %m", conn->path);
-		} else if ((size_t)ret != str_len(str))
+		} else if ((size_t)ret != size)
 			i_error("write(%s) wrote partial update", conn->path);
 		if (close(conn->fd) < 0)
 			i_error("close(%s) failed: %m", conn->path);
@@ -105,6 +115,76 @@ void stats_connection_send(struct stats_connection *conn, const string_t *str)
 	}
 }
 
+void stats_connection_flush(struct stats_connection *conn)
+{
+	if (conn->to_flush != NULL)
+		timeout_remove(&conn->to_flush);
+	if (conn->pending->used > 0) {
+		stats_connection_write(conn, conn->pending->data,
+				       conn->pending->used);
+		buffer_set_used_size(conn->pending, 0);
+	}
+}
+
+void stats_connection_send(struct stats_connection *conn, string_t *str)
+{
+	static bool pipe_warned = FALSE;
+	uint16_t size;
+
+	if (str_len(str) > 0 && str_data(str)[0] == STATS_RECORD_MAGIC) {
+		/* finish the binary record */
+		i_assert(str_len(str) >= STATS_RECORD_HDR_SIZE &&
+			 str_len(str) <= (uint16_t)-1);
+		size = str_len(str);
+		buffer_write(str, 2, &size, sizeof(size));
+	}
+
+	if (str_len(str) > PIPE_BUF && !pipe_warned) {
+		i_warning("stats update sent more bytes that PIPE_BUF "
+			  "(%"PRIuSIZE_T" > %u), this may break statistics",
+			  str_len(str), (unsigned int)PIPE_BUF);
+		pipe_warned = TRUE;
+	}
+
+	if (conn->pending->used + str_len(str) > PIPE_BUF)
+		stats_connection_flush(conn);
+	if (current_ioloop != conn->ioloop || str_len(str) > PIPE_BUF) {
+		/* we can't leave a timeout to a temporary ioloop */
+		stats_connection_flush(conn);
+		stats_connection_write(conn, str_data(str), str_len(str));
+		return;
+	}
+
+	buffer_append_buf(conn->pending, str, 0, (size_t)-1);
+	if (conn->to_flush == NULL) {
+		conn->to_flush = timeout_add_short(STATS_CONNECTION_FLUSH_MSECS,
+						   stats_connection_flush, conn);
+	}
+}
+
+void stats_record_init(string_t *str, enum stats_record_type type,
+		       const guid_128_t session_guid)
+{
+	uint8_t hdr[STATS_RECORD_HDR_SIZE];
+
+	/* the size is filled by stats_connection_send() */
+	memset(hdr, 0, sizeof(hdr));
+	hdr[0] = STATS_RECORD_MAGIC;
+	hdr[1] = type;
+	buffer_append(str, hdr, sizeof(hdr));
+	buffer_append(str, session_guid, GUID_128_SIZE);
+}
+
+void stats_record_append_str(string_t *str, const char *value,
+			     size_t max_len)
+{
+	uint16_t len;
+
+	len = I_MIN(strlen(value), I_MIN(max_len, (uint16_t)-1));
+	buffer_append(str, &len, sizeof(len));
+	buffer_append(str, value, len);
+}
+
 void stats_connection_connect(struct stats_connection *conn,
 			      struct mail_user *user)
 {
@@ -143,6 +223,8 @@ void stats_connection_disconnect(struct stats_connection *conn,
 	str_append(str, guid_128_to_string(suser->session_guid));
 	str_append_c(str, '\n');
 	stats_connection_send(conn, str);
+	/* the process may be about to exit */
+	stats_connection_flush(conn);
 }
 
 void stats_connection_send_session(struct stats_connection *conn,
@@ -150,13 +232,10 @@ void stats_connection_send_session(struct stats_connection *conn,
 				   const struct mail_stats *stats)
 {
 	struct stats_user *suser = STATS_USER_CONTEXT(user);
-	string_t *str = t_str_new(128);
-
-	str_append(str, "UPDATE-SESSION\t");
-	str_append(str, guid_128_to_string(suser->session_guid));
+	string_t *str = t_str_new(256);
 
-	mail_stats_export(str, stats);
-
-	str_append_c(str, '\n');
+	stats_record_init(str, STATS_RECORD_TYPE_UPDATE_SESSION,
+			  suser->session_guid);
+	mail_stats_export_binary(str, stats);
 	stats_connection_send(conn, str);
 }
@@ -1,9 +1,35 @@
 #ifndef STATS_CONNECTION_H
 #define STATS_CONNECTION_H
 
+#include "guid.h"
+
 struct mail_stats;
 struct mail_user;
 
+/* Frequent updates are sent as binary records, which the stats process
+   can handle without parsing text:
+
+   uint8_t STATS_RECORD_MAGIC, uint8_t type, uint16_t record size,
+   16 bytes session GUID, type-specific fields, mail stats.
+
+   UPDATE-CMD has uint32_t command id, uint8_t flags and for new commands
+   name and args strings. Strings are uint16_t length + data. Mail stats are
+   uint16_t count + count * uint64_t values in the same order as the text
+   fields, with timevals as microseconds. Integers are in host byte order.
+   The stats process must be kept in sync with this. */
+#define STATS_RECORD_MAGIC 0x01
+#define STATS_RECORD_HDR_SIZE 4
+
+enum stats_record_type {
+	STATS_RECORD_TYPE_UPDATE_SESSION = 1,
+	STATS_RECORD_TYPE_UPDATE_CMD
+};
+
+enum stats_record_cmd_flags {
+	STATS_RECORD_CMD_FLAG_DONE	= 0x01,
+	STATS_RECORD_CMD_FLAG_CONTINUED	= 0x02
+};
+
 struct stats_connection *stats_connection_create(const char *path);
 void stats_connection_ref(struct stats_connection *conn);
 void stats_connection_unref(struct stats_connection **conn);
@@ -16,6 +42,17 @@ void stats_connection_disconnect(struct stats_connection *conn,
 void stats_connection_send_session(struct stats_connection *conn,
 				   struct mail_user *user,
 				   const struct mail_stats *stats);
-void stats_connection_send(struct stats_connection *conn, const string_t *str);
+/* Queue a text line or a binary record to be sent to the stats process.
+   The pending updates are sent after a short delay. */
+void stats_connection_send(struct stats_connection *conn, string_t *str);
+/* Send all the pending updates now. */
+void stats_connection_flush(struct stats_connection *conn);
+
+/* Start a binary record. It's finished by stats_connection_send(). */
+void stats_record_init(string_t *str, enum stats_record_type type,
+		       const guid_128_t session_guid);
+/* Append a string to a binary record, truncated to max_len bytes. */
+void stats_record_append_str(string_t *str, const char *value,
+			     size_t max_len);
 
 #endif
@@ -22,6 +22,11 @@
 #define MAIL_STATS_SOCKET_NAME "stats-mail"
 #define PROC_IO_PATH "/proc/self/io"
 
+/* text field prefixes for mail_index_io_stats[] types */
+static const char *stats_index_io_names[MAIL_INDEX_IO_TYPE_COUNT] = {
+	"idx", "log", "cache", "bidx", "lock"
+};
+
 #define USECS_PER_SEC 1000000
 
 struct stats_transaction_context {
@@ -68,6 +73,7 @@ static void trans_stats_dec(struct mailbox_transaction_stats *dest,
 	dest->fstat_lookup_count -= src->fstat_lookup_count;
 	dest->files_read_count -= src->files_read_count;
 	dest->files_read_bytes -= src->files_read_bytes;
+	dest->files_read_usecs -= src->files_read_usecs;
 	dest->cache_hit_count -= src->cache_hit_count;
 }
 
@@ -79,6 +85,7 @@ static void trans_stats_add(struct mailbox_transaction_stats *dest,
 	dest->fstat_lookup_count += src->fstat_lookup_count;
 	dest->files_read_count += src->files_read_count;
 	dest->files_read_bytes += src->files_read_bytes;
+	dest->files_read_usecs += src->files_read_usecs;
 	dest->cache_hit_count += src->cache_hit_count;
 }
 
@@ -199,6 +206,8 @@ void mail_stats_get(struct stats_user *suser, struct mail_stats *stats_r)
 	(void)gettimeofday(&stats_r->clock_time, NULL);
 	process_read_io_stats(stats_r);
 	user_trans_stats_get(suser, &stats_r->trans_stats);
+	memcpy(stats_r->index_io, mail_index_io_stats,
+	       sizeof(stats_r->index_io));
 }
 
 static void stats_io_activate(void *context)
@@ -239,6 +248,8 @@ void mail_stats_add_diff(struct mail_stats *dest,
 			 const struct mail_stats *old_stats,
 			 const struct mail_stats *new_stats)
 {
+	unsigned int i;
+
 	dest->disk_input += new_stats->disk_input - old_stats->disk_input;
 	dest->disk_output += new_stats->disk_output - old_stats->disk_output;
 	dest->min_faults += new_stats->min_faults - old_stats->min_faults;
@@ -258,11 +269,24 @@ void mail_stats_add_diff(struct mail_stats *dest,
 			 &old_stats->clock_time);
 	trans_stats_dec(&dest->trans_stats, &old_stats->trans_stats);
 	trans_stats_add(&dest->trans_stats, &new_stats->trans_stats);
+
+	for (i = 0; i < MAIL_INDEX_IO_TYPE_COUNT; i++) {
+		dest->index_io[i].count +=
+			new_stats->index_io[i].count -
+			old_stats->index_io[i].count;
+		dest->index_io[i].bytes +=
+			new_stats->index_io[i].bytes -
+			old_stats->index_io[i].bytes;
+		dest->index_io[i].usecs +=
+			new_stats->index_io[i].usecs -
+			old_stats->index_io[i].usecs;
+	}
 }
 
 void mail_stats_export(string_t *str, const struct mail_stats *stats)
 {
 	const struct mailbox_transaction_stats *tstats = &stats->trans_stats;
+	unsigned int i;
 
 	str_printfa(str, "\tucpu=%ld.%ld", (long)stats->user_cpu.tv_sec,
 		    (long)stats->user_cpu.tv_usec);
@@ -291,6 +315,61 @@ void mail_stats_export(string_t *str, const struct mail_stats *stats)
 	str_printfa(str, "\tmrcount=%lu", tstats->files_read_count);
 	str_printfa(str, "\tmrbytes=%llu", tstats->files_read_bytes);
 	str_printfa(str, "\tmcache=%lu", tstats->cache_hit_count);
+	str_printfa(str, "\tmrtime=%llu.%06u",
+		    tstats->files_read_usecs / 1000000,
+		    (unsigned int)(tstats->files_read_usecs % 1000000));
+	for (i = 0; i < MAIL_INDEX_IO_TYPE_COUNT; i++) {
+		const struct mail_index_io_stat *io = &stats->index_io[i];
+		const char *name = stats_index_io_names[i];
+
+		str_printfa(str, "\t%scount=%lu\t%sbytes=%llu"
+			    "\t%stime=%llu.%06u", name, io->count,
+			    name, io->bytes, name, io->usecs / 1000000,
+			    (unsigned int)(io->usecs % 1000000));
+	}
+}
+
+static uint64_t stats_timeval_usecs(const struct timeval *tv)
+{
+	return (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+void mail_stats_export_binary(buffer_t *buf, const struct mail_stats *stats)
+{
+	const struct mailbox_transaction_stats *tstats = &stats->trans_stats;
+	uint64_t values[19 + MAIL_INDEX_IO_TYPE_COUNT*3];
+	uint16_t count = N_ELEMENTS(values);
+	unsigned int i, n = 19;
+
+	/* same order as in mail_stats_export() */
+	values[0] = stats_timeval_usecs(&stats->user_cpu);
+	values[1] = stats_timeval_usecs(&stats->sys_cpu);
+	values[2] = stats_timeval_usecs(&stats->clock_time);
+	values[3] = stats->min_faults;
+	values[4] = stats->maj_faults;
+	values[5] = stats->vol_cs;
+	values[6] = stats->invol_cs;
+	values[7] = stats->disk_input;
+	values[8] = stats->disk_output;
+	values[9] = stats->read_bytes;
+	values[10] = stats->write_bytes;
+	values[11] = stats->read_count;
+	values[12] = stats->write_count;
+	values[13] = tstats->open_lookup_count + tstats->stat_lookup_count;
+	values[14] = tstats->fstat_lookup_count + tstats->stat_lookup_count;
+	values[15] = tstats->files_read_count;
+	values[16] = tstats->files_read_bytes;
+	values[17] = tstats->cache_hit_count;
+	values[18] = tstats->files_read_usecs;
+	for (i = 0; i < MAIL_INDEX_IO_TYPE_COUNT; i++) {
+		values[n++] = stats->index_io[i].count;
+		values[n++] = stats->index_io[i].bytes;
+		values[n++] = stats->index_io[i].usecs;
+	}
+	i_assert(n == N_ELEMENTS(values));
+
+	buffer_append(buf, &count, sizeof(count));
+	buffer_append(buf, values, sizeof(values));
 }
 
 static void stats_add_session(struct mail_user *user)
@@ -310,7 +389,9 @@ static bool session_has_changed(const struct mail_stats *prev,
 	if (cur->disk_input != prev->disk_input ||
 	    cur->disk_output != prev->disk_output ||
 	    memcmp(&cur->trans_stats, &prev->trans_stats,
-		   sizeof(cur->trans_stats)) != 0)
+		   sizeof(cur->trans_stats)) != 0 ||
+	    memcmp(cur->index_io, prev->index_io,
+		   sizeof(cur->index_io)) != 0)
 		return TRUE;
 
 	/* allow a tiny bit of changes that are caused by this
@@ -26,6 +26,8 @@ struct mail_stats {
 	uint32_t read_count, write_count;
 	uint64_t read_bytes, write_bytes;
 	struct mailbox_transaction_stats trans_stats;
+	/* index file I/O and lock waits */
+	struct mail_index_io_stat index_io[MAIL_INDEX_IO_TYPE_COUNT];
 };
 
 struct stats_user {
@@ -62,6 +64,8 @@ void mail_stats_add_diff(struct mail_stats *dest,
 			 const struct mail_stats *old_stats,
 			 const struct mail_stats *new_stats);
 void mail_stats_export(string_t *str, const struct mail_stats *stats);
+/* Append the stats in the binary record format (see stats-connection.h) */
+void mail_stats_export_binary(buffer_t *buf, const struct mail_stats *stats);
 
 void stats_plugin_init(struct module *module);
 void stats_plugin_deinit(void);
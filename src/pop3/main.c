@@ -17,6 +17,7 @@
 #include "mail-error.h"
 #include "mail-user.h"
 #include "mail-storage-service.h"
+#include "pop3-commands.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -255,6 +256,7 @@ int main(int argc, char *argv[])
 
 	master_service_set_die_callback(master_service, pop3_die);
 
+	commands_init();
 	storage_service =
 		mail_storage_service_init(master_service,
 					  set_roots, storage_service_flags);
@@ -280,6 +282,7 @@ int main(int argc, char *argv[])
 	if (master_login != NULL)
 		master_login_deinit(&master_login);
 	mail_storage_service_deinit(&storage_service);
+	commands_deinit();
 	master_service_deinit(&master_service);
 	return 0;
 }
@@ -581,7 +581,7 @@ static void client_default_destroy(struct client *client, const char *reason)
 		/* deinitialize command */
 		i_stream_close(client->input);
 		o_stream_close(client->output);
-		client->cmd(client);
+		client_command_continue(client);
 		i_assert(client->cmd == NULL);
 	}
 	pop3_client_count--;
@@ -806,7 +806,7 @@ static int client_output(struct client *client)
 		timeout_reset(client->to_commit);
 
 	if (client->cmd != NULL)
-		client->cmd(client);
+		client_command_continue(client);
 
 	if (client->cmd == NULL) {
 		if (o_stream_get_buffer_used_size(client->output) <
@@ -14,6 +14,15 @@
 #include "pop3-capability.h"
 #include "pop3-commands.h"
 
+typedef int pop3_command_func_t(struct client *client, const char *args);
+
+struct command_hook {
+	command_hook_callback_t *pre;
+	command_hook_callback_t *post;
+};
+
+static ARRAY(struct command_hook) command_hooks;
+
 static enum mail_sort_type pop3_sort_program[] = {
 	MAIL_SORT_POP3_ORDER,
 	MAIL_SORT_END
@@ -888,57 +897,123 @@ static int cmd_uidl(struct client *client, const char *args)
 	return 1;
 }
 
-int client_command_execute(struct client *client,
-			   const char *name, const char *args)
+static pop3_command_func_t *
+pop3_command_find(struct client *client, const char *name)
 {
-	/* keep the command uppercased */
-	name = t_str_ucase(name);
-
-	while (*args == ' ') args++;
-
 	switch (*name) {
 	case 'C':
 		if (strcmp(name, "CAPA") == 0)
-			return cmd_capa(client, args);
+			return cmd_capa;
 		break;
 	case 'D':
 		if (strcmp(name, "DELE") == 0)
-			return cmd_dele(client, args);
+			return cmd_dele;
 		break;
 	case 'L':
 		if (strcmp(name, "LIST") == 0)
-			return cmd_list(client, args);
+			return cmd_list;
 		if (strcmp(name, "LAST") == 0 && client->set->pop3_enable_last)
-			return cmd_last(client, args);
+			return cmd_last;
 		break;
 	case 'N':
 		if (strcmp(name, "NOOP") == 0)
-			return cmd_noop(client, args);
+			return cmd_noop;
 		break;
 	case 'Q':
 		if (strcmp(name, "QUIT") == 0)
-			return cmd_quit(client, args);
+			return cmd_quit;
 		break;
 	case 'R':
 		if (strcmp(name, "RETR") == 0)
-			return cmd_retr(client, args);
+			return cmd_retr;
 		if (strcmp(name, "RSET") == 0)
-			return cmd_rset(client, args);
+			return cmd_rset;
 		break;
 	case 'S':
 		if (strcmp(name, "STAT") == 0)
-			return cmd_stat(client, args);
+			return cmd_stat;
 		break;
 	case 'T':
 		if (strcmp(name, "TOP") == 0)
-			return cmd_top(client, args);
+			return cmd_top;
 		break;
 	case 'U':
 		if (strcmp(name, "UIDL") == 0)
-			return cmd_uidl(client, args);
+			return cmd_uidl;
 		break;
 	}
+	return NULL;
+}
 
-	client_send_line(client, "-ERR Unknown command: %s", name);
-	return -1;
+int client_command_execute(struct client *client,
+			   const char *name, const char *args)
+{
+	const struct command_hook *hook;
+	pop3_command_func_t *func;
+	int ret;
+
+	/* keep the command uppercased */
+	name = t_str_ucase(name);
+
+	while (*args == ' ') args++;
+
+	func = pop3_command_find(client, name);
+	if (func == NULL) {
+		client_send_line(client, "-ERR Unknown command: %s", name);
+		return -1;
+	}
+
+	array_foreach(&command_hooks, hook)
+		hook->pre(client, name, args);
+	ret = func(client, args);
+	array_foreach(&command_hooks, hook)
+		hook->post(client, name, args);
+	return ret;
+}
+
+void client_command_continue(struct client *client)
+{
+	const struct command_hook *hook;
+
+	array_foreach(&command_hooks, hook)
+		hook->pre(client, NULL, NULL);
+	client->cmd(client);
+	array_foreach(&command_hooks, hook)
+		hook->post(client, NULL, NULL);
+}
+
+void command_hook_register(command_hook_callback_t *pre,
+			   command_hook_callback_t *post)
+{
+	struct command_hook hook;
+
+	hook.pre = pre;
+	hook.post = post;
+	array_append(&command_hooks, &hook, 1);
+}
+
+void command_hook_unregister(command_hook_callback_t *pre,
+			     command_hook_callback_t *post)
+{
+	const struct command_hook *hooks;
+	unsigned int i, count;
+
+	hooks = array_get(&command_hooks, &count);
+	for (i = 0; i < count; i++) {
+		if (hooks[i].pre == pre && hooks[i].post == post) {
+			array_delete(&command_hooks, i, 1);
+			return;
+		}
+	}
+	i_panic("command_hook_unregister(): hook not registered");
+}
+
+void commands_init(void)
+{
+	i_array_init(&command_hooks, 4);
+}
+
+void commands_deinit(void)
+{
+	array_free(&command_hooks);
 }
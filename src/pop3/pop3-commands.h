@@ -1,7 +1,25 @@
 #ifndef POP3_COMMANDS_H
 #define POP3_COMMANDS_H
 
+struct client;
+
+/* name and args are NULL when a command that didn't finish yet is
+   continued. The command is finished when client->cmd is NULL after it. */
+typedef void command_hook_callback_t(struct client *client, const char *name,
+				     const char *args);
+
 int client_command_execute(struct client *client,
 			   const char *name, const char *args);
+/* Continue running client->cmd */
+void client_command_continue(struct client *client);
+
+/* Register hook callbacks that are called before and after all commands */
+void command_hook_register(command_hook_callback_t *pre,
+			   command_hook_callback_t *post);
+void command_hook_unregister(command_hook_callback_t *pre,
+			     command_hook_callback_t *post);
+
+void commands_init(void);
+void commands_deinit(void);
 
 #endif
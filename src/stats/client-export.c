@@ -20,10 +20,11 @@ enum mail_export_level {
 	MAIL_EXPORT_LEVEL_SESSION,
 	MAIL_EXPORT_LEVEL_USER,
 	MAIL_EXPORT_LEVEL_DOMAIN,
-	MAIL_EXPORT_LEVEL_IP
+	MAIL_EXPORT_LEVEL_IP,
+	MAIL_EXPORT_LEVEL_COMMAND_NAME
 };
 static const char *mail_export_level_names[] = {
-	"command", "session", "user", "domain", "ip"
+	"command", "session", "user", "domain", "ip", "cmdname"
 };
 
 struct mail_export_filter {
@@ -94,6 +95,12 @@ mail_export_parse_filter(const char *const *args, pool_t pool,
 	return 0;
 }
 
+static void client_export_timeval(string_t *str, const struct timeval *tv)
+{
+	str_printfa(str, "\t%ld.%06u", (long)tv->tv_sec,
+		    (unsigned int)tv->tv_usec);
+}
+
 static void
 client_export_mail_stats(string_t *str, const struct mail_stats *stats)
 {
@@ -102,7 +109,13 @@ client_export_mail_stats(string_t *str, const struct mail_stats *stats)
 	"\tdisk_input\tdisk_output" \
 	"\tread_count\tread_bytes\twrite_count\twrite_bytes" \
 	"\tmail_lookup_path\tmail_lookup_attr" \
-	"\tmail_read_count\tmail_read_bytes\tmail_cache_hits\n"
+	"\tmail_read_count\tmail_read_bytes\tmail_cache_hits" \
+	"\tmail_read_time" \
+	"\tindex_count\tindex_bytes\tindex_time" \
+	"\tlog_count\tlog_bytes\tlog_time" \
+	"\tcache_count\tcache_bytes\tcache_time" \
+	"\tbackend_index_count\tbackend_index_bytes\tbackend_index_time" \
+	"\tlock_count\tlock_time\n"
 
 	str_printfa(str, "\t%ld.%06u", (long)stats->user_cpu.tv_sec,
 		    (unsigned int)stats->user_cpu.tv_usec);
@@ -123,6 +136,61 @@ client_export_mail_stats(string_t *str, const struct mail_stats *stats)
 		    stats->mail_read_count,
 		    (unsigned long long)stats->mail_read_bytes,
 		    stats->mail_cache_hits);
+	client_export_timeval(str, &stats->mail_read_time);
+	str_printfa(str, "\t%u\t%llu", stats->index_count,
+		    (unsigned long long)stats->index_bytes);
+	client_export_timeval(str, &stats->index_time);
+	str_printfa(str, "\t%u\t%llu", stats->log_count,
+		    (unsigned long long)stats->log_bytes);
+	client_export_timeval(str, &stats->log_time);
+	str_printfa(str, "\t%u\t%llu", stats->cache_count,
+		    (unsigned long long)stats->cache_bytes);
+	client_export_timeval(str, &stats->cache_time);
+	str_printfa(str, "\t%u\t%llu", stats->bidx_count,
+		    (unsigned long long)stats->bidx_bytes);
+	client_export_timeval(str, &stats->bidx_time);
+	str_printfa(str, "\t%u", stats->lock_count);
+	client_export_timeval(str, &stats->lock_time);
+}
+
+static void
+client_export_latency(string_t *str, const struct mail_latency *latency)
+{
+#define MAIL_LATENCY_HEADER(prefix) \
+	"\t"prefix"_p50\t"prefix"_p90\t"prefix"_p99\t"prefix"_max" \
+	"\t"prefix"_histogram"
+	static const unsigned int percentiles[] = { 50, 90, 99 };
+	uint64_t usecs;
+	unsigned int i;
+	bool first = TRUE;
+
+	for (i = 0; i < N_ELEMENTS(percentiles); i++) {
+		usecs = mail_latency_percentile(latency, percentiles[i]);
+		str_printfa(str, "\t%llu.%06u",
+			    (unsigned long long)(usecs / 1000000),
+			    (unsigned int)(usecs % 1000000));
+	}
+	str_printfa(str, "\t%llu.%06u",
+		    (unsigned long long)(latency->max_usecs / 1000000),
+		    (unsigned int)(latency->max_usecs % 1000000));
+
+	/* <bucket max usecs>:<count>,... for non-empty buckets. the last
+	   bucket has no upper limit, so it's written as "inf". */
+	str_append_c(str, '\t');
+	for (i = 0; i < MAIL_LATENCY_BUCKET_COUNT; i++) {
+		if (latency->buckets[i] == 0)
+			continue;
+		if (!first)
+			str_append_c(str, ',');
+		first = FALSE;
+		if (i == MAIL_LATENCY_BUCKET_COUNT-1)
+			str_append(str, "inf");
+		else {
+			str_printfa(str, "%llu", (unsigned long long)
+				    mail_latency_bucket_max(i));
+		}
+		str_printfa(str, ":%u", latency->buckets[i]);
+	}
 }
 
 static bool
@@ -242,10 +310,13 @@ mail_export_filter_match_ip(const struct mail_export_filter *filter,
 	return TRUE;
 }
 
-static void client_export_timeval(string_t *str, const struct timeval *tv)
+static bool
+mail_export_filter_match_cmd_name(const struct mail_export_filter *filter,
+				  const struct mail_command_name *cmd_name)
 {
-	str_printfa(str, "\t%ld.%06u", (long)tv->tv_sec,
-		    (unsigned int)tv->tv_usec);
+	/* the commands aren't tracked by session, so only the since filter
+	   can be used */
+	return filter->since <= cmd_name->last_update.tv_sec;
 }
 
 static int client_export_iter_command(struct client *client)
@@ -360,7 +431,8 @@ static int client_export_iter_user(struct client *client)
 	if (!cmd->header_sent) {
 		o_stream_nsend_str(client->output,
 			"user\treset_timestamp\tlast_update"
-			"\tnum_logins\tnum_cmds"MAIL_STATS_HEADER);
+			"\tnum_logins\tnum_cmds"MAIL_LATENCY_HEADER("cmd")
+			MAIL_STATS_HEADER);
 		cmd->header_sent = TRUE;
 	}
 
@@ -376,6 +448,7 @@ static int client_export_iter_user(struct client *client)
 		client_export_timeval(cmd->str, &user->last_update);
 		str_printfa(cmd->str, "\t%u\t%u",
 			    user->num_logins, user->num_cmds);
+		client_export_latency(cmd->str, &user->cmd_latency);
 		client_export_mail_stats(cmd->str, &user->stats);
 		str_append_c(cmd->str, '\n');
 		o_stream_nsend(client->output, str_data(cmd->str),
@@ -401,7 +474,8 @@ static int client_export_iter_domain(struct client *client)
 	if (!cmd->header_sent) {
 		o_stream_nsend_str(client->output,
 			"domain\treset_timestamp\tlast_update"
-			"\tnum_logins\tnum_cmds"MAIL_STATS_HEADER);
+			"\tnum_logins\tnum_cmds"MAIL_LATENCY_HEADER("cmd")
+			MAIL_STATS_HEADER);
 		cmd->header_sent = TRUE;
 	}
 
@@ -417,6 +491,7 @@ static int client_export_iter_domain(struct client *client)
 		client_export_timeval(cmd->str, &domain->last_update);
 		str_printfa(cmd->str, "\t%u\t%u",
 			    domain->num_logins, domain->num_cmds);
+		client_export_latency(cmd->str, &domain->cmd_latency);
 		client_export_mail_stats(cmd->str, &domain->stats);
 		str_append_c(cmd->str, '\n');
 		o_stream_nsend(client->output, str_data(cmd->str),
@@ -442,7 +517,8 @@ static int client_export_iter_ip(struct client *client)
 	if (!cmd->header_sent) {
 		o_stream_nsend_str(client->output,
 			"ip\treset_timestamp\tlast_update"
-			"\tnum_logins\tnum_cmds"MAIL_STATS_HEADER);
+			"\tnum_logins\tnum_cmds"MAIL_LATENCY_HEADER("cmd")
+			MAIL_STATS_HEADER);
 		cmd->header_sent = TRUE;
 	}
 
@@ -459,6 +535,7 @@ static int client_export_iter_ip(struct client *client)
 		str_printfa(cmd->str, "\t%ld", (long)ip->reset_timestamp);
 		client_export_timeval(cmd->str, &ip->last_update);
 		str_printfa(cmd->str, "\t%u\t%u", ip->num_logins, ip->num_cmds);
+		client_export_latency(cmd->str, &ip->cmd_latency);
 		client_export_mail_stats(cmd->str, &ip->stats);
 		str_append_c(cmd->str, '\n');
 		o_stream_nsend(client->output, str_data(cmd->str),
@@ -473,6 +550,47 @@ static int client_export_iter_ip(struct client *client)
 	return 1;
 }
 
+static int client_export_iter_cmd_name(struct client *client)
+{
+	struct client_export_cmd *cmd = client->cmd_export;
+	struct mail_command_name *cmd_name = client->mail_cmd_name_iter;
+
+	i_assert(cmd->level == MAIL_EXPORT_LEVEL_COMMAND_NAME);
+	mail_command_name_unref(&client->mail_cmd_name_iter);
+
+	if (!cmd->header_sent) {
+		o_stream_nsend_str(client->output,
+			"cmd\treset_timestamp\tlast_update\tnum_cmds"
+			MAIL_LATENCY_HEADER("latency")MAIL_STATS_HEADER);
+		cmd->header_sent = TRUE;
+	}
+
+	for (; cmd_name != NULL; cmd_name = cmd_name->stable_next) {
+		if (client_is_busy(client))
+			break;
+		if (!mail_export_filter_match_cmd_name(&cmd->filter, cmd_name))
+			continue;
+
+		str_truncate(cmd->str, 0);
+		str_append_tabescaped(cmd->str, cmd_name->name);
+		str_printfa(cmd->str, "\t%ld", (long)cmd_name->reset_timestamp);
+		client_export_timeval(cmd->str, &cmd_name->last_update);
+		str_printfa(cmd->str, "\t%u", cmd_name->num_cmds);
+		client_export_latency(cmd->str, &cmd_name->latency);
+		client_export_mail_stats(cmd->str, &cmd_name->stats);
+		str_append_c(cmd->str, '\n');
+		o_stream_nsend(client->output, str_data(cmd->str),
+			       str_len(cmd->str));
+	}
+
+	if (cmd_name != NULL) {
+		client->mail_cmd_name_iter = cmd_name;
+		mail_command_name_ref(cmd_name);
+		return 0;
+	}
+	return 1;
+}
+
 static int client_export_more(struct client *client)
 {
 	if (client->cmd_export->export_iter(client) == 0)
@@ -582,6 +700,13 @@ static bool client_export_iter_init(struct client *client)
 		mail_ip_ref(client->mail_ip_iter);
 		cmd->export_iter = client_export_iter_ip;
 		break;
+	case MAIL_EXPORT_LEVEL_COMMAND_NAME:
+		client->mail_cmd_name_iter = stable_mail_command_names;
+		if (client->mail_cmd_name_iter == NULL)
+			return FALSE;
+		mail_command_name_ref(client->mail_cmd_name_iter);
+		cmd->export_iter = client_export_iter_cmd_name;
+		break;
 	}
 	i_assert(cmd->export_iter != NULL);
 	return TRUE;
@@ -158,6 +158,8 @@ static void client_unref_iters(struct client *client)
 {
 	if (client->mail_cmd_iter != NULL)
 		mail_command_unref(&client->mail_cmd_iter);
+	if (client->mail_cmd_name_iter != NULL)
+		mail_command_name_unref(&client->mail_cmd_name_iter);
 	if (client->mail_session_iter != NULL)
 		mail_session_unref(&client->mail_session_iter);
 	if (client->mail_user_iter != NULL)
@@ -18,6 +18,7 @@ struct client {
 	   struct's refcount so it won't be deleted during iteration */
 	unsigned int iter_count;
 	struct mail_command *mail_cmd_iter;
+	struct mail_command_name *mail_cmd_name_iter;
 	struct mail_session *mail_session_iter;
 	struct mail_user *mail_user_iter;
 	struct mail_domain *mail_domain_iter;
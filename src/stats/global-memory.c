@@ -24,6 +24,8 @@ static bool global_memory_free_something(void)
 		mail_ips_free_memory();
 	if (global_used_memory > stats_settings->memory_limit)
 		mail_domains_free_memory();
+	if (global_used_memory > stats_settings->memory_limit)
+		mail_command_names_free_memory();
 
 	return global_used_memory < orig_used_memory;
 }
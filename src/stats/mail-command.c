@@ -2,11 +2,15 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "hash.h"
 #include "llist.h"
 #include "global-memory.h"
 #include "stats-settings.h"
 #include "mail-stats.h"
 #include "mail-session.h"
+#include "mail-user.h"
+#include "mail-domain.h"
+#include "mail-ip.h"
 #include "mail-command.h"
 
 #define MAIL_COMMAND_TIMEOUT_SECS (60*15)
@@ -15,11 +19,110 @@
 struct mail_command *stable_mail_commands_head;
 struct mail_command *stable_mail_commands_tail;
 
+static HASH_TABLE(char *, struct mail_command_name *) mail_command_names_hash;
+/* command names are sorted by their last_update timestamp, oldest first */
+static struct mail_command_name *mail_command_names_head;
+static struct mail_command_name *mail_command_names_tail;
+struct mail_command_name *stable_mail_command_names;
+
 static size_t mail_command_memsize(const struct mail_command *cmd)
 {
 	return sizeof(*cmd) + strlen(cmd->name) + 1 + strlen(cmd->args) + 1;
 }
 
+static size_t
+mail_command_name_memsize(const struct mail_command_name *cmd_name)
+{
+	return sizeof(*cmd_name) + strlen(cmd_name->name) + 1;
+}
+
+static struct mail_command_name *mail_command_name_get(const char *name)
+{
+	struct mail_command_name *cmd_name;
+
+	cmd_name = hash_table_lookup(mail_command_names_hash, name);
+	if (cmd_name != NULL) {
+		mail_command_name_ref(cmd_name);
+		return cmd_name;
+	}
+
+	cmd_name = i_new(struct mail_command_name, 1);
+	cmd_name->refcount = 1;
+	cmd_name->name = i_strdup(name);
+	cmd_name->reset_timestamp = ioloop_time;
+	cmd_name->last_update = ioloop_timeval;
+
+	hash_table_insert(mail_command_names_hash, cmd_name->name, cmd_name);
+	DLLIST_PREPEND_FULL(&stable_mail_command_names, cmd_name,
+			    stable_prev, stable_next);
+	DLLIST2_APPEND_FULL(&mail_command_names_head,
+			    &mail_command_names_tail, cmd_name,
+			    sorted_prev, sorted_next);
+	global_memory_alloc(mail_command_name_memsize(cmd_name));
+	return cmd_name;
+}
+
+static void mail_command_name_free(struct mail_command_name *cmd_name)
+{
+	i_assert(cmd_name->refcount == 0);
+
+	global_memory_free(mail_command_name_memsize(cmd_name));
+	hash_table_remove(mail_command_names_hash, cmd_name->name);
+	DLLIST_REMOVE_FULL(&stable_mail_command_names, cmd_name,
+			   stable_prev, stable_next);
+	DLLIST2_REMOVE_FULL(&mail_command_names_head,
+			    &mail_command_names_tail, cmd_name,
+			    sorted_prev, sorted_next);
+	i_free(cmd_name->name);
+	i_free(cmd_name);
+}
+
+void mail_command_name_ref(struct mail_command_name *cmd_name)
+{
+	cmd_name->refcount++;
+}
+
+void mail_command_name_unref(struct mail_command_name **_cmd_name)
+{
+	struct mail_command_name *cmd_name = *_cmd_name;
+
+	i_assert(cmd_name->refcount > 0);
+	cmd_name->refcount--;
+
+	*_cmd_name = NULL;
+}
+
+static void mail_command_finished(struct mail_command *cmd)
+{
+	struct mail_session *session = cmd->session;
+	struct mail_command_name *cmd_name;
+	uint64_t usecs;
+
+	usecs = (uint64_t)cmd->stats.clock_time.tv_sec * 1000000 +
+		cmd->stats.clock_time.tv_usec;
+	mail_latency_add(&session->user->cmd_latency, usecs);
+	mail_latency_add(&session->user->domain->cmd_latency, usecs);
+	if (session->ip != NULL)
+		mail_latency_add(&session->ip->cmd_latency, usecs);
+
+	/* adding the name may free memory, don't let it free the command */
+	mail_command_ref(cmd);
+	cmd_name = mail_command_name_get(cmd->name);
+	cmd_name->num_cmds++;
+	mail_stats_add(&cmd_name->stats, &cmd->stats);
+	mail_latency_add(&cmd_name->latency, usecs);
+
+	cmd_name->last_update = ioloop_timeval;
+	DLLIST2_REMOVE_FULL(&mail_command_names_head,
+			    &mail_command_names_tail, cmd_name,
+			    sorted_prev, sorted_next);
+	DLLIST2_APPEND_FULL(&mail_command_names_head,
+			    &mail_command_names_tail, cmd_name,
+			    sorted_prev, sorted_next);
+	mail_command_name_unref(&cmd_name);
+	mail_command_unref(&cmd);
+}
+
 static struct mail_command *
 mail_command_find(struct mail_session *session, unsigned int id)
 {
@@ -94,12 +197,62 @@ void mail_command_unref(struct mail_command **_cmd)
 	*_cmd = NULL;
 }
 
-int mail_command_update_parse(const char *const *args, const char **error_r)
+static int
+mail_command_update(struct mail_session *session, unsigned int cmd_id,
+		    bool done, bool continued, const char *name,
+		    const char *args, const struct mail_stats *stats,
+		    const char **error_r)
 {
-	struct mail_session *session;
 	struct mail_command *cmd;
-	struct mail_stats stats, diff_stats;
+	struct mail_stats diff_stats;
 	const char *error;
+
+	cmd = mail_command_find(session, cmd_id);
+	if (!continued) {
+		/* new command */
+		if (cmd != NULL) {
+			*error_r = "UPDATE-CMD: Duplicate new command id";
+			return -1;
+		}
+		cmd = mail_command_add(session, name, args);
+		cmd->id = cmd_id;
+
+		session->highest_cmd_id =
+			I_MAX(session->highest_cmd_id, cmd_id);
+		session->num_cmds++;
+		session->user->num_cmds++;
+		session->user->domain->num_cmds++;
+		if (session->ip != NULL)
+			session->ip->num_cmds++;
+	} else {
+		if (cmd == NULL) {
+			/* already expired command, ignore */
+			i_warning("UPDATE-CMD: Already expired");
+			return 0;
+		}
+		cmd->last_update = ioloop_timeval;
+	}
+	if (!mail_stats_diff(&cmd->stats, stats, &diff_stats, &error)) {
+		*error_r = t_strconcat("UPDATE-CMD: stats shrank: ",
+				       error, NULL);
+		return -1;
+	}
+	mail_stats_add(&cmd->stats, &diff_stats);
+
+	if (done) {
+		mail_command_finished(cmd);
+		cmd->id = 0;
+		mail_command_unref(&cmd);
+	}
+	mail_session_refresh(session, NULL);
+	return 0;
+}
+
+int mail_command_update_parse(const char *const *args, const char **error_r)
+{
+	struct mail_session *session;
+	struct mail_stats stats;
+	const char *name = NULL, *cmd_args = NULL;
 	unsigned int i, cmd_id;
 	bool done = FALSE, continued = FALSE;
 
@@ -130,54 +283,40 @@ int mail_command_update_parse(const char *const *args, const char **error_r)
 		}
 	}
 
-	cmd = mail_command_find(session, cmd_id);
 	if (!continued) {
-		/* new command */
-		if (cmd != NULL) {
-			*error_r = "UPDATE-CMD: Duplicate new command id";
-			return -1;
-		}
 		if (str_array_length(args) < 5) {
 			*error_r = "UPDATE-CMD: Too few parameters";
 			return -1;
 		}
-		cmd = mail_command_add(session, args[3], args[4]);
-		cmd->id = cmd_id;
-
-		session->highest_cmd_id =
-			I_MAX(session->highest_cmd_id, cmd_id);
-		session->num_cmds++;
-		session->user->num_cmds++;
-		session->user->domain->num_cmds++;
-		if (session->ip != NULL)
-			session->ip->num_cmds++;
+		name = args[3];
+		cmd_args = args[4];
 		args += 5;
 	} else {
-		if (cmd == NULL) {
-			/* already expired command, ignore */
-			i_warning("UPDATE-CMD: Already expired");
-			return 0;
-		}
 		args += 3;
-		cmd->last_update = ioloop_timeval;
 	}
 	if (mail_stats_parse(args, &stats, error_r) < 0) {
 		*error_r = t_strconcat("UPDATE-CMD: ", *error_r, NULL);
 		return -1;
 	}
-	if (!mail_stats_diff(&cmd->stats, &stats, &diff_stats, &error)) {
-		*error_r = t_strconcat("UPDATE-CMD: stats shrank: ",
-				       error, NULL);
-		return -1;
-	}
-	mail_stats_add(&cmd->stats, &diff_stats);
+	return mail_command_update(session, cmd_id, done, continued,
+				   name, cmd_args, &stats, error_r);
+}
 
-	if (done) {
-		cmd->id = 0;
-		mail_command_unref(&cmd);
+int mail_command_update_binary(const guid_128_t session_guid,
+			       unsigned int cmd_id, bool done, bool continued,
+			       const char *name, const char *args,
+			       const struct mail_stats *stats,
+			       const char **error_r)
+{
+	struct mail_session *session;
+
+	if (cmd_id == 0) {
+		*error_r = "UPDATE-CMD: Invalid command id";
+		return -1;
 	}
-	mail_session_refresh(session, NULL);
-	return 0;
+	mail_session_get_guid(session_guid, &session);
+	return mail_command_update(session, cmd_id, done, continued,
+				   name, args, stats, error_r);
 }
 
 static bool mail_command_is_timed_out(struct mail_command *cmd)
@@ -216,8 +355,31 @@ void mail_commands_free_memory(void)
 	}
 }
 
+void mail_command_names_free_memory(void)
+{
+	unsigned int diff;
+
+	while (mail_command_names_head != NULL &&
+	       mail_command_names_head->refcount == 0) {
+		mail_command_name_free(mail_command_names_head);
+
+		if (global_used_memory < stats_settings->memory_limit ||
+		    mail_command_names_head == NULL)
+			break;
+
+		/* there are only a few command names, keep them as long as
+		   domains */
+		diff = ioloop_time -
+			mail_command_names_head->last_update.tv_sec;
+		if (diff < stats_settings->domain_min_time)
+			break;
+	}
+}
+
 void mail_commands_init(void)
 {
+	hash_table_create(&mail_command_names_hash, default_pool, 0,
+			  str_hash, strcmp);
 }
 
 void mail_commands_deinit(void)
@@ -229,4 +391,7 @@ void mail_commands_deinit(void)
 			mail_command_unref(&cmd);
 		mail_command_free(stable_mail_commands_head);
 	}
+	while (mail_command_names_head != NULL)
+		mail_command_name_free(mail_command_names_head);
+	hash_table_destroy(&mail_command_names_hash);
 }
@@ -1,17 +1,32 @@
 #ifndef MAIL_COMMAND_H
 #define MAIL_COMMAND_H
 
+#include "guid.h"
+
 struct mail_command;
+struct mail_command_name;
+struct mail_stats;
 
 extern struct mail_command *stable_mail_commands_head;
 extern struct mail_command *stable_mail_commands_tail;
+extern struct mail_command_name *stable_mail_command_names;
 
 int mail_command_update_parse(const char *const *args, const char **error_r);
+/* name and args are used only for new (non-continued) commands */
+int mail_command_update_binary(const guid_128_t session_guid,
+			       unsigned int cmd_id, bool done, bool continued,
+			       const char *name, const char *args,
+			       const struct mail_stats *stats,
+			       const char **error_r);
 
 void mail_command_ref(struct mail_command *cmd);
 void mail_command_unref(struct mail_command **cmd);
 
+void mail_command_name_ref(struct mail_command_name *cmd_name);
+void mail_command_name_unref(struct mail_command_name **cmd_name);
+
 void mail_commands_free_memory(void);
+void mail_command_names_free_memory(void);
 void mail_commands_init(void);
 void mail_commands_deinit(void);
 
@@ -5,6 +5,7 @@
 #include "istream.h"
 #include "ostream.h"
 #include "master-service.h"
+#include "mail-stats.h"
 #include "mail-session.h"
 #include "mail-command.h"
 #include "mail-server-connection.h"
@@ -13,6 +14,14 @@
 
 #define MAX_INBUF_SIZE (PIPE_BUF*2)
 
+/* binary records - keep in sync with plugins/stats/stats-connection.h */
+#define STATS_RECORD_MAGIC 0x01
+#define STATS_RECORD_HDR_SIZE 4
+#define STATS_RECORD_TYPE_UPDATE_SESSION 1
+#define STATS_RECORD_TYPE_UPDATE_CMD 2
+#define STATS_RECORD_CMD_FLAG_DONE 0x01
+#define STATS_RECORD_CMD_FLAG_CONTINUED 0x02
+
 struct mail_server_connection {
 	int fd;
 	struct istream *input;
@@ -60,10 +69,131 @@ mail_server_connection_request(const char *const *args, const char **error_r)
 	return -1;
 }
 
-static void mail_server_connection_input(struct mail_server_connection *conn)
+static bool
+mail_server_record_get(const unsigned char **p, size_t *size,
+		       void *dest, size_t dest_size)
+{
+	if (*size < dest_size)
+		return FALSE;
+	memcpy(dest, *p, dest_size);
+	*p += dest_size; *size -= dest_size;
+	return TRUE;
+}
+
+static bool
+mail_server_record_get_str(const unsigned char **p, size_t *size,
+			   const char **str_r)
+{
+	uint16_t len;
+
+	if (!mail_server_record_get(p, size, &len, sizeof(len)) ||
+	    *size < len)
+		return FALSE;
+	*str_r = t_strndup(*p, len);
+	*p += len; *size -= len;
+	return TRUE;
+}
+
+static int
+mail_server_connection_record(const unsigned char *data, size_t size,
+			      const char **error_r)
+{
+	struct mail_stats stats;
+	guid_128_t guid;
+	const char *name = NULL, *args = NULL;
+	uint32_t cmd_id;
+	uint8_t type, flags;
+	bool done, continued;
+
+	/* <magic> <type> <size> <session guid> .. */
+	type = data[1];
+	data += STATS_RECORD_HDR_SIZE; size -= STATS_RECORD_HDR_SIZE;
+	if (!mail_server_record_get(&data, &size, guid, sizeof(guid))) {
+		*error_r = "Record truncated";
+		return -1;
+	}
+
+	switch (type) {
+	case STATS_RECORD_TYPE_UPDATE_SESSION:
+		if (mail_stats_parse_binary(data, size, &stats, error_r) < 0) {
+			*error_r = t_strconcat("UPDATE-SESSION: ",
+					       *error_r, NULL);
+			return -1;
+		}
+		return mail_session_update_binary(guid, &stats, error_r);
+	case STATS_RECORD_TYPE_UPDATE_CMD:
+		/* <cmd id> <flags> [<name> <args>] <stats> */
+		if (!mail_server_record_get(&data, &size, &cmd_id,
+					    sizeof(cmd_id)) ||
+		    !mail_server_record_get(&data, &size, &flags,
+					    sizeof(flags))) {
+			*error_r = "UPDATE-CMD: Record truncated";
+			return -1;
+		}
+		done = (flags & STATS_RECORD_CMD_FLAG_DONE) != 0;
+		continued = (flags & STATS_RECORD_CMD_FLAG_CONTINUED) != 0;
+		if (!continued &&
+		    (!mail_server_record_get_str(&data, &size, &name) ||
+		     !mail_server_record_get_str(&data, &size, &args))) {
+			*error_r = "UPDATE-CMD: Record truncated";
+			return -1;
+		}
+		if (mail_stats_parse_binary(data, size, &stats, error_r) < 0) {
+			*error_r = t_strconcat("UPDATE-CMD: ", *error_r, NULL);
+			return -1;
+		}
+		return mail_command_update_binary(guid, cmd_id, done,
+						  continued, name, args,
+						  &stats, error_r);
+	}
+	*error_r = t_strdup_printf("Unknown record type %u", type);
+	return -1;
+}
+
+static bool
+mail_server_connection_next(struct mail_server_connection *conn)
 {
+	const unsigned char *data;
 	const char *const *args, *error;
+	uint16_t record_size;
+	size_t size;
+	int ret;
+
+	data = i_stream_get_data(conn->input, &size);
+	if (size == 0)
+		return FALSE;
+
+	if (data[0] != STATS_RECORD_MAGIC) {
+		/* text line */
+		if ((args = mail_server_connection_next_line(conn)) == NULL)
+			return FALSE;
+		if (mail_server_connection_request(args, &error) < 0)
+			i_error("Mail server input error: %s", error);
+		return TRUE;
+	}
+
+	if (size < STATS_RECORD_HDR_SIZE)
+		return FALSE;
+	memcpy(&record_size, data + 2, sizeof(record_size));
+	if (record_size < STATS_RECORD_HDR_SIZE) {
+		i_error("Mail server input error: Invalid record size %u",
+			record_size);
+		/* we can't find the next record anymore */
+		i_stream_skip(conn->input, size);
+		return FALSE;
+	}
+	if (size < record_size)
+		return FALSE;
+
+	ret = mail_server_connection_record(data, record_size, &error);
+	i_stream_skip(conn->input, record_size);
+	if (ret < 0)
+		i_error("Mail server input error: %s", error);
+	return TRUE;
+}
 
+static void mail_server_connection_input(struct mail_server_connection *conn)
+{
 	switch (i_stream_read(conn->input)) {
 	case -2:
 		i_error("BUG: Mail server sent too much data");
@@ -74,10 +204,7 @@ static void mail_server_connection_input(struct mail_server_connection *conn)
 		return;
 	}
 
-	while ((args = mail_server_connection_next_line(conn)) != NULL) {
-		if (mail_server_connection_request(args, &error) < 0)
-			i_error("Mail server input error: %s", error);
-	}
+	while (mail_server_connection_next(conn)) ;
 }
 
 struct mail_server_connection *mail_server_connection_create(int fd)
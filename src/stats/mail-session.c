@@ -169,7 +169,7 @@ static void mail_session_free(struct mail_session *session)
 	i_free(session);
 }
 
-static void mail_session_guid_lost(guid_128_t session_guid)
+static void mail_session_guid_lost(const guid_128_t session_guid)
 {
 	if (ioloop_time < session_guid_warn_hide_until) {
 		if (session_guid_hide_warned)
@@ -184,11 +184,24 @@ static void mail_session_guid_lost(guid_128_t session_guid)
 		  guid_128_to_string(session_guid));
 }
 
+static bool
+mail_session_lookup_guid(const guid_128_t session_guid,
+			 struct mail_session **session_r)
+{
+	uint8_t *guid_p = (uint8_t *)session_guid;
+
+	*session_r = hash_table_lookup(mail_sessions_hash, guid_p);
+	if (*session_r == NULL) {
+		mail_session_guid_lost(session_guid);
+		return FALSE;
+	}
+	return TRUE;
+}
+
 int mail_session_lookup(const char *guid, struct mail_session **session_r,
 			const char **error_r)
 {
 	guid_128_t session_guid;
-	uint8_t *guid_p;
 
 	if (guid == NULL) {
 		*error_r = "Too few parameters";
@@ -198,35 +211,44 @@ int mail_session_lookup(const char *guid, struct mail_session **session_r,
 		*error_r = "Invalid GUID";
 		return -1;
 	}
-	guid_p = session_guid;
-	*session_r = hash_table_lookup(mail_sessions_hash, guid_p);
-	if (*session_r == NULL) {
-		mail_session_guid_lost(session_guid);
-		return 0;
-	}
-	return 1;
+	return mail_session_lookup_guid(session_guid, session_r) ? 1 : 0;
 }
 
 int mail_session_get(const char *guid, struct mail_session **session_r,
 		     const char **error_r)
 {
-	const char *new_args[5];
-	int ret;
+	guid_128_t session_guid;
 
-	if ((ret = mail_session_lookup(guid, session_r, error_r)) != 0)
-		return ret;
+	if (guid == NULL) {
+		*error_r = "Too few parameters";
+		return -1;
+	}
+	if (guid_128_from_string(guid, session_guid) < 0) {
+		*error_r = "Invalid GUID";
+		return -1;
+	}
+	mail_session_get_guid(session_guid, session_r);
+	return 0;
+}
+
+void mail_session_get_guid(const guid_128_t session_guid,
+			   struct mail_session **session_r)
+{
+	const char *new_args[5], *error;
+
+	if (mail_session_lookup_guid(session_guid, session_r))
+		return;
 
 	/* Create a new dummy session to avoid repeated warnings */
-	new_args[0] = guid;
+	new_args[0] = guid_128_to_string(session_guid);
 	new_args[1] = ""; /* username */
 	new_args[2] = ""; /* service */
 	new_args[3] = "0"; /* pid */
 	new_args[4] = NULL;
-	if (mail_session_connect_parse(new_args, error_r) < 0)
+	if (mail_session_connect_parse(new_args, &error) < 0)
 		i_unreached();
-	if (mail_session_lookup(guid, session_r, error_r) != 1)
+	if (!mail_session_lookup_guid(session_guid, session_r))
 		i_unreached();
-	return 0;
 }
 
 int mail_session_disconnect_parse(const char *const *args, const char **error_r)
@@ -260,11 +282,27 @@ void mail_session_refresh(struct mail_session *session,
 		mail_ip_refresh(session->ip, diff_stats);
 }
 
+static int
+mail_session_update(struct mail_session *session,
+		    const struct mail_stats *stats, const char **error_r)
+{
+	struct mail_stats diff_stats;
+	const char *error;
+
+	if (!mail_stats_diff(&session->stats, stats, &diff_stats, &error)) {
+		*error_r = t_strdup_printf("UPDATE-SESSION %s %s: stats shrank: %s",
+					   session->user->name,
+					   session->service, error);
+		return -1;
+	}
+	mail_session_refresh(session, &diff_stats);
+	return 0;
+}
+
 int mail_session_update_parse(const char *const *args, const char **error_r)
 {
 	struct mail_session *session;
-	struct mail_stats stats, diff_stats;
-	const char *error;
+	struct mail_stats stats;
 
 	/* <session guid> [key=value ..] */
 	if (mail_session_get(args[0], &session, error_r) < 0)
@@ -276,15 +314,17 @@ int mail_session_update_parse(const char *const *args, const char **error_r)
 					   session->service, *error_r);
 		return -1;
 	}
+	return mail_session_update(session, &stats, error_r);
+}
 
-	if (!mail_stats_diff(&session->stats, &stats, &diff_stats, &error)) {
-		*error_r = t_strdup_printf("UPDATE-SESSION %s %s: stats shrank: %s",
-					   session->user->name,
-					   session->service, error);
-		return -1;
-	}
-	mail_session_refresh(session, &diff_stats);
-	return 0;
+int mail_session_update_binary(const guid_128_t session_guid,
+			       const struct mail_stats *stats,
+			       const char **error_r)
+{
+	struct mail_session *session;
+
+	mail_session_get_guid(session_guid, &session);
+	return mail_session_update(session, stats, error_r);
 }
 
 void mail_sessions_free_memory(void)
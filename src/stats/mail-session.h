@@ -1,6 +1,8 @@
 #ifndef MAIL_SESSION_H
 #define MAIL_SESSION_H
 
+#include "guid.h"
+
 struct mail_stats;
 struct mail_session;
 
@@ -9,6 +11,9 @@ extern struct mail_session *stable_mail_sessions;
 int mail_session_connect_parse(const char *const *args, const char **error_r);
 int mail_session_disconnect_parse(const char *const *args, const char **error_r);
 int mail_session_update_parse(const char *const *args, const char **error_r);
+int mail_session_update_binary(const guid_128_t session_guid,
+			       const struct mail_stats *stats,
+			       const char **error_r);
 int mail_session_cmd_update_parse(const char *const *args, const char **error_r);
 
 void mail_session_ref(struct mail_session *session);
@@ -18,6 +23,9 @@ int mail_session_lookup(const char *guid, struct mail_session **session_r,
 			const char **error_r);
 int mail_session_get(const char *guid, struct mail_session **session_r,
 		     const char **error_r);
+/* Like mail_session_get(), but with an already parsed GUID */
+void mail_session_get_guid(const guid_128_t session_guid,
+			   struct mail_session **session_r);
 void mail_session_refresh(struct mail_session *session,
 			  const struct mail_stats *diff_stats) ATTR_NULL(2);
 
@@ -36,7 +36,24 @@ struct mail_stats_parse_map {
 	EN("mlattr", mail_lookup_attr),
 	EN("mrcount", mail_read_count),
 	EN("mrbytes", mail_read_bytes),
-	EN("mcache", mail_cache_hits)
+	EN("mcache", mail_cache_hits),
+	E("mrtime", mail_read_time, TYPE_TIMEVAL),
+
+	EN("idxcount", index_count),
+	EN("idxbytes", index_bytes),
+	E("idxtime", index_time, TYPE_TIMEVAL),
+	EN("logcount", log_count),
+	EN("logbytes", log_bytes),
+	E("logtime", log_time, TYPE_TIMEVAL),
+	EN("cachecount", cache_count),
+	EN("cachebytes", cache_bytes),
+	E("cachetime", cache_time, TYPE_TIMEVAL),
+	EN("bidxcount", bidx_count),
+	EN("bidxbytes", bidx_bytes),
+	E("bidxtime", bidx_time, TYPE_TIMEVAL),
+	EN("lockcount", lock_count),
+	EN("lockbytes", lock_bytes),
+	E("locktime", lock_time, TYPE_TIMEVAL)
 };
 
 static int mail_stats_parse_timeval(const char *value, struct timeval *tv)
@@ -133,6 +150,61 @@ int mail_stats_parse(const char *const *args, struct mail_stats *stats_r,
 	return 0;
 }
 
+int mail_stats_parse_binary(const void *data, size_t size,
+			    struct mail_stats *stats_r, const char **error_r)
+{
+	const unsigned char *p = data;
+	uint16_t count;
+	uint64_t value;
+	unsigned int i;
+	void *dest;
+
+	/* <uint16 count> <count * uint64> in parse_map order */
+	memset(stats_r, 0, sizeof(*stats_r));
+	if (size < sizeof(count)) {
+		*error_r = "mail stats truncated";
+		return -1;
+	}
+	memcpy(&count, p, sizeof(count));
+	p += sizeof(count); size -= sizeof(count);
+	if (size / sizeof(value) < count) {
+		*error_r = "mail stats truncated";
+		return -1;
+	}
+
+	/* ignore any fields that we don't know about */
+	for (i = 0; i < count && i < N_ELEMENTS(parse_map); i++) {
+		memcpy(&value, p + i * sizeof(value), sizeof(value));
+		dest = PTR_OFFSET(stats_r, parse_map[i].offset);
+		switch (parse_map[i].type) {
+		case TYPE_NUM:
+			switch (parse_map[i].size) {
+			case sizeof(uint32_t):
+				if (value > (uint32_t)-1) {
+					*error_r = "invalid number";
+					return -1;
+				}
+				*(uint32_t *)dest = value;
+				break;
+			case sizeof(uint64_t):
+				*(uint64_t *)dest = value;
+				break;
+			default:
+				i_unreached();
+			}
+			break;
+		case TYPE_TIMEVAL: {
+			struct timeval *tv = dest;
+
+			tv->tv_sec = value / 1000000;
+			tv->tv_usec = value % 1000000;
+			break;
+		}
+		}
+	}
+	return 0;
+}
+
 static bool mail_stats_diff_timeval(struct timeval *dest,
 				    const struct timeval *src1,
 				    const struct timeval *src2)
@@ -270,3 +342,62 @@ void mail_stats_add(struct mail_stats *dest, const struct mail_stats *src)
 		}
 	}
 }
+
+unsigned int mail_latency_bucket_idx(uint64_t usecs)
+{
+	unsigned int msb, idx;
+
+	if (usecs < 4)
+		return usecs;
+	for (msb = 2; msb < 63 && (usecs >> (msb+1)) != 0; msb++) ;
+	/* the two bits after the most significant bit select the bucket
+	   within this power of 2 */
+	idx = 4*(msb-1) + ((usecs >> (msb-2)) & 3);
+	return I_MIN(idx, MAIL_LATENCY_BUCKET_COUNT-1);
+}
+
+uint64_t mail_latency_bucket_max(unsigned int idx)
+{
+	unsigned int msb;
+
+	i_assert(idx < MAIL_LATENCY_BUCKET_COUNT);
+
+	if (idx == MAIL_LATENCY_BUCKET_COUNT-1)
+		return (uint64_t)-1;
+	idx++;
+	if (idx < 4)
+		return idx - 1;
+	/* the next bucket's min value - 1 */
+	msb = idx/4 + 1;
+	return ((uint64_t)(4 + idx%4) << (msb-2)) - 1;
+}
+
+void mail_latency_add(struct mail_latency *latency, uint64_t usecs)
+{
+	latency->buckets[mail_latency_bucket_idx(usecs)]++;
+	latency->count++;
+	if (latency->max_usecs < usecs)
+		latency->max_usecs = usecs;
+}
+
+uint64_t mail_latency_percentile(const struct mail_latency *latency,
+				 unsigned int percentile)
+{
+	uint64_t rank, sum = 0;
+	unsigned int i;
+
+	i_assert(percentile <= 100);
+
+	if (latency->count == 0)
+		return 0;
+	rank = ((uint64_t)latency->count * percentile + 99) / 100;
+	if (rank == 0)
+		rank = 1;
+	for (i = 0; i < MAIL_LATENCY_BUCKET_COUNT; i++) {
+		sum += latency->buckets[i];
+		if (sum >= rank)
+			break;
+	}
+	i_assert(i < MAIL_LATENCY_BUCKET_COUNT);
+	return I_MIN(mail_latency_bucket_max(i), latency->max_usecs);
+}
@@ -16,6 +16,24 @@ struct mail_stats {
 	uint32_t mail_lookup_path, mail_lookup_attr, mail_read_count;
 	uint32_t mail_cache_hits;
 	uint64_t mail_read_bytes;
+	struct timeval mail_read_time;
+
+	/* index file I/O: main index, transaction log, cache file, storage
+	   backend's own index (e.g. dovecot-uidlist) and lock waits */
+	uint32_t index_count, log_count, cache_count, bidx_count, lock_count;
+	uint64_t index_bytes, log_bytes, cache_bytes, bidx_bytes, lock_bytes;
+	struct timeval index_time, log_time, cache_time, bidx_time, lock_time;
+};
+
+/* Log-linear histogram of microseconds: 4 buckets for each power of 2.
+   All histograms have the same buckets, so they can be merged by adding
+   the bucket counts together. */
+#define MAIL_LATENCY_BUCKET_COUNT 112
+
+struct mail_latency {
+	uint32_t buckets[MAIL_LATENCY_BUCKET_COUNT];
+	uint32_t count;
+	uint64_t max_usecs;
 };
 
 struct mail_command {
@@ -68,6 +86,7 @@ struct mail_user {
 
 	struct timeval last_update;
 	struct mail_stats stats;
+	struct mail_latency cmd_latency;
 	unsigned int num_logins;
 	unsigned int num_cmds;
 
@@ -83,6 +102,7 @@ struct mail_domain {
 
 	struct timeval last_update;
 	struct mail_stats stats;
+	struct mail_latency cmd_latency;
 	unsigned int num_logins;
 	unsigned int num_cmds;
 
@@ -98,6 +118,7 @@ struct mail_ip {
 
 	struct timeval last_update;
 	struct mail_stats stats;
+	struct mail_latency cmd_latency;
 	unsigned int num_logins;
 	unsigned int num_cmds;
 
@@ -105,8 +126,26 @@ struct mail_ip {
 	struct mail_session *sessions;
 };
 
+/* Finished commands with the same name */
+struct mail_command_name {
+	struct mail_command_name *stable_prev, *stable_next;
+	struct mail_command_name *sorted_prev, *sorted_next;
+	char *name;
+	time_t reset_timestamp;
+
+	struct timeval last_update;
+	struct mail_stats stats;
+	struct mail_latency latency;
+	unsigned int num_cmds;
+
+	int refcount;
+};
+
 int mail_stats_parse(const char *const *args, struct mail_stats *stats_r,
 		     const char **error_r);
+/* Parse stats sent as a binary record by the stats plugin. */
+int mail_stats_parse_binary(const void *data, size_t size,
+			    struct mail_stats *stats_r, const char **error_r);
 /* diff1 is supposed to have smaller values than diff2. Returns TRUE if this
    is so, FALSE if not */
 bool mail_stats_diff(const struct mail_stats *stats1,
@@ -114,4 +153,14 @@ bool mail_stats_diff(const struct mail_stats *stats1,
 		     struct mail_stats *diff_stats_r, const char **error_r);
 void mail_stats_add(struct mail_stats *dest, const struct mail_stats *src);
 
+void mail_latency_add(struct mail_latency *latency, uint64_t usecs);
+/* Returns the upper bound of the bucket containing the given percentile,
+   or 0 if the histogram is empty. */
+uint64_t mail_latency_percentile(const struct mail_latency *latency,
+				 unsigned int percentile);
+/* Returns the bucket where the given value falls into. */
+unsigned int mail_latency_bucket_idx(uint64_t usecs);
+/* Returns the largest value that falls into the given bucket. */
+uint64_t mail_latency_bucket_max(unsigned int idx);
+
 #endif
@@ -0,0 +1,93 @@
+/* Copyright (c) 2014 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "mail-stats.h"
+#include "test-common.h"
+
+static void test_mail_latency_bucket_idx(void)
+{
+	unsigned int i;
+
+	test_begin("mail latency bucket idx");
+	/* the first buckets are exact */
+	for (i = 0; i < 8; i++)
+		test_assert(mail_latency_bucket_idx(i) == i);
+	/* then 4 buckets per power of 2 */
+	test_assert(mail_latency_bucket_idx(8) == 8);
+	test_assert(mail_latency_bucket_idx(9) == 8);
+	test_assert(mail_latency_bucket_idx(10) == 9);
+	test_assert(mail_latency_bucket_idx(15) == 11);
+	test_assert(mail_latency_bucket_idx(16) == 12);
+	test_assert(mail_latency_bucket_idx(1023) == 35);
+	test_assert(mail_latency_bucket_idx(1024) == 36);
+	/* everything large goes to the overflow bucket */
+	test_assert(mail_latency_bucket_idx((uint64_t)1 << 40) ==
+		    MAIL_LATENCY_BUCKET_COUNT-1);
+	test_assert(mail_latency_bucket_idx((uint64_t)-1) ==
+		    MAIL_LATENCY_BUCKET_COUNT-1);
+	test_end();
+}
+
+static void test_mail_latency_bucket_max(void)
+{
+	uint64_t max;
+	unsigned int i;
+
+	test_begin("mail latency bucket max");
+	for (i = 0; i < MAIL_LATENCY_BUCKET_COUNT-1; i++) {
+		max = mail_latency_bucket_max(i);
+		test_assert(mail_latency_bucket_idx(max) == i);
+		test_assert(mail_latency_bucket_idx(max+1) == i+1);
+		if (i > 0) {
+			test_assert(mail_latency_bucket_max(i-1) < max);
+			test_assert(mail_latency_bucket_idx(
+				mail_latency_bucket_max(i-1)+1) == i);
+		}
+	}
+	test_assert(mail_latency_bucket_max(MAIL_LATENCY_BUCKET_COUNT-1) ==
+		    (uint64_t)-1);
+	test_end();
+}
+
+static void test_mail_latency_percentile(void)
+{
+	struct mail_latency latency;
+	unsigned int i;
+
+	test_begin("mail latency percentile");
+	memset(&latency, 0, sizeof(latency));
+	test_assert(mail_latency_percentile(&latency, 0) == 0);
+	test_assert(mail_latency_percentile(&latency, 50) == 0);
+	test_assert(mail_latency_percentile(&latency, 100) == 0);
+
+	/* 1..100 usecs */
+	for (i = 1; i <= 100; i++)
+		mail_latency_add(&latency, i);
+	test_assert(latency.count == 100 && latency.max_usecs == 100);
+	test_assert(mail_latency_percentile(&latency, 0) == 1);
+	test_assert(mail_latency_percentile(&latency, 50) ==
+		    mail_latency_bucket_max(mail_latency_bucket_idx(50)));
+	/* 99 is in the 96..111 bucket, but clamped to the max value */
+	test_assert(mail_latency_percentile(&latency, 99) == 100);
+	test_assert(mail_latency_percentile(&latency, 100) == 100);
+
+	/* the overflow bucket's percentile is clamped to the max value */
+	mail_latency_add(&latency, (uint64_t)1 << 40);
+	test_assert(latency.buckets[MAIL_LATENCY_BUCKET_COUNT-1] == 1);
+	test_assert(mail_latency_percentile(&latency, 100) ==
+		    (uint64_t)1 << 40);
+	test_assert(mail_latency_percentile(&latency, 50) ==
+		    mail_latency_bucket_max(mail_latency_bucket_idx(51)));
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_mail_latency_bucket_idx,
+		test_mail_latency_bucket_max,
+		test_mail_latency_percentile,
+		NULL
+	};
+	return test_run(test_functions);
+}